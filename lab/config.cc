@@ -1,9 +1,11 @@
 #include <sstream>
 #include <iostream>
 #include <stdio.h>
+#include <sys/time.h>
 #include "config.h"
 #include "paxos.h"
 #include "handle.h"
+#include "jsl_log.h"
 
 // The config module maintains views. As a node joins or leaves a
 // view, the next view will be the same as previous view, except with
@@ -59,7 +61,7 @@ config::config(std::string _first, std::string _me, config_view_change *_vc)
 
   // XXX hack; maybe should have its own port number
   pxsrpc = acc->get_rpcs();
-  pxsrpc->reg(paxos_protocol::heartbeat, this, &config::heartbeat);
+  pxsrpc->reg(paxos_protocol::heartbeat, this, &config::heartbeat, true);
 
   assert(pthread_mutex_lock(&cfg_mutex)==0);
 
@@ -97,7 +99,7 @@ std::vector<std::string>
 config::get_view(unsigned instance)
 {
   std::string value = acc->value(instance);
-  printf("get_view(%d): returns %s\n", instance, value.c_str());
+  jsl_log(JSL_DBG_1, "get_view(%d): returns %s\n", instance, value.c_str());
   return members(value);
 }
 
@@ -132,7 +134,7 @@ config::reconstruct()
     std::string m;
     myvid = acc->instance();
     mems = get_view(myvid);
-    printf("config::reconstruct: %d %s\n", myvid, print_members(mems).c_str());
+    jsl_log(JSL_DBG_1, "config::reconstruct: %d %s\n", myvid, print_members(mems).c_str());
   }
 }
 
@@ -145,13 +147,13 @@ config::paxos_commit(unsigned instance, std::string value)
   assert(pthread_mutex_lock(&cfg_mutex)==0);
 
   newmem = members(value);
-  printf("config::paxos_commit: %d: %s\n", instance, 
+  jsl_log(JSL_DBG_1, "config::paxos_commit: %d: %s\n", instance, 
 	 print_members(newmem).c_str());
 
   for (unsigned i = 0; i < mems.size(); i++) {
-    printf("config::paxos_commit: is %s still a member?\n", mems[i].c_str());
+    jsl_log(JSL_DBG_1, "config::paxos_commit: is %s still a member?\n", mems[i].c_str());
     if (!isamember(mems[i], newmem) && me != mems[i]) {
-      printf("config::paxos_commit: delete %s\n", mems[i].c_str());
+      jsl_log(JSL_DBG_1, "config::paxos_commit: delete %s\n", mems[i].c_str());
       mgr.delete_handle(mems[i]);
     }
   }
@@ -225,7 +227,7 @@ config::add(std::string new_m)
 {
   std::vector<std::string> m;
   assert(pthread_mutex_lock(&cfg_mutex)==0);
-  printf("config::add %s\n", new_m.c_str());
+  jsl_log(JSL_DBG_1, "config::add %s\n", new_m.c_str());
   m = mems;
   m.push_back(new_m);
   std::string v = value(m);
@@ -234,9 +236,9 @@ config::add(std::string new_m)
   bool r = pro->run(nxt_vid, mems, v);
   assert(pthread_mutex_lock(&cfg_mutex)==0);
   if (r) {
-    printf("config::add: proposer returned success\n");
+    jsl_log(JSL_DBG_1, "config::add: proposer returned success\n");
   } else {
-    printf("config::add: proposer returned failure\n");
+    jsl_log(JSL_DBG_1, "config::add: proposer returned failure\n");
   }
   assert(pthread_mutex_unlock(&cfg_mutex)==0);
   return r;
@@ -246,7 +248,7 @@ config::add(std::string new_m)
 bool
 config::remove_wo(std::string m)
 {
-  printf("config::remove: myvid %d remove? %s\n", myvid, m.c_str());
+  jsl_log(JSL_DBG_1, "config::remove: myvid %d remove? %s\n", myvid, m.c_str());
   std::vector<std::string> n;
   for (unsigned i = 0; i < mems.size(); i++) {
     if (mems[i] != m) n.push_back(mems[i]);
@@ -256,9 +258,9 @@ config::remove_wo(std::string m)
   bool r = pro->run(myvid+1, mems, v);
   assert(pthread_mutex_lock(&cfg_mutex)==0);
   if (r) {
-    printf("config::remove: proposer returned success\n");
+    jsl_log(JSL_DBG_1, "config::remove: proposer returned success\n");
   } else {
-    printf("config::remove: proposer returned failure\n");
+    jsl_log(JSL_DBG_1, "config::remove: proposer returned failure\n");
   }
   return r;
 }
@@ -279,15 +281,15 @@ config::heartbeater()
     gettimeofday(&now, NULL);
     next_timeout.tv_sec = now.tv_sec + 3;
     next_timeout.tv_nsec = 0;
-    printf("heartbeater: go to sleep\n");
+    jsl_log(JSL_DBG_1, "heartbeater: go to sleep\n");
     pthread_cond_timedwait(&config_cond, &cfg_mutex, &next_timeout);
 
     stable = true;
 
-    printf("heartbeater: current membership %s\n", print_members(mems).c_str());
+    jsl_log(JSL_DBG_1, "heartbeater: current membership %s\n", print_members(mems).c_str());
 
     if (!isamember(me, mems)) {
-      printf("heartbeater: not member yet; skip hearbeat\n");
+      jsl_log(JSL_DBG_1, "heartbeater: not member yet; skip hearbeat\n");
       continue;
     }
 
@@ -335,7 +337,7 @@ config::heartbeat(std::string m, unsigned vid, int &r)
   assert(pthread_mutex_lock(&cfg_mutex)==0);
   int ret = paxos_protocol::ERR;
   r = (int) myvid;
-  printf("heartbeat from %s(%d) myvid %d\n", m.c_str(), vid, myvid);
+  jsl_log(JSL_DBG_1, "heartbeat from %s(%d) myvid %d\n", m.c_str(), vid, myvid);
   if (vid == myvid) {
     ret = paxos_protocol::OK;
   } else if (pro->isrunning()) {
@@ -356,12 +358,12 @@ config::doheartbeat(std::string m)
   unsigned vid = myvid;
   heartbeat_t res = OK;
 
-  printf("doheartbeater to %s (%d)\n", m.c_str(), vid);
+  jsl_log(JSL_DBG_1, "doheartbeater to %s (%d)\n", m.c_str(), vid);
   handle h(m);
   if (h.get_rpcc()) {
     assert(pthread_mutex_unlock(&cfg_mutex)==0);
     ret = h.get_rpcc()->call(paxos_protocol::heartbeat, me, vid, r, 
-			 rpcc::to(1000));
+			 rpcc::urgent(rpcc::to(1000)));
     assert(pthread_mutex_lock(&cfg_mutex)==0);
   } 
   if (ret != paxos_protocol::OK) {
@@ -369,13 +371,13 @@ config::doheartbeat(std::string m)
 	ret == rpc_const::oldsrv_failure) {
       mgr.delete_handle(m);
     } else {
-      printf("doheartbeat: problem with %s (%d) my vid %d his vid %d\n", 
+      jsl_log(JSL_DBG_1, "doheartbeat: problem with %s (%d) my vid %d his vid %d\n", 
 	     m.c_str(), ret, vid, r);
       if (ret < 0) res = FAILURE;
       else res = VIEWERR;
     }
   }
-  printf("doheartbeat done %d\n", res);
+  jsl_log(JSL_DBG_1, "doheartbeat done %d\n", res);
   return res;
 }
 
@@ -2,20 +2,22 @@
 
 #include "extent_client.h"
 #include <sstream>
+#include <utility>
 #include <iostream>
 #include <stdio.h>
 #include <unistd.h>
 #include <time.h>
+#include "jsl_log.h"
 
 // The calls assume that the caller holds a lock on the extent
 
 extent_client::extent_client(std::string dst)
 {
-  sockaddr_in dstsock;
+  sockaddr_storage dstsock;
 	make_sockaddr(dst.c_str(), &dstsock);
   cl = new rpcc(dstsock);
   if (cl->bind() != 0) {
-    printf("extent_client: bind failed\n");
+    jsl_log(JSL_DBG_1, "extent_client: bind failed\n");
   }
 }
 
@@ -36,10 +38,26 @@ extent_client::get(extent_protocol::extentid_t eid, std::string &buf)
     //   return extent_protocol::NOENT;
     // }
     buf = it->second.data;
-    printf("extent_client content id = %016llx is cached , content is (%s)\n",eid,buf.c_str());
+    jsl_log(JSL_DBG_4, "extent_client content id = %016llx is cached, %zu bytes\n",eid,buf.size());
   } else {
-    printf("extent_client content id = %016llx is not cached \n",eid);
-    ret = cl->call(extent_protocol::get, eid, buf);
+    jsl_log(JSL_DBG_4, "extent_client content id = %016llx is not cached \n",eid);
+    if (_attr_cache_map.count(eid)) {
+      ret = cl->call(extent_protocol::get, eid, buf);
+    } else {
+      // the attributes are usually wanted next, so they come along in
+      // the same round trip
+      rpc_batch b;
+      b.add(extent_protocol::get, eid);
+      b.add(extent_protocol::getattr, eid);
+      ret = cl->call_batch(b);
+      if (ret == extent_protocol::OK)
+        ret = b.get(0, buf);
+      if (ret == extent_protocol::OK) {
+        extent_protocol::attr a;
+        ret = b.get(1, a);
+        _attr_cache_map[eid] = a;
+      }
+    }
     _extent_cache_map[eid] = extent_cache();
     _extent_cache_map[eid].data = buf;
   }
@@ -53,7 +71,7 @@ extent_client::put(extent_protocol::extentid_t eid, std::string buf)
   extent_protocol::status ret = extent_protocol::OK;
   //int r;
   //ret = cl->call(extent_protocol::put, eid, buf, r);
-  printf("extent_client put id = %016llx with content: %s \n",eid,buf.c_str());
+  jsl_log(JSL_DBG_4, "extent_client put id = %016llx with %zu bytes\n",eid,buf.size());
   std::map<extent_protocol::extentid_t, extent_cache>::iterator it;
   it = _extent_cache_map.find(eid);
 
@@ -62,13 +80,13 @@ extent_client::put(extent_protocol::extentid_t eid, std::string buf)
   }
 
   //set content
-  _extent_cache_map[eid].data = buf;
+  _extent_cache_map[eid].data = std::move(buf);
   _extent_cache_map[eid].dirty = true;
   _extent_cache_map[eid].deleted = false;
 
   //set attributes
   extent_protocol::attr a;
-  a.size = buf.size();
+  a.size = _extent_cache_map[eid].data.size();
   time_t TIME_CUR = time(NULL);
   a.atime = TIME_CUR;
   a.ctime = TIME_CUR;
@@ -86,7 +104,7 @@ extent_client::remove(extent_protocol::extentid_t eid)
   it = _extent_cache_map.find(eid);
 
   if(it != _extent_cache_map.end()){
-    extent_cache e_cache = _extent_cache_map[eid];
+    extent_cache &e_cache = _extent_cache_map[eid];
     
     if(e_cache.deleted){
       assert(true == _extent_cache_map[eid].dirty);
@@ -111,16 +129,16 @@ extent_client::getattr(extent_protocol::extentid_t eid, extent_protocol::attr &a
   std::map<extent_protocol::extentid_t, extent_protocol::attr>::iterator it;
   it = _attr_cache_map.find(eid);
 
-  printf("extent_client getattr  id =%016llx\n",eid);
+  jsl_log(JSL_DBG_4, "extent_client getattr  id =%016llx\n",eid);
 
   if (it != _attr_cache_map.end()){
     // if(_extent_cache_map[eid].deleted){
     //   return extent_protocol::NOENT; 
     // }
     attr = it->second;
-    printf("extent_client attr id = %016llx is cached \n",eid);
+    jsl_log(JSL_DBG_4, "extent_client attr id = %016llx is cached \n",eid);
   } else {
-    printf("extent_client getattr id = %016llx is not cached, try to get attr from the server\n",eid);
+    jsl_log(JSL_DBG_4, "extent_client getattr id = %016llx is not cached, try to get attr from the server\n",eid);
     ret = cl->call(extent_protocol::getattr, eid, attr);
     assert(extent_protocol::OK == ret);
     _attr_cache_map[eid] = attr;
@@ -146,12 +164,13 @@ extent_protocol::attr a)
   }
 
   if (a.size < old_a.size){  
-        buf = buf.substr(0, a.size);
-        _extent_cache_map[eid].data = buf;
-        assert(buf.size() == a.size);   
+        buf.resize(a.size);
+        _extent_cache_map[eid].data = std::move(buf);
+        assert(_extent_cache_map[eid].data.size() == a.size);
     } else if (old_a.size < a.size){
         buf.resize(a.size);
-        _extent_cache_map[eid].data = buf;
+        _extent_cache_map[eid].data = std::move(buf);
+        assert(_extent_cache_map[eid].data.size() == a.size);
   }
 
   _attr_cache_map[eid].size = a.size;
@@ -171,8 +190,9 @@ extent_client::flush(extent_protocol::extentid_t eid)
 {
   extent_protocol::status ret = extent_protocol::OK;
   int r;
+  rpc_batch b;
 
-  printf("flush is called with eid = %016llx\n",eid);
+  jsl_log(JSL_DBG_4, "flush is called with eid = %016llx\n",eid);
 
   //assert(_extent_cache_map.count(eid) > 0);
   if(_extent_cache_map.count(eid) == 0){
@@ -182,7 +202,7 @@ extent_client::flush(extent_protocol::extentid_t eid)
     return ret;
   } 
 
-  extent_cache e_cache = _extent_cache_map[eid];
+  extent_cache &e_cache = _extent_cache_map[eid];
 
   /** potential optimization: in current implemenation, if a client create a 
   file local and then delete it (suppose that the created file name does not 
@@ -195,16 +215,31 @@ extent_client::flush(extent_protocol::extentid_t eid)
     /** send the data to the server, we don't need to send the attr to the server, 
     since the server will update it when the server receives the put RPC
     */
-    printf("data is dirty, e_cache.data is:%s\n",e_cache.data.c_str());
-    ret = cl->call(extent_protocol::put, eid, e_cache.data, r);
-    assert(extent_protocol::OK == ret);   
+    jsl_log(JSL_DBG_4, "data is dirty, %zu bytes\n",e_cache.data.size());
   }
 
   if(e_cache.deleted){
     assert(_attr_cache_map.count(eid) > 0);
-    printf("data is deleted\n");
+    jsl_log(JSL_DBG_4, "data is deleted\n");
+  }
+
+  // a put and a remove go to the server in one round trip; a put on
+  // its own is sent straight from the cache, without the batch's copies
+  if(e_cache.dirty && e_cache.deleted){
+    b.add(extent_protocol::put, eid, e_cache.data);
+    b.add(extent_protocol::remove, eid);
+    ret = cl->call_batch(b);
+    assert(extent_protocol::OK == ret);
+    for (int i = 0; i < b.size(); i++) {
+      ret = b.get(i, r);
+      assert(extent_protocol::OK == ret);
+    }
+  } else if(e_cache.dirty){
+    ret = cl->call(extent_protocol::put, eid, e_cache.data, r);
+    assert(extent_protocol::OK == ret);
+  } else if(e_cache.deleted){
     ret = cl->call(extent_protocol::remove, eid, r);
-    assert(extent_protocol::OK == ret); 
+    assert(extent_protocol::OK == ret);
   }
 
   _extent_cache_map.erase(eid);
@@ -42,7 +42,7 @@ operator>>(unmarshall &u, extent_protocol::attr &a)
 }
 
 inline marshall &
-operator<<(marshall &m, extent_protocol::attr a)
+operator<<(marshall &m, const extent_protocol::attr &a)
 {
   m << a.atime;
   m << a.mtime;
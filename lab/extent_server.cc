@@ -3,6 +3,7 @@
 #include "extent_server.h"
 #include "gettime.h"
 #include <sstream>
+#include <utility>
 #include <stdio.h>
 #include <unistd.h>
 #include <sys/types.h>
@@ -38,15 +39,15 @@ int extent_server::put(extent_protocol::extentid_t id, std::string buf, int &)
         status = extent_protocol::FBIG;
     } else {    
         // should be overwrite
+        // buf is ours (the rpc layer moves it in), so keep it rather than copy it
+        extent_protocol::attr at;
+        at.size = buf.size();
 
-        _content_map[id] = buf;
+        _content_map[id] = std::move(buf);
 
         struct timespec now;
         clock_gettime(CLOCK_REALTIME, &now);
         
-        extent_protocol::attr at;
-
-        at.size = buf.size();
         at.atime = now.tv_sec;
         at.mtime = now.tv_sec; 
         at.ctime = now.tv_sec;            
@@ -12,7 +12,7 @@ main(int argc, char *argv[])
   int count = 0;
 
   if(argc != 2){
-    fprintf(stderr, "Usage: %s port\n", argv[0]);
+    fprintf(stderr, "Usage: %s port|socket-path\n", argv[0]);
     exit(1);
   }
 
@@ -23,7 +23,7 @@ main(int argc, char *argv[])
     count = atoi(count_env);
   }
 
-  rpcs server(atoi(argv[1]), count);
+  rpcs server(argv[1], count);
   extent_server ls;
 
   server.reg(extent_protocol::get, &ls, &extent_server::get);
@@ -17,6 +17,7 @@
 #include <assert.h>
 #include <arpa/inet.h>
 #include "yfs_client.h"
+#include "jsl_log.h"
 
 int myid;
 yfs_client *yfs;
@@ -60,7 +61,7 @@ getattr(yfs_client::inum inum, struct stat &st)
   bzero(&st, sizeof(st));
 
   st.st_ino = inum;
-  printf("getattr %016llx %d\n", inum, yfs->isfile(inum));
+  jsl_log(JSL_DBG_4, "getattr %016llx %d\n", inum, yfs->isfile(inum));
   if(yfs->isfile(inum)){
      yfs_client::fileinfo info;
      ret = yfs->getfile(inum, info);
@@ -72,7 +73,7 @@ getattr(yfs_client::inum inum, struct stat &st)
      st.st_mtime = info.mtime;
      st.st_ctime = info.ctime;
      st.st_size = info.size;
-     printf("   getattr -> %llu\n", info.size);
+     jsl_log(JSL_DBG_4, "   getattr -> %llu\n", info.size);
    } else {
      yfs_client::dirinfo info;
      ret = yfs->getdir(inum, info);
@@ -83,7 +84,7 @@ getattr(yfs_client::inum inum, struct stat &st)
      st.st_atime = info.atime;
      st.st_mtime = info.mtime;
      st.st_ctime = info.ctime;
-     printf("   getattr -> %lu %lu %lu\n", info.atime, info.mtime, info.ctime);
+     jsl_log(JSL_DBG_4, "   getattr -> %lu %lu %lu\n", info.atime, info.mtime, info.ctime);
    }
    return yfs_client::OK;
 }
@@ -139,10 +140,10 @@ fuseserver_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set
 
   yfs->yfs_lock(ino);
 
-  printf("fuseserver_setattr 0x%x\n", to_set);
+  jsl_log(JSL_DBG_4, "fuseserver_setattr 0x%x\n", to_set);
   if (FUSE_SET_ATTR_SIZE & to_set) {
     //We only support changing the size attr
-    printf("   fuseserver_setattr set size to %zu\n", attr->st_size);
+    jsl_log(JSL_DBG_4, "   fuseserver_setattr set size to %zu\n", attr->st_size);
 
     struct stat st;
 
@@ -282,7 +283,7 @@ fuseserver_create(fuse_req_t req, fuse_ino_t parent, const char *name,
 
   struct fuse_entry_param e;
 
-  printf("\tcreate: parent(%08lx), name(%s), mode(%o)\n", parent, name, mode);
+  jsl_log(JSL_DBG_4, "\tcreate: parent(%08lx), name(%s), mode(%o)\n", parent, name, mode);
 
   if( fuseserver_createhelper( parent, name, mode, &e ) == yfs_client::OK ) {
     fuse_reply_create(req, &e, fi);
@@ -300,7 +301,7 @@ void fuseserver_mknod( fuse_req_t req, fuse_ino_t parent,
   yfs->yfs_lock(parent);
   struct fuse_entry_param e;
   
-  printf("\tcreate: parent(%08lx), name(%s), mode(%o)\n", parent, name, mode);
+  jsl_log(JSL_DBG_4, "\tcreate: parent(%08lx), name(%s), mode(%o)\n", parent, name, mode);
   
   if( fuseserver_createhelper( parent, name, mode, &e ) == yfs_client::OK ) {
     fuse_reply_entry(req, &e);
@@ -335,10 +336,10 @@ fuseserver_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
   //parent must be a dir.
   assert(yfs->isdir(parent));
   
-  printf("\t lookup: parent(%08lx), name(%s)\n", parent, name);
+  jsl_log(JSL_DBG_4, "\t lookup: parent(%08lx), name(%s)\n", parent, name);
   if (yfs->lookup(parent, file_name, ino) == yfs_client::OK)
   {
-      printf("\tfuse.cc parent(%08lx), name(%s),ino(%08llx) found\n", parent, name, ino);
+      jsl_log(JSL_DBG_4, "\tfuse.cc parent(%08lx), name(%s),ino(%08llx) found\n", parent, name, ino);
       e.ino = ino;
 
       yfs->yfs_lock(ino);
@@ -368,7 +369,7 @@ fuseserver_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
   struct dirbuf b;
   yfs_client::dirent e;
 
-  printf("fuseserver_readdir\n");
+  jsl_log(JSL_DBG_4, "fuseserver_readdir\n");
 
   if(!yfs->isdir(inum)){
     fuse_reply_err(req, ENOTDIR);
@@ -482,7 +483,7 @@ fuseserver_statfs(fuse_req_t req)
 {
   struct statvfs buf;
 
-  printf("statfs\n");
+  jsl_log(JSL_DBG_4, "statfs\n");
 
   memset(&buf, 0, sizeof(buf));
 
@@ -1,5 +1,6 @@
 #include "handle.h"
 #include <stdio.h>
+#include "jsl_log.h"
 
 handle_mgr mgr;
 
@@ -26,15 +27,15 @@ handle_mgr::get_handle(std::string m)
   rpcc *cl = 0;
   struct hinfo *h = 0;
   if (hmap.find(m) == hmap.end()) {
-    sockaddr_in dstsock;
+    sockaddr_storage dstsock;
     make_sockaddr(m.c_str(), &dstsock);
     cl = new rpcc(dstsock);
-    printf("paxos::get_handle trying to bind...%s\n", m.c_str());
+    jsl_log(JSL_DBG_1, "paxos::get_handle trying to bind...%s\n", m.c_str());
     ret = cl->bind(rpcc::to(1000));
     if (ret < 0) {
-      printf("handle_mgr::get_handle bind failure! %s %d\n", m.c_str(), ret);
+      jsl_log(JSL_DBG_1, "handle_mgr::get_handle bind failure! %s %d\n", m.c_str(), ret);
     } else {
-      printf("handle_mgr::get_handle bind succeeded %s\n", m.c_str());
+      jsl_log(JSL_DBG_1, "handle_mgr::get_handle bind succeeded %s\n", m.c_str());
       hmap[m].cl = cl;
       hmap[m].refcnt = 1;
       hmap[m].del = false;
@@ -72,9 +73,9 @@ void
 handle_mgr::delete_handle_wo(std::string m)
 {
   if (hmap.find(m) == hmap.end()) {
-    printf("handle_mgr::delete_handle_wo: cl %s isn't in cl list\n", m.c_str());
+    jsl_log(JSL_DBG_1, "handle_mgr::delete_handle_wo: cl %s isn't in cl list\n", m.c_str());
   } else {
-    printf("handle_mgr::delete_handle_wo: cl %s refcnt %d\n", m.c_str(),
+    jsl_log(JSL_DBG_1, "handle_mgr::delete_handle_wo: cl %s refcnt %d\n", m.c_str(),
 	   hmap[m].refcnt);
     if (hmap[m].refcnt == 0) {
       hmap[m].cl->cancel();
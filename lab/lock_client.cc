@@ -7,14 +7,15 @@
 #include <sstream>
 #include <iostream>
 #include <stdio.h>
+#include "jsl_log.h"
 
 lock_client::lock_client(std::string dst)
 {
-  sockaddr_in dstsock;
+  sockaddr_storage dstsock;
   make_sockaddr(dst.c_str(), &dstsock);
   cl = new rpcc(dstsock);
   if (cl->bind() < 0) {
-    printf("lock_client: call bind\n");
+    jsl_log(JSL_DBG_1, "lock_client: call bind\n");
   }
 }
 
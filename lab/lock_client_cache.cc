@@ -4,9 +4,9 @@
 #include "lock_client_cache.h"
 #include "rpc.h"
 #include <sstream>
-#include <iostream>
 #include <stdio.h>
 #include <random>
+#include "jsl_log.h"
 
 
 static void *
@@ -37,11 +37,11 @@ lock_client_cache::lock_client_cache(std::string xdst,
   
   while (true) {
         try {
-            std::cout << "Trying port " << rlock_port << "..." << std::endl;
+            jsl_log(JSL_DBG_2, "lock_client_cache: trying port %d\n", rlock_port);
             rlsrpc = new rpcs(rlock_port);
             break;
         } catch (PortBusyException e) {
-            std::cout << "Port " << rlock_port << " busy" << std::endl;
+            jsl_log(JSL_DBG_2, "lock_client_cache: port %d busy\n", rlock_port);
             rlock_port = uniformIntDistribution(rndgen);
         }
     }
@@ -59,8 +59,8 @@ lock_client_cache::lock_client_cache(std::string xdst,
   
   
   /* register RPC handlers with rlsrpc */
-  rlsrpc->reg(rlock_protocol::revoke, this, &lock_client_cache::revoke);
-  rlsrpc->reg(rlock_protocol::retry, this, &lock_client_cache::retry);
+  rlsrpc->reg(rlock_protocol::revoke, this, &lock_client_cache::revoke, true);
+  rlsrpc->reg(rlock_protocol::retry, this, &lock_client_cache::retry, true);
 
   //initialize the cl_map mutex
   assert(pthread_mutex_init(&c_lock_map_mutex, NULL) == 0);
@@ -104,7 +104,7 @@ lock_client_cache::releaser()
       //operations on c_lock
       pthread_mutex_lock(&c_lock.cached_lock_mutex);
       
-      printf("id = %s now tries to release lock lid = %016llx from server\n", id.c_str(), lid);  
+      jsl_log(JSL_DBG_4, "id = %s now tries to release lock lid = %016llx from server\n", id.c_str(), lid);  
 
       assert(RELEASING == c_lock.lock_state); //all entires in this list should have state == RELEASING
       lock_protocol::xid_t cur_xid = c_lock.xid;
@@ -129,7 +129,7 @@ lock_client_cache::releaser()
           pthread_cond_signal(&c_lock.ac_cv);
           pthread_mutex_unlock(&c_lock.cached_lock_mutex);
         }else{
-          printf("ERROR from releaser in lock_client_cache\n");
+          jsl_log(JSL_DBG_1, "ERROR from releaser in lock_client_cache\n");
           assert(false);
           return;
         }
@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include "jsl_log.h"
 
 lock_server::lock_server():
   nacquire (0)
@@ -26,7 +27,7 @@ lock_protocol::status
 lock_server::stat(int clt, lock_protocol::lockid_t lid, int &r)
 {
   lock_protocol::status ret = lock_protocol::OK;
-  printf("stat request from clt %d\n", clt);
+  jsl_log(JSL_DBG_4, "stat request from clt %d\n", clt);
   r = nacquire;
   return ret;
 }
@@ -6,6 +6,7 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include "handle.h"
+#include "jsl_log.h"
 
 static void *
 revokethread(void *x)
@@ -24,17 +25,11 @@ retrythread(void *x)
 }
 
 lock_server_cache::lock_server_cache(class rsm *_rsm) 
-  : rsm (_rsm)
+  : rsm (_rsm), revoke_queue(1024), retry_queue(1024)
 {
   assert(pthread_mutex_init(&lock_obj_map_mutex, NULL) == 0);
   assert(pthread_mutex_init(&rpcc_pool_mutex, NULL) == 0);
 
-  assert(pthread_mutex_init(&revoke_list_mutex, NULL) == 0);
-  assert(pthread_mutex_init(&retry_list_mutex, NULL) == 0);
-
-  assert(pthread_cond_init(&revoker_condition, NULL) == 0);
-  assert(pthread_cond_init(&retryer_condition, NULL) == 0);
-
 
   pthread_t th;
   int r = pthread_create(&th, NULL, &revokethread, (void *) this);
@@ -52,18 +47,42 @@ lock_server_cache::~lock_server_cache()
     pthread_mutex_destroy(&lock_obj_map_mutex);
     pthread_mutex_destroy(&rpcc_pool_mutex);
 
-    pthread_mutex_destroy(&revoke_list_mutex);
-    pthread_mutex_destroy(&retry_list_mutex);
-    
-    pthread_cond_destroy(&revoker_condition);
-    pthread_cond_destroy(&retryer_condition);
-
     for (std::map<std::string, rpcc*>::iterator it = rpcc_pool.begin(); it != rpcc_pool.end(); ++it)
     {
         delete it->second;
     }
 }
 
+//wait for at least one entry of q, then send proc to the clients of
+//everything queued so far at once
+void
+lock_server_cache::send_batch(mpmc_queue<lock_info> &q, unsigned int proc)
+{
+  std::vector<lock_info> batch(1);
+  q.deq(&batch[0]);
+  lock_info li;
+  while (q.try_deq(&li))
+    batch.push_back(li);
+
+  if (!rsm->amiprimary())
+    return;
+
+  //do not wait for one client before sending to the next
+  std::vector<rpc_future<int> > rs(batch.size());
+  for (unsigned i = 0; i < batch.size(); i++) {
+    rpcc *cl = handle(batch[i].client_id).get_rpcc();
+    assert(cl != NULL);
+
+    if (proc == rlock_protocol::revoke)
+      jsl_log(JSL_DBG_4, "send revoke to client_id = %s for lockid =%016llx \n", batch[i].client_id.c_str() ,batch[i].lid );
+    cl->call_async(proc, rs[i], rpcc::urgent(), batch[i].lid);
+  }
+  int r;
+  for (unsigned i = 0; i < rs.size(); i++) {
+    assert(rlock_protocol::OK == rs[i].get(r));
+  }
+}
+
 void
 lock_server_cache::revoker()
 {
@@ -72,32 +91,9 @@ lock_server_cache::revoker()
   // messages to lock holders whenever another client wants the
   // same lock
 
-  int r;
-  pthread_mutex_lock(&revoke_list_mutex);
-
   while(true){
-    while(!revoke_list.empty()){
-      lock_info l_info = revoke_list.front();
-      revoke_list.pop_front();
-
-      if (rsm->amiprimary()) {
-        rpcc *cl = handle(l_info.client_id).get_rpcc();
-        assert(cl != NULL);
-
-        printf("send revoke to client_id = %s for lockid =%016llx \n", l_info.client_id.c_str() ,l_info.lid );
-        //send revoke RPC, do not hold mutex while calling RPC
-        pthread_mutex_unlock(&revoke_list_mutex);
-        assert(rlock_protocol::OK == cl->call(rlock_protocol::revoke, l_info.lid, r));
-        //get the list mutex again
-        pthread_mutex_lock(&revoke_list_mutex);
-      }
-    }
-    pthread_cond_wait(&revoker_condition, &revoke_list_mutex); 
-    
+    send_batch(revoke_queue, rlock_protocol::revoke);
   }
-
-  pthread_mutex_unlock(&revoke_list_mutex);
-
 }
 
 
@@ -109,32 +105,9 @@ lock_server_cache::retryer()
   // to be released and then sending retry messages to those who
   // are waiting for it.
 
-  int r;
-  pthread_mutex_lock(&retry_list_mutex);
   while(true){
-    while(!retry_list.empty()){
-      lock_info l_info = retry_list.front();
-      retry_list.pop_front();
-
-      if (rsm->amiprimary()) {
-        rpcc *cl = handle(l_info.client_id).get_rpcc();
-        assert(cl != NULL);
-
-        //send retry RPC, do not hold mutex while calling RPC
-        pthread_mutex_unlock(&retry_list_mutex);
-        assert(rlock_protocol::OK == cl->call(rlock_protocol::retry, l_info.lid, r));
-
-        //get the list mutex again
-        pthread_mutex_lock(&retry_list_mutex);
-      }
-    }
-    pthread_cond_wait(&retryer_condition, &retry_list_mutex); 
-    
+    send_batch(retry_queue, rlock_protocol::retry);
   }
-
-  pthread_mutex_unlock(&retry_list_mutex);
-  return;
-
 }
 
 lock_protocol::status
@@ -146,7 +119,7 @@ lock_protocol::status
 lock_server_cache::acquire(std::string id, lock_protocol::lockid_t lid, lock_protocol::xid_t xid, int &r){
   pthread_mutex_lock(&lock_obj_map_mutex);
 
-  printf("client id: %s acquires lock lid = %016llx, xid = %016llx \n", id.c_str(), lid, xid);
+  jsl_log(JSL_DBG_4, "client id: %s acquires lock lid = %016llx, xid = %016llx \n", id.c_str(), lid, xid);
 
   //if never seen this lock, we create one and add it to the map
   if(lock_obj_map.find(lid) == lock_obj_map.end()){ 
@@ -160,17 +133,17 @@ lock_server_cache::acquire(std::string id, lock_protocol::lockid_t lid, lock_pro
     l_obj.highest_xid_from_client_map[id] = 0;
   }
 
-  printf("I have seen acquire request with xid = %016llx from client id: %s with lid = %016llx. \n", l_obj.highest_xid_from_client_map[id], id.c_str(), lid);
+  jsl_log(JSL_DBG_4, "I have seen acquire request with xid = %016llx from client id: %s with lid = %016llx. \n", l_obj.highest_xid_from_client_map[id], id.c_str(), lid);
 
   if(l_obj.highest_xid_from_client_map[id] == xid && l_obj.owner_clientid == id){ //this should be a duplicated request
   
-      printf("duplicated accquire request, reuqire id = %s  current owner  id = %s \n", id.c_str(), l_obj.owner_clientid.c_str());
+      jsl_log(JSL_DBG_4, "duplicated accquire request, reuqire id = %s  current owner  id = %s \n", id.c_str(), l_obj.owner_clientid.c_str());
       pthread_mutex_unlock(&lock_obj_map_mutex);
       return lock_protocol::OK;
   }
 
   if(l_obj.highest_xid_from_client_map[id] == xid && l_obj.owner_clientid != id){
-    printf("this should be a duplicated accquire request but we will send revoke agian tho the current owner = %s \n", l_obj.owner_clientid.c_str());
+    jsl_log(JSL_DBG_4, "this should be a duplicated accquire request but we will send revoke agian tho the current owner = %s \n", l_obj.owner_clientid.c_str());
   }else{
     assert(xid == (l_obj.highest_xid_from_client_map[id] + 1) );
     l_obj.highest_xid_from_client_map[id] = xid;
@@ -179,7 +152,7 @@ lock_server_cache::acquire(std::string id, lock_protocol::lockid_t lid, lock_pro
 
   // if the lock is FREE
   if(FREE == l_obj.lock_state){
-    printf("acquire: id = %s  lid = %016llx, lock is free\n", id.c_str(), lid);
+    jsl_log(JSL_DBG_4, "acquire: id = %s  lid = %016llx, lock is free\n", id.c_str(), lid);
     l_obj.lock_state = LOCKED;
     l_obj.owner_clientid = id;
 
@@ -188,12 +161,13 @@ lock_server_cache::acquire(std::string id, lock_protocol::lockid_t lid, lock_pro
       l_obj.lock_state = REVOKING;
 
       //use revoker notify the current owner to give lock back
-      pthread_mutex_lock(&revoke_list_mutex);
-      printf("lock is free but we need to revoke lid = %016llx from owner = %s because others also wait for this lock\n",  lid, l_obj.owner_clientid.c_str());
-      revoke_list.push_back(lock_info(l_obj.owner_clientid, lid));
-      pthread_cond_signal(&revoker_condition);
-      pthread_mutex_unlock(&revoke_list_mutex);
+      jsl_log(JSL_DBG_4, "lock is free but we need to revoke lid = %016llx from owner = %s because others also wait for this lock\n",  lid, l_obj.owner_clientid.c_str());
+      lock_info li(l_obj.owner_clientid, lid);
 
+      //the queue may be full, so wait for room without holding the map
+      pthread_mutex_unlock(&lock_obj_map_mutex);
+      revoke_queue.enq(li);
+      return lock_protocol::OK;
     }
 
   pthread_mutex_unlock(&lock_obj_map_mutex);
@@ -204,7 +178,7 @@ lock_server_cache::acquire(std::string id, lock_protocol::lockid_t lid, lock_pro
   if(LOCKED == l_obj.lock_state || REVOKING == l_obj.lock_state){
     assert(!l_obj.owner_clientid.empty());
 
-    printf("acquire: id = %s lid = %016llx, lock is LOCKED OR REVOKING\n", id.c_str(), lid);
+    jsl_log(JSL_DBG_4, "acquire: id = %s lid = %016llx, lock is LOCKED OR REVOKING\n", id.c_str(), lid);
 
     //in both cases the client should wait for the lock, push it into the list
     l_obj.waiting_clientids.push_back(id);
@@ -215,11 +189,13 @@ lock_server_cache::acquire(std::string id, lock_protocol::lockid_t lid, lock_pro
       l_obj.lock_state = REVOKING;
 
       //use revoker notify the current owner to give lock back
-      pthread_mutex_lock(&revoke_list_mutex);
-      printf("need to revoke lid = %016llx from owner = %s\n",  lid, l_obj.owner_clientid.c_str());
-      revoke_list.push_back(lock_info(l_obj.owner_clientid, lid));
-      pthread_cond_signal(&revoker_condition);
-      pthread_mutex_unlock(&revoke_list_mutex);
+      jsl_log(JSL_DBG_4, "need to revoke lid = %016llx from owner = %s\n",  lid, l_obj.owner_clientid.c_str());
+      lock_info li(l_obj.owner_clientid, lid);
+
+      //the queue may be full, so wait for room without holding the map
+      pthread_mutex_unlock(&lock_obj_map_mutex);
+      revoke_queue.enq(li);
+      return lock_protocol::RETRY;
     }
     
     //unlock and return
@@ -243,17 +219,17 @@ lock_server_cache::release(std::string id, lock_protocol::lockid_t lid, lock_pro
 
   if(xid == l_obj.highest_xid_from_client_map[id]){
     if( l_obj.lock_state == FREE || l_obj.owner_clientid.empty() ){
-      printf("[debug] This should be a duplicated request\n");
+      jsl_log(JSL_DBG_4, "[debug] This should be a duplicated request\n");
       pthread_mutex_unlock(&lock_obj_map_mutex);
       return lock_protocol::OK;
     }
 
   }else{
-    printf("[error] there is something wrong\n");
+    jsl_log(JSL_DBG_1, "[error] there is something wrong\n");
     assert(false);
   }
 
-  printf(" owner = %s tries to release the lock_lid = %016llx  xid = %016llx\n", l_obj.owner_clientid.c_str(), lid, xid);
+  jsl_log(JSL_DBG_4, " owner = %s tries to release the lock_lid = %016llx  xid = %016llx\n", l_obj.owner_clientid.c_str(), lid, xid);
   
   assert(LOCKED == l_obj.lock_state || REVOKING == l_obj.lock_state);
 
@@ -268,12 +244,12 @@ lock_server_cache::release(std::string id, lock_protocol::lockid_t lid, lock_pro
     std::string nxt_client_id = l_obj.waiting_clientids.front();
     l_obj.waiting_clientids.pop_front();
 
-    //add the lock_info to the retryer list
-    pthread_mutex_lock(&retry_list_mutex);
-    retry_list.push_back(lock_info(nxt_client_id, lid));
-    //wake up the retryer to send rerty() to the next client in the waiting list
-    pthread_cond_signal(&retryer_condition);
-    pthread_mutex_unlock(&retry_list_mutex);
+    //hand the lock_info to the retryer, which sends retry() to the
+    //next client in the waiting list.  the queue may be full, so
+    //wait for room without holding the map
+    pthread_mutex_unlock(&lock_obj_map_mutex);
+    retry_queue.enq(lock_info(nxt_client_id, lid));
+    return lock_protocol::OK;
   }
 
   
@@ -291,7 +267,7 @@ rpcc* lock_server_cache::get_rpcc(std::string id)
     pthread_mutex_lock(&rpcc_pool_mutex);
     if (rpcc_pool.count(id) == 0)
     {
-        sockaddr_in dstsock;
+        sockaddr_storage dstsock;
         make_sockaddr(id.c_str(), &dstsock);
         cl = new rpcc(dstsock);
         if (cl->bind() == 0)
@@ -5,6 +5,7 @@
 #include <map>
 #include "lock_protocol.h"
 #include "rpc.h"
+#include "mpmc_queue.h"
 #include "lock_server.h"
 
 #include "rsm.h"
@@ -35,10 +36,12 @@ class lock_server_cache : public rsm_state_transfer{
     }
   };
 
-  struct lock_info { // relationship between client and lock. refer to revke_list and retry_list
+  struct lock_info { // relationship between client and lock. refer to revoke_queue and retry_queue
     std::string client_id;
     lock_protocol::lockid_t lid;
 
+    lock_info() : lid(0) {} // for mpmc_queue
+
     lock_info(std::string id_, lock_protocol::lockid_t lid_){
     	client_id = id_;
     	lid = lid_;
@@ -48,21 +51,16 @@ class lock_server_cache : public rsm_state_transfer{
   //maps and lists
   std::map<lock_protocol::lockid_t, lock_obj> lock_obj_map;
   std::map<std::string, rpcc*> rpcc_pool; //<client_nonce, rpc_client>, rpcc_pool is used for manage all lock_client
-  std::list<lock_info> revoke_list;
-  std::list<lock_info> retry_list;
+  mpmc_queue<lock_info> revoke_queue;
+  mpmc_queue<lock_info> retry_queue;
 
   //mutexes
   pthread_mutex_t lock_obj_map_mutex;
   pthread_mutex_t rpcc_pool_mutex;
-  pthread_mutex_t revoke_list_mutex;
-  pthread_mutex_t retry_list_mutex;
-
-  //conditions
-  pthread_cond_t retryer_condition;
-  pthread_cond_t revoker_condition;
 
   //private functions
   rpcc* get_rpcc(std::string id);
+  void send_batch(mpmc_queue<lock_info> &q, unsigned int proc);
 
  public:
   lock_server_cache(class rsm *_rsm);
@@ -47,7 +47,7 @@ main(int argc, char *argv[])
 
 #ifndef RSM
   //lock_server_cache ls;
-  printf("Form Lab8, lock_server_cache without RSM is not supoorted anymore\n");
+  jsl_log(JSL_DBG_1, "Form Lab8, lock_server_cache without RSM is not supoorted anymore\n");
   assert(false);
   rpcs server(atoi(argv[1]), count);
   server.reg(lock_protocol::stat, &ls, &lock_server_cache::stat);
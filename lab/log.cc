@@ -1,6 +1,7 @@
 #include "paxos.h"
 #include <fstream>
 #include <iostream>
+#include "jsl_log.h"
 
 // Paxos must maintain some durable state (i.e., that survives power
 // failures) to run Paxos correct.  This module implements a log with
@@ -22,7 +23,7 @@ log::logread(void)
   unsigned instance;
 
   from.open(name.c_str());
-  printf ("logread\n");
+  jsl_log(JSL_DBG_1, "logread\n");
   while (from >> type) {
     if (type == "done") {
       std::string v;
@@ -31,7 +32,7 @@ log::logread(void)
       getline(from, v);
       pxs->values[instance] = v;
       pxs->instance_h = instance;
-      printf ("logread: instance: %d w. v = %s\n", instance, 
+      jsl_log(JSL_DBG_1, "logread: instance: %d w. v = %s\n", instance, 
 	      pxs->values[instance].c_str());
       pxs->v_a.clear();
       pxs->n_h.n = 0;
@@ -39,7 +40,7 @@ log::logread(void)
     } else if (type == "high") {
       from >> pxs->n_h.n;
       from >> pxs->n_h.m;
-      printf("logread: high update: %d(%s)\n", pxs->n_h.n, pxs->n_h.m.c_str());
+      jsl_log(JSL_DBG_1, "logread: high update: %d(%s)\n", pxs->n_h.n, pxs->n_h.m.c_str());
     } else if (type == "prop") {
       std::string v;
       from >> pxs->n_a.n;
@@ -47,10 +48,10 @@ log::logread(void)
       from.get();
       getline(from, v);
       pxs->v_a = v;
-      printf("logread: prop update %d(%s) with v = %s\n", pxs->n_a.n, 
+      jsl_log(JSL_DBG_1, "logread: prop update %d(%s) with v = %s\n", pxs->n_a.n, 
 	     pxs->n_a.m.c_str(), pxs->v_a.c_str());
     } else {
-      printf("logread: unknown log record\n");
+      jsl_log(JSL_DBG_1, "logread: unknown log record\n");
       assert(0);
     }
   } 
@@ -75,7 +76,7 @@ void
 log::restore(std::string s)
 {
   std::ofstream f;
-  printf("restore: %s\n", s.c_str());
+  jsl_log(JSL_DBG_1, "restore: %s\n", s.c_str());
   f.open(name.c_str(), std::ios::trunc);
   f << s;
   f.close();
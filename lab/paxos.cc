@@ -2,6 +2,8 @@
 #include "handle.h"
 // #include <signal.h>
 #include <stdio.h>
+#include <list>
+#include "jsl_log.h"
 
 // This module implements the proposer and acceptor of the Paxos
 // distributed algorithm as described by Lamport's "Paxos Made
@@ -98,9 +100,9 @@ proposer::run(int instance, std::vector<std::string> newnodes, std::string newv)
   bool r = false;
 
   pthread_mutex_lock(&pxs_mutex);
-  printf("start: node %s initiates paxos for %s w. i=%d v=%s stable=%d\n", me.c_str(), print_members(newnodes).c_str(), instance, newv.c_str(), stable);
+  jsl_log(JSL_DBG_1, "start: node %s initiates paxos for %s w. i=%d v=%s stable=%d\n", me.c_str(), print_members(newnodes).c_str(), instance, newv.c_str(), stable);
   if (!stable) {  // already running proposer?
-    printf("proposer::run: already running\n");
+    jsl_log(JSL_DBG_1, "proposer::run: already running\n");
     //pthread_mutex_unlock(&pxs_mutex);
     return false;
   }
@@ -121,7 +123,7 @@ proposer::run(int instance, std::vector<std::string> newnodes, std::string newv)
   if (prepare(instance, accepts, nodes, v)) {
 
     if (majority(c_nodes, accepts)) {
-      printf("paxos::manager: received a majority of prepare responses\n");
+      jsl_log(JSL_DBG_1, "paxos::manager: received a majority of prepare responses\n");
 
       if (v.size() == 0) {
 	v = c_v;
@@ -134,20 +136,20 @@ proposer::run(int instance, std::vector<std::string> newnodes, std::string newv)
       accept(instance, accepts, nodes1, v);
 
       if (majority(c_nodes, accepts)) {
-	printf("paxos::manager: received a majority of accept responses\n");
+	jsl_log(JSL_DBG_1, "paxos::manager: received a majority of accept responses\n");
 
 	breakpoint2();
 
 	decide(instance, accepts, v);
 	r = true;
       } else {
-	printf("paxos::manager: no majority of accept responses\n");
+	jsl_log(JSL_DBG_1, "paxos::manager: no majority of accept responses\n");
       }
     } else {
-      printf("paxos::manager: no majority of prepare responses\n");
+      jsl_log(JSL_DBG_1, "paxos::manager: no majority of prepare responses\n");
     }
   } else {
-    printf("paxos::manager: prepare is rejected %d\n", stable);
+    jsl_log(JSL_DBG_1, "paxos::manager: prepare is rejected %d\n", stable);
   }
   stable = true;
   pthread_mutex_unlock(&pxs_mutex);
@@ -178,41 +180,53 @@ proposer::prepare(unsigned instance, std::vector<std::string> &accepts,
   //the prepare handle will return a prepareres
   paxos_protocol::prepareres r;
 
+  //send the prepare requests to all nodes at once, then look at the
+  //replies in node order
+  std::list<handle> hs;
+  std::vector<rpc_future<paxos_protocol::prepareres> > rs(nodes.size());
+  std::vector<bool> sent(nodes.size(), false);
   for(unsigned i = 0; i < nodes.size(); i++){
-    handle h(nodes[i]);
-    rpcc* cl = h.get_rpcc();
+    hs.emplace_back(nodes[i]);
+    rpcc* cl = hs.back().get_rpcc();
     if (cl != NULL) 
     {
-        printf("[debug] proposer::prepare node(%s) preparereq v = %s\n", nodes[i].c_str(), a.v.c_str());
-        if (cl->call(paxos_protocol::preparereq, me, a, r, rpcc::to(1000)) == paxos_protocol::OK)
+        jsl_log(JSL_DBG_1, "[debug] proposer::prepare node(%s) preparereq v = %s\n", nodes[i].c_str(), a.v.c_str());
+        cl->call_async(paxos_protocol::preparereq, rs[i], rpcc::urgent(rpcc::to(1000)), me, a);
+        sent[i] = true;
+    }else{ //bind fails
+        jsl_log(JSL_DBG_1, "[debug] proposer::prepare node(%s) h.get_rpcc() == NULL\n", nodes[i].c_str());
+    }
+  }
+
+  for(unsigned i = 0; i < nodes.size(); i++){
+    if (!sent[i])
+      continue;
+    if (rs[i].get(r) == paxos_protocol::OK)
+    {
+      // node instance is behind, commit the old value(recovery from replica)
+      if (r.oldinstance)
+      {
+        assert(r.v_a.size() > 0); 
+        jsl_log(JSL_DBG_1, "[debug] proposer::prepare node(%s) oldinstance r.v_a = %s\n", nodes[i].c_str(), r.v_a.c_str());
+        acc->commit(instance, r.v_a);
+        return false;
+      }
+      // node accept, get the highest prop
+      if (r.accept)
+      {
+        accepts.push_back(nodes[i]);
+        jsl_log(JSL_DBG_1, "[debug] proposer::prepare node(%s) accept r.n_a.n = %d r.n_a.v = %s\n", nodes[i].c_str(), r.n_a.n, r.v_a.c_str());
+        if (r.n_a > max_n) //if the n_a from acceptor nodes[i] is bigger than max_n, we update it (and we update the value too). We use this to choose the v_a from the highest n_a
         {
-          // node instance is behind, commit the old value(recovery from replica)
-          if (r.oldinstance)
-          {
-            assert(r.v_a.size() > 0); 
-            printf("[debug] proposer::prepare node(%s) oldinstance r.v_a = %s\n", nodes[i].c_str(), r.v_a.c_str());
-            acc->commit(instance, r.v_a);
-            return false;
-          }
-          // node accept, get the highest prop
-          if (r.accept)
-          {
-            accepts.push_back(nodes[i]);
-            printf("[debug] proposer::prepare node(%s) accept r.n_a.n = %d r.n_a.v = %s\n", nodes[i].c_str(), r.n_a.n, r.v_a.c_str());
-            if (r.n_a > max_n) //if the n_a from acceptor nodes[i] is bigger than max_n, we update it (and we update the value too). We use this to choose the v_a from the highest n_a
-            {
-              max_n = r.n_a;
-              v = r.v_a;  // highest v from nodes
-            }
-          }
-          else{ // the proposal is rejected by the acceptor nodes[i]
-            printf("[debug] proposer::prepare node(%s) r.accept = 0, i.e. proposer is rejected\n", nodes[i].c_str());
-          }
-        }else{  //no OK reply from an acceptor
-            printf("[error] proposer::prepare node(%s) rpcc error\n", nodes[i].c_str());
+          max_n = r.n_a;
+          v = r.v_a;  // highest v from nodes
         }
-    }else{ //bind fails
-        printf("[debug] proposer::prepare node(%s) h.get_rpcc() == NULL\n", nodes[i].c_str());
+      }
+      else{ // the proposal is rejected by the acceptor nodes[i]
+        jsl_log(JSL_DBG_1, "[debug] proposer::prepare node(%s) r.accept = 0, i.e. proposer is rejected\n", nodes[i].c_str());
+      }
+    }else{  //no OK reply from an acceptor
+        jsl_log(JSL_DBG_1, "[error] proposer::prepare node(%s) rpcc error\n", nodes[i].c_str());
     }
   }
 
@@ -231,25 +245,35 @@ proposer::accept(unsigned instance, std::vector<std::string> &accepts,
   a.v = v;
   unsigned r;
 
+  //send to all nodes at once; accepts keeps the order of nodes
+  std::list<handle> hs;
+  std::vector<rpc_future<unsigned> > rs(nodes.size());
+  std::vector<bool> sent(nodes.size(), false);
   for(unsigned i = 0; i < nodes.size(); i++){
-    handle h(nodes[i]);
-    rpcc* cl = h.get_rpcc();
+    hs.emplace_back(nodes[i]);
+    rpcc* cl = hs.back().get_rpcc();
     if (cl != NULL){
-      printf("[debug] proposer::accept node(%s) acceptreq v = %s\n", nodes[i].c_str(), a.v.c_str());
-      if (cl->call(paxos_protocol::acceptreq, me, a, r) == paxos_protocol::OK){
-        
-        if(r){ //accept
-          accepts.push_back(nodes[i]);
-        }else{
-          printf("[debug] proposer::accept node(%s) ret = 0, proposal not accepted\n", nodes[i].c_str());
-        }
+      jsl_log(JSL_DBG_1, "[debug] proposer::accept node(%s) acceptreq v = %s\n", nodes[i].c_str(), a.v.c_str());
+      cl->call_async(paxos_protocol::acceptreq, rs[i], rpcc::urgent(), me, a);
+      sent[i] = true;
+    }else{
+      jsl_log(JSL_DBG_1, "[debug] proposer::accept node(%s) h.get_rpcc() == NULL\n", nodes[i].c_str());
+    }
+  }
 
+  for(unsigned i = 0; i < nodes.size(); i++){
+    if (!sent[i])
+      continue;
+    if (rs[i].get(r) == paxos_protocol::OK){
+      
+      if(r){ //accept
+        accepts.push_back(nodes[i]);
       }else{
-        printf("[error] proposer::accept node(%s) rpcc error\n", nodes[i].c_str());
+        jsl_log(JSL_DBG_1, "[debug] proposer::accept node(%s) ret = 0, proposal not accepted\n", nodes[i].c_str());
       }
 
     }else{
-      printf("[debug] proposer::accept node(%s) h.get_rpcc() == NULL\n", nodes[i].c_str());
+      jsl_log(JSL_DBG_1, "[error] proposer::accept node(%s) rpcc error\n", nodes[i].c_str());
     }
   }
 }
@@ -265,19 +289,29 @@ proposer::decide(unsigned instance, std::vector<std::string> accepts,
   //r is not used, only needed for rpc call
   int r = 1;
 
+  std::list<handle> hs;
+  std::vector<rpc_future<int> > rs(accepts.size());
+  std::vector<bool> sent(accepts.size(), false);
   for(unsigned i = 0; i < accepts.size(); i++){
-    handle h(accepts[i]);
-    rpcc* cl = h.get_rpcc();
+    hs.emplace_back(accepts[i]);
+    rpcc* cl = hs.back().get_rpcc();
 
     if(cl != NULL ){
-      printf("[debug] proposer::decide node(%s) decidereq v = %s\n", accepts[i].c_str(), a.v.c_str());
-      if (cl->call(paxos_protocol::decidereq, me, a, r, rpcc::to(1000)) == paxos_protocol::OK){
-        printf("[debug] proposer::decide node(%s) has processed my decide request and r = %d\n", accepts[i].c_str(), r);
-      }else{
-        printf("[error] proposer::decide node(%s) rpcc error\n", accepts[i].c_str());
-      }
+      jsl_log(JSL_DBG_1, "[debug] proposer::decide node(%s) decidereq v = %s\n", accepts[i].c_str(), a.v.c_str());
+      cl->call_async(paxos_protocol::decidereq, rs[i], rpcc::urgent(rpcc::to(1000)), me, a);
+      sent[i] = true;
+    }else{
+      jsl_log(JSL_DBG_1, "[debug] proposer::decide node(%s) h.get_rpcc() == NULL\n", accepts[i].c_str());
+    }
+  }
+
+  for(unsigned i = 0; i < accepts.size(); i++){
+    if (!sent[i])
+      continue;
+    if (rs[i].get(r) == paxos_protocol::OK){
+      jsl_log(JSL_DBG_1, "[debug] proposer::decide node(%s) has processed my decide request and r = %d\n", accepts[i].c_str(), r);
     }else{
-      printf("[debug] proposer::decide node(%s) h.get_rpcc() == NULL\n", accepts[i].c_str());
+      jsl_log(JSL_DBG_1, "[error] proposer::decide node(%s) rpcc error\n", accepts[i].c_str());
     }
   }
 }
@@ -303,9 +337,9 @@ acceptor::acceptor(class paxos_change *_cfg, bool _first, std::string _me,
   }
 
   pxs = new rpcs(atoi(_me.c_str()));
-  pxs->reg(paxos_protocol::preparereq, this, &acceptor::preparereq);
-  pxs->reg(paxos_protocol::acceptreq, this, &acceptor::acceptreq);
-  pxs->reg(paxos_protocol::decidereq, this, &acceptor::decidereq);
+  pxs->reg(paxos_protocol::preparereq, this, &acceptor::preparereq, true);
+  pxs->reg(paxos_protocol::acceptreq, this, &acceptor::acceptreq, true);
+  pxs->reg(paxos_protocol::decidereq, this, &acceptor::decidereq, true);
 }
 
 paxos_protocol::status
@@ -315,10 +349,10 @@ acceptor::preparereq(std::string src, paxos_protocol::preparearg a,
   // handle a preparereq message from proposer
 
   ScopedLock ml(&pxs_mutex);
-  printf("[debug] acceptor::preparereq node(%s) got prepare request. Request's info: instance = %d\n", me.c_str(), a.instance);
+  jsl_log(JSL_DBG_1, "[debug] acceptor::preparereq node(%s) got prepare request. Request's info: instance = %d\n", me.c_str(), a.instance);
   //check instance number
   if(a.instance <= instance_h){
-    printf("[debug] acceptor::preparereq node(%s) got prepare request, reject because oldinstance\n", me.c_str());
+    jsl_log(JSL_DBG_1, "[debug] acceptor::preparereq node(%s) got prepare request, reject because oldinstance\n", me.c_str());
     r.oldinstance = 1;
     r.accept = 0;
     assert(values.count(instance_h) > 0);
@@ -329,7 +363,7 @@ acceptor::preparereq(std::string src, paxos_protocol::preparearg a,
   //assert(a.instance == instance_h);
 
   if(a.n > n_h){ //accept
-    printf("[debug] acceptor::preparereq node(%s) got prepare request, accepted\n", me.c_str());
+    jsl_log(JSL_DBG_1, "[debug] acceptor::preparereq node(%s) got prepare request, accepted\n", me.c_str());
     n_h = a.n;
     l->loghigh(n_h);
 
@@ -338,7 +372,7 @@ acceptor::preparereq(std::string src, paxos_protocol::preparearg a,
     r.n_a = n_a;
     r.v_a = v_a;
   }else{ //reject
-    printf("[debug] acceptor::preparereq node(%s) got prepare request, reject because prepare number is low\n", me.c_str());
+    jsl_log(JSL_DBG_1, "[debug] acceptor::preparereq node(%s) got prepare request, reject because prepare number is low\n", me.c_str());
     r.oldinstance = 0;
     r.accept = 0;
   }
@@ -353,24 +387,24 @@ acceptor::acceptreq(std::string src, paxos_protocol::acceptarg a, int &r)
   // handle an acceptreq message from proposer
 
   ScopedLock ml(&pxs_mutex);
-  printf("[debug] acceptor::acceptreq node(%s) got accept request. Request's info: instance = %d\n", me.c_str(), a.instance);
+  jsl_log(JSL_DBG_1, "[debug] acceptor::acceptreq node(%s) got accept request. Request's info: instance = %d\n", me.c_str(), a.instance);
   
   r = 0;
 
   if(a.instance <= instance_h){
-    printf("[debug] acceptor::acceptreq node(%s) got accept request. reject beacause old instance number", me.c_str());
+    jsl_log(JSL_DBG_1, "[debug] acceptor::acceptreq node(%s) got accept request. reject beacause old instance number", me.c_str());
     r = 0;
     return paxos_protocol::OK;
   }
 
   if(a.n >= n_h){
-    printf("[debug] acceptor::acceptreq node(%s) got accept request. accepted\n", me.c_str());
+    jsl_log(JSL_DBG_1, "[debug] acceptor::acceptreq node(%s) got accept request. accepted\n", me.c_str());
     n_a = a.n;
     v_a = a.v;
     r = 1;
     l->logprop(n_a, v_a);
   }else{
-    printf("[debug] acceptor::acceptreq node(%s) got accept request. reject beacause prepare number is low", me.c_str());
+    jsl_log(JSL_DBG_1, "[debug] acceptor::acceptreq node(%s) got accept request. reject beacause prepare number is low", me.c_str());
     r = 0;
   }
   return paxos_protocol::OK;
@@ -383,17 +417,17 @@ acceptor::decidereq(std::string src, paxos_protocol::decidearg a, int &r)
   // handle an decide message from proposer
 
   ScopedLock ml(&pxs_mutex);
-  printf("[debug] acceptor::decidereq node(%s) got accept request. Request's info: instance = %d\n", me.c_str(), a.instance);
+  jsl_log(JSL_DBG_1, "[debug] acceptor::decidereq node(%s) got accept request. Request's info: instance = %d\n", me.c_str(), a.instance);
   if(a.instance <= instance_h){//ignore the request
-    printf("[debug] acceptor::decidereq node(%s) got accept request. Ignored because old instance\n", me.c_str());
+    jsl_log(JSL_DBG_1, "[debug] acceptor::decidereq node(%s) got accept request. Ignored because old instance\n", me.c_str());
     return paxos_protocol::OK;
   }
 
   if(a.instance == instance_h + 1){ //commit
-    printf("[debug] acceptor::decidereq node(%s) got accept request. OK, commit now\n", me.c_str());
+    jsl_log(JSL_DBG_1, "[debug] acceptor::decidereq node(%s) got accept request. OK, commit now\n", me.c_str());
     commit_wo(a.instance, a.v);
   }else{ //a.instance > (instance_h + 1) TODO: is it even possible?
-    printf("[debug] acceptor::decidereq node(%s) got accept request. Ignored because a.instance >= instance_h + 2\n", me.c_str());
+    jsl_log(JSL_DBG_1, "[debug] acceptor::decidereq node(%s) got accept request. Ignored because a.instance >= instance_h + 2\n", me.c_str());
     return paxos_protocol::OK;
   }
 
@@ -404,9 +438,9 @@ void
 acceptor::commit_wo(unsigned instance, std::string value)
 {
   //assume pxs_mutex is held
-  printf("acceptor::commit: instance=%d has v= %s\n", instance, value.c_str());
+  jsl_log(JSL_DBG_1, "acceptor::commit: instance=%d has v= %s\n", instance, value.c_str());
   if (instance > instance_h) {
-    printf("commit: highestaccepteinstance = %d\n", instance);
+    jsl_log(JSL_DBG_1, "commit: highestaccepteinstance = %d\n", instance);
     values[instance] = value;
     l->loginstance(instance, value);
     instance_h = instance;
@@ -453,7 +487,7 @@ void
 proposer::breakpoint1()
 {
   if (break1) {
-    printf("Dying at breakpoint 1!\n");
+    jsl_log(JSL_DBG_1, "Dying at breakpoint 1!\n");
     exit(1);
   }
 }
@@ -463,7 +497,7 @@ void
 proposer::breakpoint2()
 {
   if (break2) {
-    printf("Dying at breakpoint 2!\n");
+    jsl_log(JSL_DBG_1, "Dying at breakpoint 2!\n");
     exit(1);
   }
 }
@@ -472,10 +506,10 @@ void
 proposer::breakpoint(int b)
 {
   if (b == 3) {
-    printf("Proposer: breakpoint 1\n");
+    jsl_log(JSL_DBG_1, "Proposer: breakpoint 1\n");
     break1 = true;
   } else if (b == 4) {
-    printf("Proposer: breakpoint 2\n");
+    jsl_log(JSL_DBG_1, "Proposer: breakpoint 2\n");
     break2 = true;
   }
 }
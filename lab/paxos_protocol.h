@@ -54,7 +54,7 @@ operator>>(unmarshall &u, prop_t &a)
 }
 
 inline marshall &
-operator<<(marshall &m, prop_t a)
+operator<<(marshall &m, const prop_t &a)
 {
   m << a.n;
   m << a.m;
@@ -71,7 +71,7 @@ operator>>(unmarshall &u, paxos_protocol::preparearg &a)
 }
 
 inline marshall &
-operator<<(marshall &m, paxos_protocol::preparearg a)
+operator<<(marshall &m, const paxos_protocol::preparearg &a)
 {
   m << a.instance;
   m << a.n;
@@ -90,7 +90,7 @@ operator>>(unmarshall &u, paxos_protocol::prepareres &r)
 }
 
 inline marshall &
-operator<<(marshall &m, paxos_protocol::prepareres r)
+operator<<(marshall &m, const paxos_protocol::prepareres &r)
 {
   m << r.oldinstance;
   m << r.accept;
@@ -109,7 +109,7 @@ operator>>(unmarshall &u, paxos_protocol::acceptarg &a)
 }
 
 inline marshall &
-operator<<(marshall &m, paxos_protocol::acceptarg a)
+operator<<(marshall &m, const paxos_protocol::acceptarg &a)
 {
   m << a.instance;
   m << a.n;
@@ -126,7 +126,7 @@ operator>>(unmarshall &u, paxos_protocol::decidearg &a)
 }
 
 inline marshall &
-operator<<(marshall &m, paxos_protocol::decidearg a)
+operator<<(marshall &m, const paxos_protocol::decidearg &a)
 {
   m << a.instance;
   m << a.v;
@@ -0,0 +1,534 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+#include "binlog.h"
+#include "slock.h"
+
+#define RING_SIZE (64 << 10) // bytes, a power of two
+#define DRAIN_MS 10
+
+// a thread's records: the thread writes at head and only the drain
+// moves tail, so neither side takes a lock
+struct ring {
+	char buf[RING_SIZE];
+	std::atomic<uint64_t> head;
+	std::atomic<uint64_t> tail;
+	uint32_t id;
+	std::atomic<bool> dead; // the thread has exited
+};
+
+// a thread's ring lives on after the thread until it is drained
+struct ring_owner {
+	ring *r;
+	~ring_owner() {
+		if (r)
+			r->dead = true;
+		r = NULL; // a destructor that runs later may still log
+	}
+};
+
+static thread_local ring_owner tl_ring;
+// the thread is in binlog_flush(), and holds its locks
+static thread_local bool tl_flushing;
+
+static pthread_mutex_t binlog_m = PTHREAD_MUTEX_INITIALIZER; // all below
+static pthread_mutex_t out_m = PTHREAD_MUTEX_INITIALIZER; // draining
+static pthread_cond_t drain_c = PTHREAD_COND_INITIALIZER;
+// the vectors are never destroyed, as threads may log while the
+// process exits
+static std::vector<ring *> &rings = *new std::vector<ring *>;
+static std::vector<binlog_site *> &sites = // by id - 1
+	*new std::vector<binlog_site *>;
+static uint32_t nrings;
+static bool started; // the drain thread
+static std::atomic<bool> exiting; // exit() has begun: log directly
+static int binfd = -1; // RPC_LOG.pid, or text on stdout if -1
+static std::vector<bool> &written = // sites binfd has been told of
+	*new std::vector<bool>;
+
+// a format, split at its conversions
+struct fmt_piece {
+	std::string text; // printed before the conversion
+	std::string spec; // the conversion, for snprintf; "" after the last
+	int stars; // arguments that the width and precision take
+	char conv;
+};
+
+// the formats of sites, parsed once, by id - 1
+static std::vector<std::vector<fmt_piece> *> &parsed =
+	*new std::vector<std::vector<fmt_piece> *>;
+static void parse_format(const char *fmt, std::vector<fmt_piece> *v);
+
+static void binlog_child();
+static void binlog_exit();
+static void binlog_abort(int);
+
+static int64_t
+now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void *
+drain_loop(void *)
+{
+	while (1) {
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += DRAIN_MS * 1000000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		{
+			ScopedLock ml(&binlog_m);
+			pthread_cond_timedwait(&drain_c, &binlog_m, &ts);
+		}
+		binlog_flush();
+	}
+	return NULL;
+}
+
+// called with binlog_m held
+static void
+start_drain()
+{
+	static bool once;
+	if (!once) {
+		once = true;
+		atexit(binlog_exit);
+		pthread_atfork(NULL, NULL, binlog_child);
+		// an assert() that fails does not exit(), and what was
+		// logged just before it is what explains it.  a handler
+		// the program installed itself is left alone
+		struct sigaction sa, old;
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = binlog_abort;
+		sa.sa_flags = SA_RESETHAND;
+		sigemptyset(&sa.sa_mask);
+		if (sigaction(SIGABRT, NULL, &old) == 0 &&
+				old.sa_handler == SIG_DFL)
+			sigaction(SIGABRT, &sa, NULL);
+	}
+	started = true;
+	char *path = getenv("RPC_LOG");
+	if (path && *path) {
+		// one file per process, as forked children log too
+		char name[1024];
+		snprintf(name, sizeof(name), "%s.%d", path, getpid());
+		binfd = open(name, O_WRONLY|O_CREAT|O_TRUNC|O_APPEND, 0644);
+		if (binfd < 0)
+			perror(name); // and fall back to text
+		written.clear();
+	}
+	pthread_t th;
+	assert(pthread_create(&th, NULL, drain_loop, NULL) == 0);
+	pthread_detach(th);
+}
+
+// the drain thread did not survive the fork, and the parent still owns
+// what was in the rings
+static void
+binlog_child()
+{
+	pthread_mutex_init(&binlog_m, NULL);
+	pthread_mutex_init(&out_m, NULL);
+	pthread_cond_init(&drain_c, NULL);
+	rings.clear();
+	if (tl_ring.r) {
+		tl_ring.r->tail = tl_ring.r->head.load();
+		rings.push_back(tl_ring.r);
+	}
+	started = false;
+	if (binfd >= 0)
+		close(binfd);
+	binfd = -1;
+}
+
+static void
+binlog_exit()
+{
+	{
+		ScopedLock ml(&binlog_m);
+		exiting = true;
+	}
+	binlog_flush();
+}
+
+// abort() raises SIGABRT again once this returns, with the default
+// action.  flushing takes locks, which is fine unless the thread that
+// aborted holds them already
+static void
+binlog_abort(int)
+{
+	if (!tl_flushing)
+		binlog_flush();
+}
+
+static ring *
+new_ring()
+{
+	ring *r = new ring;
+	r->head = 0;
+	r->tail = 0;
+	r->dead = false;
+	ScopedLock ml(&binlog_m);
+	r->id = ++nrings;
+	rings.push_back(r);
+	if (!started)
+		start_drain();
+	return r;
+}
+
+static void
+ring_read(ring *r, uint64_t pos, void *dst, size_t n)
+{
+	size_t off = pos & (RING_SIZE - 1);
+	size_t k = std::min(n, (size_t)RING_SIZE - off);
+	memcpy(dst, r->buf + off, k);
+	memcpy((char *)dst + k, r->buf, n - k);
+}
+
+static void
+ring_write(ring *r, uint64_t pos, const void *src, size_t n)
+{
+	size_t off = pos & (RING_SIZE - 1);
+	size_t k = std::min(n, (size_t)RING_SIZE - off);
+	memcpy(r->buf + off, src, k);
+	memcpy(r->buf, (const char *)src + k, n - k);
+}
+
+static void
+write_all(int fd, const std::string &s)
+{
+	for (size_t off = 0; off < s.size(); ) {
+		ssize_t n = write(fd, s.data() + off, s.size() - off);
+		if (n <= 0)
+			return;
+		off += n;
+	}
+}
+
+// the records of one pass over the rings, and where each starts
+struct batch {
+	std::string buf;
+	std::vector<std::pair<int64_t, size_t> > at; // ns, offset
+};
+
+static void format_args(const std::vector<fmt_piece> &v, const char *args,
+		int n, std::string &out);
+
+// called with out_m held
+static void
+emit(batch &b)
+{
+	// the rings are each in order, but not with one another
+	std::sort(b.at.begin(), b.at.end());
+	std::string out;
+	ScopedLock ml(&binlog_m);
+	for (unsigned i = 0; i < b.at.size(); i++) {
+		const char *rec = b.buf.data() + b.at[i].second;
+		uint32_t len, id;
+		memcpy(&len, rec, sizeof(len));
+		memcpy(&id, rec + 4, sizeof(id));
+		binlog_site *s = sites[id - 1];
+		if (binfd < 0) {
+			if (parsed.size() < id)
+				parsed.resize(id, NULL);
+			if (!parsed[id - 1]) {
+				parsed[id - 1] = new std::vector<fmt_piece>;
+				parse_format(s->fmt, parsed[id - 1]);
+			}
+			format_args(*parsed[id - 1], rec + BINLOG_HEADER,
+					len - BINLOG_HEADER, out);
+			continue;
+		}
+		if (written.size() < id)
+			written.resize(id, false);
+		if (!written[id - 1]) {
+			written[id - 1] = true;
+			uint16_t flen = strlen(s->file), mlen = strlen(s->fmt);
+			out += 'S';
+			out.append((const char *)&id, sizeof(id));
+			out.append((const char *)&s->level, sizeof(s->level));
+			out.append((const char *)&s->line, sizeof(s->line));
+			out.append((const char *)&flen, sizeof(flen));
+			out.append(s->file, flen);
+			out.append((const char *)&mlen, sizeof(mlen));
+			out.append(s->fmt, mlen);
+		}
+		out += 'R';
+		out.append(rec, len);
+	}
+	write_all(binfd < 0 ? 1 : binfd, out);
+}
+
+void
+binlog_flush()
+{
+	ScopedLock ol(&out_m);
+	tl_flushing = true;
+	std::vector<ring *> rs;
+	{
+		ScopedLock ml(&binlog_m);
+		rs = rings;
+	}
+	batch b;
+	for (unsigned i = 0; i < rs.size(); i++) {
+		ring *r = rs[i];
+		bool dead = r->dead; // before head, so that nothing is missed
+		uint64_t h = r->head.load(std::memory_order_acquire);
+		uint64_t t = r->tail.load(std::memory_order_relaxed);
+		size_t off = b.buf.size();
+		b.buf.resize(off + (h - t));
+		ring_read(r, t, &b.buf[off], h - t);
+		r->tail.store(h, std::memory_order_release);
+		while (off < b.buf.size()) {
+			uint32_t len;
+			int64_t ns;
+			memcpy(&len, b.buf.data() + off, sizeof(len));
+			memcpy(&ns, b.buf.data() + off + 12, sizeof(ns));
+			b.at.push_back(std::make_pair(ns, off));
+			off += len;
+		}
+		if (dead) {
+			ScopedLock ml(&binlog_m);
+			rings.erase(std::find(rings.begin(), rings.end(), r));
+			delete r;
+		}
+	}
+	if (b.at.size())
+		emit(b);
+	tl_flushing = false;
+}
+
+static uint32_t
+register_site(binlog_site *s, const char *fmt)
+{
+	ScopedLock ml(&binlog_m);
+	if (!s->id) {
+		s->fmt = fmt;
+		sites.push_back(s);
+		s->id = sites.size();
+	}
+	return s->id;
+}
+
+void
+binlog_append(binlog_site *s, const char *fmt, char *rec, int n)
+{
+	uint32_t id = s->id.load(std::memory_order_acquire);
+	if (!id)
+		id = register_site(s, fmt);
+	ring *r = tl_ring.r;
+	if (!r)
+		r = tl_ring.r = new_ring();
+	int64_t ns = now_ns();
+	uint32_t len = n;
+	memcpy(rec, &len, sizeof(len));
+	memcpy(rec + 4, &id, sizeof(id));
+	memcpy(rec + 8, &r->id, sizeof(r->id));
+	memcpy(rec + 12, &ns, sizeof(ns));
+
+	if (exiting) {
+		ScopedLock ol(&out_m);
+		batch b;
+		b.buf.assign(rec, n);
+		b.at.push_back(std::make_pair(ns, 0));
+		emit(b);
+		return;
+	}
+
+	uint64_t h = r->head.load(std::memory_order_relaxed);
+	uint64_t t = r->tail.load(std::memory_order_acquire);
+	while (h + n - t > RING_SIZE) {
+		// full: the drain has fallen behind, so wait for it
+		pthread_cond_signal(&drain_c);
+		usleep(100);
+		t = r->tail.load(std::memory_order_acquire);
+	}
+	ring_write(r, h, rec, n);
+	r->head.store(h + n, std::memory_order_release);
+	if (h - t <= RING_SIZE / 2 && h + n - t > RING_SIZE / 2)
+		pthread_cond_signal(&drain_c);
+}
+
+static void
+appendf(std::string &out, const char *fmt, ...)
+{
+	char buf[256];
+	va_list ap;
+	va_start(ap, fmt);
+	int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	if (n < (int)sizeof(buf)) {
+		out.append(buf, std::max(n, 0));
+		return;
+	}
+	std::string big(n + 1, '\0');
+	va_start(ap, fmt);
+	vsnprintf(&big[0], n + 1, fmt, ap);
+	va_end(ap);
+	out.append(big, 0, n);
+}
+
+struct binlog_arg {
+	char tag; // 0 if there are no more
+	int64_t i;
+	uint64_t u;
+	double d;
+	const char *s;
+	uint16_t len;
+};
+
+static void
+next_arg(const char **a, const char *end, binlog_arg *x)
+{
+	x->tag = 0;
+	if (*a >= end)
+		return;
+	char tag = *(*a)++;
+	if (tag == 's') {
+		if (end - *a < (int)sizeof(x->len))
+			return;
+		memcpy(&x->len, *a, sizeof(x->len));
+		*a += sizeof(x->len);
+		if (end - *a < x->len)
+			return;
+		x->s = *a;
+		*a += x->len;
+	} else {
+		if (end - *a < 8)
+			return;
+		memcpy(&x->u, *a, 8);
+		memcpy(&x->i, *a, 8);
+		memcpy(&x->d, *a, 8);
+		*a += 8;
+	}
+	x->tag = tag;
+}
+
+static void
+parse_format(const char *fmt, std::vector<fmt_piece> *v)
+{
+	fmt_piece p;
+	p.stars = 0;
+	p.conv = 0;
+	for (const char *f = fmt; *f; ) {
+		if (*f != '%') {
+			p.text += *f++;
+			continue;
+		}
+		if (f[1] == '%') {
+			p.text += '%';
+			f += 2;
+			continue;
+		}
+		// %[flags][width][.precision][length]conversion; the length
+		// is replaced by one that suits the recorded argument
+		p.spec = "%";
+		for (f++; *f && strchr("-+ #0'", *f); f++)
+			p.spec += *f;
+		for (; (*f >= '0' && *f <= '9') || *f == '.' || *f == '*'; f++) {
+			p.spec += *f;
+			if (*f == '*')
+				p.stars++;
+		}
+		while (*f && strchr("hlLqjzt", *f))
+			f++;
+		if (!*f)
+			break;
+		p.conv = *f++;
+		if (strchr("diouxX", p.conv))
+			p.spec += "ll";
+		else if (!strchr("eEfFgGaAcsp", p.conv))
+			p.conv = 'n'; // %n, or nonsense: print nothing
+		p.spec += p.conv;
+		v->push_back(p);
+		p = fmt_piece();
+		p.stars = 0;
+		p.conv = 0;
+	}
+	v->push_back(p);
+}
+
+static void
+format_args(const std::vector<fmt_piece> &v, const char *args, int n,
+		std::string &out)
+{
+	const char *a = args, *end = args + n;
+	binlog_arg x;
+	for (unsigned k = 0; k < v.size(); k++) {
+		const fmt_piece &p = v[k];
+		out += p.text;
+		if (!p.conv)
+			continue;
+		const char *spec = p.spec.c_str();
+		std::string starred;
+		if (p.stars) {
+			for (const char *c = spec; *c; c++) {
+				if (*c != '*') {
+					starred += *c;
+					continue;
+				}
+				next_arg(&a, end, &x);
+				starred += std::to_string(x.tag ? x.i : 0);
+			}
+			spec = starred.c_str();
+		}
+		next_arg(&a, end, &x);
+		if (!x.tag) {
+			out += "<?>";
+			continue;
+		}
+		switch (p.conv) {
+			case 's':
+				if (x.tag == 's') {
+					std::string str(x.s, x.len);
+					appendf(out, spec, str.c_str());
+				} else {
+					appendf(out, "%lld", (long long)x.i);
+				}
+				break;
+			case 'c':
+				appendf(out, spec, (int)x.i);
+				break;
+			case 'e': case 'E': case 'f': case 'F':
+			case 'g': case 'G': case 'a': case 'A':
+				appendf(out, spec, x.tag == 'd' ? x.d :
+						x.tag == 'i' ? (double)x.i : (double)x.u);
+				break;
+			case 'p':
+				appendf(out, spec, (void *)(uintptr_t)x.u);
+				break;
+			case 'n':
+				break;
+			default: // d i o u x X
+				if (x.tag == 's')
+					out.append(x.s, x.len);
+				else
+					appendf(out, spec, x.tag == 'd' ? (long long)x.d : x.i);
+				break;
+		}
+	}
+}
+
+std::string
+binlog_format(const char *fmt, const char *args, int n)
+{
+	std::vector<fmt_piece> v;
+	parse_format(fmt, &v);
+	std::string out;
+	format_args(v, args, n, out);
+	return out;
+}
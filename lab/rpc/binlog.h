@@ -0,0 +1,113 @@
+#ifndef binlog_h
+#define binlog_h
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <string>
+#include <type_traits>
+
+// asynchronous binary logging, behind jsl_log().  a message is not
+// formatted where it is logged: the caller copies its call site and
+// raw arguments into a ring buffer that belongs to its thread, with no
+// lock and no system call, and a background thread drains the rings
+// every few ms.  that thread writes the messages to stdout as text, as
+// printf would have, or, if RPC_LOG names a file, appends the binary
+// records to it for rpc/logdump to format later.
+//
+// a record is a header (BINLOG_HEADER bytes: total length, site id,
+// thread, CLOCK_REALTIME ns) and the arguments, each a tag byte and
+// the value: 'i' int64_t, 'u' uint64_t, 'd' double, 'p' a pointer as
+// uint64_t, 's' a uint16_t length and the bytes.  all in host order.
+
+#define BINLOG_HEADER 20
+#define BINLOG_MAX_RECORD 4096
+#define BINLOG_MAX_STRING 1024 // longer %s arguments are cut short
+
+// one per jsl_log() call site
+struct binlog_site {
+	int level;
+	const char *file;
+	int line;
+	std::atomic<uint32_t> id; // 0 until its first message
+	const char *fmt;
+};
+
+struct binlog_buf {
+	char *p;
+	char *end;
+};
+
+void binlog_append(binlog_site *s, const char *fmt, char *rec, int n);
+// write out whatever the rings hold now.  abort(), and so a failed
+// assert(), gets this from a SIGABRT handler set up with the rings
+void binlog_flush();
+// fmt with the arguments of a record, as printf would have it
+std::string binlog_format(const char *fmt, const char *args, int n);
+
+static inline void
+binlog_put_raw(binlog_buf &b, char tag, const void *v, size_t n)
+{
+	if ((size_t)(b.end - b.p) < 1 + n)
+		return; // formatted as if missing
+	*b.p++ = tag;
+	memcpy(b.p, v, n);
+	b.p += n;
+}
+
+template<class T> static inline
+typename std::enable_if<std::is_integral<T>::value ||
+	std::is_enum<T>::value>::type
+binlog_put(binlog_buf &b, T v)
+{
+	if (std::is_signed<T>::value) {
+		int64_t x = (int64_t)v;
+		binlog_put_raw(b, 'i', &x, sizeof(x));
+	} else {
+		uint64_t x = (uint64_t)v;
+		binlog_put_raw(b, 'u', &x, sizeof(x));
+	}
+}
+
+static inline void
+binlog_put(binlog_buf &b, double v)
+{
+	binlog_put_raw(b, 'd', &v, sizeof(v));
+}
+
+static inline void
+binlog_put(binlog_buf &b, const void *v)
+{
+	uint64_t x = (uintptr_t)v;
+	binlog_put_raw(b, 'p', &x, sizeof(x));
+}
+
+static inline void
+binlog_put(binlog_buf &b, const char *s)
+{
+	if (!s)
+		s = "(null)";
+	// leave room for a few more arguments after this one
+	size_t n = strnlen(s, BINLOG_MAX_STRING);
+	size_t left = b.end - b.p;
+	if (left < 3 + 8 * 9)
+		return;
+	if (n > left - 3 - 8 * 9)
+		n = left - 3 - 8 * 9;
+	uint16_t len = n;
+	*b.p++ = 's';
+	memcpy(b.p, &len, sizeof(len));
+	memcpy(b.p + sizeof(len), s, n);
+	b.p += sizeof(len) + n;
+}
+
+template<class... Args> void
+binlog_write(binlog_site *s, const char *fmt, const Args &... args)
+{
+	char rec[BINLOG_MAX_RECORD];
+	binlog_buf b = { rec + BINLOG_HEADER, rec + sizeof(rec) };
+	(binlog_put(b, args), ...);
+	binlog_append(s, fmt, rec, b.p - rec);
+}
+
+#endif
@@ -0,0 +1,252 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "slock.h"
+#include "bufpool.h"
+
+// size classes are 1<<MIN_CLASS_SHIFT ... 1<<MAX_CLASS_SHIFT bytes,
+// header included
+#define MIN_CLASS_SHIFT 6
+#define MAX_CLASS_SHIFT 24
+#define NCLASSES (MAX_CLASS_SHIFT - MIN_CLASS_SHIFT + 1)
+#define UNPOOLED (-1)
+
+// memory kept idle on each shared free list; a class bigger than this
+// still keeps one buffer, so a stream of large extents reuses it
+#define MAX_IDLE_BYTES (1<<20)
+
+// each thread also keeps a few idle buffers of the smaller classes
+// for itself, so most allocations take no lock at all
+#define TL_MAX_CLASS_SHIFT 16
+#define TL_NCLASSES (TL_MAX_CLASS_SHIFT - MIN_CLASS_SHIFT + 1)
+#define TL_MAX_IDLE 32
+#define TL_MAX_IDLE_BYTES (128<<10)
+
+// hidden in front of every buffer; 16 bytes keep the user part aligned
+// like malloc() memory
+struct bufhdr {
+	int cls;
+	int capa;
+	union {
+		bufhdr *next; // free list link while the buffer is idle
+		int refs; // holders while it is in use
+	};
+};
+#define HDR_SZ 16
+
+struct freelist {
+	pthread_mutex_t m;
+	bufhdr *head;
+	int n;
+};
+
+// a thread's own free lists; no lock, as only that thread uses them
+struct tlcache {
+	bufhdr *head[TL_NCLASSES];
+	int n[TL_NCLASSES];
+};
+
+static freelist pool[NCLASSES];
+static pthread_once_t pool_is_initialized = PTHREAD_ONCE_INIT;
+static pthread_key_t tl_key; // only so that tl_exit() runs
+static __thread tlcache *tl;
+
+static void pool_put(bufhdr *h);
+
+// hand a dying thread's idle buffers to the shared lists
+static void
+tl_exit(void *arg)
+{
+	tlcache *c = (tlcache *)arg;
+	for (int i = 0; i < TL_NCLASSES; i++) {
+		while (c->head[i]) {
+			bufhdr *h = c->head[i];
+			c->head[i] = h->next;
+			pool_put(h);
+		}
+	}
+	free(c);
+	tl = NULL;
+}
+
+static void
+pool_init()
+{
+	for (int i = 0; i < NCLASSES; i++) {
+		assert(pthread_mutex_init(&pool[i].m, NULL) == 0);
+		pool[i].head = NULL;
+		pool[i].n = 0;
+	}
+	assert(pthread_key_create(&tl_key, tl_exit) == 0);
+}
+
+static inline int
+tl_max_idle(int cls)
+{
+	int n = TL_MAX_IDLE_BYTES >> (cls + MIN_CLASS_SHIFT);
+	return n < TL_MAX_IDLE ? n : TL_MAX_IDLE;
+}
+
+static tlcache *
+tl_get()
+{
+	if (!tl) {
+		tl = (tlcache *)calloc(1, sizeof(tlcache));
+		assert(tl);
+		assert(pthread_setspecific(tl_key, tl) == 0);
+	}
+	return tl;
+}
+
+static void
+pool_put(bufhdr *h)
+{
+	freelist *fl = &pool[h->cls];
+	int max = MAX_IDLE_BYTES >> (h->cls + MIN_CLASS_SHIFT);
+	{
+		ScopedLock ml(&fl->m);
+		if (fl->n < (max > 0 ? max : 1)) {
+			h->next = fl->head;
+			fl->head = h;
+			fl->n++;
+			return;
+		}
+	}
+	free(h);
+}
+
+static inline bufhdr *
+hdr_of(const char *b)
+{
+	return (bufhdr *)(b - HDR_SZ);
+}
+
+static inline int
+class_of(int total)
+{
+	if (total <= (1 << MIN_CLASS_SHIFT))
+		return 0;
+	//bits needed for total - 1, i.e. log2 of total rounded up
+	return 32 - __builtin_clz(total - 1) - MIN_CLASS_SHIFT;
+}
+
+char *
+rpc_buf_alloc(int sz)
+{
+	assert(sizeof(bufhdr) <= HDR_SZ);
+	assert(sz >= 0);
+	pthread_once(&pool_is_initialized, pool_init);
+
+	int total = sz + HDR_SZ;
+	bufhdr *h = NULL;
+
+	if (total > (1 << MAX_CLASS_SHIFT)) {
+		h = (bufhdr *)malloc(total);
+		assert(h);
+		h->cls = UNPOOLED;
+		h->capa = sz;
+		h->refs = 1;
+		return (char *)h + HDR_SZ;
+	}
+
+	int cls = class_of(total);
+	if (cls < TL_NCLASSES) {
+		tlcache *c = tl_get();
+		if (c->head[cls]) {
+			h = c->head[cls];
+			c->head[cls] = h->next;
+			c->n[cls]--;
+			h->refs = 1;
+			return (char *)h + HDR_SZ;
+		}
+	}
+
+	freelist *fl = &pool[cls];
+	{
+		ScopedLock ml(&fl->m);
+		if (fl->head) {
+			h = fl->head;
+			fl->head = h->next;
+			fl->n--;
+		}
+	}
+	if (!h) {
+		h = (bufhdr *)malloc(1 << (cls + MIN_CLASS_SHIFT));
+		assert(h);
+		h->cls = cls;
+		h->capa = (1 << (cls + MIN_CLASS_SHIFT)) - HDR_SZ;
+	}
+	h->refs = 1;
+	return (char *)h + HDR_SZ;
+}
+
+void
+rpc_buf_free(char *b)
+{
+	if (!b)
+		return;
+
+	bufhdr *h = hdr_of(b);
+	//a buffer with a single holder, the usual case, needs no atomic
+	//update to be released
+	if (__atomic_load_n(&h->refs, __ATOMIC_ACQUIRE) != 1 &&
+			__atomic_sub_fetch(&h->refs, 1, __ATOMIC_ACQ_REL) > 0)
+		return;
+	if (h->cls == UNPOOLED) {
+		free(h);
+		return;
+	}
+
+	assert(h->cls >= 0 && h->cls < NCLASSES);
+	if (h->cls < TL_NCLASSES) {
+		//a buffer is often freed by another thread than the one
+		//that allocated it (the reactor sends what a caller or
+		//worker marshalled), so a full cache spills to the shared
+		//lists rather than to free()
+		tlcache *c = tl_get();
+		if (c->n[h->cls] < tl_max_idle(h->cls)) {
+			h->next = c->head[h->cls];
+			c->head[h->cls] = h;
+			c->n[h->cls]++;
+			return;
+		}
+	}
+	pool_put(h);
+}
+
+char *
+rpc_buf_realloc(char *b, int sz)
+{
+	if (!b)
+		return rpc_buf_alloc(sz);
+
+	bufhdr *h = hdr_of(b);
+	assert(h->refs == 1);
+	if (sz <= h->capa)
+		return b;
+
+	if (h->cls == UNPOOLED) {
+		h = (bufhdr *)realloc(h, sz + HDR_SZ);
+		assert(h);
+		h->capa = sz;
+		return (char *)h + HDR_SZ;
+	}
+
+	char *nb = rpc_buf_alloc(sz);
+	memcpy(nb, b, h->capa);
+	rpc_buf_free(b);
+	return nb;
+}
+
+void
+rpc_buf_ref(char *b)
+{
+	__atomic_add_fetch(&hdr_of(b)->refs, 1, __ATOMIC_RELAXED);
+}
+
+int
+rpc_buf_capacity(const char *b)
+{
+	return hdr_of(b)->capa;
+}
@@ -0,0 +1,27 @@
+#ifndef bufpool_h
+#define bufpool_h
+
+// recyclable buffers for rpc pdus.  buffers are grouped in power-of-two
+// size classes and a freed buffer is kept on its class's free list for
+// the next pdu of similar size, so the steady stream of small requests
+// and replies does not go through malloc/free.  buffers larger than the
+// biggest class are plain malloc'd blocks.  every thread keeps a small
+// cache of the smaller classes in front of the shared free lists.
+//
+// every pdu buffer handed between marshall, unmarshall, connection and
+// the at-most-once reply window comes from here and must be released
+// with rpc_buf_free(), never with free().  a buffer may have several
+// holders (see rpc_buf_ref()); it is recycled when the last one frees
+// it.
+
+char *rpc_buf_alloc(int sz);
+// like realloc(): keeps the first min(old, sz) bytes of b
+char *rpc_buf_realloc(char *b, int sz);
+void rpc_buf_free(char *b);
+// one more holder of b, who releases it with rpc_buf_free() in turn.
+// a shared buffer must not be realloc'd
+void rpc_buf_ref(char *b);
+// number of usable bytes in b (at least what was asked for)
+int rpc_buf_capacity(const char *b);
+
+#endif
@@ -1,22 +1,43 @@
 #include <fcntl.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <netinet/tcp.h>
 #include <errno.h>
 #include <signal.h>
 #include <unistd.h>
+#include <poll.h>
+#include <sys/uio.h>
+
+#include <algorithm>
 
 #include "method_thread.h"
 #include "connection.h"
 #include "slock.h"
 #include "pollmgr.h"
 #include "jsl_log.h"
+#include "bufpool.h"
+#include "marshall.h"
+#include "crc32c.h"
+
+//the flags a pdu may carry; see seal() for PDU_CRC
+#define PDU_FLAGS (PDU_CRC | PDU_URGENT | PDU_LZ | PDU_LZ_OK | PDU_V2 | \
+		PDU_BUDGET)
+//a checksum covers the whole pdu, length word and flags included, and
+//follows it
+#define CRC_SZ (int)sizeof(uint32_t)
+#define MAX_WRITEV 64 //pieces gathered into a single writev()
+#define RECV_SLAB_SZ (16<<10) //bytes asked for by each read() of small pdus
 
-#define MAX_PDU (10<<20) //maximum PDF is 10M
+static_assert(MAX_PDU + PDU_TRAILERS_MAX <= PDU_LEN_MASK,
+		"pdu size overlaps the flags");
 
 
 connection::connection(chanmgr *m1, int f1, int l1) 
-: mgr_(m1), fd_(f1), dead_(false),waiters_(0), refno_(1),lossy_(l1)
+: mgr_(m1), fd_(f1), pollmgr_(PollMgr::Instance(f1)), dead_(false), rflags_(0), crc_(false), mark_urgent_(false),
+	rstart_(0), rend_(0), refno_(1),lossy_(l1)
 {
+	rbuf_ = (char *)malloc(RECV_SLAB_SZ);
+	assert(rbuf_);
 
 	int flags = fcntl(fd_, F_GETFL, NULL);
 	flags |= O_NONBLOCK;
@@ -25,10 +46,9 @@ connection::connection(chanmgr *m1, int f1, int l1)
 	signal(SIGPIPE, SIG_IGN);
 	assert(pthread_mutex_init(&m_,0)==0);
 	assert(pthread_mutex_init(&ref_m_,0)==0);
-	assert(pthread_cond_init(&send_wait_,0)==0);
 	assert(pthread_cond_init(&send_complete_,0)==0);
 
-	PollMgr::Instance()->add_callback(fd_, CB_RDONLY, this);
+	pollmgr_->add_callback(fd_, CB_RDONLY, this);
 }
 
 connection::~connection()
@@ -36,11 +56,10 @@ connection::~connection()
 	assert(dead_);
 	assert(pthread_mutex_destroy(&m_)== 0);
 	assert(pthread_mutex_destroy(&ref_m_)== 0);
-	assert(pthread_cond_destroy(&send_wait_) == 0);
 	assert(pthread_cond_destroy(&send_complete_) == 0);
-	if (rpdu_.buf)
-		free(rpdu_.buf);
-	assert(!wpdu_.buf);
+	rpc_buf_free(rpdu_.buf);
+	free(rbuf_);
+	assert(wq_.empty());
 	close(fd_);
 }
 
@@ -66,13 +85,14 @@ connection::closeconn()
 		if (!dead_) {
 			dead_ = true;
 			shutdown(fd_,SHUT_RDWR);
+			fail_sends();
 		}else{
 			return;
 		}
 	}
-	//after block_remove_fd, select will never wait on fd_ 
+	//after block_remove_fd, PollMgr will never wait on fd_ 
 	//and no callbacks will be active
-	PollMgr::Instance()->block_remove_fd(fd_);
+	pollmgr_->block_remove_fd(fd_);
 }
 
 void
@@ -101,21 +121,63 @@ connection::ref()
 	return refno_;
 }
 
-bool
-connection::send(char *b, int sz)
+//mark m as finished; the connection owns (and now frees) async
+//pdus, while blocking senders are woken up to collect the result
+void
+connection::complete(outmsg *m, bool ok)
 {
-	ScopedLock ml(&m_);
-	waiters_++;
-	while (!dead_ && wpdu_.buf) {
-		assert(pthread_cond_wait(&send_wait_, &m_)==0);
+	m->done = true;
+	m->ok = ok;
+	if (m->owned) {
+		rpc_buf_free(m->buf);
+		delete m;
+	} else {
+		pthread_cond_broadcast(&send_complete_);
+	}
+}
+
+//the connection is dead; nothing left in wq_ will ever be written
+void
+connection::fail_sends()
+{
+	while (!wq_.empty()) {
+		outmsg *m = wq_.front();
+		wq_.pop_front();
+		complete(m, false);
 	}
-	waiters_--;
+}
+
+//append m to the send queue.  if the queue was empty nobody is
+//writing, so try to send m right away (unless deferred); whatever
+//the socket cannot take now is left for the reactor (write_cb),
+//which keeps the write callback registered for as long as wq_ is
+//not empty
+bool
+connection::enqueue(outmsg *m, bool defer)
+{
 	if (dead_) {
 		return false;
 	}
-	wpdu_.buf = b;
-	wpdu_.sz = sz;
-	wpdu_.solong = 0;
+
+	int sz = htonl(m->sz | m->flags);
+	bcopy(&sz, m->buf, sizeof(sz));
+	if (m->urgent) {
+		//behind the pdu being written and the other urgent ones
+		std::deque<outmsg *>::iterator i = wq_.begin();
+		while (i != wq_.end() && ((*i)->urgent || (*i)->solong > 0)) {
+			++i;
+		}
+		wq_.insert(i, m);
+	} else {
+		wq_.push_back(m);
+	}
+	if (wq_.size() > 1) {
+		return true;
+	}
+	if (defer) {
+		pollmgr_->add_callback(fd_, CB_WRONLY, this);
+		return true;
+	}
 
 	if (lossy_) {
 		if ((random()%100) < lossy_) {
@@ -124,27 +186,87 @@ connection::send(char *b, int sz)
 		}
 	}
 
-	if (!writepdu()) {
+	if (!writepdus()) {
 		dead_ = true;
+		fail_sends();
 		assert(pthread_mutex_unlock(&m_) == 0);
-		PollMgr::Instance()->block_remove_fd(fd_);
+		pollmgr_->block_remove_fd(fd_);
 		assert(pthread_mutex_lock(&m_) == 0);
-	}else{
-		if (wpdu_.solong == wpdu_.sz) {
-		}else{
-			//should be rare to need to explicitly add write callback
-			PollMgr::Instance()->add_callback(fd_, CB_WRONLY, this);
-			while (!dead_ && wpdu_.solong >= 0 && wpdu_.solong < wpdu_.sz) {
-				assert(pthread_cond_wait(&send_complete_,&m_) == 0);
-			}
-		}
+	} else if (!wq_.empty()) {
+		pollmgr_->add_callback(fd_, CB_WRONLY, this);
 	}
-	bool ret = (!dead_ && wpdu_.solong == wpdu_.sz);
-	wpdu_.solong = wpdu_.sz = 0;
-	wpdu_.buf = NULL;
-	if (waiters_ > 0)
-		pthread_cond_broadcast(&send_wait_);
-	return ret;
+	return true;
+}
+
+bool
+connection::send(char *b, int sz, unsigned int flags)
+{
+	struct iovec iov;
+	iov.iov_base = b;
+	iov.iov_len = sz;
+	return send(&iov, 1, flags);
+}
+
+bool
+connection::send(const struct iovec *iov, int cnt, unsigned int flags)
+{
+	assert(cnt > 0 && iov[0].iov_len >= sizeof(int));
+	int sz = 0;
+	for (int i = 0; i < cnt; i++) {
+		sz += iov[i].iov_len;
+	}
+
+	outmsg m((char *)iov[0].iov_base, sz, false);
+	if (cnt > 1) {
+		m.segs = iov;
+		m.nsegs = cnt;
+	}
+	seal(&m, iov, cnt, flags);
+
+	ScopedLock ml(&m_);
+	if (!enqueue(&m)) {
+		return false;
+	}
+	while (!m.done) {
+		assert(pthread_cond_wait(&send_complete_, &m_) == 0);
+	}
+	return m.ok;
+}
+
+bool
+connection::send_async(char *b, int sz, unsigned int flags)
+{
+	struct iovec iov;
+	iov.iov_base = b;
+	iov.iov_len = sz;
+	outmsg *m = new outmsg(b, sz, true);
+	seal(m, &iov, 1, flags);
+
+	ScopedLock ml(&m_);
+	if (!enqueue(m)) {
+		rpc_buf_free(b);
+		delete m;
+		return false;
+	}
+	return true;
+}
+
+//writing here could find the socket broken, and the reactor cannot
+//wait for itself in block_remove_fd(), so leave it to write_cb()
+bool
+connection::send_async_wo(char *b, int sz, unsigned int flags)
+{
+	struct iovec iov;
+	iov.iov_base = b;
+	iov.iov_len = sz;
+	outmsg *m = new outmsg(b, sz, true);
+	seal(m, &iov, 1, flags);
+	if (!enqueue(m, true)) {
+		rpc_buf_free(b);
+		delete m;
+		return false;
+	}
+	return true;
 }
 
 //fd_ is ready to be written
@@ -152,25 +274,22 @@ void
 connection::write_cb(int s)
 {
 	ScopedLock ml(&m_);
-	assert(!dead_);
 	assert(fd_ == s);
-	if (wpdu_.sz == 0) {
-		PollMgr::Instance()->del_callback(fd_,CB_WRONLY);
+	if (dead_) {
 		return;
 	}
-	if (!writepdu()) {
-		PollMgr::Instance()->del_callback(fd_, CB_RDWR);
+	if (!writepdus()) {
+		pollmgr_->del_callback(fd_, CB_RDWR);
 		dead_ = true;
-	}else{
-		assert(wpdu_.solong >= 0);
-		if (wpdu_.solong < wpdu_.sz) {
-			return;
-		}
-	} 
-	pthread_cond_signal(&send_complete_);
+		fail_sends();
+	} else if (wq_.empty()) {
+		pollmgr_->del_callback(fd_, CB_WRONLY);
+	}
 }
 
 //fd_ is ready to be read
+//the epoll backend is edge-triggered, so keep consuming pdus
+//until the socket has been drained
 void
 connection::read_cb(int s)
 {
@@ -180,124 +299,304 @@ connection::read_cb(int s)
 		return;
 	}
 
-	bool succ = true;
-	if (!rpdu_.buf || rpdu_.solong < rpdu_.sz) {
-		succ = readpdu();
-	}
+	while (1) {
+		if (!readpdu()) {
+			//let the peer see it too, rather than wait on a
+			//connection nobody reads any more
+			shutdown(fd_, SHUT_RDWR);
+			pollmgr_->del_callback(fd_,CB_RDWR);
+			dead_ = true;
+			fail_sends();
+			break;
+		}
 
-	if (!succ) {
-		PollMgr::Instance()->del_callback(fd_,CB_RDWR);
-		dead_ = true;
-		pthread_cond_signal(&send_complete_);
+		if (!rpdu_.buf || rpdu_.sz != rpdu_.solong) {
+			//no complete pdu and nothing more to read for now
+			break;
+		}
+
+		if (!mgr_->got_pdu(this, rpdu_.buf, rpdu_.sz)) {
+			//chanmgr cannot take the pdu right now.  more pdus
+			//may be sitting in rbuf_ already, so do not wait for
+			//the socket to become readable again
+			pollmgr_->retry_read(fd_);
+			break;
+		}
+
+		//chanmgr has successfully consumed (and now owns) the pdu
+		rpdu_.buf = NULL;
+		rpdu_.sz = rpdu_.solong = 0;
 	}
+}
 
-	if (rpdu_.buf && rpdu_.sz == rpdu_.solong) {
-		if (mgr_->got_pdu(this, rpdu_.buf, rpdu_.sz)) {
-			//chanmgr has successfully consumed the pdu
-			rpdu_.buf = NULL;
-			rpdu_.sz = rpdu_.solong = 0;
+//add what is left to write of m to iov[*cnt..MAX_WRITEV)
+static void
+gather(connection::outmsg *m, struct iovec *iov, int *cnt)
+{
+	assert(m->solong < m->sz);
+	int body = m->sz - m->tail;
+	int skip = m->solong;
+	if (!m->segs) {
+		if (skip < body) {
+			iov[*cnt].iov_base = m->buf + skip;
+			iov[*cnt].iov_len = body - skip;
+			(*cnt)++;
+			skip = 0;
+		} else {
+			skip -= body;
 		}
+	} else {
+		for (int i = 0; i < m->nsegs; i++) {
+			int len = m->segs[i].iov_len;
+			if (skip >= len) {
+				skip -= len;
+				continue;
+			}
+			if (*cnt == MAX_WRITEV)
+				return; //the rest, trailer included, goes next time
+			iov[*cnt].iov_base = (char *)m->segs[i].iov_base + skip;
+			iov[*cnt].iov_len = len - skip;
+			(*cnt)++;
+			skip = 0;
+		}
+	}
+	if (m->tail && *cnt < MAX_WRITEV) {
+		iov[*cnt].iov_base = m->trailer + skip;
+		iov[*cnt].iov_len = m->tail - skip;
+		(*cnt)++;
 	}
 }
 
+//write as much of wq_ as the socket will take, gathering the pieces
+//of up to MAX_WRITEV queued pdus into each writev().  returns false
+//only if the connection has failed
 bool
-connection::writepdu()
+connection::writepdus()
 {
-	assert(wpdu_.solong >= 0);
-	if (wpdu_.solong == wpdu_.sz)
-		return true;
+	struct iovec iov[MAX_WRITEV];
 
-	if (wpdu_.solong == 0) {
-		int sz = htonl(wpdu_.sz);
-		bcopy(&sz,wpdu_.buf,sizeof(sz));
-	}
-	int n = write(fd_, wpdu_.buf + wpdu_.solong, (wpdu_.sz-wpdu_.solong));
-	if (n < 0) {
-		if (errno != EAGAIN) {
-			jsl_log(JSL_DBG_1, "connection::writepdu fd_ %d failure errno=%d\n", fd_, errno);
-			wpdu_.solong = -1;
-			wpdu_.sz = 0;
+	while (!wq_.empty()) {
+		int cnt = 0;
+		for (std::deque<outmsg *>::iterator i = wq_.begin();
+				i != wq_.end() && cnt < MAX_WRITEV; ++i) {
+			gather(*i, iov, &cnt);
+		}
+
+		ssize_t n = writev(fd_, iov, cnt);
+		if (n < 0) {
+			if (errno != EAGAIN) {
+				jsl_log(JSL_DBG_1, "connection::writepdus fd_ %d failure errno=%d\n", fd_, errno);
+			}
+			return (errno == EAGAIN);
+		}
+
+		while (n > 0) {
+			outmsg *m = wq_.front();
+			int left = m->sz - m->solong;
+			if (n < left) {
+				m->solong += n;
+				break;
+			}
+			n -= left;
+			m->solong = m->sz;
+			wq_.pop_front();
+			complete(m, true);
 		}
-		return (errno == EAGAIN);
 	}
-	wpdu_.solong += n;
 	return true;
 }
 
+//fill rpdu_ until it holds a complete pdu or the socket has no more
+//input. small pdus are sliced out of the receive slab, so a single
+//read() can deliver many of them; the tail of a pdu too big for the
+//slab is read straight into its own buffer. returns false if the
+//connection has failed
 bool
 connection::readpdu()
 {
-	if (!rpdu_.sz) {
-		int sz, sz1;
-		int n = read(fd_, &sz1, sizeof(sz1));
+	while (1) {
+		if (!rpdu_.buf && rend_ - rstart_ >= (int)sizeof(int)) {
+			int sz1, sz;
+			memcpy(&sz1, rbuf_ + rstart_, sizeof(sz1));
+			sz = ntohl(sz1) & PDU_LEN_MASK;
+			rflags_ = ntohl(sz1) & ~PDU_LEN_MASK;
+
+			//the trailers come on top of what the sender's
+			//rpc layer kept within MAX_PDU
+			if (sz > MAX_PDU + pdu_trailers(rflags_) ||
+					sz < (int)sizeof(sz) || (rflags_ & ~PDU_FLAGS)) {
+				char *tmpb = (char *)&sz1;
+				jsl_log(JSL_DBG_2, "connection::readpdu read pdu TOO BIG %d network order=%x %x %x %x %x\n", sz, 
+						sz1, tmpb[0],tmpb[1],tmpb[2],tmpb[3]);
+				return false;
+			}
 
-		if (n == 0) {
-			return false;
+			rpdu_.buf = rpc_buf_alloc(sz);
+			rpdu_.sz = sz;
+			rpdu_.solong = 0;
 		}
 
-		if (n < 0) {
-			assert(errno!=EAGAIN);
-			return false;
+		if (rpdu_.buf) {
+			int n = std::min(rend_ - rstart_, rpdu_.sz - rpdu_.solong);
+			memcpy(rpdu_.buf + rpdu_.solong, rbuf_ + rstart_, n);
+			rpdu_.solong += n;
+			rstart_ += n;
+			if (rpdu_.solong == rpdu_.sz) {
+				return verify();
+			}
 		}
 
-		if (n >0 && n!= sizeof(sz)) {
-			jsl_log(JSL_DBG_OFF, "connection::readpdu short read of sz\n");
-			return false;
+		//rbuf_ is used up, apart from part of a length word at most
+		int n;
+		if (rpdu_.buf && rpdu_.sz - rpdu_.solong >= RECV_SLAB_SZ) {
+			n = read(fd_, rpdu_.buf + rpdu_.solong, rpdu_.sz - rpdu_.solong);
+			if (n > 0) {
+				rpdu_.solong += n;
+				continue;
+			}
+		} else {
+			if (rstart_ > 0) {
+				memmove(rbuf_, rbuf_ + rstart_, rend_ - rstart_);
+				rend_ -= rstart_;
+				rstart_ = 0;
+			}
+			n = read(fd_, rbuf_ + rend_, RECV_SLAB_SZ - rend_);
+			if (n > 0) {
+				rend_ += n;
+				continue;
+			}
 		}
 
-		sz = ntohl(sz1);
-
-		if (sz > MAX_PDU) {
-			char *tmpb = (char *)&sz1;
-			jsl_log(JSL_DBG_2, "connection::readpdu read pdu TOO BIG %d network order=%x %x %x %x %x\n", sz, 
-					sz1, tmpb[0],tmpb[1],tmpb[2],tmpb[3]);
+		if (n == 0) {
 			return false;
 		}
-
-		rpdu_.sz = sz;
-		assert(rpdu_.buf == NULL);
-		rpdu_.buf = (char *)malloc(sz+sizeof(sz));
-		assert(rpdu_.buf);
-		bcopy(&sz1,rpdu_.buf,sizeof(sz));
-		rpdu_.solong = sizeof(sz);
+		//nothing more to read until the next readiness event
+		return (errno == EAGAIN);
 	}
+}
 
-	int n = read(fd_, rpdu_.buf + rpdu_.solong, rpdu_.sz - rpdu_.solong);
-	if (n <= 0) {
-		if (errno == EAGAIN)
-			return true;
-		if (rpdu_.buf)
-			free(rpdu_.buf);
-		rpdu_.buf = NULL;
-		rpdu_.sz = rpdu_.solong = 0;
-		return (errno == EAGAIN);
+//rpdu_ is complete; if it carries a crc32c, check it before
+//anybody looks at the pdu.  a mismatch kills the connection, and the
+//rpc layer retries the call on a new one
+bool
+connection::verify()
+{
+	if (!(rflags_ & PDU_CRC)) {
+		return true;
 	}
-	rpdu_.solong += n;
+	int n = rpdu_.sz - CRC_SZ;
+	if (n < (int)sizeof(rpc_sz_t)) {
+		return false;
+	}
+	uint32_t want = rpc_get_be<uint32_t>(rpdu_.buf + n);
+	uint32_t got = crc32c(0, rpdu_.buf, n);
+	if (got != want) {
+		jsl_log(JSL_DBG_1, "connection::readpdu fd_ %d pdu of %d bytes has crc32c %x, expected %x\n",
+				fd_, rpdu_.sz, got, want);
+		return false;
+	}
+	//the rpc layer never sees the trailer, and a pdu that chanmgr
+	//could not take yet is not verified again
+	rpdu_.sz = rpdu_.solong = n;
+	rflags_ &= ~PDU_CRC;
+	crc_ = true;
 	return true;
 }
 
+//settle the framing flags of m, the pdu iov[0..cnt), from the PDU_*
+//flags it was sent with, and if checksums are on give it a crc32c
+//trailer.  the crc covers the length word m will go out with, which
+//enqueue() writes later, so it is worked out here.  the pdu's own
+//bytes are left alone, so a buffer shared with the reply window is
+//only read.  called before m is queued, so senders do not checksum
+//under m_
+void
+connection::seal(outmsg *m, const struct iovec *iov, int cnt,
+		unsigned int flags)
+{
+	m->flags = flags & (PDU_LZ | PDU_LZ_OK | PDU_V2 | PDU_BUDGET);
+	m->urgent = flags & PDU_URGENT;
+	if (m->urgent && mark_urgent_) {
+		m->flags |= PDU_URGENT;
+	}
+	if (!crc_ || (int)iov[0].iov_len < (int)sizeof(rpc_sz_t)) {
+		return;
+	}
+	m->tail = CRC_SZ;
+	m->sz += CRC_SZ;
+	m->flags |= PDU_CRC;
+	char word[sizeof(rpc_sz_t)];
+	rpc_put_be<uint32_t>(word, m->sz | m->flags);
+	const char *b = (const char *)iov[0].iov_base;
+	uint32_t crc = crc32c(0, word, sizeof(word));
+	crc = crc32c(crc, b + sizeof(rpc_sz_t), iov[0].iov_len - sizeof(rpc_sz_t));
+	for (int i = 1; i < cnt; i++) {
+		crc = crc32c(crc, iov[i].iov_base, iov[i].iov_len);
+	}
+	rpc_put_be(m->trailer, crc);
+}
+
 tcpsconn::tcpsconn(chanmgr *m1, int port, int lossytest) 
 : mgr_(m1), lossy_(lossytest)
 {
-
-	assert(pthread_mutex_init(&m_,NULL) == 0);
-
 	struct sockaddr_in sin;
 	memset(&sin, 0, sizeof(sin));
 	sin.sin_family = AF_INET;
 	sin.sin_port = htons(port);
 
-	tcp_ = socket(AF_INET, SOCK_STREAM, 0);
+	start((sockaddr *)&sin, sizeof(sin));
+}
+
+tcpsconn::tcpsconn(chanmgr *m1, const char *path, int lossytest)
+: path_(path), mgr_(m1), lossy_(lossytest)
+{
+	struct sockaddr_un sun;
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	if (path_.size() >= sizeof(sun.sun_path)) {
+		fprintf(stderr, "socket path too long: %s\n", path);
+		exit(1);
+	}
+	strcpy(sun.sun_path, path);
+
+	//a server that died without cleaning up leaves its socket behind,
+	//which nothing answers on; anything else at path is not ours to
+	//remove
+	struct stat st;
+	if (lstat(path, &st) == 0) {
+		if (!S_ISSOCK(st.st_mode))
+			throw PortBusyException(std::string(path) + " is not a socket");
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		assert(fd >= 0);
+		int r = connect(fd, (sockaddr *)&sun, sizeof(sun));
+		int err = errno;
+		close(fd);
+		if (r == 0 || err != ECONNREFUSED)
+			throw PortBusyException(std::string(path) + " is in use: " +
+					(r == 0 ? "a server answers" : strerror(err)));
+		unlink(path);
+	}
+	start((sockaddr *)&sun, sizeof(sun));
+}
+
+void
+tcpsconn::start(const struct sockaddr *sa, socklen_t len)
+{
+	assert(pthread_mutex_init(&m_,NULL) == 0);
+
+	tcp_ = socket(sa->sa_family, SOCK_STREAM, 0);
 	if(tcp_ < 0){
 		perror("tcpsconn::tcpsconn accept_loop socket:");
 		assert(0);
 	}
 
 	int yes = 1;
-	setsockopt(tcp_, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
-	setsockopt(tcp_, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+	if (sa->sa_family == AF_INET) {
+		setsockopt(tcp_, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+		setsockopt(tcp_, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+	}
 
-	if(bind(tcp_, (sockaddr *)&sin, sizeof(sin)) < 0){
+	if(bind(tcp_, sa, len) < 0){
         throw PortBusyException(std::string("accept_loop tcp bind error: ") + std::string(strerror(errno))); 
 	}
 
@@ -329,12 +628,15 @@ tcpsconn::~tcpsconn()
 		i->second->closeconn();
 		i->second->decref();
 	}	
+	if (!path_.empty()) {
+		unlink(path_.c_str());
+	}
 }
 
 void
 tcpsconn::process_accept()
 {
-	sockaddr_in sin;
+	sockaddr_storage sin;
 	socklen_t slen = sizeof(sin);
 	int s1 = accept(tcp_, (sockaddr *)&sin, &slen); 
 	if (s1 < 0) {
@@ -342,8 +644,8 @@ tcpsconn::process_accept()
 		pthread_exit(NULL);
 	}
 
-	jsl_log(JSL_DBG_2, "accept_loop got connection fd=%d %s:%d\n", 
-			s1, inet_ntoa(sin.sin_addr), ntohs(sin.sin_port));
+	jsl_log(JSL_DBG_2, "accept_loop got connection fd=%d %s\n", 
+			s1, path_.empty() ? sockaddr_str(sin).c_str() : path_.c_str());
 	connection *ch = new connection(mgr_, s1, lossy_);
 
         // garbage collect all dead connections with refcount of 1
@@ -365,32 +667,36 @@ tcpsconn::process_accept()
 void
 tcpsconn::accept_conn()
 {
-	fd_set rfds;
-	int max_fd = pipe_[0] > tcp_ ? pipe_[0] : tcp_;
+	//poll() rather than select(): a server created after many
+	//connections are open may get fds beyond FD_SETSIZE
+	struct pollfd pfds[2];
 
 	while (1) { 
-		FD_ZERO(&rfds);
-		FD_SET(pipe_[0], &rfds);
-		FD_SET(tcp_, &rfds);
+		pfds[0].fd = pipe_[0];
+		pfds[0].events = POLLIN;
+		pfds[0].revents = 0;
+		pfds[1].fd = tcp_;
+		pfds[1].events = POLLIN;
+		pfds[1].revents = 0;
 
-		int ret = select(max_fd+1, &rfds, NULL, NULL, NULL);
+		int ret = poll(pfds, 2, -1);
 
 		if (ret < 0) {
 			if (errno == EINTR) {
 				continue;
 			} else {
-				perror("accept_conn select:");
+				perror("accept_conn poll:");
 				jsl_log(JSL_DBG_OFF, "tcpsconn::accept_conn failure errno %d\n",errno);
 				assert(0);
 	                }
 		}
 
-		if (FD_ISSET(pipe_[0], &rfds)) {
+		if (pfds[0].revents) {
 			close(pipe_[0]);
 			close(tcp_);
 			return;
 		}
-		else if (FD_ISSET(tcp_, &rfds)) {
+		else if (pfds[1].revents) {
 			process_accept();
 		} else {
 			assert(0);
@@ -399,20 +705,38 @@ tcpsconn::accept_conn()
 }
 
 connection *
-connect_to_dst(const sockaddr_in &dst, chanmgr *mgr, int lossy)
+connect_to_dst(const sockaddr_storage &dst, chanmgr *mgr, int lossy)
 {
-	int s= socket(AF_INET, SOCK_STREAM, 0);
+	int s= socket(dst.ss_family, SOCK_STREAM, 0);
 	int yes = 1;
-	setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
-	if(connect(s, (sockaddr*)&dst, sizeof(dst)) < 0) {
-		jsl_log(JSL_DBG_1, "rpcc::connect_to_dst failed to %s:%d\n", 
-				inet_ntoa(dst.sin_addr), (int)ntohs(dst.sin_port));
+	if (dst.ss_family == AF_INET) {
+		setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+	}
+	if(connect(s, (sockaddr*)&dst, sockaddr_len(dst)) < 0) {
+		jsl_log(JSL_DBG_1, "rpcc::connect_to_dst failed to %s\n", 
+				sockaddr_str(dst).c_str());
 		close(s);
 		return NULL;
 	}
-	jsl_log(JSL_DBG_2, "connect_to_dst fd=%d to dst %s:%d\n",
-			s, inet_ntoa(dst.sin_addr), (int)ntohs(dst.sin_port));
+	jsl_log(JSL_DBG_2, "connect_to_dst fd=%d to dst %s\n",
+			s, sockaddr_str(dst).c_str());
 	return new connection(mgr, s, lossy);
 }
 
+socklen_t
+sockaddr_len(const sockaddr_storage &a)
+{
+	return a.ss_family == AF_UNIX ? sizeof(sockaddr_un) : sizeof(sockaddr_in);
+}
 
+std::string
+sockaddr_str(const sockaddr_storage &a)
+{
+	if (a.ss_family == AF_UNIX) {
+		return ((const sockaddr_un &)a).sun_path;
+	}
+	const sockaddr_in &in = (const sockaddr_in &)a;
+	char b[64];
+	snprintf(b, sizeof(b), "%s:%d", inet_ntoa(in.sin_addr), (int)ntohs(in.sin_port));
+	return b;
+}
@@ -3,16 +3,41 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 
+#include <atomic>
+#include <deque>
 #include <map>
 #include <stdexcept>
+#include <string>
 
 #include "pollmgr.h"
 
 class connection;
 
+#define MAX_PDU (10<<20) //maximum PDF is 10M
+
+//the top byte of a pdu's length word holds flags
+#define PDU_LEN_MASK 0x00ffffff
+#define PDU_CRC 0x01000000 //a crc32c of the pdu follows it
+#define PDU_URGENT 0x02000000 //to be dispatched ahead of normal requests
+#define PDU_LZ 0x04000000 //the body is compressed, see marshall::lz_pack()
+#define PDU_LZ_OK 0x08000000 //the sender takes PDU_LZ replies
+#define PDU_V2 0x10000000 //the body is in the compact encoding
+#define PDU_BUDGET 0x20000000 //the request ends in a budget, see rpc_req_set_budget()
+
+//bytes the crc32c and budget trailers add to a pdu.  they do not count
+//toward MAX_PDU, which is the limit on what the rpc layer marshalls
+inline int
+pdu_trailers(unsigned int flags)
+{
+	return ((flags & PDU_CRC) ? 4 : 0) + ((flags & PDU_BUDGET) ? 4 : 0);
+}
+#define PDU_TRAILERS_MAX 8
+
 class PortBusyException : public std::runtime_error {
    using runtime_error::runtime_error;
 };
@@ -33,6 +58,25 @@ class connection : public aio_callback {
 			int solong; //amount of bytes written or read so far
 		};
 
+		//a pdu waiting in (or being written from) the send queue.
+		//it is buf, or the pieces segs[0..nsegs) if segs is set,
+		//in which case buf is the first piece
+		//sz counts the trailer, which is sent after the pdu itself
+		struct outmsg : public charbuf {
+			outmsg(char *b, int s, bool own)
+				: charbuf(b, s), segs(NULL), nsegs(0), tail(0), flags(0),
+				urgent(false), owned(own), done(false), ok(false) {}
+			const struct iovec *segs;
+			int nsegs;
+			char trailer[sizeof(uint32_t)]; //the crc32c, see seal()
+			int tail; //bytes of trailer in use
+			unsigned int flags; //framing flags for the length word
+			bool urgent; //goes ahead of normal pdus not yet started
+			bool owned; //connection frees buf once it has been written
+			bool done; //fully written, or the connection died
+			bool ok;
+		};
+
 		connection(chanmgr *m1, int f1, int lossytest=0);
 		~connection();
 
@@ -40,7 +84,34 @@ class connection : public aio_callback {
 		bool isdead();
 		void closeconn();
 
-		bool send(char *b, int sz);
+		//queue b for sending and wait until it has been written.
+		//flags may hold PDU_URGENT, to queue b after the other
+		//urgent pdus but ahead of every normal one that has not
+		//started going out, and PDU_LZ, PDU_LZ_OK and PDU_V2,
+		//which are the rpc layer's and are sent as they are
+		bool send(char *b, int sz, unsigned int flags=0);
+		//the same for a pdu in pieces; the first piece must hold at
+		//least the length word and is written to
+		bool send(const struct iovec *iov, int cnt, unsigned int flags=0);
+		//queue b for sending and return; the connection takes
+		//ownership of b (which must come from rpc_buf_alloc) and frees it
+		bool send_async(char *b, int sz, unsigned int flags=0);
+		//send_async() for chanmgr::got_pdu(), which runs with m_
+		//held: b is only queued, and the reactor writes it once it
+		//is done with the pdus it is reading
+		bool send_async_wo(char *b, int sz, unsigned int flags=0);
+		//put a crc32c on every pdu sent from now on.  pdus that
+		//arrive with one are always checked, and the first such
+		//pdu turns this on as well, so a server answers in kind
+		void set_checksum(bool on) { crc_ = on; }
+		//flag urgent pdus with PDU_URGENT, so that the peer
+		//dispatches them first; for once it has agreed to at bind
+		void set_mark_urgent(bool on) { mark_urgent_ = on; }
+		//the PDU_* flags of a pdu handed to chanmgr::got_pdu()
+		static unsigned int flags(const char *pdu) {
+			return ntohl(*(const uint32_t *)pdu) & ~PDU_LEN_MASK;
+		}
+
 		void write_cb(int s);
 		void read_cb(int s);
 
@@ -51,28 +122,45 @@ class connection : public aio_callback {
 	private:
 
 		bool readpdu();
-		bool writepdu();
+		bool verify();
+		void seal(outmsg *m, const struct iovec *iov, int cnt,
+				unsigned int flags);
+		bool writepdus();
+		bool enqueue(outmsg *m, bool defer=false);
+		void complete(outmsg *m, bool ok);
+		void fail_sends();
 
 		chanmgr *mgr_;
 		const int fd_;
+		PollMgr *pollmgr_; // the event loop that owns fd_
 		bool dead_;
 
-		charbuf wpdu_;
-		charbuf rpdu_;
+		std::deque<outmsg *> wq_; //pdus waiting to be written, in order
+		charbuf rpdu_; //pdu being received, from rpc_buf_alloc()
+		unsigned int rflags_; //framing flags of rpdu_
+		std::atomic<bool> crc_; //checksum outgoing pdus
+		std::atomic<bool> mark_urgent_;
+
+		//receive slab: each read() takes as much input as fits and
+		//complete pdus are sliced out of [rstart_, rend_)
+		char *rbuf_;
+		int rstart_;
+		int rend_;
 
-		int waiters_;
 		int refno_;
 		const int lossy_;
 
 		pthread_mutex_t m_;
 		pthread_mutex_t ref_m_;
 		pthread_cond_t send_complete_;
-		pthread_cond_t send_wait_;
 };
 
+//accepts connections on a tcp port, or on a unix-domain socket for
+//clients on the same host, which skips the loopback tcp stack
 class tcpsconn {
 	public:
 		tcpsconn(chanmgr *m1, int port, int lossytest=0);
+		tcpsconn(chanmgr *m1, const char *path, int lossytest=0);
 		~tcpsconn();
 
 		void accept_conn();
@@ -83,10 +171,12 @@ class tcpsconn {
 		int pipe_[2];
 
 		int tcp_; //file desciptor for accepting connection
+		std::string path_; //of the unix-domain socket, if it is one
 		chanmgr *mgr_;
 		int lossy_;
 		std::map<int, connection *> conns_;
 
+		void start(const struct sockaddr *sa, socklen_t len);
 		void process_accept();
 };
 
@@ -98,5 +188,9 @@ struct bundle {
 };
 
 void start_accept_thread(chanmgr *mgr, int port, pthread_t *th, int *fd = NULL, int lossy=0);
-connection *connect_to_dst(const sockaddr_in &dst, chanmgr *mgr, int lossy=0);
+//dst is a sockaddr_in, or a sockaddr_un for a unix-domain socket
+connection *connect_to_dst(const sockaddr_storage &dst, chanmgr *mgr, int lossy=0);
+socklen_t sockaddr_len(const sockaddr_storage &a);
+//"host:port", or the path of a unix-domain socket
+std::string sockaddr_str(const sockaddr_storage &a);
 #endif
@@ -0,0 +1,185 @@
+#include <pthread.h>
+#include <string.h>
+#include "crc32c.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#define CRC32C_HW 1
+#endif
+
+#define POLY 0x82f63b78 // CRC-32C, bit-reversed
+
+// the hardware path runs three crc32 streams side by side, over
+// consecutive blocks of CRC_LONG (then CRC_SHORT) bytes, and stitches
+// the three crcs together. the instruction takes three cycles but a
+// new one can start every cycle, so one stream alone would leave the
+// unit idle two thirds of the time
+#define CRC_LONG 8192
+#define CRC_SHORT 256
+
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static bool have_hw;
+static uint32_t table[8][256]; // slicing-by-8
+static uint32_t shift_long[4][256]; // appends CRC_LONG zero bytes to a crc
+static uint32_t shift_short[4][256]; // and CRC_SHORT
+
+// multiply vec by the 32x32 matrix over GF(2) mat
+static uint32_t
+gf2_times(const uint32_t *mat, uint32_t vec)
+{
+	uint32_t sum = 0;
+	for (; vec; vec >>= 1, mat++) {
+		if (vec & 1)
+			sum ^= *mat;
+	}
+	return sum;
+}
+
+static void
+gf2_square(uint32_t *sq, const uint32_t *mat)
+{
+	for (int i = 0; i < 32; i++)
+		sq[i] = gf2_times(mat, mat[i]);
+}
+
+// tables that take a crc to the crc of the same data followed by len
+// zero bytes (len a power of two), a byte of the crc at a time
+static void
+make_shift(uint32_t t[4][256], size_t len)
+{
+	uint32_t odd[32], even[32];
+	uint32_t *op;
+
+	//one zero bit
+	odd[0] = POLY;
+	for (int i = 1; i < 32; i++)
+		odd[i] = 1U << (i - 1);
+	//two, four, then one byte and doubling until len
+	gf2_square(even, odd);
+	gf2_square(odd, even);
+	for (op = even; ; len >>= 1) {
+		gf2_square(op, op == even ? odd : even);
+		if (len == 1)
+			break;
+		op = (op == even) ? odd : even;
+	}
+
+	for (int n = 0; n < 256; n++) {
+		t[0][n] = gf2_times(op, n);
+		t[1][n] = gf2_times(op, n << 8);
+		t[2][n] = gf2_times(op, n << 16);
+		t[3][n] = gf2_times(op, (uint32_t)n << 24);
+	}
+}
+
+static inline uint32_t
+shift(uint32_t t[4][256], uint32_t crc)
+{
+	return t[0][crc & 0xff] ^ t[1][(crc >> 8) & 0xff] ^
+		t[2][(crc >> 16) & 0xff] ^ t[3][crc >> 24];
+}
+
+static void
+crc32c_init()
+{
+	for (int n = 0; n < 256; n++) {
+		uint32_t c = n;
+		for (int k = 0; k < 8; k++)
+			c = (c & 1) ? (c >> 1) ^ POLY : c >> 1;
+		table[0][n] = c;
+	}
+	for (int n = 0; n < 256; n++) {
+		for (int k = 1; k < 8; k++) {
+			uint32_t c = table[k - 1][n];
+			table[k][n] = (c >> 8) ^ table[0][c & 0xff];
+		}
+	}
+#if CRC32C_HW
+	have_hw = __builtin_cpu_supports("sse4.2");
+#endif
+	make_shift(shift_long, CRC_LONG);
+	make_shift(shift_short, CRC_SHORT);
+}
+
+uint32_t
+crc32c_sw(uint32_t crc, const void *p, size_t n)
+{
+	const unsigned char *b = (const unsigned char *)p;
+
+	pthread_once(&once, crc32c_init);
+	crc = ~crc;
+	for (; n >= 8; n -= 8, b += 8) {
+		uint32_t lo = crc ^ (b[0] | b[1] << 8 | b[2] << 16 |
+				(uint32_t)b[3] << 24);
+		crc = table[7][lo & 0xff] ^ table[6][(lo >> 8) & 0xff] ^
+			table[5][(lo >> 16) & 0xff] ^ table[4][lo >> 24] ^
+			table[3][b[4]] ^ table[2][b[5]] ^
+			table[1][b[6]] ^ table[0][b[7]];
+	}
+	for (; n > 0; n--, b++)
+		crc = (crc >> 8) ^ table[0][(crc ^ *b) & 0xff];
+	return ~crc;
+}
+
+#if CRC32C_HW
+static inline uint64_t
+load64(const unsigned char *b)
+{
+	uint64_t w;
+	memcpy(&w, b, sizeof(w));
+	return w;
+}
+
+// three streams over each 3*blk bytes: crc0 carries on from what came
+// before, crc1 and crc2 start from zero and are added in once crc0 has
+// been shifted past their blocks
+#define CRC_STREAMS(blk, t) \
+	while (n >= 3 * (blk)) { \
+		uint64_t crc1 = 0, crc2 = 0; \
+		const unsigned char *end = b + (blk); \
+		for (; b < end; b += 8) { \
+			crc0 = _mm_crc32_u64(crc0, load64(b)); \
+			crc1 = _mm_crc32_u64(crc1, load64(b + (blk))); \
+			crc2 = _mm_crc32_u64(crc2, load64(b + 2 * (blk))); \
+		} \
+		crc0 = shift(t, (uint32_t)crc0) ^ crc1; \
+		crc0 = shift(t, (uint32_t)crc0) ^ crc2; \
+		b += 2 * (blk); \
+		n -= 3 * (blk); \
+	}
+
+__attribute__((target("sse4.2"))) static uint32_t
+crc32c_hw(uint32_t crc, const void *p, size_t n)
+{
+	const unsigned char *b = (const unsigned char *)p;
+	uint64_t crc0 = ~crc;
+
+	for (; n > 0 && ((uintptr_t)b & 7); n--, b++)
+		crc0 = _mm_crc32_u8((uint32_t)crc0, *b);
+	CRC_STREAMS(CRC_LONG, shift_long);
+	CRC_STREAMS(CRC_SHORT, shift_short);
+	for (; n >= 8; n -= 8, b += 8)
+		crc0 = _mm_crc32_u64(crc0, load64(b));
+	for (; n > 0; n--, b++)
+		crc0 = _mm_crc32_u8((uint32_t)crc0, *b);
+	return ~(uint32_t)crc0;
+}
+#endif
+
+bool
+crc32c_hw_available()
+{
+	pthread_once(&once, crc32c_init);
+	return have_hw;
+}
+
+uint32_t
+crc32c(uint32_t crc, const void *p, size_t n)
+{
+	pthread_once(&once, crc32c_init);
+#if CRC32C_HW
+	if (have_hw)
+		return crc32c_hw(crc, p, n);
+#endif
+	return crc32c_sw(crc, p, n);
+}
@@ -0,0 +1,21 @@
+#ifndef crc32c_h
+#define crc32c_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC-32C (Castagnoli), the checksum of iSCSI and ext4.  on x86 cpus
+// with SSE4.2 it is computed by the crc32 instruction, three streams at
+// a time; elsewhere eight bytes at a time from tables.
+//
+// crc is the crc32c of whatever came before p (0 to start with), so
+//   crc32c(crc32c(0, a, na), b, nb) == crc32c of a followed by b
+uint32_t crc32c(uint32_t crc, const void *p, size_t n);
+
+// the same, forced onto the table-driven code; for tests and benchmarks
+uint32_t crc32c_sw(uint32_t crc, const void *p, size_t n);
+
+// whether crc32c() uses the cpu's crc32 instruction
+bool crc32c_hw_available();
+
+#endif
@@ -19,7 +19,7 @@ class fifo {
 		~fifo();
 		bool enq(T, bool blocking=true);
 		void deq(T *);
-		bool size();
+		unsigned int size();
 
 	private:
 		std::list<T> q_;
@@ -46,7 +46,7 @@ fifo<T>::~fifo()
 	assert(pthread_cond_destroy(&has_space_c_) == 0);
 }
 
-template<class T> bool
+template<class T> unsigned int
 fifo<T>::size()
 {
 	ScopedLock ml(&m_);
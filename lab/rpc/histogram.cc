@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include "histogram.h"
+
+histogram::histogram() : n_(0), sum_(0), max_(0)
+{
+	for (int i = 0; i < HIST_BUCKETS; i++)
+		counts_[i].store(0, std::memory_order_relaxed);
+}
+
+// values below HIST_SUB have a bucket each; above that, the bucket is
+// picked by the position of the top bit and the HIST_SUB_BITS below it
+int
+histogram::bucket(uint64_t v)
+{
+	if (v >= (1ULL << HIST_MAX_SHIFT))
+		return HIST_BUCKETS - 1;
+	if (v < HIST_SUB)
+		return (int)v;
+	int e = 63 - __builtin_clzll(v);
+	int sub = (v >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1);
+	return ((e - HIST_SUB_BITS + 1) << HIST_SUB_BITS) + sub;
+}
+
+// the largest value that falls in bucket b
+uint64_t
+histogram::bucket_top(int b)
+{
+	if (b < HIST_SUB)
+		return b;
+	int e = (b >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+	uint64_t sub = b & (HIST_SUB - 1);
+	return ((HIST_SUB + sub + 1) << (e - HIST_SUB_BITS)) - 1;
+}
+
+void
+histogram::add(uint64_t v)
+{
+	counts_[bucket(v)].fetch_add(1, std::memory_order_relaxed);
+	n_.fetch_add(1, std::memory_order_relaxed);
+	sum_.fetch_add(v, std::memory_order_relaxed);
+	uint64_t m = max_.load(std::memory_order_relaxed);
+	while (v > m && !max_.compare_exchange_weak(m, v,
+				std::memory_order_relaxed))
+		;
+}
+
+double
+histogram::mean() const
+{
+	uint64_t n = count();
+	return n ? (double)sum_.load(std::memory_order_relaxed) / n : 0;
+}
+
+uint64_t
+histogram::percentile(double q) const
+{
+	uint64_t n = count();
+	if (n == 0)
+		return 0;
+	uint64_t want = (uint64_t)(q * n + 0.5);
+	if (want < 1)
+		want = 1;
+	uint64_t seen = 0;
+	for (int b = 0; b < HIST_BUCKETS; b++) {
+		seen += counts_[b].load(std::memory_order_relaxed);
+		if (seen >= want) {
+			uint64_t top = bucket_top(b);
+			return top < max() ? top : max();
+		}
+	}
+	return max();
+}
+
+std::string
+histogram::summary(double div) const
+{
+	char buf[256];
+	snprintf(buf, sizeof(buf),
+			"mean %.1f p50 %.1f p90 %.1f p99 %.1f p99.9 %.1f max %.1f",
+			mean() / div, percentile(0.5) / div, percentile(0.9) / div,
+			percentile(0.99) / div, percentile(0.999) / div, max() / div);
+	return buf;
+}
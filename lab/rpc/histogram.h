@@ -0,0 +1,44 @@
+#ifndef histogram_h
+#define histogram_h
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+// a latency histogram in the style of HdrHistogram: buckets are a power
+// of two wide and split into HIST_SUB sub-buckets, so every value is
+// known to within 1/HIST_SUB of itself whatever its magnitude.  add()
+// is a few relaxed atomic operations, so the dispatch threads can share
+// one without a lock; readers see a slightly fuzzy snapshot.
+#define HIST_SUB_BITS 3
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_MAX_SHIFT 36 // values below 1<<36 (ns: ~68s); larger ones are clamped
+#define HIST_BUCKETS ((HIST_MAX_SHIFT - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+
+class histogram {
+	public:
+		histogram();
+
+		void add(uint64_t v);
+
+		uint64_t count() const { return n_.load(std::memory_order_relaxed); }
+		uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+		double mean() const;
+		// the smallest value that a fraction q (0..1) of the samples
+		// do not exceed, to within a bucket
+		uint64_t percentile(double q) const;
+		// "mean .. p50 .. p90 .. p99 .. p99.9 .. max ..", every
+		// value divided by div
+		std::string summary(double div) const;
+
+	private:
+		static int bucket(uint64_t v);
+		static uint64_t bucket_top(int b);
+
+		std::atomic<uint64_t> counts_[HIST_BUCKETS];
+		std::atomic<uint64_t> n_;
+		std::atomic<uint64_t> sum_;
+		std::atomic<uint64_t> max_;
+};
+
+#endif
@@ -1,9 +1,16 @@
+#include <stdlib.h>
 #include "jsl_log.h"
 
-int JSL_DEBUG_LEVEL = 1;
+// RPC_DEBUG=4 brings back the messages servers log for every request
+static int
+initial_level()
+{
+	char *e = getenv("RPC_DEBUG");
+	return e ? atoi(e) : 1;
+}
+
+int JSL_DEBUG_LEVEL = initial_level();
 void
 jsl_set_debug(int level) {
 	JSL_DEBUG_LEVEL = level;
 }
-
-
@@ -1,6 +1,9 @@
 #ifndef __JSL_LOG_H__
 #define __JSL_LOG_H__ 1
 
+#include <stdio.h>
+#include "binlog.h"
+
 enum dbcode {
 	JSL_DBG_OFF = 0,
 	JSL_DBG_1 = 1, // Critical
@@ -9,14 +12,26 @@ enum dbcode {
 	JSL_DBG_4 = 4, // Debugging
 };
 
+// messages above this level are compiled out, e.g. -DJSL_MAX_LEVEL=1
+#ifndef JSL_MAX_LEVEL
+#define JSL_MAX_LEVEL JSL_DBG_4
+#endif
+
 extern int JSL_DEBUG_LEVEL;
 
+#define JSL_ABS(level) ((level) < 0 ? -(level) : (level))
+
+// printf(), but asynchronous (see binlog.h); the printf that is never
+// called keeps the compiler checking the arguments against the format
 #define jsl_log(level,...)                                    \
 	do {                                                        \
-		if(JSL_DEBUG_LEVEL < abs(level))			      							\
-		{;}                                                       \
-		else {                                                    \
-			{ printf(__VA_ARGS__);}														\
+		if (JSL_ABS(level) <= JSL_MAX_LEVEL &&                    \
+				JSL_DEBUG_LEVEL >= JSL_ABS(level)) {                  \
+			static binlog_site jsl_site_ =                          \
+				{ JSL_ABS(level), __FILE__, __LINE__, {0}, 0 };       \
+			if (0)                                                  \
+				printf(__VA_ARGS__);                                  \
+			binlog_write(&jsl_site_, __VA_ARGS__);                  \
 		}                                                         \
 	} while(0)
 
@@ -0,0 +1,144 @@
+// format a binary log (see binlog.h) as text.
+//
+//   logdump [-v] file ...
+//
+// a process run with RPC_LOG=path writes its log to path.pid.  each
+// message comes out as the process would have printed it; -v starts
+// every line with the time, the thread, the level and where in the
+// source it was logged.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "binlog.h"
+
+struct site {
+	int level;
+	int line;
+	std::string file;
+	std::string fmt;
+};
+
+static bool
+get(FILE *f, void *v, size_t n)
+{
+	return fread(v, 1, n, f) == n;
+}
+
+static bool
+get_str(FILE *f, std::string *s)
+{
+	uint16_t n;
+	if (!get(f, &n, sizeof(n)))
+		return false;
+	s->resize(n);
+	return n == 0 || get(f, &(*s)[0], n);
+}
+
+// false if the file is cut short or not a binary log
+static bool
+dump(FILE *f, bool verbose)
+{
+	std::vector<site> sites; // by id - 1
+	bool bol = true; // at the beginning of a line
+	int c;
+	while ((c = getc(f)) != EOF) {
+		if (c == 'S') {
+			uint32_t id;
+			site s;
+			if (!get(f, &id, sizeof(id)) ||
+					!get(f, &s.level, sizeof(s.level)) ||
+					!get(f, &s.line, sizeof(s.line)) ||
+					!get_str(f, &s.file) || !get_str(f, &s.fmt))
+				return false;
+			if (sites.size() < id)
+				sites.resize(id);
+			sites[id - 1] = s;
+			continue;
+		}
+		if (c != 'R')
+			return false;
+		char hdr[BINLOG_HEADER];
+		if (!get(f, hdr, sizeof(hdr)))
+			return false;
+		uint32_t len, id, thread;
+		int64_t ns;
+		memcpy(&len, hdr, sizeof(len));
+		memcpy(&id, hdr + 4, sizeof(id));
+		memcpy(&thread, hdr + 8, sizeof(thread));
+		memcpy(&ns, hdr + 12, sizeof(ns));
+		if (len < BINLOG_HEADER || id == 0 || id > sites.size())
+			return false;
+		std::string args(len - BINLOG_HEADER, '\0');
+		if (args.size() && !get(f, &args[0], args.size()))
+			return false;
+		const site &s = sites[id - 1];
+		std::string msg = binlog_format(s.fmt.c_str(), args.data(),
+				args.size());
+		if (!verbose) {
+			fwrite(msg.data(), 1, msg.size(), stdout);
+			continue;
+		}
+		char prefix[128];
+		time_t sec = ns / 1000000000;
+		struct tm tm;
+		localtime_r(&sec, &tm);
+		int n = strftime(prefix, sizeof(prefix), "%H:%M:%S", &tm);
+		snprintf(prefix + n, sizeof(prefix) - n, ".%06d %3u %d %s:%d ",
+				(int)(ns % 1000000000 / 1000), thread, s.level,
+				s.file.c_str(), s.line);
+		for (size_t i = 0; i < msg.size(); i++) {
+			if (bol)
+				fputs(prefix, stdout);
+			putchar(msg[i]);
+			bol = msg[i] == '\n';
+		}
+	}
+	if (!bol)
+		putchar('\n');
+	return true;
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-v] file ...\n", prog);
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	bool verbose = false;
+	int ch;
+	while ((ch = getopt(argc, argv, "v")) != -1) {
+		switch (ch) {
+			case 'v': verbose = true; break;
+			default: usage(argv[0]);
+		}
+	}
+	if (optind >= argc)
+		usage(argv[0]);
+
+	int failed = 0;
+	for (int i = optind; i < argc; i++) {
+		FILE *f = fopen(argv[i], "r");
+		if (!f) {
+			perror(argv[i]);
+			failed = 1;
+			continue;
+		}
+		if (!dump(f, verbose)) {
+			fprintf(stderr, "%s: not a binary log, or cut short\n",
+					argv[i]);
+			failed = 1;
+		}
+		fclose(f);
+	}
+	return failed;
+}
@@ -0,0 +1,222 @@
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include "lz.h"
+
+// the LZ4 block format: a sequence is a token byte (literal count in
+// the high nibble, match length - MINMATCH in the low one, 15 meaning
+// more follows in bytes of 255 and a last one below 255), the
+// literals, and a two-byte little-endian offset back to the match.
+// the last sequence has only literals.
+#define MINMATCH 4
+#define LASTLITERALS 5 //a block always ends in this many literals
+#define MFLIMIT 12 //and no match starts within this many bytes of the end
+#define MAX_OFFSET 65535
+#define HASH_LOG 13
+
+static inline uint32_t
+read32(const unsigned char *p)
+{
+	uint32_t x;
+	memcpy(&x, p, sizeof(x));
+	return x;
+}
+
+static inline uint64_t
+read64(const unsigned char *p)
+{
+	uint64_t x;
+	memcpy(&x, p, sizeof(x));
+	return x;
+}
+
+static inline uint32_t
+hash(uint32_t x)
+{
+	return (x * 2654435761U) >> (32 - HASH_LOG);
+}
+
+//the bytes after a length nibble of 15
+static inline unsigned char *
+put_len(unsigned char *op, size_t len)
+{
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = (unsigned char)len;
+	return op;
+}
+
+//the length of the common prefix of p and m, up to limit
+static inline size_t
+match_len(const unsigned char *p, const unsigned char *m,
+		const unsigned char *limit)
+{
+	const unsigned char *start = p;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	while (p + 8 <= limit) {
+		uint64_t x = read64(p) ^ read64(m);
+		if (x)
+			return p - start + (__builtin_ctzll(x) >> 3);
+		p += 8;
+		m += 8;
+	}
+#endif
+	while (p < limit && *p == *m) {
+		p++;
+		m++;
+	}
+	return p - start;
+}
+
+int
+lz_compress(const char *src, int n, char *dst, int cap)
+{
+	const unsigned char *base = (const unsigned char *)src;
+	const unsigned char *ip = base, *anchor = base, *end = base + n;
+	unsigned char *op = (unsigned char *)dst, *oend = op + cap;
+	size_t lit;
+
+	if (n > MFLIMIT) {
+		const unsigned char *mflimit = end - MFLIMIT;
+		const unsigned char *matchlimit = end - LASTLITERALS;
+		//positions relative to base; a stale entry is caught by
+		//comparing the bytes
+		uint32_t *table = new uint32_t[1 << HASH_LOG]();
+
+		for (ip++; ip <= mflimit; ) {
+			//look for a match, striding further the longer we
+			//go without one so that incompressible input is
+			//skimmed rather than searched
+			const unsigned char *m;
+			unsigned int tries = 1 << 6;
+			for (;;) {
+				uint32_t h = hash(read32(ip));
+				m = base + table[h];
+				table[h] = ip - base;
+				if (m < ip && ip - m <= MAX_OFFSET &&
+						read32(m) == read32(ip))
+					break;
+				ip += tries++ >> 6;
+				if (ip > mflimit)
+					goto last;
+			}
+			while (ip > anchor && m > base && ip[-1] == m[-1]) {
+				ip--;
+				m--;
+			}
+			size_t ml = match_len(ip + MINMATCH, m + MINMATCH,
+					matchlimit);
+
+			lit = ip - anchor;
+			if (op + 1 + lit / 255 + 1 + lit + 2 + ml / 255 + 1 +
+					LASTLITERALS > oend) {
+				delete[] table;
+				return 0;
+			}
+			unsigned char *token = op++;
+			*token = (unsigned char)(std::min(lit, (size_t)15) << 4);
+			if (lit >= 15)
+				op = put_len(op, lit - 15);
+			memcpy(op, anchor, lit);
+			op += lit;
+			size_t off = ip - m;
+			*op++ = (unsigned char)off;
+			*op++ = (unsigned char)(off >> 8);
+			*token |= (unsigned char)std::min(ml, (size_t)15);
+			if (ml >= 15)
+				op = put_len(op, ml - 15);
+
+			ip += MINMATCH + ml;
+			anchor = ip;
+			if (ip <= mflimit)
+				table[hash(read32(ip - 2))] = ip - 2 - base;
+		}
+last:
+		delete[] table;
+	}
+
+	lit = end - anchor;
+	if (op + 1 + lit / 255 + 1 + lit > oend)
+		return 0;
+	*op++ = (unsigned char)(std::min(lit, (size_t)15) << 4);
+	if (lit >= 15)
+		op = put_len(op, lit - 15);
+	memcpy(op, anchor, lit);
+	op += lit;
+	return op - (unsigned char *)dst;
+}
+
+//a length continued in bytes after a nibble of 15; false if the input
+//runs out first
+static inline bool
+get_len(const unsigned char **ip, const unsigned char *end, size_t *len)
+{
+	unsigned char b;
+	do {
+		if (*ip >= end)
+			return false;
+		b = *(*ip)++;
+		*len += b;
+	} while (b == 255);
+	return true;
+}
+
+int
+lz_decompress(const char *src, int n, char *dst, int cap)
+{
+	const unsigned char *ip = (const unsigned char *)src, *end = ip + n;
+	unsigned char *base = (unsigned char *)dst, *op = base;
+	unsigned char *oend = base + cap;
+
+	while (ip < end) {
+		unsigned int token = *ip++;
+		size_t lit = token >> 4;
+		if (lit < 15 && end - ip >= 16 && oend - op >= 16) {
+			//the common case, a few literals well away from the
+			//ends: copy 16 bytes whatever lit is
+			memcpy(op, ip, 16);
+		} else {
+			if (lit == 15 && !get_len(&ip, end, &lit))
+				return -1;
+			if (lit > (size_t)(end - ip) || lit > (size_t)(oend - op))
+				return -1;
+			memcpy(op, ip, lit);
+		}
+		op += lit;
+		ip += lit;
+		if (ip == end)
+			break; //the last sequence
+		if (end - ip < 2)
+			return -1;
+		size_t off = ip[0] | ip[1] << 8;
+		ip += 2;
+		size_t ml = token & 15;
+		if (ml == 15 && !get_len(&ip, end, &ml))
+			return -1;
+		ml += MINMATCH;
+		if (off == 0 || off > (size_t)(op - base) ||
+				ml > (size_t)(oend - op))
+			return -1;
+		const unsigned char *m = op - off;
+		if (off >= 8 && (size_t)(oend - op) >= ml + 8) {
+			//eight bytes at a time, maybe a few too many
+			unsigned char *e = op + ml;
+			do {
+				memcpy(op, m, 8);
+				op += 8;
+				m += 8;
+			} while (op < e);
+			op = e;
+			continue;
+		}
+		//an overlapping match repeats the last off bytes; copy
+		//them in pieces that double in size
+		while (ml > 0) {
+			size_t k = std::min((size_t)(op - m), ml);
+			memcpy(op, m, k);
+			op += k;
+			ml -= k;
+		}
+	}
+	return op - base;
+}
@@ -0,0 +1,23 @@
+#ifndef lz_h
+#define lz_h
+
+// a fast LZ77 codec producing the LZ4 block format: runs of literals
+// and back references of at least 4 bytes up to 64KB back, found with
+// a single hash probe per position.  it gives up some ratio for
+// speed, which is the right trade for rpc bodies: text and sparse
+// extents shrink several times over at close to memcpy speed, and
+// incompressible data is skipped over quickly.
+
+// the most that n bytes can compress to
+inline int lz_bound(int n) { return n + n / 255 + 16; }
+
+// compress n bytes at src into at most cap bytes at dst.  returns the
+// compressed size, or 0 if it does not fit in cap
+int lz_compress(const char *src, int n, char *dst, int cap);
+
+// decompress n bytes at src into at most cap bytes at dst.  returns
+// the decompressed size, or -1 if src is not a valid block or
+// decompresses to more than cap bytes
+int lz_decompress(const char *src, int n, char *dst, int cap);
+
+#endif
@@ -10,6 +10,11 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <type_traits>
+
+#include "bufpool.h"
 
 struct req_header {
 	req_header(int x=0, int p=0, int c = 0, int s = 0, int xi = 0):
@@ -33,6 +38,20 @@ typedef int rpc_sz_t;
 //size of initial buffer allocation 
 const int DEFAULT_RPC_SZ = 1024;
 
+//strings at least this long are passed to a blocking rpcc::call by
+//reference, and written to the socket straight from the caller's
+//memory, instead of being copied into the request buffer
+const int MARSHALL_REF_MIN = 16<<10;
+
+//bodies at least this long are compressed once both ends have agreed
+//to it at bind time (see marshall::lz_pack()).  the compressed pdu has
+//to fit in a connection's MAX_PDU, but may unpack to up to RPC_LZ_MAX
+const int RPC_LZ_MIN = 4<<10;
+const int RPC_LZ_MAX = 64<<20;
+//how much of a body lz_pack() tries first, to see whether the rest is
+//worth compressing
+const int RPC_LZ_SAMPLE = 4<<10;
+
 #if RPC_CHECKSUMMING
 	//size of rpc_header includes a 4-byte int to be filled by tcpchan and uint64_t checksum
 	const int RPC_HEADER_SZ = std::max(sizeof(req_header), sizeof(reply_header)) + sizeof(rpc_sz_t) + sizeof(rpc_checksum_t);
@@ -40,33 +59,160 @@ const int DEFAULT_RPC_SZ = 1024;
 	const int RPC_HEADER_SZ = std::max(sizeof(req_header), sizeof(reply_header)) + sizeof(rpc_sz_t);
 #endif
 
+//the first bytes of a pdu, which the connection fills in as it sends
+//it: the length word, and the checksum if there is room for one
+#if RPC_CHECKSUMMING
+	const int RPC_FRAME_SZ = sizeof(rpc_sz_t) + sizeof(rpc_checksum_t);
+#else
+	const int RPC_FRAME_SZ = sizeof(rpc_sz_t);
+#endif
+
+// integers go on the wire in network (big-endian) order.  these store
+// and load one a word at a time rather than a byte at a time
+template<class T> inline void
+rpc_put_be(char *p, T x)
+{
+	static_assert(std::is_integral<T>::value, "integers only");
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	if constexpr (sizeof(T) == 2)
+		x = __builtin_bswap16(x);
+	else if constexpr (sizeof(T) == 4)
+		x = __builtin_bswap32(x);
+	else if constexpr (sizeof(T) == 8)
+		x = __builtin_bswap64(x);
+#endif
+	memcpy(p, &x, sizeof(x));
+}
+
+template<class T> inline T
+rpc_get_be(const char *p)
+{
+	static_assert(std::is_integral<T>::value, "integers only");
+	T x;
+	memcpy(&x, p, sizeof(x));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	if constexpr (sizeof(T) == 2)
+		x = __builtin_bswap16(x);
+	else if constexpr (sizeof(T) == 4)
+		x = __builtin_bswap32(x);
+	else if constexpr (sizeof(T) == 8)
+		x = __builtin_bswap64(x);
+#endif
+	return x;
+}
+
+// integer types whose wire form is just their bytes in network order,
+// so arrays of them can be (un)marshalled in one go
+template<class T> struct rpc_is_word {
+	static const bool value = std::is_integral<T>::value &&
+		!std::is_same<T, bool>::value &&
+		(sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8);
+};
+
+// zigzag maps small negative numbers to small unsigned ones (0, -1, 1,
+// -2 ... to 0, 1, 2, 3 ...) so they make short varints
+inline unsigned long long
+rpc_zigzag(long long x)
+{
+	return ((unsigned long long)x << 1) ^ (unsigned long long)(x >> 63);
+}
+
+inline long long
+rpc_unzigzag(unsigned long long x)
+{
+	return (long long)(x >> 1) ^ -(long long)(x & 1);
+}
+
 class marshall {
 	private:
 		char *_buf;     // Base of the raw bytes buffer (dynamically readjusted)
 		int _capa;      // Capacity of the buffer
 		int _ind;       // Read/write head position
 
+		// bytes that belong at offset off of _buf but were not
+		// copied there (see rawref())
+		struct segment {
+			int off;
+			const char *p;
+			int n;
+		};
+		std::vector<segment> _segs;
+		int _extsz;     // Sum of the segments' n
+		bool _v2;       // Body in the compact encoding (see set_v2())
+
+		void grow(int n);
+		// the whole pdu, referenced bytes included, into size() bytes
+		// at b
+		void copy_to(char *b);
+
 	public:
 		marshall() {
-			_buf = (char *) malloc(sizeof(char)*DEFAULT_RPC_SZ);
-			assert(_buf);
-			_capa = DEFAULT_RPC_SZ;
+			_buf = rpc_buf_alloc(DEFAULT_RPC_SZ);
+			_capa = rpc_buf_capacity(_buf);
+			_ind = RPC_HEADER_SZ;
+			_extsz = 0;
+			_v2 = false;
+		}
+
+		// room for sz bytes of content up front, for when the
+		// caller knows roughly how much it is going to pack
+		explicit marshall(int sz) {
+			_buf = rpc_buf_alloc(RPC_HEADER_SZ + std::max(sz, 0));
+			_capa = rpc_buf_capacity(_buf);
 			_ind = RPC_HEADER_SZ;
+			_extsz = 0;
+			_v2 = false;
 		}
 
 		~marshall() { 
-			if (_buf) 
-				free(_buf); 
+			rpc_buf_free(_buf);
 		}
 
-		int size() { return _ind;}
+		// size of the whole pdu, referenced bytes included
+		int size() { return _ind + _extsz;}
+		// only the bytes copied so far; flatten() first if it matters
 		char *cstr() { return _buf;}
 
-		void rawbyte(unsigned char);
-		void rawbytes(const char *, int);
+		// append n bytes and return them for the caller to fill in;
+		// the capacity is checked once for the lot
+		char *grab(int n) {
+			if (_ind + n > _capa)
+				grow(n);
+			char *p = _buf + _ind;
+			_ind += n;
+			return p;
+		}
+		void rawbyte(unsigned char x) { *grab(1) = x; }
+		void rawbytes(const char *p, int n) { memcpy(grab(n), p, n); }
+		// LEB128: seven bits a byte, low bits first
+		void varint(unsigned long long x);
+		// append n bytes at p without copying them; p must stay
+		// valid until the pdu has been sent or flatten()ed
+		void rawref(const char *p, int n);
+		// copy referenced bytes into the buffer
+		void flatten();
+		// the pdu as a list of pieces for writev(), the buffer's
+		// first bytes (the header) first
+		void iov(std::vector<struct iovec> *v);
+		// compress the content (everything after the header) if it
+		// is at least RPC_LZ_MIN bytes and shrinks by an eighth or
+		// more; returns whether it did.  the receiver has to be told,
+		// and undoes it with unmarshall::lz_unpack().  a body that
+		// does not compress is left as it was, rawref()ed bytes and
+		// all
+		bool lz_pack();
+
+		// pack the body in the compact encoding the peer agreed to at
+		// bind time (rpc_const::feat_v2): integers wider than a byte as
+		// varints, signed ones zigzagged, and string, vector and map
+		// lengths as varints too, set before any of it is packed.  the
+		// header is fixed-width either way
+		void set_v2(bool v2) { _v2 = v2; }
+		bool v2() { return _v2; }
 
 		// Return the current content (excluding header) as a string
 		std::string get_content() { 
+			flatten();
 			return std::string(_buf+RPC_HEADER_SZ,_ind-RPC_HEADER_SZ);
 		}
 
@@ -105,6 +251,7 @@ class marshall {
 		}
 
 		void take_buf(char **b, int *s) {
+			flatten();
 			*b = _buf;
 			*s = _ind;
 			_buf = NULL;
@@ -121,22 +268,73 @@ marshall& operator<<(marshall &, short);
 marshall& operator<<(marshall &, unsigned long long);
 marshall& operator<<(marshall &, const std::string &);
 
+// a guess at the bytes x takes once marshalled, to size a marshall
+// before packing into it; only strings are big enough to matter, and
+// those rpcc::call passes by reference take no room in the buffer
+template<class T> inline int
+marshall_hint(const T &)
+{
+	return sizeof(T);
+}
+
+inline int
+marshall_hint(const std::string &s)
+{
+	if ((int)s.size() >= MARSHALL_REF_MIN)
+		return sizeof(unsigned int);
+	return sizeof(unsigned int) + s.size();
+}
+
+inline int
+marshall_hint(const char *s)
+{
+	return sizeof(unsigned int) + strlen(s);
+}
+
+// pack x for a blocking call, which outlives the request: like <<,
+// but a long string is referenced rather than copied
+template<class T> inline void
+marshall_ref(marshall &m, const T &x)
+{
+	m << x;
+}
+
+inline void
+marshall_ref(marshall &m, const std::string &s)
+{
+	if ((int)s.size() < MARSHALL_REF_MIN) {
+		m << s;
+		return;
+	}
+	m << (unsigned int) s.size();
+	m.rawref(s.data(), s.size());
+}
+
 class unmarshall {
 	private:
 		char *_buf;
 		int _sz;
 		int _ind;
 		bool _ok;
+		bool _v2;
+		bool _borrowed; // _buf belongs to someone else
 	public:
-		unmarshall(): _buf(NULL),_sz(0),_ind(0),_ok(false) {}
-		unmarshall(char *b, int sz): _buf(b),_sz(sz),_ind(),_ok(true) {}
-		unmarshall(const std::string &s) : _buf(NULL),_sz(0),_ind(0),_ok(false) 
+		unmarshall(): _buf(NULL),_sz(0),_ind(0),_ok(false),_v2(false),_borrowed(false) {}
+		unmarshall(char *b, int sz): _buf(b),_sz(sz),_ind(),_ok(true),_v2(false),_borrowed(false) {}
+		unmarshall(const std::string &s) : _buf(NULL),_sz(0),_ind(0),_ok(false),_v2(false),_borrowed(false)
 		{
 			//take the content which does not exclude a RPC header from a string
 			take_content(s);
 		}
+		// the n bytes at p, which lie at least RPC_HEADER_SZ bytes into
+		// another unmarshall's buffer, as content of their own without
+		// copying them; good for as long as that unmarshall is
+		unmarshall(const char *p, int n, bool v2)
+			: _buf((char *)p - RPC_HEADER_SZ), _sz(RPC_HEADER_SZ + n),
+			_ind(RPC_HEADER_SZ), _ok(true), _v2(v2), _borrowed(true) {}
 		~unmarshall() {
-			if (_buf) free(_buf);
+			if (!_borrowed)
+				rpc_buf_free(_buf);
 		}
 
 		//take contents from another unmarshall object
@@ -144,24 +342,47 @@ class unmarshall {
 
 		//take the content which does not exclude a RPC header from a string
 		void take_content(const std::string &s) {
+			assert(!_borrowed);
 			_sz = s.size()+RPC_HEADER_SZ;
-			_buf = (char *)realloc(_buf,_sz);
-			assert(_buf);
+			_buf = rpc_buf_realloc(_buf,_sz);
 			_ind = RPC_HEADER_SZ;
 			memcpy(_buf+_ind, s.data(), s.size());
 			_ok = true;
 		}
 
 		bool ok() { return _ok; }
+		// give up on the content, e.g. a length that cannot be right
+		void fail() { _ok = false; }
 		char *cstr() { return _buf;}
 		bool okdone();
+		// the next n bytes, or NULL (and !ok()) if there are not
+		// that many left
+		const char *take(size_t n) {
+			if (n > (size_t)(_sz - _ind)) {
+				_ok = false;
+				return NULL;
+			}
+			const char *p = _buf + _ind;
+			_ind += n;
+			return p;
+		}
 		unsigned int rawbyte();
 		void rawbytes(std::string &s, unsigned int n);
+		// a marshall::varint(); 0 (and !ok()) if it runs off the end
+		// or past 64 bits
+		unsigned long long varint();
+		// the body is in the compact encoding (see marshall::set_v2())
+		void set_v2(bool v2) { _v2 = v2; }
+		bool v2() { return _v2; }
+		// undo marshall::lz_pack(); false (and !ok()) if the content
+		// is corrupt
+		bool lz_unpack();
 
 		int ind() { return _ind;}
 		int size() { return _sz;}
 		void unpack(int *); //non-const ref
 		void take_buf(char **b, int *sz) {
+			assert(!_borrowed);
 			*b = _buf;
 			*sz = _sz;
 			_sz = _ind = 0;
@@ -194,6 +415,55 @@ class unmarshall {
 		}
 };
 
+// the xid and proc of a request pdu of at least RPC_HEADER_SZ bytes,
+// for deciding how to queue it before unpack_req_header()
+inline int
+rpc_req_xid(const char *b)
+{
+	int off = sizeof(rpc_sz_t); //the length word
+#if RPC_CHECKSUMMING
+	off += sizeof(rpc_checksum_t);
+#endif
+	return rpc_get_be<int>(b + off);
+}
+
+inline int
+rpc_req_proc(const char *b)
+{
+	int off = sizeof(rpc_sz_t) + sizeof(int); //the length word and xid
+#if RPC_CHECKSUMMING
+	off += sizeof(rpc_checksum_t);
+#endif
+	return rpc_get_be<int>(b + off);
+}
+
+inline unsigned int
+rpc_req_clt_nonce(const char *b)
+{
+	//the length word, xid and proc
+	int off = sizeof(rpc_sz_t) + 2 * sizeof(int);
+#if RPC_CHECKSUMMING
+	off += sizeof(rpc_checksum_t);
+#endif
+	return rpc_get_be<unsigned int>(b + off);
+}
+
+// a request flagged PDU_BUDGET ends in the ms its caller still waits
+// from when it is sent, 0 for ever.  it is set again each time the
+// request is sent, from what is left of it then; end is the end of
+// the pdu
+inline void
+rpc_req_set_budget(char *end, int ms)
+{
+	rpc_put_be<int>(end - sizeof(int), ms);
+}
+
+inline int
+rpc_req_budget(const char *end)
+{
+	return rpc_get_be<int>(end - sizeof(int));
+}
+
 unmarshall& operator>>(unmarshall &, unsigned char &);
 unmarshall& operator>>(unmarshall &, char &);
 unmarshall& operator>>(unmarshall &, unsigned short &);
@@ -204,11 +474,22 @@ unmarshall& operator>>(unmarshall &, unsigned long long &);
 unmarshall& operator>>(unmarshall &, std::string &);
 
 template <class C> marshall &
-operator<<(marshall &m, std::vector<C> v)
+operator<<(marshall &m, const std::vector<C> &v)
 {
 	m << (unsigned int) v.size();
-	for(unsigned i = 0; i < v.size(); i++)
-		m << v[i];
+	if constexpr (rpc_is_word<C>::value) {
+		if (m.v2() && sizeof(C) > 1) {
+			for (unsigned i = 0; i < v.size(); i++)
+				m << v[i];
+			return m;
+		}
+		char *p = m.grab(v.size() * sizeof(C));
+		for (unsigned i = 0; i < v.size(); i++)
+			rpc_put_be(p + i * sizeof(C), v[i]);
+	} else {
+		for (unsigned i = 0; i < v.size(); i++)
+			m << v[i];
+	}
 	return m;
 }
 
@@ -217,10 +498,32 @@ operator>>(unmarshall &u, std::vector<C> &v)
 {
 	unsigned n;
 	u >> n;
-	for(unsigned i = 0; i < n; i++){
-		C z;
-		u >> z;
-		v.push_back(z);
+	if constexpr (rpc_is_word<C>::value) {
+		if (u.v2() && sizeof(C) > 1) {
+			//every element takes at least a byte
+			if (!u.ok() || n > (unsigned)(u.size() - u.ind())) {
+				u.fail();
+				return u;
+			}
+			size_t old = v.size();
+			v.resize(old + n);
+			for (unsigned i = 0; i < n; i++)
+				u >> v[old + i];
+			return u;
+		}
+		const char *p = u.take((size_t)n * sizeof(C));
+		if (!p)
+			return u;
+		size_t old = v.size();
+		v.resize(old + n);
+		for (unsigned i = 0; i < n; i++)
+			v[old + i] = rpc_get_be<C>(p + i * sizeof(C));
+	} else {
+		for (unsigned i = 0; i < n; i++){
+			C z;
+			u >> z;
+			v.push_back(z);
+		}
 	}
 	return u;
 }
@@ -0,0 +1,1464 @@
+// micro benchmarks for pieces of the rpc library.
+//
+//   microbench [section ...]
+//
+// runs the named sections (all of them by default) and prints one
+// table per section.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <atomic>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "slock.h"
+#include "rpc.h"
+#include "crc32c.h"
+#include "histogram.h"
+#include "lz.h"
+#include "jsl_log.h"
+#include "marshall.h"
+#include "bufpool.h"
+#include "reply_window.h"
+#include "proc_table.h"
+#include "fifo.h"
+#include "mpmc_queue.h"
+#include "thr_pool.h"
+#include "extent_protocol.h"
+#include "paxos_protocol.h"
+#include "lock_protocol.h"
+#include "rsm_protocol.h"
+
+static double
+now_sec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+ncores()
+{
+	int n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? n : 1;
+}
+
+// run fn(arg, i) on nthreads threads at once and return the elapsed
+// wall-clock time
+struct bench_thread {
+	void (*fn)(void *, int);
+	void *arg;
+	int i;
+};
+
+static void *
+bench_thread_main(void *a)
+{
+	bench_thread *t = (bench_thread *)a;
+	t->fn(t->arg, t->i);
+	return NULL;
+}
+
+static double
+run_threads(int nthreads, void (*fn)(void *, int), void *arg)
+{
+	std::vector<pthread_t> th(nthreads);
+	std::vector<bench_thread> ts(nthreads);
+	double t0 = now_sec();
+	for (int i = 0; i < nthreads; i++) {
+		ts[i].fn = fn;
+		ts[i].arg = arg;
+		ts[i].i = i;
+		assert(pthread_create(&th[i], NULL, bench_thread_main, &ts[i]) == 0);
+	}
+	for (int i = 0; i < nthreads; i++) {
+		assert(pthread_join(th[i], NULL) == 0);
+	}
+	return now_sec() - t0;
+}
+
+/*---------------marshall buffers--------------*/
+
+// a request buffer as marshall used to get it: malloc 1KB, then
+// realloc to twice the size whenever it fills up
+static void
+malloc_marshall(const std::string &s)
+{
+	int capa = DEFAULT_RPC_SZ;
+	char *b = (char *)malloc(capa);
+	while (capa < RPC_HEADER_SZ + (int)s.size()) {
+		capa *= 2;
+		b = (char *)realloc(b, capa);
+	}
+	memcpy(b + RPC_HEADER_SZ, s.data(), s.size());
+	free(b);
+}
+
+// and as a size-hinted marshall gets it now
+static void
+pooled_marshall(const std::string &s)
+{
+	char *b = rpc_buf_alloc(RPC_HEADER_SZ + s.size());
+	memcpy(b + RPC_HEADER_SZ, s.data(), s.size());
+	rpc_buf_free(b);
+}
+
+struct marshall_bench {
+	void (*fn)(const std::string &);
+	std::string s;
+	int n;
+};
+
+static void
+marshall_worker(void *arg, int)
+{
+	marshall_bench *b = (marshall_bench *)arg;
+	for (int i = 0; i < b->n; i++)
+		b->fn(b->s);
+}
+
+static double
+marshall_run(void (*fn)(const std::string &), int nthreads, int sz)
+{
+	marshall_bench b;
+	b.fn = fn;
+	b.s = std::string(sz, 'x');
+	b.n = sz >= (1<<20) ? 20 : 200000 / (1 + sz / 4096);
+	double t = run_threads(nthreads, marshall_worker, &b);
+	return b.n * nthreads / t;
+}
+
+static void
+bench_marshall()
+{
+	int sizes[] = { 64, 4096, 65536, 1<<20, 8<<20 };
+	int threads[] = { 1, 4 };
+
+	printf("marshall: get, fill and free the buffer of one request\n");
+	printf("%7s %9s %14s %14s %8s\n", "threads", "bytes", "malloc ops/s",
+			"pool ops/s", "speedup");
+	for (unsigned t = 0; t < sizeof(threads)/sizeof(threads[0]); t++) {
+		for (unsigned i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+			double o = marshall_run(malloc_marshall, threads[t], sizes[i]);
+			double n = marshall_run(pooled_marshall, threads[t], sizes[i]);
+			printf("%7d %9d %14.0f %14.0f %7.1fx\n", threads[t], sizes[i],
+					o, n, n / o);
+		}
+	}
+}
+
+/*---------------marshall primitives--------------*/
+
+// the encoders and decoders as they were: every byte is a call of its
+// own, with its own capacity or length check
+static void __attribute__((noinline))
+old_byte(marshall &m, unsigned char x)
+{
+	m.rawbyte(x);
+}
+
+static void
+old_put(marshall &m, unsigned int x)
+{
+	old_byte(m, (x >> 24) & 0xff);
+	old_byte(m, (x >> 16) & 0xff);
+	old_byte(m, (x >> 8) & 0xff);
+	old_byte(m, x & 0xff);
+}
+
+static void
+old_put(marshall &m, int x)
+{
+	old_put(m, (unsigned int) x);
+}
+
+static void
+old_put(marshall &m, unsigned long long x)
+{
+	old_put(m, (unsigned int) (x >> 32));
+	old_put(m, (unsigned int) x);
+}
+
+static void
+old_put(marshall &m, const std::string &s)
+{
+	old_put(m, (unsigned int) s.size());
+	m.rawbytes(s.data(), s.size());
+}
+
+static void
+old_get(unmarshall &u, unsigned int &x)
+{
+	x = (u.rawbyte() & 0xff) << 24;
+	x |= (u.rawbyte() & 0xff) << 16;
+	x |= (u.rawbyte() & 0xff) << 8;
+	x |= u.rawbyte() & 0xff;
+}
+
+static void
+old_get(unmarshall &u, int &x)
+{
+	old_get(u, (unsigned int &) x);
+}
+
+static void
+old_get(unmarshall &u, unsigned long long &x)
+{
+	unsigned int h, l;
+	old_get(u, h);
+	old_get(u, l);
+	x = l | ((unsigned long long) h << 32);
+}
+
+static void
+old_get(unmarshall &u, std::string &s)
+{
+	unsigned int sz;
+	old_get(u, sz);
+	if (u.ok())
+		u.rawbytes(s, sz);
+}
+
+static void
+old_put(marshall &m, const extent_protocol::attr &a)
+{
+	old_put(m, a.atime);
+	old_put(m, a.mtime);
+	old_put(m, a.ctime);
+	old_put(m, a.size);
+}
+
+static void
+old_get(unmarshall &u, extent_protocol::attr &a)
+{
+	old_get(u, a.atime);
+	old_get(u, a.mtime);
+	old_get(u, a.ctime);
+	old_get(u, a.size);
+}
+
+static void
+old_put(marshall &m, const paxos_protocol::prepareres &r)
+{
+	old_put(m, r.oldinstance);
+	old_put(m, r.accept);
+	old_put(m, r.n_a.n);
+	old_put(m, r.n_a.m);
+	old_put(m, r.v_a);
+}
+
+static void
+old_get(unmarshall &u, paxos_protocol::prepareres &r)
+{
+	old_get(u, r.oldinstance);
+	old_get(u, r.accept);
+	old_get(u, r.n_a.n);
+	old_get(u, r.n_a.m);
+	old_get(u, r.v_a);
+}
+
+static void
+old_put(marshall &m, const std::vector<unsigned long long> &v)
+{
+	old_put(m, (unsigned int) v.size());
+	for (unsigned i = 0; i < v.size(); i++)
+		old_put(m, v[i]);
+}
+
+static void
+old_get(unmarshall &u, std::vector<unsigned long long> &v)
+{
+	unsigned int n;
+	old_get(u, n);
+	for (unsigned i = 0; i < n; i++) {
+		unsigned long long z;
+		old_get(u, z);
+		v.push_back(z);
+	}
+}
+
+template<class T> struct old_codec {
+	static void put(marshall &m, const T &x) { old_put(m, x); }
+	static void get(unmarshall &u, T &x) { old_get(u, x); }
+};
+
+template<class T> struct new_codec {
+	static void put(marshall &m, const T &x) { m << x; }
+	static void get(unmarshall &u, T &x) { u >> x; }
+};
+
+// encode x and decode it again, n times; returns round trips per second
+template<class T, class Codec> static double
+codec_run(const T &x, int n, std::string *wire)
+{
+	double t0 = now_sec();
+	for (int i = 0; i < n; i++) {
+		marshall m;
+		Codec::put(m, x);
+		if (i == 0)
+			*wire = m.str();
+		char *b;
+		int sz;
+		m.take_buf(&b, &sz);
+		unmarshall u(b, sz);
+		u.take(RPC_HEADER_SZ);
+		T y = T();
+		Codec::get(u, y);
+		assert(u.okdone());
+	}
+	return n / (now_sec() - t0);
+}
+
+template<class T> static void
+codec_row(const char *name, const T &x, int n)
+{
+	std::string w0, w1;
+	double o = codec_run<T, old_codec<T> >(x, n, &w0);
+	double c = codec_run<T, new_codec<T> >(x, n, &w1);
+	assert(w0 == w1); //same bytes on the wire
+	printf("%-24s %14.0f %14.0f %7.1fx\n", name, o, c, c / o);
+}
+
+static void
+bench_codec()
+{
+	extent_protocol::attr a;
+	a.atime = 1;
+	a.mtime = 2;
+	a.ctime = 3;
+	a.size = 4096;
+
+	paxos_protocol::prepareres r;
+	r.oldinstance = 0;
+	r.accept = 1;
+	r.n_a.n = 7;
+	r.n_a.m = "127.0.0.1:3772";
+	r.v_a = "3772 3773 3774";
+
+	std::vector<unsigned long long> v(512);
+	for (unsigned i = 0; i < v.size(); i++)
+		v[i] = i * 0x9e3779b97f4a7c15ULL;
+
+	printf("codec: marshall and unmarshall one value\n");
+	printf("%-24s %14s %14s %8s\n", "type", "per-byte ops/s", "word ops/s",
+			"speedup");
+	codec_row("extent_protocol::attr", a, 500000);
+	codec_row("paxos::prepareres", r, 500000);
+	codec_row("vector<ull>(512)", v, 20000);
+}
+
+/*---------------procedure lookup--------------*/
+
+// the procedure table as rpcs kept it before: a map under a mutex
+class map_procs {
+	public:
+		map_procs() { assert(pthread_mutex_init(&m_, 0) == 0); }
+		bool add(unsigned int proc, handler *h) {
+			ScopedLock ml(&m_);
+			procs_[proc] = h;
+			return true;
+		}
+		handler *lookup(unsigned int proc) {
+			ScopedLock ml(&m_);
+			if (procs_.count(proc) < 1)
+				return NULL;
+			return procs_[proc];
+		}
+	private:
+		std::map<int, handler *> procs_;
+		pthread_mutex_t m_;
+};
+
+// the procedures of the extent, lock, rsm and paxos protocols
+static const unsigned int bench_procs[] = {
+	0x6001, 0x6002, 0x6003, 0x6004, 0x6005, 0x7001, 0x7002, 0x7003,
+	0x8001, 0x8002, 0x9001, 0x9002, 0x9003, 0x10001, 0x10002, 0x10003,
+	0x11001, 0x11002, 0x11003, 0x11004,
+};
+#define NBENCH_PROCS (sizeof(bench_procs)/sizeof(bench_procs[0]))
+
+template<class T> struct procs_bench {
+	T t;
+	int n;
+	std::atomic<unsigned long> found;
+};
+
+template<class T> static void
+procs_worker(void *arg, int id)
+{
+	procs_bench<T> *b = (procs_bench<T> *)arg;
+	unsigned long found = 0;
+	for (int i = 0; i < b->n; i++) {
+		if (b->t.lookup(bench_procs[(i + id) % NBENCH_PROCS]))
+			found++;
+	}
+	b->found += found;
+}
+
+template<class T> static double
+procs_run(int nthreads, int n)
+{
+	procs_bench<T> b;
+	b.n = n;
+	b.found = 0;
+	for (unsigned i = 0; i < NBENCH_PROCS; i++)
+		assert(b.t.add(bench_procs[i], (handler *)(uintptr_t)(i + 1)));
+	double t = run_threads(nthreads, procs_worker<T>, &b);
+	assert(b.found == (unsigned long)n * nthreads);
+	return (double)n * nthreads / t;
+}
+
+static void
+bench_procs_table()
+{
+	int threads[] = { 1, 2, 4 };
+	const int n = 2000000;
+
+	printf("procs: look up a registered procedure, %d per thread\n", n);
+	printf("%7s %14s %16s %8s\n", "threads", "map lookups/s",
+			"table lookups/s", "speedup");
+	for (unsigned i = 0; i < sizeof(threads)/sizeof(threads[0]); i++) {
+		double o = procs_run<map_procs>(threads[i], n);
+		double t = procs_run<proc_table>(threads[i], n);
+		printf("%7d %14.0f %16.0f %7.1fx\n", threads[i], o, t, t / o);
+	}
+}
+
+/*---------------at-most-once reply window--------------*/
+
+// the reply window as rpcs kept it before: one lock and a list walk
+// per request
+class list_window {
+	public:
+		list_window() { assert(pthread_mutex_init(&m_, 0) == 0); }
+		~list_window() {
+			std::map<unsigned int, std::list<reply_t> >::iterator c;
+			for (c = w_.begin(); c != w_.end(); c++) {
+				std::list<reply_t>::iterator it;
+				for (it = c->second.begin(); it != c->second.end(); it++)
+					rpc_buf_free(it->buf);
+			}
+		}
+		reply_window::rpcstate_t check(unsigned int clt_nonce, unsigned int xid,
+				unsigned int xid_rep, char **b, int *sz) {
+			ScopedLock ml(&m_);
+			reply_window::rpcstate_t state = reply_window::NEW;
+			std::list<reply_t> &l = w_[clt_nonce];
+			std::list<reply_t>::iterator it;
+			for (it = l.begin(); it != l.end();) {
+				if (it->xid == xid) {
+					if (it->xid <= xid_rep)
+						state = reply_window::FORGOTTEN;
+					else if (!it->cb_present)
+						state = reply_window::INPROGRESS;
+					else {
+						*b = it->buf;
+						*sz = it->sz;
+						state = reply_window::DONE;
+					}
+				}
+				if (it->xid <= xid_rep) {
+					rpc_buf_free(it->buf);
+					it = l.erase(it);
+				} else {
+					it++;
+				}
+			}
+			if (state == reply_window::NEW)
+				l.push_back(reply_t(xid));
+			return state;
+		}
+		bool add(unsigned int clt_nonce, unsigned int xid, char *b, int sz,
+				unsigned int) {
+			ScopedLock ml(&m_);
+			std::list<reply_t> &l = w_[clt_nonce];
+			std::list<reply_t>::iterator it;
+			for (it = l.begin(); it != l.end(); it++) {
+				if (it->xid == xid) {
+					it->cb_present = true;
+					it->buf = b;
+					it->sz = sz;
+					return true;
+				}
+			}
+			return false;
+		}
+	private:
+		struct reply_t {
+			reply_t(unsigned int x) : xid(x), cb_present(false), buf(NULL), sz(0) {}
+			unsigned int xid;
+			bool cb_present;
+			char *buf;
+			int sz;
+		};
+		pthread_mutex_t m_;
+		std::map<unsigned int, std::list<reply_t> > w_;
+};
+
+template<class W>
+struct window_bench {
+	W w;
+	int nthreads;
+	int nclients;
+	int depth;
+	int ops; // per thread
+};
+
+// thread i plays clients i, i+nthreads, ...; every request leaves the
+// last depth replies of its client unacknowledged, like a client with
+// depth calls outstanding
+template<class W> static void
+window_worker(void *a, int i)
+{
+	window_bench<W> *b = (window_bench<W> *)a;
+	std::vector<unsigned int> mine;
+	for (int c = i; c < b->nclients; c += b->nthreads)
+		mine.push_back(1000 + c);
+	if (mine.empty())
+		return;
+	std::vector<unsigned int> xid(mine.size(), 1);
+
+	for (int n = 0; n < b->ops; n++) {
+		unsigned int k = n % mine.size();
+		unsigned int x = xid[k]++;
+		unsigned int xid_rep = x > (unsigned)b->depth ? x - b->depth : 0;
+		char *rb;
+		int rsz;
+		reply_window::rpcstate_t st = b->w.check(mine[k], x, xid_rep, &rb, &rsz);
+		assert(st == reply_window::NEW);
+		char *rep = rpc_buf_alloc(64);
+		if (!b->w.add(mine[k], x, rep, 64, 0))
+			rpc_buf_free(rep);
+	}
+}
+
+template<class W> static double
+window_run(int nthreads, int nclients, int depth, int ops)
+{
+	window_bench<W> *b = new window_bench<W>;
+	b->nthreads = nthreads;
+	b->nclients = nclients;
+	b->depth = depth;
+	b->ops = ops;
+	double t = run_threads(nthreads, window_worker<W>, b);
+	delete b;
+	return (double)ops * nthreads / t;
+}
+
+static void
+bench_reply_window()
+{
+	int nthreads = ncores() < 8 ? ncores() : 8;
+	int clients[] = { 1, 16, 256 };
+	int depths[] = { 1, 16, 256 };
+	const int ops = 100000;
+
+	printf("reply_window: %d dispatch threads, %d requests each\n", nthreads, ops);
+	printf("%8s %6s %14s %14s %8s\n", "clients", "depth", "list ops/s", "window ops/s", "speedup");
+	for (unsigned i = 0; i < sizeof(clients)/sizeof(clients[0]); i++) {
+		for (unsigned j = 0; j < sizeof(depths)/sizeof(depths[0]); j++) {
+			double o = window_run<list_window>(nthreads, clients[i], depths[j], ops);
+			double n = window_run<reply_window>(nthreads, clients[i], depths[j], ops);
+			printf("%8d %6d %14.0f %14.0f %7.1fx\n", clients[i], depths[j], o, n, n / o);
+		}
+	}
+}
+
+/*---------------job queue--------------*/
+
+template<class Q>
+struct queue_bench {
+	Q *q;
+	int nproducers;
+	int nconsumers;
+	int items; // per producer
+};
+
+// threads 0..nproducers-1 enqueue, the others dequeue an equal share
+template<class Q> static void
+queue_worker(void *a, int i)
+{
+	queue_bench<Q> *b = (queue_bench<Q> *)a;
+	if (i < b->nproducers) {
+		for (int n = 0; n < b->items; n++)
+			b->q->enq(n);
+	} else {
+		int share = b->items * b->nproducers / b->nconsumers;
+		for (int n = 0; n < share; n++) {
+			int x;
+			b->q->deq(&x);
+		}
+	}
+}
+
+template<class Q> static double
+queue_run(int nproducers, int nconsumers, int items)
+{
+	queue_bench<Q> b;
+	b.q = new Q(1024);
+	b.nproducers = nproducers;
+	b.nconsumers = nconsumers;
+	b.items = items;
+	double t = run_threads(nproducers + nconsumers, queue_worker<Q>, &b);
+	delete b.q;
+	return (double)nproducers * items / t;
+}
+
+static void
+bench_queue()
+{
+	int configs[][2] = { {1, 1}, {2, 2}, {4, 4}, {1, 4}, {4, 1} };
+	const int items = 400000;
+
+	printf("queue: blocking enq/deq through a 1024-entry queue\n");
+	printf("%9s %9s %14s %14s %8s\n", "producers", "consumers", "fifo ops/s", "mpmc ops/s", "speedup");
+	for (unsigned i = 0; i < sizeof(configs)/sizeof(configs[0]); i++) {
+		int p = configs[i][0], c = configs[i][1];
+		double o = queue_run<fifo<int> >(p, c, items);
+		double n = queue_run<mpmc_queue<int> >(p, c, items);
+		printf("%9d %9d %14.0f %14.0f %7.1fx\n", p, c, o, n, n / o);
+	}
+}
+
+/*---------------dispatch thread pool--------------*/
+
+// the dispatch pool as it was before: every worker takes jobs from
+// one shared fifo
+class fifo_pool {
+	public:
+		struct job_t {
+			void (*f)(void *);
+			void *a;
+		};
+		fifo_pool(int sz) : q_(100*sz) {
+			for (int i = 0; i < sz; i++) {
+				pthread_t t;
+				assert(pthread_create(&t, NULL, worker, this) == 0);
+				th_.push_back(t);
+			}
+		}
+		~fifo_pool() {
+			for (unsigned i = 0; i < th_.size(); i++) {
+				job_t j;
+				j.f = NULL;
+				q_.enq(j);
+			}
+			for (unsigned i = 0; i < th_.size(); i++)
+				assert(pthread_join(th_[i], NULL) == 0);
+		}
+		template<class C, class A> bool addObjJob(C *o, void (C::*m)(A), A a) {
+			struct objfunc {
+				C *o;
+				void (C::*m)(A);
+				A a;
+				static void func(void *v) {
+					objfunc *x = (objfunc *)v;
+					(x->o->*x->m)(x->a);
+					delete x;
+				}
+			};
+			objfunc *x = new objfunc;
+			x->o = o;
+			x->m = m;
+			x->a = a;
+			job_t j;
+			j.f = &objfunc::func;
+			j.a = x;
+			return q_.enq(j);
+		}
+	private:
+		static void *worker(void *a) {
+			fifo_pool *p = (fifo_pool *)a;
+			while (1) {
+				job_t j;
+				p->q_.deq(&j);
+				if (!j.f)
+					break;
+				j.f(j.a);
+			}
+			return NULL;
+		}
+		fifo<job_t> q_;
+		std::vector<pthread_t> th_;
+};
+
+struct counter {
+	std::atomic<int> n;
+	void bump(int) { n++; }
+};
+
+template<class P>
+struct pool_bench {
+	P *pool;
+	counter c;
+	int jobs; // per producer
+};
+
+template<class P> static void
+pool_producer(void *a, int)
+{
+	pool_bench<P> *b = (pool_bench<P> *)a;
+	for (int i = 0; i < b->jobs; i++)
+		assert(b->pool->addObjJob(&b->c, &counter::bump, i));
+}
+
+// jobs per second through a pool of nworkers, fed by nproducers
+// threads, until every job has run
+template<class P> static double
+pool_run(int nworkers, int nproducers, int jobs)
+{
+	pool_bench<P> b;
+	b.pool = new P(nworkers);
+	b.c.n = 0;
+	b.jobs = jobs;
+	double t0 = now_sec();
+	run_threads(nproducers, pool_producer<P>, &b);
+	while (b.c.n.load() < nproducers * jobs)
+		sched_yield();
+	double t = now_sec() - t0;
+	delete b.pool;
+	return nproducers * jobs / t;
+}
+
+static void
+bench_thr_pool()
+{
+	int nworkers = ncores() < 4 ? 4 : ncores();
+	int producers[] = { 1, 2, 4 };
+	const int jobs = 200000;
+
+	printf("thr_pool: %d workers, %d empty jobs per producer\n", nworkers, jobs);
+	printf("%9s %14s %14s %8s\n", "producers", "fifo jobs/s", "pool jobs/s", "speedup");
+	for (unsigned i = 0; i < sizeof(producers)/sizeof(producers[0]); i++) {
+		double o = pool_run<fifo_pool>(nworkers, producers[i], jobs);
+		double n = pool_run<ThrPool>(nworkers, producers[i], jobs);
+		printf("%9d %14.0f %14.0f %7.1fx\n", producers[i], o, n, n / o);
+	}
+}
+
+/*---------------crc32c--------------*/
+
+// MB/s of fn over a buffer of sz bytes
+static double
+crc_run(uint32_t (*fn)(uint32_t, const void *, size_t), int sz)
+{
+	std::string s(sz, 'x');
+	int n = (256 << 20) / sz;
+	volatile uint32_t c = 0;
+	double t0 = now_sec();
+	for (int i = 0; i < n; i++)
+		c = fn(c, s.data(), s.size());
+	return (double)n * sz / (now_sec() - t0) / (1 << 20);
+}
+
+// an extent_server::put that keeps nothing
+class put_srv {
+	public:
+		int put(const std::string &buf, int &r) { r = buf.size(); return 0; }
+};
+
+// MB/s of sz-byte put()s over loopback, with pdu checksums on or off
+static double
+crc_rpc_run(bool on, int sz)
+{
+	static int port = 20000 + (getpid() % 10000);
+	char ports[16];
+	snprintf(ports, sizeof(ports), "%d", ++port);
+	assert(setenv("RPC_CHECKSUM", on ? "1" : "0", 1) == 0);
+
+	put_srv srv;
+	rpcs s(port);
+	s.reg(16, &srv, &put_srv::put);
+	sockaddr_in dst;
+	make_sockaddr("127.0.0.1", ports, &dst);
+	rpcc c(dst);
+	assert(c.bind() == 0);
+
+	std::string buf(sz, 'x');
+	int n = std::max(20, (64 << 20) / sz);
+	double t0 = now_sec();
+	for (int i = 0; i < n; i++) {
+		int r;
+		assert(c.call(16, buf, r) == 0 && r == sz);
+	}
+	double t = now_sec() - t0;
+	assert(unsetenv("RPC_CHECKSUM") == 0);
+	return (double)n * sz / t / (1 << 20);
+}
+
+static void
+bench_crc()
+{
+	int sizes[] = { 64, 4096, 65536, 1<<20, 8<<20 };
+
+	printf("crc: crc32c of one buffer, sse4.2 %s\n",
+			crc32c_hw_available() ? "in use" : "not available");
+	printf("%9s %14s %14s %8s\n", "bytes", "table MB/s", "crc32c MB/s", "speedup");
+	for (unsigned i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+		double o = crc_run(crc32c_sw, sizes[i]);
+		double n = crc_run(crc32c, sizes[i]);
+		printf("%9d %14.0f %14.0f %7.1fx\n", sizes[i], o, n, n / o);
+	}
+
+	printf("\ncrc: put() round trips over loopback, pdu checksums off and on\n");
+	printf("%9s %14s %14s %8s\n", "bytes", "off MB/s", "on MB/s", "ratio");
+	for (unsigned i = 1; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+		double o = crc_rpc_run(false, sizes[i]);
+		double n = crc_rpc_run(true, sizes[i]);
+		printf("%9d %14.0f %14.0f %7.2fx\n", sizes[i], o, n, n / o);
+	}
+}
+
+/*---------------transports--------------*/
+
+// calls/s of sz-byte put()s to a server listening on addr, a port or
+// a unix-domain socket
+static double
+transport_run(const char *addr, int sz)
+{
+	put_srv srv;
+	rpcs s(addr);
+	s.reg(16, &srv, &put_srv::put);
+	sockaddr_storage dst;
+	make_sockaddr(addr, &dst);
+	rpcc c(dst);
+	assert(c.bind() == 0);
+
+	std::string buf(sz, 'x');
+	int n = std::max(50, std::min(20000, (256 << 20) / sz));
+	double t0 = now_sec();
+	for (int i = 0; i < n; i++) {
+		int r;
+		assert(c.call(16, buf, r) == 0 && r == sz);
+	}
+	return n / (now_sec() - t0);
+}
+
+static void
+bench_transport()
+{
+	int sizes[] = { 16, 4096, 65536, 1<<20 };
+	char port[16], path[64];
+	snprintf(port, sizeof(port), "%d", 30000 + (getpid() % 10000));
+	snprintf(path, sizeof(path), "/tmp/microbench-%d.sock", (int)getpid());
+
+	printf("transport: put() round trips, loopback tcp and unix-domain socket\n");
+	printf("%9s %14s %14s %8s\n", "bytes", "tcp calls/s", "unix calls/s", "speedup");
+	for (unsigned i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+		double o = transport_run(port, sizes[i]);
+		double n = transport_run(path, sizes[i]);
+		printf("%9d %14.0f %14.0f %7.2fx\n", sizes[i], o, n, n / o);
+	}
+}
+
+/*---------------compression--------------*/
+
+// a yfs directory extent of n entries, as yfs_client::serialize()
+// writes it
+static std::string
+lz_dir(int n)
+{
+	std::string s;
+	char e[64];
+	for (int i = 0; i < n; i++) {
+		snprintf(e, sizeof(e), "%sfile%06d;%llu", i ? "," : "", i,
+				(unsigned long long)((random() % 0x7FFFFF) | (1ULL << 31)));
+		s += e;
+	}
+	return s;
+}
+
+static void
+lz_codec_row(const char *name, const std::string &s)
+{
+	std::string z(lz_bound(s.size()), 0), u(s.size(), 0);
+	int n = std::max(5, (64 << 20) / (int)s.size());
+	int zn = 0;
+	double t0 = now_sec();
+	for (int i = 0; i < n; i++)
+		zn = lz_compress(s.data(), s.size(), &z[0], z.size());
+	double t1 = now_sec();
+	for (int i = 0; i < n; i++)
+		assert(lz_decompress(z.data(), zn, &u[0], u.size()) == (int)s.size());
+	double t2 = now_sec();
+	printf("%-10s %9zu %9d %7.2fx %12.0f %12.0f\n", name, s.size(), zn,
+			(double)s.size() / zn, n * s.size() / (t1 - t0) / (1 << 20),
+			n * s.size() / (t2 - t1) / (1 << 20));
+}
+
+// an extent_server::get that returns the same extent every time
+class get_srv {
+	public:
+		std::string ext;
+		int get(int, std::string &r) { r = ext; return 0; }
+};
+
+// MB/s of get()s of ext over loopback, with compression on or off
+static double
+lz_rpc_run(bool on, const std::string &ext)
+{
+	static int port = 20000 + ((getpid() + 2500) % 10000);
+	char ports[16];
+	snprintf(ports, sizeof(ports), "%d", ++port);
+	assert(setenv("RPC_COMPRESS", on ? "1" : "0", 1) == 0);
+
+	get_srv srv;
+	srv.ext = ext;
+	rpcs s(port);
+	s.reg(18, &srv, &get_srv::get);
+	sockaddr_in dst;
+	make_sockaddr("127.0.0.1", ports, &dst);
+	rpcc c(dst);
+	assert(c.bind() == 0);
+
+	int n = std::max(20, (64 << 20) / (int)ext.size());
+	double t0 = now_sec();
+	for (int i = 0; i < n; i++) {
+		std::string r;
+		assert(c.call(18, 0, r) == 0 && r.size() == ext.size());
+	}
+	double t = now_sec() - t0;
+	assert(unsetenv("RPC_COMPRESS") == 0);
+	return (double)n * ext.size() / t / (1 << 20);
+}
+
+static void
+bench_lz()
+{
+	std::string dir = lz_dir(40000);
+	std::string sparse(1 << 20, 0);
+	for (int i = 0; i < 64; i++)
+		sparse[random() % sparse.size()] = random();
+	std::string noise(1 << 20, 0);
+	for (unsigned i = 0; i < noise.size(); i++)
+		noise[i] = random();
+
+	printf("lz: compressing one extent\n");
+	printf("%-10s %9s %9s %8s %12s %12s\n", "extent", "bytes", "packed",
+			"ratio", "pack MB/s", "unpack MB/s");
+	lz_codec_row("directory", dir);
+	lz_codec_row("sparse", sparse);
+	lz_codec_row("random", noise);
+
+	printf("\nlz: get() round trips over loopback, compression off and on\n");
+	printf("%-10s %9s %14s %14s %8s\n", "extent", "bytes", "off MB/s",
+			"on MB/s", "ratio");
+	const char *names[] = { "directory", "sparse", "random" };
+	const std::string *exts[] = { &dir, &sparse, &noise };
+	for (int i = 0; i < 3; i++) {
+		double o = lz_rpc_run(false, *exts[i]);
+		double n = lz_rpc_run(true, *exts[i]);
+		printf("%-10s %9zu %14.0f %14.0f %7.2fx\n", names[i],
+				exts[i]->size(), o, n, n / o);
+	}
+}
+
+/*---------------priority lanes--------------*/
+
+// a put() that takes 2ms, as if it went to disk
+class lane_srv {
+	public:
+		int put(const std::string &buf, int &r) {
+			usleep(2000);
+			r = buf.size();
+			return 0;
+		}
+		int ping(int a, int &r) { r = a; return 0; }
+};
+
+struct lane_arg {
+	rpcc *c;
+	rpcc::TO to; // of the pings
+	int n;
+	std::atomic<bool> stop;
+	histogram h;
+};
+
+// thread 0 times n pings; the others put 256KB at a time until it is done
+static void
+lane_worker(void *a, int i)
+{
+	lane_arg *l = (lane_arg *)a;
+	if (i > 0) {
+		std::string buf(256 << 10, 'x');
+		while (!l->stop) {
+			int r;
+			assert(l->c->call(16, buf, r) == 0 && r == (int)buf.size());
+		}
+		return;
+	}
+	usleep(100000); // let the bulk traffic build up
+	for (int k = 0; k < l->n; k++) {
+		double t0 = now_sec();
+		int r;
+		assert(l->c->call(17, k, r, l->to) == 0 && r == k);
+		l->h.add((now_sec() - t0) * 1e9);
+	}
+	l->stop = true;
+}
+
+static void
+lane_row(const char *name, int nbulk, rpcc::TO to)
+{
+	static int port = 20000 + ((getpid() + 5000) % 10000);
+	char ports[16];
+	snprintf(ports, sizeof(ports), "%d", ++port);
+
+	lane_srv srv;
+	rpcs s(port, 0, 1);
+	s.reg(16, &srv, &lane_srv::put);
+	s.reg(17, &srv, &lane_srv::ping);
+	sockaddr_in dst;
+	make_sockaddr("127.0.0.1", ports, &dst);
+	rpcc c(dst);
+	assert(c.bind() == 0);
+
+	lane_arg l;
+	l.c = &c;
+	l.to = to;
+	l.n = 500;
+	l.stop = false;
+	run_threads(nbulk + 1, lane_worker, &l);
+	printf("%-14s %10.0f %10.0f %10.0f\n", name, l.h.percentile(0.5) / 1e3,
+			l.h.percentile(0.99) / 1e3, l.h.max() / 1e3);
+}
+
+static void
+bench_urgent()
+{
+	int nbulk = 4;
+
+	printf("urgent: latency of small calls while %d threads put 256KB each\n"
+			"on the same connection to a server with one dispatch thread\n",
+			nbulk);
+	printf("%-14s %10s %10s %10s\n", "calls", "p50 us", "p99 us", "max us");
+	lane_row("idle", 0, rpcc::to_max);
+	lane_row("normal", nbulk, rpcc::to_max);
+	lane_row("urgent", nbulk, rpcc::urgent());
+}
+
+/*---------------admission control--------------*/
+
+// a call that takes 2ms of a dispatch thread
+class ovl_srv {
+	public:
+		std::atomic<int> ran;
+		ovl_srv() : ran(0) {}
+		int work(int a, int &r) {
+			usleep(2000);
+			ran++;
+			r = a;
+			return 0;
+		}
+};
+
+struct ovl_stats {
+	pthread_mutex_t m;
+	histogram h; // latency of the calls that succeeded
+	int ok, busy, timedout;
+	std::atomic<int> done;
+	ovl_stats() : ok(0), busy(0), timedout(0), done(0) {
+		assert(pthread_mutex_init(&m, 0) == 0);
+	}
+};
+
+// offer rate calls/s for secs to a server with two dispatch threads
+// (1000 calls/s), each call given 1s
+static void
+ovl_row(const char *name, int max_queued, int max_qdelay, int rate,
+		double secs)
+{
+	static int port = 20000 + ((getpid() + 7500) % 10000);
+	char ports[16];
+	snprintf(ports, sizeof(ports), "%d", ++port);
+
+	ovl_srv srv;
+	rpcs *s = new rpcs(port, 0, 2);
+	s->set_admission(max_queued, max_qdelay);
+	s->reg(18, &srv, &ovl_srv::work);
+	sockaddr_in dst;
+	make_sockaddr("127.0.0.1", ports, &dst);
+	rpcc *c = new rpcc(dst);
+	assert(c->bind() == 0);
+
+	ovl_stats st;
+	int n = rate * secs;
+	double t0 = now_sec();
+	for (int i = 0; i < n; i++) {
+		double sent = now_sec();
+		c->call_async<int>(18, [&st, sent](int ret, int &r) {
+			ScopedLock ml(&st.m);
+			if (ret == 0) {
+				st.ok++;
+				st.h.add((now_sec() - sent) * 1e9);
+			} else if (ret == rpc_const::busy_failure) {
+				st.busy++;
+			} else {
+				st.timedout++;
+			}
+			st.done++;
+		}, rpcc::to(1000), i);
+		double next = t0 + (i + 1) / (double)rate;
+		double now = now_sec();
+		if (next > now)
+			usleep((next - now) * 1e6);
+	}
+	while (st.done.load() < n)
+		usleep(10000);
+	delete c;
+	delete s; // runs whatever is still queued
+	printf("%-10s %7d %7d %7d %9d %9.0f %9.0f\n", name, st.ok, st.busy,
+			st.timedout, srv.ran.load(),
+			st.ok ? st.h.percentile(0.5) / 1e6 : 0,
+			st.ok ? st.h.percentile(0.99) / 1e6 : 0);
+}
+
+static void
+bench_overload()
+{
+	int rate = 1500;
+	double secs = 3;
+
+	printf("overload: %d calls/s for %.0fs to a server that does 1000/s,\n"
+			"each call given 1s; ran counts the calls the server did\n",
+			rate, secs);
+	printf("%-10s %7s %7s %7s %9s %9s %9s\n", "admission", "ok", "busy",
+			"timeout", "ran", "p50 ms", "p99 ms");
+	// with both limits off only a full ThrPool turns calls away
+	ovl_row("off", 0, 0, rate, secs);
+	ovl_row("queue", 2 * rpcs::max_queued_per_thread, 0, rate, secs);
+	ovl_row("delay", 0, rpcs::default_max_qdelay, rate, secs);
+	ovl_row("default", 2 * rpcs::max_queued_per_thread,
+			rpcs::default_max_qdelay, rate, secs);
+}
+
+/*---------------batches--------------*/
+
+// calls/s of k 16-byte put()s at a time, made one by one or as a batch
+static double
+batch_run(bool batch, int k)
+{
+	static int port = 30000 + ((getpid() + 5000) % 10000);
+	char ports[16];
+	snprintf(ports, sizeof(ports), "%d", ++port);
+
+	put_srv srv;
+	rpcs s(port);
+	s.reg(16, &srv, &put_srv::put);
+	sockaddr_in dst;
+	make_sockaddr("127.0.0.1", ports, &dst);
+	rpcc c(dst);
+	assert(c.bind() == 0);
+
+	std::string buf(16, 'x');
+	int n = 20000 / k;
+	double t0 = now_sec();
+	for (int i = 0; i < n; i++) {
+		int r;
+		if (!batch) {
+			for (int j = 0; j < k; j++)
+				assert(c.call(16, buf, r) == 0 && r == 16);
+			continue;
+		}
+		rpc_batch b;
+		for (int j = 0; j < k; j++)
+			b.add(16, buf);
+		assert(c.call_batch(b) == 0);
+		for (int j = 0; j < k; j++)
+			assert(b.get(j, r) == 0 && r == 16);
+	}
+	return n * k / (now_sec() - t0);
+}
+
+static void
+bench_batch()
+{
+	int ks[] = { 1, 2, 4, 16 };
+
+	printf("batch: 16-byte put()s over loopback, k at a time\n");
+	printf("%9s %14s %14s %8s\n", "k", "single calls/s", "batch calls/s",
+			"speedup");
+	for (unsigned i = 0; i < sizeof(ks)/sizeof(ks[0]); i++) {
+		double o = batch_run(false, ks[i]);
+		double n = batch_run(true, ks[i]);
+		printf("%9d %14.0f %14.0f %7.2fx\n", ks[i], o, n, n / o);
+	}
+}
+
+/*---------------wire encoding--------------*/
+
+// the pdu that carries args, header included, in either encoding
+template<class... Args> static int
+wire_size(bool v2, const Args &... args)
+{
+	marshall m;
+	m.set_v2(v2);
+	((m << args), ...);
+	return m.size();
+}
+
+// args as the rsm and batch layers carry them: packed into a string
+// beforehand, in the old encoding
+template<class... Args> static std::string
+wire_inner(const Args &... args)
+{
+	marshall m;
+	((m << args), ...);
+	return m.str();
+}
+
+struct wire_rpc {
+	const char *name;
+	int (*fn)(bool v2); // request plus reply bytes
+};
+
+// typical arguments: a lock client's id is its address, a lock or an
+// extent is named by an inum (32 random bits), paxos nodes by port
+static const std::string wire_id = "127.0.0.1:38291";
+static const unsigned long long wire_inum = 0x8a3f61c9ULL;
+static const unsigned long long wire_xid = 37;
+
+static paxos_protocol::preparearg
+wire_prepare()
+{
+	paxos_protocol::preparearg a;
+	a.instance = 3;
+	a.n.n = 4;
+	a.n.m = "3772";
+	a.v = "3772 3773 3774";
+	return a;
+}
+
+static const wire_rpc wire_rpcs[] = {
+	{ "lock acquire", [](bool v2) {
+		return wire_size(v2, wire_id, wire_inum, wire_xid) +
+			wire_size(v2, 0); } },
+	{ "lock revoke", [](bool v2) {
+		return wire_size(v2, wire_inum) + wire_size(v2, 0); } },
+	{ "lock acquire via rsm", [](bool v2) {
+		std::string req = wire_inner(wire_id, wire_inum, wire_xid);
+		std::string rep = wire_inner(0);
+		return wire_size(v2, (int)lock_protocol::acquire, req) +
+			wire_size(v2, rep); } },
+	{ "rsm invoke to backup", [](bool v2) {
+		std::string req = wire_inner(wire_id, wire_inum, wire_xid);
+		return wire_size(v2, (int)lock_protocol::acquire,
+				viewstamp(2, 1234), req) + wire_size(v2, 0); } },
+	{ "extent getattr", [](bool v2) {
+		extent_protocol::attr a;
+		a.atime = a.mtime = a.ctime = 1760000000;
+		a.size = 1234;
+		return wire_size(v2, wire_inum) + wire_size(v2, a); } },
+	{ "extent get, 1KB", [](bool v2) {
+		return wire_size(v2, wire_inum) +
+			wire_size(v2, std::string(1024, 'x')); } },
+	{ "extent put, 1KB", [](bool v2) {
+		return wire_size(v2, wire_inum, std::string(1024, 'x')) +
+			wire_size(v2, 0); } },
+	{ "paxos prepare", [](bool v2) {
+		paxos_protocol::prepareres r;
+		r.oldinstance = 0;
+		r.accept = 1;
+		r.n_a.n = 3;
+		r.n_a.m = "3773";
+		r.v_a = "3772 3773 3774";
+		return wire_size(v2, std::string("3772"), wire_prepare()) +
+			wire_size(v2, r); } },
+	{ "paxos accept", [](bool v2) {
+		paxos_protocol::acceptarg a;
+		a.instance = 3;
+		a.n.n = 4;
+		a.n.m = "3772";
+		a.v = "3772 3773 3774";
+		return wire_size(v2, std::string("3772"), a) +
+			wire_size(v2, 1); } },
+	{ "paxos decide", [](bool v2) {
+		paxos_protocol::decidearg a;
+		a.instance = 3;
+		a.v = "3772 3773 3774";
+		return wire_size(v2, std::string("3772"), a) +
+			wire_size(v2, 0); } },
+};
+
+// marshall and unmarshall a lock request's args n times; per second
+static double
+wire_codec_run(bool v2, int n)
+{
+	double t0 = now_sec();
+	for (int i = 0; i < n; i++) {
+		marshall m;
+		m.set_v2(v2);
+		m << wire_id << wire_inum << wire_xid;
+		char *b;
+		int sz;
+		m.take_buf(&b, &sz);
+		unmarshall u(b, sz);
+		u.set_v2(v2);
+		u.take(RPC_HEADER_SZ);
+		std::string id;
+		unsigned long long lid, xid;
+		u >> id >> lid >> xid;
+		assert(u.okdone());
+	}
+	return n / (now_sec() - t0);
+}
+
+static void
+bench_wire()
+{
+	printf("wire: bytes per rpc, request and reply, %d-byte headers "
+			"included\n", RPC_HEADER_SZ);
+	printf("%-24s %8s %8s %8s %8s\n", "rpc", "v1", "v2", "saved",
+			"body");
+	for (unsigned i = 0; i < sizeof(wire_rpcs)/sizeof(wire_rpcs[0]); i++) {
+		int o = wire_rpcs[i].fn(false);
+		int n = wire_rpcs[i].fn(true);
+		int body = o - 2 * RPC_HEADER_SZ;
+		printf("%-24s %8d %8d %7.1f%% %7.1f%%\n", wire_rpcs[i].name, o, n,
+				100.0 * (o - n) / o, 100.0 * (o - n) / body);
+	}
+	double o = wire_codec_run(false, 1000000);
+	double n = wire_codec_run(true, 1000000);
+	printf("%-24s %8.0f %8.0f %7.2fx\n", "lock args round trips/s", o, n,
+			n / o);
+}
+
+/*---------------logging--------------*/
+
+// a message such as the servers log for every request
+enum { log_printf, log_jsl, log_jsl_off };
+static FILE *log_file;
+
+static inline void
+log_one(int how, int i)
+{
+	static const char *who = "127.0.0.1:40123 (lock_server_cache)";
+	if (how == log_printf)
+		fprintf(log_file, "acquire: id = %s lid = %016llx, xid = %d\n",
+				who, (unsigned long long)i * 7, i);
+	else if (how == log_jsl)
+		jsl_log(JSL_DBG_1, "acquire: id = %s lid = %016llx, xid = %d\n",
+				who, (unsigned long long)i * 7, i);
+	else
+		jsl_log(JSL_DBG_4, "acquire: id = %s lid = %016llx, xid = %d\n",
+				who, (unsigned long long)i * 7, i);
+}
+
+struct log_bench {
+	int how;
+	int n;
+	std::atomic<uint64_t> burst_ns;
+};
+
+// a burst that fits in the thread's ring, then a long run that has to
+// wait for the drain
+static void
+log_worker(void *arg, int)
+{
+	log_bench *b = (log_bench *)arg;
+	for (int r = 0; r < 20; r++) {
+		double t0 = now_sec();
+		for (int i = 0; i < 200; i++)
+			log_one(b->how, i);
+		b->burst_ns += (now_sec() - t0) * 1e9;
+		usleep(20000); // for the drain
+	}
+	for (int i = 0; i < b->n; i++)
+		log_one(b->how, i);
+}
+
+static void
+bench_log()
+{
+	const char *names[] = { "printf, unbuffered", "jsl_log", "jsl_log, level off" };
+	int threads[] = { 1, 4 };
+
+	// a file, as the servers' stdout is in the tests.  the drain
+	// writes to fd 1, which must not land in the table
+	char path[64];
+	snprintf(path, sizeof(path), "/tmp/microbench-log.%d", getpid());
+	log_file = fopen(path, "w");
+	setvbuf(log_file, NULL, _IONBF, 0);
+	int saved = dup(1);
+	std::vector<std::string> rows;
+	char line[128];
+	for (int h = 0; h < 3; h++) {
+		for (unsigned t = 0; t < sizeof(threads)/sizeof(threads[0]); t++) {
+			log_bench b;
+			b.how = h;
+			b.n = 100000;
+			b.burst_ns = 0;
+			dup2(fileno(log_file), 1);
+			double t0 = now_sec();
+			run_threads(threads[t], log_worker, &b);
+			binlog_flush();
+			double secs = now_sec() - t0 - 20 * 0.02;
+			dup2(saved, 1);
+			snprintf(line, sizeof(line), "%-20s %7d %14.0f %14.0f\n",
+					names[h], threads[t],
+					b.burst_ns / (20.0 * 200 * threads[t]),
+					b.n * threads[t] / secs);
+			rows.push_back(line);
+		}
+	}
+	close(saved);
+	fclose(log_file);
+	unlink(path);
+
+	printf("log: a lock_server_cache message to a file\n");
+	printf("%-20s %7s %14s %14s\n", "", "threads", "burst ns/msg",
+			"sustained msg/s");
+	for (unsigned i = 0; i < rows.size(); i++)
+		printf("%s", rows[i].c_str());
+}
+
+/*---------------main--------------*/
+
+struct section {
+	const char *name;
+	void (*fn)();
+};
+
+static section sections[] = {
+	{ "marshall", bench_marshall },
+	{ "codec", bench_codec },
+	{ "procs", bench_procs_table },
+	{ "reply_window", bench_reply_window },
+	{ "queue", bench_queue },
+	{ "thr_pool", bench_thr_pool },
+	{ "crc", bench_crc },
+	{ "transport", bench_transport },
+	{ "lz", bench_lz },
+	{ "urgent", bench_urgent },
+	{ "overload", bench_overload },
+	{ "batch", bench_batch },
+	{ "log", bench_log },
+	{ "wire", bench_wire },
+};
+
+int
+main(int argc, char *argv[])
+{
+	setvbuf(stdout, NULL, _IONBF, 0);
+	int n = sizeof(sections)/sizeof(sections[0]);
+	for (int i = 0; i < n; i++) {
+		bool run = argc < 2;
+		for (int a = 1; a < argc; a++) {
+			if (strcmp(argv[a], sections[i].name) == 0)
+				run = true;
+		}
+		if (run) {
+			sections[i].fn();
+			printf("\n");
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,268 @@
+#ifndef mpmc_queue_h
+#define mpmc_queue_h
+
+// bounded multi-producer multi-consumer queue, after Dmitry Vyukov's
+// array-based design. every slot has a sequence number that says
+// whether it is free for the producer of a given position or holds an
+// element for the consumer of that position, so enq and deq are one
+// compare-and-swap on a position counter and never take a lock.
+//
+// the blocking enq()/deq() spin for a short while and then park the
+// thread (on a futex on linux, on a condition variable elsewhere).
+
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <atomic>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define CACHE_LINE 64
+#define MPMC_SPINS 16 //failed attempts spent spinning by a blocking call
+#define MPMC_YIELDS 16 //and then yielding the cpu, before it parks
+
+// the i-th failed attempt of a blocking call: spin first, in case
+// another core is about to make progress, then give the cpu away
+static inline void
+backoff(int i)
+{
+	if (i < MPMC_SPINS) {
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#endif
+	} else {
+		sched_yield();
+	}
+}
+
+// somewhere for threads to wait for a condition (an eventcount).
+// a waiter takes a ticket with prepare(), checks its condition once
+// more and then wait()s, or just drops the ticket if the condition
+// holds by now. a wake() issued after the condition changed makes
+// every earlier ticket stale, so wait() on it returns at once.
+//
+// the low bit of the futex word says that a ticket has been handed
+// out since the last wake(), so a wake() with nobody waiting is just
+// a fence and a load, and only the first of a burst of wake()s
+// enters the kernel.
+class parker {
+	public:
+		parker() : word_(0) {
+#ifndef __linux__
+			assert(pthread_mutex_init(&m_, 0) == 0);
+			assert(pthread_cond_init(&c_, 0) == 0);
+#endif
+		}
+		~parker() {
+#ifndef __linux__
+			assert(pthread_mutex_destroy(&m_) == 0);
+			assert(pthread_cond_destroy(&c_) == 0);
+#endif
+		}
+
+		unsigned int prepare() {
+			unsigned int t = word_.fetch_or(1) | 1;
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			return t;
+		}
+		void wait(unsigned int ticket) {
+#ifdef __linux__
+			syscall(SYS_futex, (unsigned int *)&word_, FUTEX_WAIT_PRIVATE,
+					ticket, NULL, NULL, 0);
+#else
+			assert(pthread_mutex_lock(&m_) == 0);
+			while (word_.load() == ticket)
+				assert(pthread_cond_wait(&c_, &m_) == 0);
+			assert(pthread_mutex_unlock(&m_) == 0);
+#endif
+		}
+		// wakes every waiter; they re-check and the losers wait again
+		void wake() {
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			unsigned int w = word_.load();
+			if (!(w & 1))
+				return;
+			//clear the bit and bump the count; if that fails
+			//another wake() got there first
+			if (!word_.compare_exchange_strong(w, w + 1))
+				return;
+#ifdef __linux__
+			syscall(SYS_futex, (unsigned int *)&word_, FUTEX_WAKE_PRIVATE,
+					INT_MAX, NULL, NULL, 0);
+#else
+			assert(pthread_mutex_lock(&m_) == 0);
+			assert(pthread_cond_broadcast(&c_) == 0);
+			assert(pthread_mutex_unlock(&m_) == 0);
+#endif
+		}
+
+	private:
+		std::atomic<unsigned int> word_; //the futex word: count << 1 | waiters
+#ifndef __linux__
+		pthread_mutex_t m_;
+		pthread_cond_t c_;
+#endif
+};
+
+static_assert(sizeof(std::atomic<unsigned int>) == sizeof(unsigned int),
+		"futex word must be a plain 32-bit int");
+
+// T must be default constructible and assignable
+template<class T>
+class mpmc_queue {
+	public:
+		// capacity is rounded up to a power of two
+		mpmc_queue(unsigned int capacity);
+		~mpmc_queue();
+
+		// return false at once if the queue is full/empty
+		bool try_enq(const T &e);
+		bool try_deq(T *e);
+
+		// like fifo: enq() blocks while the queue is full (or returns
+		// false if !blocking), deq() blocks while it is empty
+		bool enq(const T &e, bool blocking=true);
+		void deq(T *e);
+
+		// a snapshot, may be stale by the time it returns
+		unsigned int size();
+		unsigned int capacity() { return mask_ + 1; }
+
+	private:
+		struct cell {
+			std::atomic<size_t> seq;
+			T data;
+		};
+
+		cell *buf_;
+		size_t mask_;
+
+		// producers and consumers each get their own cache lines
+		alignas(CACHE_LINE) std::atomic<size_t> enq_pos_;
+		alignas(CACHE_LINE) std::atomic<size_t> deq_pos_;
+		alignas(CACHE_LINE) parker not_empty_;
+		parker not_full_;
+		char pad_[CACHE_LINE];
+};
+
+template<class T>
+mpmc_queue<T>::mpmc_queue(unsigned int capacity)
+: enq_pos_(0), deq_pos_(0)
+{
+	size_t n = 2;
+	while (n < capacity)
+		n <<= 1;
+	buf_ = new cell[n];
+	mask_ = n - 1;
+	for (size_t i = 0; i < n; i++)
+		buf_[i].seq.store(i, std::memory_order_relaxed);
+}
+
+template<class T>
+mpmc_queue<T>::~mpmc_queue()
+{
+	//to be deleted only when no threads are using it
+	delete [] buf_;
+}
+
+template<class T> bool
+mpmc_queue<T>::try_enq(const T &e)
+{
+	cell *c;
+	size_t pos = enq_pos_.load(std::memory_order_relaxed);
+	while (1) {
+		c = &buf_[pos & mask_];
+		size_t seq = c->seq.load(std::memory_order_acquire);
+		intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+		if (dif == 0) {
+			if (enq_pos_.compare_exchange_weak(pos, pos + 1,
+						std::memory_order_relaxed))
+				break;
+		} else if (dif < 0) {
+			return false; //full
+		} else {
+			pos = enq_pos_.load(std::memory_order_relaxed);
+		}
+	}
+	c->data = e;
+	c->seq.store(pos + 1, std::memory_order_release);
+	not_empty_.wake();
+	return true;
+}
+
+template<class T> bool
+mpmc_queue<T>::try_deq(T *e)
+{
+	cell *c;
+	size_t pos = deq_pos_.load(std::memory_order_relaxed);
+	while (1) {
+		c = &buf_[pos & mask_];
+		size_t seq = c->seq.load(std::memory_order_acquire);
+		intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+		if (dif == 0) {
+			if (deq_pos_.compare_exchange_weak(pos, pos + 1,
+						std::memory_order_relaxed))
+				break;
+		} else if (dif < 0) {
+			return false; //empty
+		} else {
+			pos = deq_pos_.load(std::memory_order_relaxed);
+		}
+	}
+	*e = c->data;
+	c->seq.store(pos + mask_ + 1, std::memory_order_release);
+	not_full_.wake();
+	return true;
+}
+
+template<class T> bool
+mpmc_queue<T>::enq(const T &e, bool blocking)
+{
+	for (int i = 0; ; i++) {
+		if (try_enq(e))
+			return true;
+		if (!blocking)
+			return false;
+		if (i < MPMC_SPINS + MPMC_YIELDS) {
+			backoff(i);
+			continue;
+		}
+		unsigned int t = not_full_.prepare();
+		if (try_enq(e))
+			return true;
+		not_full_.wait(t);
+	}
+}
+
+template<class T> void
+mpmc_queue<T>::deq(T *e)
+{
+	for (int i = 0; ; i++) {
+		if (try_deq(e))
+			return;
+		if (i < MPMC_SPINS + MPMC_YIELDS) {
+			backoff(i);
+			continue;
+		}
+		unsigned int t = not_empty_.prepare();
+		if (try_deq(e))
+			return;
+		not_empty_.wait(t);
+	}
+}
+
+template<class T> unsigned int
+mpmc_queue<T>::size()
+{
+	size_t d = deq_pos_.load();
+	size_t e = enq_pos_.load();
+	return e > d ? e - d : 0;
+}
+
+#endif
@@ -2,6 +2,12 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
 
 #include "slock.h"
 #include "jsl_log.h"
@@ -9,27 +15,58 @@
 
 #include "pollmgr.h"
 
-PollMgr *PollMgr::instance = NULL;
+PollMgr **PollMgr::instances = NULL;
+int PollMgr::ninstances = 0;
 static pthread_once_t pollmgr_is_initialized = PTHREAD_ONCE_INIT;
 
 void
 PollMgrInit()
 {
-	PollMgr::instance = new PollMgr();
+	int n = 0;
+	char *reactors_env = getenv("RPC_REACTORS");
+	if (reactors_env != NULL) {
+		n = atoi(reactors_env);
+	}
+	if (n <= 0) {
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if (n <= 0) {
+		n = 1;
+	}
+	jsl_log(JSL_DBG_2, "PollMgrInit: %d reactor threads\n", n);
+
+	PollMgr::instances = new PollMgr *[n];
+	for (int i = 0; i < n; i++) {
+		PollMgr::instances[i] = new PollMgr();
+	}
+	PollMgr::ninstances = n;
 }
 
 PollMgr *
-PollMgr::Instance()
+PollMgr::Instance(int fd)
 {
 	pthread_once(&pollmgr_is_initialized, PollMgrInit);
-	return instance;
+	assert(fd >= 0);
+	return instances[fd % ninstances];
+}
+
+aio_mgr *
+PollMgr::create_aio()
+{
+	char *aio_env = getenv("RPC_AIO");
+#ifdef __linux__
+	if (aio_env == NULL || strcmp(aio_env, "select") != 0) {
+		jsl_log(JSL_DBG_2, "PollMgr::create_aio using epoll\n");
+		return new EPollAIO();
+	}
+#endif
+	jsl_log(JSL_DBG_2, "PollMgr::create_aio using select\n");
+	return new SelectAIO();
 }
 
 PollMgr::PollMgr() : pending_change_(false)
 {
-	bzero(callbacks_, MAX_POLL_FDS*sizeof(void *));
-	aio_ = new SelectAIO();
-	//aio_ = new EPollAIO();
+	aio_ = create_aio();
 
 	assert(pthread_mutex_init(&m_, NULL) == 0);
 	assert(pthread_cond_init(&changedone_c_, NULL) == 0);
@@ -45,9 +82,15 @@ PollMgr::~PollMgr()
 void
 PollMgr::add_callback(int fd, poll_flag flag, aio_callback *ch)
 {
-	assert(fd < MAX_POLL_FDS);
+	assert(fd >= 0);
 
 	ScopedLock ml(&m_);
+	if ((unsigned)fd >= callbacks_.size()) {
+		unsigned n = callbacks_.size() ? callbacks_.size() : 64;
+		while (n <= (unsigned)fd)
+			n *= 2;
+		callbacks_.resize(n, NULL);
+	}
 	aio_->watch_fd(fd, flag);
 
 	assert(!callbacks_[fd] || callbacks_[fd]==ch);
@@ -64,14 +107,23 @@ PollMgr::block_remove_fd(int fd)
 	aio_->unwatch_fd(fd, CB_RDWR);
 	pending_change_ = true;
 	assert(pthread_cond_wait(&changedone_c_, &m_)==0);
-	callbacks_[fd] = NULL;
+	if ((unsigned)fd < callbacks_.size())
+		callbacks_[fd] = NULL;
+	retry_.erase(std::remove(retry_.begin(), retry_.end(), fd), retry_.end());
+}
+
+void
+PollMgr::retry_read(int fd)
+{
+	ScopedLock ml(&m_);
+	retry_.push_back(fd);
 }
 
 void
 PollMgr::del_callback(int fd, poll_flag flag)
 {
 	ScopedLock ml(&m_);
-	if (aio_->unwatch_fd(fd, flag)) {
+	if (aio_->unwatch_fd(fd, flag) && (unsigned)fd < callbacks_.size()) {
 		callbacks_[fd] = NULL;
 	}
 }
@@ -80,7 +132,7 @@ bool
 PollMgr::has_callback(int fd, poll_flag flag, aio_callback *c)
 {
 	ScopedLock ml(&m_);
-	if (!callbacks_[fd] || callbacks_[fd]!=c)
+	if ((unsigned)fd >= callbacks_.size() || callbacks_[fd]!=c)
 		return false;
 
 	return aio_->is_watched(fd, flag);
@@ -92,39 +144,61 @@ PollMgr::wait_loop()
 
 	std::vector<int> readable;
 	std::vector<int> writable;
+	std::vector<int> retry;
 
 	while (1) {
+		retry.clear();
 		{
 			ScopedLock ml(&m_);
 			if (pending_change_) {
 				pending_change_ = false;
 				assert(pthread_cond_broadcast(&changedone_c_)==0);
 			}
+			retry.swap(retry_);
 		}
 		readable.clear();
 		writable.clear();
-		aio_->wait_ready(&readable,&writable);
+		aio_->wait_ready(&readable,&writable,
+				retry.empty() ? -1 : RETRY_READ_MS);
+
+		//retried fds that did not show up as readable by themselves
+		for (unsigned int i = 0; i < retry.size(); i++) {
+			if (std::find(readable.begin(), readable.end(), retry[i]) == readable.end())
+				readable.push_back(retry[i]);
+		}
 
 		if (!readable.size() && !writable.size()) {
 			continue;
 		} 
-		//no locking of m_
-		//because no add_callback() and del_callback should 
-		//modify callbacks_[fd] while the fd is not dead
+		//callbacks_ may be resized by add_callback(), so look each
+		//callback up under m_ but invoke it without m_. a callback
+		//cannot be deleted during this round since block_remove_fd()
+		//waits for this loop to come around
 		for (unsigned int i = 0; i < readable.size(); i++) {
 			int fd = readable[i];
-			if (callbacks_[fd])
-				callbacks_[fd]->read_cb(fd);
+			aio_callback *cb = lookup_callback(fd);
+			if (cb)
+				cb->read_cb(fd);
 		}
 
 		for (unsigned int i = 0; i < writable.size(); i++) {
 			int fd = writable[i];
-			if (callbacks_[fd])
-				callbacks_[fd]->write_cb(fd);
+			aio_callback *cb = lookup_callback(fd);
+			if (cb)
+				cb->write_cb(fd);
 		}
 	}
 }
 
+aio_callback *
+PollMgr::lookup_callback(int fd)
+{
+	ScopedLock ml(&m_);
+	if ((unsigned)fd >= callbacks_.size())
+		return NULL;
+	return callbacks_[fd];
+}
+
 SelectAIO::SelectAIO() : highfds_(0)
 {
 	FD_ZERO(&rfds_);
@@ -149,6 +223,9 @@ SelectAIO::~SelectAIO()
 void
 SelectAIO::watch_fd(int fd, poll_flag flag)
 {
+	//fd_set cannot describe larger fds; use the epoll backend
+	assert(fd < FD_SETSIZE);
+
 	ScopedLock ml(&m_);
 	if (highfds_ <= fd) 
 		highfds_ = fd;
@@ -215,7 +292,7 @@ SelectAIO::unwatch_fd(int fd, poll_flag flag)
 }
 
 void
-SelectAIO::wait_ready(std::vector<int> *readable, std::vector<int> *writable)
+SelectAIO::wait_ready(std::vector<int> *readable, std::vector<int> *writable, int timeout_ms)
 {
 	fd_set trfds, twfds;
 	int high;
@@ -228,7 +305,10 @@ SelectAIO::wait_ready(std::vector<int> *readable, std::vector<int> *writable)
 
 	}
 
-	int ret = select(high+1, &trfds, &twfds, NULL, NULL);
+	struct timeval tv;
+	tv.tv_sec = timeout_ms / 1000;
+	tv.tv_usec = (timeout_ms % 1000) * 1000;
+	int ret = select(high+1, &trfds, &twfds, NULL, timeout_ms < 0 ? NULL : &tv);
 
 	if (ret < 0) {
 		if (errno == EINTR) {
@@ -260,99 +340,149 @@ SelectAIO::wait_ready(std::vector<int> *readable, std::vector<int> *writable)
 
 EPollAIO::EPollAIO()
 {
-	pollfd_ = epoll_create(MAX_POLL_FDS);
+	pollfd_ = epoll_create(MAX_POLL_EVENTS);
 	assert(pollfd_ >= 0);
-	bzero(fdstatus_, sizeof(int)*MAX_POLL_FDS);
+
+	wakefd_ = eventfd(0, EFD_NONBLOCK);
+	assert(wakefd_ >= 0);
+
+	struct epoll_event ev;
+	bzero(&ev, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLET;
+	ev.data.fd = wakefd_;
+	assert(epoll_ctl(pollfd_, EPOLL_CTL_ADD, wakefd_, &ev) == 0);
+
+	assert(pthread_mutex_init(&m_, NULL) == 0);
 }
 
 EPollAIO::~EPollAIO()
 {
+	close(wakefd_);
 	close(pollfd_);
+	assert(pthread_mutex_destroy(&m_) == 0);
 }
 
-static inline
-int poll_flag_to_event(poll_flag flag)
-{
-	int f;
-	if (flag == CB_RDONLY) {
-		f = EPOLLIN;
-	}else if (flag == CB_WRONLY) {
-		f = EPOLLOUT;
-	}else { //flag == CB_RDWR
-		f = EPOLLIN | EPOLLOUT;
-	}
-	return f;
-}
-
+//register the new interest set of fd with the kernel. an unchanged
+//set is re-armed with EPOLL_CTL_MOD, which makes the kernel report the
+//fd again if it is still ready. caller holds m_
 void
-EPollAIO::watch_fd(int fd, poll_flag flag)
+EPollAIO::update_fd(int fd, int oldstatus)
 {
-	assert(fd < MAX_POLL_FDS);
+	int status = fdstatus_[fd];
+	if (!status && !oldstatus)
+		return;
 
 	struct epoll_event ev;
-	int op = fdstatus_[fd]? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
-	fdstatus_[fd] |= (int)flag;
-
+	bzero(&ev, sizeof(ev));
 	ev.events = EPOLLET;
 	ev.data.fd = fd;
 
-	if (fdstatus_[fd] & CB_RDONLY) {
+	if (status & CB_RDONLY) {
 		ev.events |= EPOLLIN;
 	}
-	if (fdstatus_[fd] & CB_WRONLY) {
+	if (status & CB_WRONLY) {
 		ev.events |= EPOLLOUT;
 	}
 
-	if (flag == CB_RDWR) {
-		assert(ev.events == (uint32_t)(EPOLLET | EPOLLIN | EPOLLOUT));
+	int op;
+	if (!oldstatus) {
+		op = EPOLL_CTL_ADD;
+	} else if (!status) {
+		op = EPOLL_CTL_DEL;
+	} else {
+		op = EPOLL_CTL_MOD;
+	}
+	if (epoll_ctl(pollfd_, op, fd, &ev) != 0) {
+		//a dead connection may have shut its socket down already;
+		//there is nothing left to watch in that case
+		jsl_log(JSL_DBG_1, "EPollAIO::update_fd fd %d op %d errno %d\n",
+				fd, op, errno);
+		assert(op == EPOLL_CTL_DEL);
 	}
+}
 
-	assert(epoll_ctl(pollfd_, op, fd, &ev) == 0);
+void
+EPollAIO::watch_fd(int fd, poll_flag flag)
+{
+	assert(fd >= 0);
+
+	ScopedLock ml(&m_);
+	if ((unsigned)fd >= fdstatus_.size()) {
+		unsigned n = fdstatus_.size() ? fdstatus_.size() : 64;
+		while (n <= (unsigned)fd)
+			n *= 2;
+		fdstatus_.resize(n, 0);
+	}
+
+	int old = fdstatus_[fd];
+	fdstatus_[fd] |= (int)flag;
+	update_fd(fd, old);
 }
 
 bool 
 EPollAIO::unwatch_fd(int fd, poll_flag flag)
 {
-	assert(fd < MAX_POLL_FDS);
-	fdstatus_[fd] &= ~(int)flag;
+	assert(fd >= 0);
 
-	struct epoll_event ev;
-	int op = fdstatus_[fd]? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-
-	ev.events = EPOLLET;
-	ev.data.fd = fd;
-
-	if (fdstatus_[fd] & CB_RDONLY) {
-		ev.events |= EPOLLIN;
-	}
-	if (fdstatus_[fd] & CB_WRONLY) {
-		ev.events |= EPOLLOUT;
+	ScopedLock ml(&m_);
+	if ((unsigned)fd < fdstatus_.size()) {
+		int old = fdstatus_[fd];
+		fdstatus_[fd] &= ~(int)flag;
+		if (fdstatus_[fd] != old)
+			update_fd(fd, old);
 	}
 
 	if (flag == CB_RDWR) {
-		assert(op == EPOLL_CTL_DEL);
+		//block_remove_fd() waits for wait_loop() to come around
+		uint64_t one = 1;
+		assert(write(wakefd_, &one, sizeof(one)) == sizeof(one));
 	}
-	assert(epoll_ctl(pollfd_, op, fd, &ev) == 0);
-	return (op == EPOLL_CTL_DEL);
+	return ((unsigned)fd >= fdstatus_.size() || fdstatus_[fd] == 0);
 }
 
 bool
 EPollAIO::is_watched(int fd, poll_flag flag)
 {
-	assert(fd < MAX_POLL_FDS);
-	return ((fdstatus_[fd] & CB_MASK) == flag);
+	ScopedLock ml(&m_);
+	if (fd < 0 || (unsigned)fd >= fdstatus_.size())
+		return false;
+	return ((fdstatus_[fd] & flag) == flag);
 }
 
 void
-EPollAIO::wait_ready(std::vector<int> *readable, std::vector<int> *writable)
+EPollAIO::wait_ready(std::vector<int> *readable, std::vector<int> *writable, int timeout_ms)
 {
-	int nfds = epoll_wait(pollfd_, ready_,	MAX_POLL_FDS, -1);
+	int nfds = epoll_wait(pollfd_, ready_, MAX_POLL_EVENTS, timeout_ms);
+	if (nfds < 0) {
+		if (errno == EINTR) {
+			return;
+		} else {
+			perror("epoll_wait:");
+			jsl_log(JSL_DBG_OFF, "PollMgr::epoll_loop failure errno %d\n",errno);
+			assert(0);
+		}
+	}
+	ScopedLock ml(&m_);
 	for (int i = 0; i < nfds; i++) {
-		if (ready_[i].events & EPOLLIN) {
-			readable->push_back(ready_[i].data.fd);
+		int fd = ready_[i].data.fd;
+		uint32_t ev = ready_[i].events;
+		if (fd == wakefd_) {
+			uint64_t cnt;
+			while (read(wakefd_, &cnt, sizeof(cnt)) > 0)
+				;
+			continue;
+		}
+		//errors and hangups are reported to whichever callback
+		//is watching; its read()/write() will see the failure
+		if (ev & (EPOLLERR | EPOLLHUP)) {
+			ev |= EPOLLIN | EPOLLOUT;
+		}
+		int status = (unsigned)fd < fdstatus_.size() ? fdstatus_[fd] : 0;
+		if ((ev & EPOLLIN) && (status & CB_RDONLY)) {
+			readable->push_back(fd);
 		}
-		if (ready_[i].events & EPOLLOUT) {
-			writable->push_back(ready_[i].data.fd);
+		if ((ev & EPOLLOUT) && (status & CB_WRONLY)) {
+			writable->push_back(fd);
 		}
 	}
 }
@@ -8,7 +8,12 @@
 #include <sys/epoll.h>
 #endif
 
-#define MAX_POLL_FDS 128
+// maximum number of ready events harvested by one epoll_wait();
+// this bounds the batch size, not the number of watched fds
+#define MAX_POLL_EVENTS 256
+
+// how long a read callback that called retry_read() is left to wait
+#define RETRY_READ_MS 1
 
 typedef enum {
 	CB_NONE = 0x0,
@@ -23,7 +28,9 @@ class aio_mgr {
 		virtual void watch_fd(int fd, poll_flag flag) = 0;
 		virtual bool unwatch_fd(int fd, poll_flag flag) = 0;
 		virtual bool is_watched(int fd, poll_flag flag) = 0;
-		virtual void wait_ready(std::vector<int> *readable, std::vector<int> *writable) = 0;
+		// wait for readiness, or at most timeout_ms milliseconds
+		// (-1 waits forever)
+		virtual void wait_ready(std::vector<int> *readable, std::vector<int> *writable, int timeout_ms) = 0;
 		virtual ~aio_mgr() {}
 };
 
@@ -39,26 +46,43 @@ class PollMgr {
 		PollMgr();
 		~PollMgr();
 
-		static PollMgr *Instance();
-		static PollMgr *CreateInst();
+		// PollMgr runs RPC_REACTORS event loops (one per core by
+		// default). a connection stays on the loop picked by its fd
+		// for its whole lifetime.
+		static PollMgr *Instance(int fd);
+		static int Reactors() { return ninstances; }
 
 		void add_callback(int fd, poll_flag flag, aio_callback *ch);
 		void del_callback(int fd, poll_flag flag);
 		bool has_callback(int fd, poll_flag flag, aio_callback *ch);
 		void block_remove_fd(int fd);
+		// the read callback of fd could not consume all of its input
+		// (e.g. the dispatch queue is full) and may hold some of it
+		// in memory already; call it again shortly whether or not
+		// the socket becomes readable. only for use by callbacks.
+		void retry_read(int fd);
 		void wait_loop();
 
+		// pick the aio backend: RPC_AIO=select or RPC_AIO=epoll
+		// (the default on linux)
+		static aio_mgr *create_aio();
+
 
-		static PollMgr *instance;
+		static PollMgr **instances;
+		static int ninstances;
 		static int useful;
 		static int useless;
 
 	private:
+		aio_callback *lookup_callback(int fd);
+
 		pthread_mutex_t m_;
 		pthread_cond_t changedone_c_;
 		pthread_t th_;
 
-		aio_callback *callbacks_[MAX_POLL_FDS];
+		// fd -> callback, grown on demand in add_callback()
+		std::vector<aio_callback *> callbacks_;
+		std::vector<int> retry_; // fds for retry_read()
 		aio_mgr *aio_;
 		bool pending_change_;
 
@@ -72,7 +96,7 @@ class SelectAIO : public aio_mgr {
 		void watch_fd(int fd, poll_flag flag);
 		bool unwatch_fd(int fd, poll_flag flag);
 		bool is_watched(int fd, poll_flag flag);
-		void wait_ready(std::vector<int> *readable, std::vector<int> *writable);
+		void wait_ready(std::vector<int> *readable, std::vector<int> *writable, int timeout_ms);
 
 	private:
 
@@ -86,6 +110,11 @@ class SelectAIO : public aio_mgr {
 };
 
 #ifdef __linux__ 
+// edge-triggered epoll backend. watch_fd()/unwatch_fd() only need an
+// epoll_ctl(), so the wait loop is woken up (through an eventfd) only
+// when an fd is removed entirely and block_remove_fd() is waiting for
+// the loop to come around. callbacks must consume all available
+// input/output space since the kernel reports each readiness edge once.
 class EPollAIO : public aio_mgr {
 	public:
 		EPollAIO();
@@ -93,12 +122,16 @@ class EPollAIO : public aio_mgr {
 		void watch_fd(int fd, poll_flag flag);
 		bool unwatch_fd(int fd, poll_flag flag);
 		bool is_watched(int fd, poll_flag flag);
-		void wait_ready(std::vector<int> *readable, std::vector<int> *writable);
+		void wait_ready(std::vector<int> *readable, std::vector<int> *writable, int timeout_ms);
 
 	private:
+		void update_fd(int fd, int oldstatus);
+
 		int pollfd_;
-		struct epoll_event ready_[MAX_POLL_FDS];
-		int fdstatus_[MAX_POLL_FDS];
+		int wakefd_;
+		pthread_mutex_t m_; // protects fdstatus_
+		struct epoll_event ready_[MAX_POLL_EVENTS];
+		std::vector<int> fdstatus_; // poll_flag bits per fd, grown on demand
 
 };
 #endif /* __linux */
@@ -0,0 +1,56 @@
+#include "slock.h"
+#include "proc_table.h"
+
+proc_table::proc_table()
+{
+	assert(pthread_mutex_init(&m_, 0) == 0);
+	for (int i = 0; i < PROC_NPAGES; i++)
+		pages_[i].store(NULL, std::memory_order_relaxed);
+}
+
+proc_table::~proc_table()
+{
+	for (int i = 0; i < PROC_NPAGES; i++)
+		delete [] pages_[i].load();
+	assert(pthread_mutex_destroy(&m_) == 0);
+}
+
+bool
+proc_table::add(unsigned int proc, handler *h)
+{
+	if (proc >= PROC_NPAGES * PROC_PAGE_SZ)
+		return false;
+
+	ScopedLock ml(&m_);
+	std::atomic<handler *> *page =
+		pages_[proc >> PROC_PAGE_SHIFT].load(std::memory_order_relaxed);
+	if (!page) {
+		page = new std::atomic<handler *>[PROC_PAGE_SZ];
+		for (int i = 0; i < PROC_PAGE_SZ; i++)
+			page[i].store(NULL, std::memory_order_relaxed);
+		//the page is all NULL before anyone can see it
+		pages_[proc >> PROC_PAGE_SHIFT].store(page, std::memory_order_release);
+	}
+
+	std::atomic<handler *> &e = page[proc & (PROC_PAGE_SZ - 1)];
+	if (e.load(std::memory_order_relaxed) != NULL)
+		return false;
+	e.store(h, std::memory_order_release);
+	return true;
+}
+
+void
+proc_table::list(std::vector<std::pair<unsigned int, handler *> > *v)
+{
+	v->clear();
+	for (int i = 0; i < PROC_NPAGES; i++) {
+		std::atomic<handler *> *page = pages_[i].load(std::memory_order_acquire);
+		if (!page)
+			continue;
+		for (int j = 0; j < PROC_PAGE_SZ; j++) {
+			handler *h = page[j].load(std::memory_order_acquire);
+			if (h)
+				v->push_back(std::make_pair((i << PROC_PAGE_SHIFT) | j, h));
+		}
+	}
+}
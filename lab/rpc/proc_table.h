@@ -0,0 +1,50 @@
+#ifndef proc_table_h
+#define proc_table_h
+
+#include <pthread.h>
+#include <atomic>
+#include <utility>
+#include <vector>
+
+class handler;
+
+// an rpcs's handlers, by procedure number.  each protocol numbers its
+// procedures from a multiple of 0x1000 (0x6001.. extent, 0x7001.. lock,
+// 0x8001.. rlock, 0x9001.. and 0x10001.. rsm, ...), so the table is an
+// array of 4096-entry pages, one per range, allocated when the first
+// procedure of the range is registered.
+//
+// handlers are registered while the server starts up and never
+// removed.  add() takes a lock and publishes the new entry with a
+// release store, so lookup() is two loads and needs no lock at all.
+#define PROC_PAGE_SHIFT 12
+#define PROC_PAGE_SZ (1 << PROC_PAGE_SHIFT)
+#define PROC_NPAGES 256 // procedure numbers below 1 << 20
+
+class proc_table {
+	public:
+		proc_table();
+		~proc_table();
+
+		// false if proc is out of range or already registered
+		bool add(unsigned int proc, handler *h);
+
+		// every registered procedure, in order
+		void list(std::vector<std::pair<unsigned int, handler *> > *v);
+
+		handler *lookup(unsigned int proc) {
+			if (proc >= PROC_NPAGES * PROC_PAGE_SZ)
+				return NULL;
+			std::atomic<handler *> *page =
+				pages_[proc >> PROC_PAGE_SHIFT].load(std::memory_order_acquire);
+			if (!page)
+				return NULL;
+			return page[proc & (PROC_PAGE_SZ - 1)].load(std::memory_order_acquire);
+		}
+
+	private:
+		std::atomic<std::atomic<handler *> *> pages_[PROC_NPAGES];
+		pthread_mutex_t m_; // serializes add()
+};
+
+#endif
@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "slock.h"
+#include "jsl_log.h"
+#include "bufpool.h"
+#include "marshall.h"
+#include "reply_window.h"
+
+reply_window::reply_window()
+{
+	for (int i = 0; i < nshards; i++) {
+		assert(pthread_mutex_init(&shards_[i].m, 0) == 0);
+	}
+}
+
+reply_window::~reply_window()
+{
+	for (int i = 0; i < nshards; i++) {
+		std::unordered_map<unsigned int, client_t>::iterator it;
+		for (it = shards_[i].clients.begin(); it != shards_[i].clients.end(); ++it) {
+			forget(it->second, it->second.base + it->second.replies.size());
+		}
+		assert(pthread_mutex_destroy(&shards_[i].m) == 0);
+	}
+}
+
+// drop every reply with an xid up to and including xid_rep.
+// caller holds the shard lock
+void
+reply_window::forget(client_t &c, unsigned int xid_rep)
+{
+	if (xid_rep < c.base)
+		return;
+
+	unsigned int n = xid_rep - c.base + 1;
+	if (n > c.replies.size())
+		n = c.replies.size();
+	for (unsigned int i = 0; i < n; i++) {
+		rpc_buf_free(c.replies[i].buf);
+	}
+	c.replies.erase(c.replies.begin(), c.replies.begin() + n);
+	c.base = xid_rep + 1;
+}
+
+reply_window::rpcstate_t
+reply_window::check(unsigned int clt_nonce, unsigned int xid,
+		unsigned int xid_rep, char **b, int *sz)
+{
+	shard_t &s = shard(clt_nonce);
+	ScopedLock ml(&s.m);
+
+	std::unordered_map<unsigned int, client_t>::iterator it = s.clients.find(clt_nonce);
+	if (it == s.clients.end()) {
+		jsl_log(JSL_DBG_2, "reply_window::check: new client %u xid %d\n",
+				clt_nonce, xid);
+		it = s.clients.insert(std::make_pair(clt_nonce, client_t())).first;
+	}
+	client_t &c = it->second;
+
+	forget(c, xid_rep);
+	if (xid < c.base) {
+		return FORGOTTEN;
+	}
+	if (xid - c.base >= max_window) {
+		forget(c, xid - max_window);
+	}
+
+	unsigned int i = xid - c.base;
+	if (i >= c.replies.size()) {
+		c.replies.resize(i + 1);
+	}
+
+	reply_t &r = c.replies[i];
+	if (!r.seen) {
+		r.seen = true;
+		return NEW;
+	}
+	if (!r.cb_present) {
+		return INPROGRESS;
+	}
+	*b = rpc_buf_alloc(r.sz);
+	memcpy(*b + RPC_FRAME_SZ, r.buf + RPC_FRAME_SZ, r.sz - RPC_FRAME_SZ);
+	memset(*b, 0, RPC_FRAME_SZ);
+	rpc_put_be<uint32_t>(*b, r.flags);
+	*sz = r.sz;
+	return DONE;
+}
+
+bool
+reply_window::add(unsigned int clt_nonce, unsigned int xid, char *b, int sz,
+		unsigned int flags)
+{
+	shard_t &s = shard(clt_nonce);
+	ScopedLock ml(&s.m);
+
+	std::unordered_map<unsigned int, client_t>::iterator it = s.clients.find(clt_nonce);
+	if (it == s.clients.end())
+		return false;
+	client_t &c = it->second;
+	if (xid < c.base || xid - c.base >= c.replies.size())
+		return false;
+
+	reply_t &r = c.replies[xid - c.base];
+	assert(r.seen && !r.cb_present);
+	r.cb_present = true;
+	r.buf = b;
+	r.sz = sz;
+	r.flags = flags;
+	return true;
+}
+
+void
+reply_window::stats(unsigned int *clients, unsigned int *total,
+		unsigned int *maxrep)
+{
+	*clients = *total = *maxrep = 0;
+	for (int i = 0; i < nshards; i++) {
+		ScopedLock ml(&shards_[i].m);
+		std::unordered_map<unsigned int, client_t>::iterator it;
+		for (it = shards_[i].clients.begin(); it != shards_[i].clients.end(); ++it) {
+			unsigned int n = 0;
+			for (unsigned int j = 0; j < it->second.replies.size(); j++) {
+				if (it->second.replies[j].cb_present)
+					n++;
+			}
+			(*clients)++;
+			*total += n;
+			if (n > *maxrep)
+				*maxrep = n;
+		}
+	}
+}
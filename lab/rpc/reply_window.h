@@ -0,0 +1,85 @@
+#ifndef reply_window_h
+#define reply_window_h
+
+#include <pthread.h>
+#include <deque>
+#include <unordered_map>
+
+// the at-most-once state of an rpcs: for each client (clt_nonce), the
+// replies that the client has not acknowledged receiving yet.
+//
+// clients number their requests with consecutive xids and acknowledge
+// every reply up to xid_rep with each request, so the replies of one
+// client are kept in a deque indexed by xid - base, where base is the
+// oldest xid not yet acknowledged.  a lookup or insert is O(1) and
+// acknowledged replies are dropped from the front in bulk.  clients
+// are spread over shards by clt_nonce, each with its own lock, so
+// dispatch threads serving different clients do not contend.
+class reply_window {
+	public:
+		typedef enum {
+			NEW,  // new RPC, not a duplicate
+			INPROGRESS, // duplicate of an RPC we're still processing
+			DONE, // duplicate of an RPC we already replied to (have reply)
+			FORGOTTEN,  // duplicate of an old RPC whose reply we've forgotten
+		} rpcstate_t;
+
+		reply_window();
+		~reply_window();
+
+		// forget the replies of clt_nonce up to xid_rep, then look
+		// up xid. a NEW xid is recorded as in progress; for DONE,
+		// *b and *sz are set to a copy of the saved reply, which the
+		// caller must release with rpc_buf_free().  the copy's length
+		// word holds the flags it was saved with
+		rpcstate_t check(unsigned int clt_nonce, unsigned int xid,
+				unsigned int xid_rep, char **b, int *sz);
+
+		// save the reply to a NEW xid, taking over b, along with the
+		// PDU_* flags it is sent with.  b may still be on its way out
+		// (see rpc_buf_ref()): only the bytes after the frame are
+		// ever read back, as the connection writes the frame.
+		// returns false, leaving b to the caller, if the client has
+		// acknowledged the reply in the meantime
+		bool add(unsigned int clt_nonce, unsigned int xid, char *b, int sz,
+				unsigned int flags);
+
+		void stats(unsigned int *clients, unsigned int *total,
+				unsigned int *maxrep);
+
+	private:
+		struct reply_t {
+			reply_t() : cb_present(false), seen(false), buf(NULL), sz(0),
+				flags(0) {}
+			bool cb_present;
+			bool seen;
+			char *buf;
+			int sz;
+			unsigned int flags;
+		};
+
+		struct client_t {
+			client_t() : base(0) {}
+			unsigned int base; // xid of replies[0]
+			std::deque<reply_t> replies;
+		};
+
+		struct shard_t {
+			pthread_mutex_t m;
+			std::unordered_map<unsigned int, client_t> clients;
+		};
+
+		static const int nshards = 64;
+		// the most replies kept for one client; a request further
+		// ahead of the oldest unacknowledged one forgets the oldest
+		static const unsigned int max_window = 1 << 16;
+
+		shard_t shards_[nshards];
+
+		shard_t &shard(unsigned int clt_nonce) {
+			return shards_[clt_nonce % nshards];
+		}
+		void forget(client_t &c, unsigned int xid_rep);
+};
+
+#endif
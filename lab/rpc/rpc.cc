@@ -11,17 +11,24 @@
 
  Both rpcc and rpcs class use connection class as an abstraction for the
  underlying communication channel.  To send an RPC request/reply, one calls
- connection::send() which blocks until data is sent or connection has failed
- (thus caller can safely free the buffer occupied by send() arguments).  When a
+ connection::send() which queues the data on the connection and blocks until it
+ is sent or the connection has failed (thus caller can safely free the buffer
+ occupied by send() arguments), or connection::send_async() which hands the
+ buffer over to the connection and returns at once.  Each connection writes
+ its queue of pending messages in order, batching several into one writev(),
+ so a small reply does not wait for a lock on the channel.  When a
  request/reply is received, connection makes a callback into the corresponding
  rpcc or rpcs (see rpcc::got_pdu() and rpcs::got_pdu()).
 
  Thread organization:
  rpcc uses application threads to send RPC requests and blocks to receive the
- rely or error. All connections use a single PollMgr object to perform async
- socket IO.  PollMgr creates a single thread to examine the readiness of socket
- file descriptors and informs the corresponding connection whenever a socket is
- ready to be read or written.  (We use asynchronous socket IO to reduce the
+ rely or error. All connections use PollMgr objects to perform async socket
+ IO.  Each PollMgr runs one thread (a reactor) that examines the readiness of
+ its socket file descriptors and informs the corresponding connection whenever
+ a socket is ready to be read or written.  There are RPC_REACTORS of them (one
+ per core by default) and a connection is bound to one of them, chosen by its
+ fd, for its lifetime, so connections accepted by a busy server are read and
+ parsed on all cores.  (We use asynchronous socket IO to reduce the
  number of threads needed to manage these connections; without async IO, at
  least one thread is needed per connection to read data without blocking other
  activities.)  Each rpcs object creates one thread for listening on the server
@@ -72,12 +79,21 @@
 
 #include "jsl_log.h"
 #include "gettime.h"
+#include "lz.h"
 
 const rpcc::TO rpcc::to_max = { 120000 };
 const rpcc::TO rpcc::to_min = { 1000 };
+const rpcc::TO rpcc::rto_floor = { 5 };
+//never wait longer than before for a dead connection to be noticed
+const rpcc::TO rpcc::rto_ceiling = { 1000 };
+const rpcc::TO rpcc::backoff_floor = { 2 };
+const rpcc::TO rpcc::backoff_ceiling = { 500 };
 
 rpcc::caller::caller(unsigned int xxid, unmarshall *xun)
-: xid(xxid), un(xun), done(false)
+: xid(xxid), un(xun ? xun : &rep), intret(0), done(false), lz(false),
+	ntransmits(0),
+	req(NULL), reqsz(0), refs(0), curr_to(0), flags(0),
+	backoff(backoff_floor.to), resend(false), ch(NULL)
 {
 	assert(pthread_mutex_init(&m,0) == 0);
 	assert(pthread_cond_init(&c, 0) == 0);
@@ -87,6 +103,72 @@ rpcc::caller::~caller()
 {
 	assert(pthread_mutex_destroy(&m) == 0);
 	assert(pthread_cond_destroy(&c) == 0);
+	rpc_buf_free(req);
+	if (ch)
+		ch->decref();
+}
+
+//is a on this host: a unix-domain socket or a loopback address
+static bool
+local_addr(const sockaddr_storage &a)
+{
+	if (a.ss_family == AF_UNIX)
+		return true;
+	if (a.ss_family == AF_INET)
+		return (ntohl(((const sockaddr_in &)a).sin_addr.s_addr) >> 24) ==
+			IN_LOOPBACKNET;
+	return false;
+}
+
+//the bind features this process supports, talking to peer if it is a
+//client; RPC_CHECKSUM=0 turns off pdu checksums, RPC_COMPRESS=0
+//compression, RPC_BATCH=0 batches, RPC_V2=0 the compact encoding and
+//RPC_BUSY=0 busy replies.
+//compression is off by default for a peer on this host, where copying
+//the bytes costs less than compressing them; RPC_COMPRESS=1 turns it on
+static int
+local_features(const sockaddr_storage *peer = NULL)
+{
+	int f = rpc_const::feat_urgent | rpc_const::feat_budget;
+	char *batch_env = getenv("RPC_BATCH");
+	if (batch_env == NULL || atoi(batch_env) != 0)
+		f |= rpc_const::feat_batch;
+	char *crc_env = getenv("RPC_CHECKSUM");
+	if (crc_env == NULL || atoi(crc_env) != 0)
+		f |= rpc_const::feat_crc32c;
+	char *lz_env = getenv("RPC_COMPRESS");
+	if (lz_env ? atoi(lz_env) != 0 : !(peer && local_addr(*peer)))
+		f |= rpc_const::feat_lz;
+	char *v2_env = getenv("RPC_V2");
+	if (v2_env == NULL || atoi(v2_env) != 0)
+		f |= rpc_const::feat_v2;
+	char *busy_env = getenv("RPC_BUSY");
+	if (busy_env == NULL || atoi(busy_env) != 0)
+		f |= rpc_const::feat_busy;
+	return f;
+}
+
+//the PDU_* flags of a request: whether to hurry it, whether its body
+//is compact, and once the server has agreed to compression, that the
+//reply may be compressed and whether req itself is (which it is from
+//now on, if worth it).  a server that takes budgets gets room for one
+//at the end of req, filled in when req is sent
+static unsigned int
+req_flags(marshall &req, int features, rpcc::TO to)
+{
+	unsigned int f = to.urgent ? PDU_URGENT : 0;
+	if (req.v2())
+		f |= PDU_V2;
+	if (features & rpc_const::feat_lz) {
+		f |= PDU_LZ_OK;
+		if (req.lz_pack())
+			f |= PDU_LZ;
+	}
+	if (features & rpc_const::feat_budget) {
+		f |= PDU_BUDGET;
+		rpc_req_set_budget(req.grab(sizeof(int)) + sizeof(int), 0);
+	}
+	return f;
 }
 
 inline
@@ -97,13 +179,29 @@ void set_rand_seed()
 	srandom((int)ts.tv_nsec^((int)getpid()));
 }
 
-rpcc::rpcc(sockaddr_in d, bool retrans) : 
+static sockaddr_storage
+storage_of(const sockaddr_in &in)
+{
+	sockaddr_storage a;
+	memset(&a, 0, sizeof(a));
+	memcpy(&a, &in, sizeof(in));
+	return a;
+}
+
+rpcc::rpcc(sockaddr_in d, bool retrans) : rpcc(storage_of(d), retrans)
+{
+}
+
+rpcc::rpcc(const sockaddr_storage &d, bool retrans) : 
 	dst_(d), srv_nonce_(0), bind_done_(false), xid_(1), lossytest_(0), 
-	retrans_(retrans), reachable_(true), chan_(NULL), destroy_wait_ (false)
+	retrans_(retrans), reachable_(true), chan_(NULL), uchan_(NULL), features_(0), destroy_wait_ (false),
+	have_rtt_(false), srtt_(0), rttvar_(0), rto_(to_min.to * 1000),
+	async_started_(false), async_stop_(false)
 {
 	assert(pthread_mutex_init(&m_, 0) == 0);
 	assert(pthread_mutex_init(&chan_m_, 0) == 0);
 	assert(pthread_cond_init(&destroy_wait_c_, 0) == 0);
+	assert(pthread_cond_init(&async_c_, 0) == 0);
 
 	if (retrans) {
 		set_rand_seed();
@@ -133,27 +231,53 @@ rpcc::~rpcc()
 {
 	jsl_log(JSL_DBG_2, "rpcc::~rpcc delete nonce %d channo=%d\n", 
 			clt_nonce_, chan_?chan_->channo():-1); 
+	if (async_started_) {
+		{
+			ScopedLock ml(&m_);
+			async_stop_ = true;
+			assert(pthread_cond_signal(&async_c_) == 0);
+		}
+		assert(pthread_join(async_th_, NULL) == 0);
+	}
 	if (chan_) {
 		chan_->closeconn();
 		chan_->decref();
 	}
+	if (uchan_) {
+		uchan_->closeconn();
+		uchan_->decref();
+	}
 	assert(calls_.size() == 0);
 	assert(pthread_mutex_destroy(&m_) == 0);
 	assert(pthread_mutex_destroy(&chan_m_) == 0);
+	assert(pthread_cond_destroy(&async_c_) == 0);
 }
 
 int
 rpcc::bind(TO to)
 {
 	int r;
-	int ret = call(rpc_const::bind, 0, r, to);
-	if (ret == 0) {
+	int offer = local_features(&dst_);
+	//in the old encoding, which every server takes
+	marshall m;
+	m << offer;
+	int ret = call_m(rpc_const::bind, m, r, to);
+	if (ret >= 0) {
+		{
+			ScopedLock ml(&chan_m_);
+			features_ = ret & offer;
+			if (chan_) {
+				chan_->set_checksum(features_ & rpc_const::feat_crc32c);
+				chan_->set_mark_urgent(features_ & rpc_const::feat_urgent);
+			}
+		}
 		ScopedLock ml(&m_);
 		bind_done_ = true;
 		srv_nonce_ = r;
+		ret = 0;
 	} else {
 		jsl_log(JSL_DBG_2, "rpcc::bind %s failed %d\n", 
-				inet_ntoa(dst_.sin_addr), ret);
+				sockaddr_str(dst_).c_str(), ret);
 	}
 	return ret;
 };
@@ -163,7 +287,7 @@ void
 rpcc::cancel(void)
 {
   ScopedLock ml(&m_);
-  printf("rpcc::cancel: force callers to fail\n");
+  jsl_log(JSL_DBG_1, "rpcc::cancel: force callers to fail\n");
   std::map<int,caller*>::iterator iter;
   for(iter = calls_.begin(); iter != calls_.end(); iter++){
     caller *ca = iter->second;
@@ -177,11 +301,42 @@ rpcc::cancel(void)
     }
   }
 
+  // asynchronous callers have no thread waiting on them; finish them here
+  for(iter = calls_.begin(); iter != calls_.end(); ){
+    caller *ca = (iter++)->second;
+    if (ca->cb) {
+      finish_async_wo(ca);
+    }
+  }
+
   while (calls_.size () > 0) {
     destroy_wait_ = true;
     assert(pthread_cond_wait(&destroy_wait_c_,&m_) == 0);
   }
-  printf("rpcc::cancel: done\n");
+  jsl_log(JSL_DBG_1, "rpcc::cancel: done\n");
+}
+
+//the wait in ms after a busy reply: a random point in the upper half
+//of *b, which then doubles up to backoff_ceiling.  the randomness keeps
+//clients that were turned away together from all coming back together
+static int
+next_backoff(int *b)
+{
+	int ms = *b / 2 + random() % (*b / 2 + 1);
+	*b = std::min(*b * 2, rpcc::backoff_ceiling.to);
+	return ms;
+}
+
+//what is left of a call that gives up at end, for the server to
+//see in the request's budget.  at least 1ms, as 0 means no limit
+static int
+budget_to(const struct timespec &end)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	if (cmp_timespec(end, now) <= 0)
+		return 1;
+	return std::max(diff_timespec(end, now), 1);
 }
 
 int
@@ -190,6 +345,7 @@ rpcc::call1(unsigned int proc, marshall &req, unmarshall &rep,
 {
 
 	caller ca(0, &rep);
+	TO curr_to;
 	{
 		ScopedLock ml(&m_);
 
@@ -208,25 +364,36 @@ rpcc::call1(unsigned int proc, marshall &req, unmarshall &rep,
 
 		req_header h(ca.xid, proc, clt_nonce_, srv_nonce_, xid_rep_window_.front());
 		req.pack_req_header(h);
+		curr_to.to = rto_ms_wo();
 	}
+	unsigned int flags = req_flags(req, features_, to);
 
 
-	TO curr_to;
 	struct timespec now, nextdeadline, finaldeadline; 
 
 	clock_gettime(CLOCK_REALTIME, &now);
 	add_timespec(now, to.to, &finaldeadline); 
-	curr_to.to = to_min.to;
+	struct timespec end = finaldeadline;
 
 	bool transmit = true;
 	connection *ch = NULL;
+	int backoff = backoff_floor.to;
+
+	//the send blocks until the request has been written, so long
+	//strings can go from the caller's memory straight to the socket
+	std::vector<struct iovec> iov;
+	req.iov(&iov);
 
 	while (1) {
 
 		if (transmit) {
-			get_refconn(&ch);
+			get_refconn(&ch, flags & PDU_URGENT);
 			if (ch) {
-			        if (reachable_) ch->send(req.cstr(), req.size());
+				note_transmit(&ca);
+				if (flags & PDU_BUDGET)
+					rpc_req_set_budget((char *)iov.back().iov_base +
+							iov.back().iov_len, budget_to(end));
+			        if (reachable_) ch->send(&iov[0], iov.size(), flags);
 				else jsl_log(JSL_DBG_1, "not reachable\n");
 				jsl_log(JSL_DBG_2, 
 						"rpcc::call1 %u just sent req proc %x xid %u clt_nonce %d\n", 
@@ -245,6 +412,7 @@ rpcc::call1(unsigned int proc, marshall &req, unmarshall &rep,
 			finaldeadline.tv_sec = 0;
 		}
 
+		bool busy = false;
 		{
 			ScopedLock cal(&ca.m);
 			while (!ca.done) {
@@ -256,10 +424,29 @@ rpcc::call1(unsigned int proc, marshall &req, unmarshall &rep,
 					break;
 				}
 			}
-			if (ca.done) {
+			if (ca.done && ca.intret != rpc_const::busy_failure) {
 			        jsl_log(JSL_DBG_2, "rpcc::call1: reply received\n");
 				break;
 			}
+			busy = ca.done;
+		}
+
+		if (busy) {
+			//the server did not run it: wait a while and send it
+			//again, unless that would go past the deadline
+			int ms = next_backoff(&backoff);
+			clock_gettime(CLOCK_REALTIME, &now);
+			add_timespec(now, ms, &nextdeadline);
+			if (!finaldeadline.tv_sec ||
+					cmp_timespec(nextdeadline, finaldeadline) > 0)
+				break;
+			jsl_log(JSL_DBG_2, "rpcc::call1: server busy, resend xid %u in %d ms\n",
+					ca.xid, ms);
+			usleep(ms * 1000);
+			ScopedLock cal(&ca.m);
+			ca.done = false;
+			transmit = true;
+			continue;
 		}
 
 		if (retrans_ && (!ch || ch->isdead())) {
@@ -285,30 +472,423 @@ rpcc::call1(unsigned int proc, marshall &req, unmarshall &rep,
 	ScopedLock cal(&ca.m);
 
 	jsl_log(JSL_DBG_2, 
-			"rpcc::call1 %u call done for req proc %x xid %u %s:%d done? %d ret %d \n", 
-			clt_nonce_, proc, ca.xid, inet_ntoa(dst_.sin_addr),
-			ntohs(dst_.sin_port), ca.done, ca.intret);
+			"rpcc::call1 %u call done for req proc %x xid %u %s done? %d ret %d \n", 
+			clt_nonce_, proc, ca.xid, sockaddr_str(dst_).c_str(),
+			ca.done, ca.intret);
 
 	if (ch)
 		ch->decref();
 	//destruction of req automatically frees its buffer
-	return (ca.done? ca.intret : rpc_const::timeout_failure);
+	return (ca.done? unpack_reply(&ca) : rpc_const::timeout_failure);
+}
+
+//the result of the finished call ca.  a compressed reply is inflated
+//here, by the thread that waited for it or runs its callback, rather
+//than by the reactor that read it
+int
+rpcc::unpack_reply(caller *ca)
+{
+	if (ca->lz) {
+		ca->lz = false;
+		if (!ca->un->lz_unpack()) {
+			jsl_log(JSL_DBG_1, "rpcc::unpack_reply bad compressed reply to %u\n",
+					ca->xid);
+			return rpc_const::unmarshal_reply_failure;
+		}
+	}
+	return ca->intret;
+}
+
+void
+rpcc::call1_async(unsigned int proc, marshall &req, const callback &cb,
+		TO to)
+{
+	caller *ca = new caller(0, NULL);
+	ca->cb = cb;
+	{
+		ScopedLock ml(&m_);
+
+		int ret = 0;
+		if ((proc != rpc_const::bind && !bind_done_) ||
+				(proc == rpc_const::bind && bind_done_)) {
+			jsl_log(JSL_DBG_1, "rpcc::call1_async rpcc has not been bound to dst or binding twice\n");
+			ret = rpc_const::bind_failure;
+		} else if (destroy_wait_) {
+			ret = rpc_const::cancel_failure;
+		}
+		if (ret < 0) {
+			ca->refs = 1;
+			ca->intret = ret;
+			ca->done = true;
+			completed_.push_back(ca);
+			start_async_wo();
+			assert(pthread_cond_signal(&async_c_) == 0);
+			return;
+		}
+
+		start_async_wo();
+		ca->xid = xid_++;
+		calls_[ca->xid] = ca;
+		ca->refs = 2; //calls_ and this thread
+
+		req_header h(ca->xid, proc, clt_nonce_, srv_nonce_, xid_rep_window_.front());
+		req.pack_req_header(h);
+		ca->flags = req_flags(req, features_, to);
+		req.take_buf(&ca->req, &ca->reqsz);
+
+		//same schedule as call1(): wait one rto, then double, until
+		//the final deadline
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		add_timespec(now, to.to, &ca->finaldeadline);
+		ca->end = ca->finaldeadline;
+		ca->curr_to = rto_ms_wo();
+		add_timespec(now, ca->curr_to, &ca->nextdeadline);
+		if (cmp_timespec(ca->nextdeadline, ca->finaldeadline) > 0) {
+			ca->nextdeadline = ca->finaldeadline;
+			ca->finaldeadline.tv_sec = 0;
+		}
+		//the async thread may be sleeping past the new deadline
+		assert(pthread_cond_signal(&async_c_) == 0);
+	}
+
+	jsl_log(JSL_DBG_2, "rpcc::call1_async %u sending req proc %x xid %u\n",
+			clt_nonce_, proc, ca->xid);
+	transmit_async(ca);
+	put_caller(ca);
+}
+
+void
+rpc_batch::clear()
+{
+	procs_.clear();
+	args_.clear();
+	rets_.clear();
+	bufs_.clear();
+	reps_.clear();
+	repsz_.clear();
 }
 
+int
+rpcc::call_batch(rpc_batch &b, TO to)
+{
+	int n = b.procs_.size();
+	b.rets_.assign(n, 0);
+	b.bufs_.clear();
+	b.reps_.assign(n, NULL);
+	b.repsz_.assign(n, 0);
+	//a batch of one would only cost more than the call itself
+	if (n == 1 || !(features_ & rpc_const::feat_batch)) {
+		for (int i = 0; i < n; i++) {
+			marshall m(b.args_[i].size());
+			m.rawbytes(b.args_[i].data(), b.args_[i].size());
+			b.bufs_.emplace_back();
+			unmarshall &u = b.bufs_.back();
+			int ret = call1(b.procs_[i], m, u, to);
+			if (ret < 0)
+				return ret;
+			b.rets_[i] = ret;
+			b.reps_[i] = u.cstr() + RPC_HEADER_SZ;
+			b.repsz_[i] = u.size() - RPC_HEADER_SZ;
+		}
+		return 0;
+	}
+
+	//the calls' own args and replies stay in the old encoding,
+	//since add() cannot know where they are going
+	marshall m(b.args_.size() * sizeof(int));
+	m.set_v2(features_ & rpc_const::feat_v2);
+	m << b.procs_;
+	for (int i = 0; i < n; i++)
+		marshall_ref(m, b.args_[i]);
+	b.bufs_.emplace_back();
+	unmarshall &u = b.bufs_.back();
+	int ret = call1(rpc_const::batch, m, u, to);
+	if (ret < 0)
+		return ret;
+	b.rets_.clear(); //>> appends
+	u >> b.rets_;
+	for (int i = 0; i < n && u.ok(); i++) {
+		u >> b.repsz_[i];
+		b.reps_[i] = u.take(b.repsz_[i]);
+	}
+	if (!u.okdone() || (int)b.rets_.size() != n)
+		return rpc_const::unmarshal_reply_failure;
+	return 0;
+}
+
+//send an asynchronous call on the current connection, which becomes
+//the one whose death makes the async thread retransmit.  the calling
+//thread holds a reference to ca
 void
-rpcc::get_refconn(connection **ch)
+rpcc::transmit_async(caller *ca)
+{
+	connection *ch = NULL;
+	get_refconn(&ch, ca->flags & PDU_URGENT);
+	if (ch) {
+		note_transmit(ca);
+		if (ca->flags & PDU_BUDGET)
+			rpc_req_set_budget(ca->req + ca->reqsz, budget_to(ca->end));
+		if (reachable_) ch->send(ca->req, ca->reqsz, ca->flags);
+		else jsl_log(JSL_DBG_1, "not reachable\n");
+	}
+	ScopedLock cl(&ca->m);
+	if (ca->ch)
+		ca->ch->decref();
+	ca->ch = ch;
+}
+
+//the retransmission timer of ca went off. like call1(), give up after
+//the final deadline and otherwise resend if the connection has died.
+//the calling thread holds a reference to ca
+void
+rpcc::timeout_async(caller *ca)
+{
+	bool resend;
+	{
+		ScopedLock ml(&m_);
+		std::map<int, caller *>::iterator it = calls_.find(ca->xid);
+		if (it == calls_.end() || it->second != ca)
+			return; //finished in the meantime
+		if (!ca->finaldeadline.tv_sec) {
+			ca->intret = rpc_const::timeout_failure;
+			finish_async_wo(ca);
+			return;
+		}
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		//after a busy reply the timeout starts over, not doubled
+		resend = ca->resend;
+		ca->resend = false;
+		if (!resend)
+			ca->curr_to <<= 1;
+		add_timespec(now, ca->curr_to, &ca->nextdeadline);
+		if (cmp_timespec(ca->nextdeadline, ca->finaldeadline) > 0) {
+			ca->nextdeadline = ca->finaldeadline;
+			ca->finaldeadline.tv_sec = 0;
+		}
+	}
+
+	//not under ca->m: the reactor holds the connection's lock when
+	//it takes ca->m in got_pdu()
+	connection *ch;
+	{
+		ScopedLock cl(&ca->m);
+		ch = ca->ch;
+		if (ch)
+			ch->incref();
+	}
+	bool dead = !ch || ch->isdead();
+	if (ch)
+		ch->decref();
+	if (resend || (retrans_ && dead)) {
+		jsl_log(JSL_DBG_2, "rpcc::timeout_async %u retransmit xid %u\n",
+				clt_nonce_, ca->xid);
+		transmit_async(ca);
+	}
+}
+
+//a busy reply came for asynchronous call ca: have the async thread
+//send it again after a backoff, or return false if that would go past
+//its deadline.  caller holds m_ and ca->m
+bool
+rpcc::backoff_async_wo(caller *ca)
+{
+	struct timespec now, t;
+	clock_gettime(CLOCK_REALTIME, &now);
+	add_timespec(now, next_backoff(&ca->backoff), &t);
+	//the final deadline is nextdeadline once the last wait has begun
+	if (!ca->finaldeadline.tv_sec) {
+		if (cmp_timespec(t, ca->nextdeadline) > 0)
+			return false;
+		ca->finaldeadline = ca->nextdeadline;
+	} else if (cmp_timespec(t, ca->finaldeadline) > 0) {
+		return false;
+	}
+	ca->nextdeadline = t;
+	ca->resend = true;
+	assert(pthread_cond_signal(&async_c_) == 0);
+	return true;
+}
+
+//ca has got its result (intret and reply): take it out of calls_ and
+//queue its callback for the async thread, which inherits the calls_
+//reference.  caller holds m_
+void
+rpcc::finish_async_wo(caller *ca)
+{
+	calls_.erase(ca->xid);
+	update_xid_rep(ca->xid);
+	ca->done = true;
+	completed_.push_back(ca);
+	assert(pthread_cond_signal(&async_c_) == 0);
+	if (destroy_wait_) {
+		assert(pthread_cond_signal(&destroy_wait_c_) == 0);
+	}
+}
+
+void
+rpcc::put_caller(caller *ca)
+{
+	bool last;
+	{
+		ScopedLock ml(&m_);
+		last = (--ca->refs == 0);
+	}
+	if (last)
+		delete ca;
+}
+
+// caller holds m_
+void
+rpcc::start_async_wo()
+{
+	if (!async_started_) {
+		async_started_ = true;
+		assert((async_th_ = method_thread(this, false, &rpcc::async_loop)) != 0);
+	}
+}
+
+void
+rpcc::async_loop()
+{
+	std::vector<caller *> due;
+
+	ScopedLock ml(&m_);
+	while (1) {
+		//completion callbacks run without m_, in completion order
+		while (!completed_.empty()) {
+			caller *ca = completed_.front();
+			completed_.pop_front();
+			assert(pthread_mutex_unlock(&m_) == 0);
+			ca->cb(unpack_reply(ca), *ca->un);
+			put_caller(ca);
+			assert(pthread_mutex_lock(&m_) == 0);
+		}
+
+		if (async_stop_ && completed_.empty())
+			break;
+
+		//find the asynchronous calls whose timer has gone off, and
+		//the next deadline after them
+		struct timespec now, next;
+		bool have_next = false;
+		clock_gettime(CLOCK_REALTIME, &now);
+		due.clear();
+		for (std::map<int, caller *>::iterator it = calls_.begin();
+				it != calls_.end(); ++it) {
+			caller *ca = it->second;
+			if (!ca->cb)
+				continue;
+			if (cmp_timespec(ca->nextdeadline, now) <= 0) {
+				ca->refs++;
+				due.push_back(ca);
+			} else if (!have_next || cmp_timespec(ca->nextdeadline, next) < 0) {
+				next = ca->nextdeadline;
+				have_next = true;
+			}
+		}
+
+		if (!due.empty()) {
+			assert(pthread_mutex_unlock(&m_) == 0);
+			for (unsigned i = 0; i < due.size(); i++) {
+				timeout_async(due[i]);
+				put_caller(due[i]);
+			}
+			assert(pthread_mutex_lock(&m_) == 0);
+			continue;
+		}
+
+		if (have_next) {
+			pthread_cond_timedwait(&async_c_, &m_, &next);
+		} else {
+			assert(pthread_cond_wait(&async_c_, &m_) == 0);
+		}
+	}
+}
+
+//record that ca is about to be (re)transmitted
+void
+rpcc::note_transmit(caller *ca)
+{
+	ScopedLock cl(&ca->m);
+	if (ca->ntransmits++ == 0)
+		clock_gettime(CLOCK_MONOTONIC, &ca->sent);
+}
+
+//fold a round-trip sample (in microseconds) into the retransmission
+//timeout as in Jacobson/Karels (and RFC 6298):
+//  rttvar = 3/4 rttvar + 1/4 |srtt - rtt|,  srtt = 7/8 srtt + 1/8 rtt,
+//  rto = srtt + 4 rttvar, within [rto_floor, rto_ceiling].
+//caller holds m_
+void
+rpcc::update_rtt_wo(int rtt)
+{
+	if (rtt < 0)
+		rtt = 0;
+	if (!have_rtt_) {
+		srtt_ = rtt;
+		rttvar_ = rtt / 2;
+		have_rtt_ = true;
+	} else {
+		int err = srtt_ - rtt;
+		if (err < 0)
+			err = -err;
+		rttvar_ += (err - rttvar_) / 4;
+		srtt_ += (rtt - srtt_) / 8;
+	}
+	rto_ = srtt_ + 4 * rttvar_;
+	if (rto_ < rto_floor.to * 1000)
+		rto_ = rto_floor.to * 1000;
+	if (rto_ > rto_ceiling.to * 1000)
+		rto_ = rto_ceiling.to * 1000;
+}
+
+//the rto in whole milliseconds, the resolution of the call timers.
+//caller holds m_
+int
+rpcc::rto_ms_wo()
+{
+	return (rto_ + 999) / 1000;
+}
+
+int
+rpcc::srtt()
+{
+	ScopedLock ml(&m_);
+	return srtt_;
+}
+
+int
+rpcc::rto()
+{
+	ScopedLock ml(&m_);
+	return rto_;
+}
+
+//once the server has agreed to urgent calls, they get a connection of
+//their own: on the shared one they could still be stuck behind bulk
+//pdus already in the socket buffers, where nobody can reorder them
+void
+rpcc::get_refconn(connection **ch, bool urgent)
 {
 	ScopedLock ml(&chan_m_);
-	if (!chan_ || chan_->isdead()) {
-		if (chan_)
-			chan_->decref();
-		chan_ = connect_to_dst(dst_, this, lossytest_);
+	connection *&c = (urgent && (features_ & rpc_const::feat_urgent)) ?
+		uchan_ : chan_;
+	if (!c || c->isdead()) {
+		if (c)
+			c->decref();
+		c = connect_to_dst(dst_, this, lossytest_);
+		if (c) {
+			c->set_checksum(features_ & rpc_const::feat_crc32c);
+			c->set_mark_urgent(features_ & rpc_const::feat_urgent);
+		}
 	}
-	if (ch && chan_) {
+	if (ch && c) {
 		if (*ch) {
 			(*ch)->decref();
 		}
-		*ch = chan_;
+		*ch = c;
 		(*ch)->incref();
 	}
 }
@@ -330,10 +910,16 @@ rpcc::got_pdu(connection *c, char *b, int sz)
 		jsl_log(JSL_DBG_1, "rpcc:got_pdu unmarshall header failed!!!\n");
 		return true;
 	}
+	rep.set_v2(connection::flags(b) & PDU_V2);
+	bool lz = connection::flags(b) & PDU_LZ;
 
 	ScopedLock ml(&m_);
 
-	update_xid_rep(h.xid);
+	//the server keeps no record of a request it turned away, so
+	//its xid must not be acknowledged before it is sent again
+	bool busy = h.ret == rpc_const::busy_failure;
+	if (!busy)
+		update_xid_rep(h.xid);
 
 	if (calls_.find(h.xid) == calls_.end()) {
 		jsl_log(JSL_DBG_2, "rpcc::got_pdu xid %d no pending request\n", h.xid);
@@ -342,14 +928,40 @@ rpcc::got_pdu(connection *c, char *b, int sz)
 	caller *ca = calls_[h.xid];
 
 	ScopedLock cl(&ca->m);
-	if (!ca->done) {
+	if (busy && !ca->done) {
+		jsl_log(JSL_DBG_2, "rpcc::got_pdu: server busy for xid %d\n",
+				h.xid);
+		if (ca->cb && backoff_async_wo(ca))
+			return true;
+		ca->intret = h.ret;
+		ca->done = 1;
+		if (ca->cb) {
+			finish_async_wo(ca);
+			return true;
+		}
+	} else if (!ca->done) {
+		//Karn's rule: a reply to a retransmitted request could
+		//belong to any of its transmissions, so it says nothing
+		if (ca->ntransmits == 1) {
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			update_rtt_wo((now.tv_sec - ca->sent.tv_sec) * 1000000 +
+					(now.tv_nsec - ca->sent.tv_nsec) / 1000);
+		}
 		ca->un->take_in(rep);
+		ca->lz = lz;
 		ca->intret = h.ret;
 		if (ca->intret < 0) {
 			jsl_log(JSL_DBG_2, "rpcc::got_pdu: RPC reply error for xid %d intret %d\n",
 					h.xid, ca->intret);
 		}
 		ca->done = 1;
+		if (ca->cb) {
+			//the reactor must not run callbacks: they may send
+			//on this very connection
+			finish_async_wo(ca);
+			return true;
+		}
 	}
 	assert(pthread_cond_broadcast(&ca->c) == 0);
 	return true;
@@ -382,27 +994,118 @@ compress:
 }
 
 
-rpcs::rpcs(unsigned int p1, int count)
-  : port_(p1), counting_(count), curr_counts_(count), lossytest_(0), reachable_ (true)
+//CLOCK_MONOTONIC in ns, for proc_stats
+static uint64_t
+now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//when the caller of the request this thread is running a handler for
+//gives up, in now_ns() time; 0 if never
+static __thread uint64_t tl_deadline;
+
+int
+rpcs::budget()
+{
+	if (!tl_deadline)
+		return -1;
+	uint64_t now = now_ns();
+	return now >= tl_deadline ? 0 : (tl_deadline - now) / 1000000;
+}
+
+//rpcs::batch() takes the request as it is rather than unmarshalled
+class batch_handler : public handler {
+	public:
+		batch_handler(rpcs *s) : s_(s) { }
+		int fn(unmarshall &args, marshall &rep) {
+			return s_->batch(args, rep);
+		}
+	private:
+		rpcs *s_;
+};
+
+rpcs::rpcs(unsigned int p1, int count, int nthreads)
+  : rpcs(p1, "", count, nthreads)
+{
+}
+
+//the port of "[host:]port", and the path of a unix-domain socket
+static unsigned int
+addr_port(const std::string &addr)
+{
+	if (addr.find('/') != std::string::npos)
+		return 0;
+	size_t c = addr.find(':');
+	return atoi(addr.c_str() + (c == std::string::npos ? 0 : c + 1));
+}
+
+static std::string
+addr_path(const std::string &addr)
+{
+	return addr.find('/') != std::string::npos ? addr : "";
+}
+
+rpcs::rpcs(const std::string &addr, int count, int nthreads)
+  : rpcs(addr_port(addr), addr_path(addr), count, nthreads)
+{
+}
+
+rpcs::rpcs(unsigned int p1, const std::string &path, int count, int nthreads)
+  : port_(p1), path_(path), counting_(count), curr_counts_(count), lossytest_(0), reachable_ (true),
+	dup_done_(0), dup_inprogress_(0), forgotten_(0), oldsrv_(0), badproc_(0),
+	queued_(0), qdelay_(0), busy_(0), expired_(0), ordered_(false)
 {
-	assert(pthread_mutex_init(&procs_m_, 0) == 0);
 	assert(pthread_mutex_init(&count_m_, 0) == 0);
-	assert(pthread_mutex_init(&reply_window_m_, 0) == 0);
 	assert(pthread_mutex_init(&conss_m_, 0) == 0);
+	assert(pthread_mutex_init(&busy_m_, 0) == 0);
 
 	set_rand_seed();
 	nonce_ = random();
-	jsl_log(JSL_DBG_2, "rpcs::rpcs created with nonce %d\n", nonce_);
+	features_ = local_features();
+	jsl_log(JSL_DBG_2, "rpcs::rpcs created with nonce %d features %x\n",
+			nonce_, features_);
 
 	char *loss_env = getenv("RPC_LOSSY");
 	if(loss_env != NULL){
 		lossytest_ = atoi(loss_env);
 	}
 
+	if (nthreads <= 0) {
+		char *threads_env = getenv("RPC_THREADS");
+		if (threads_env != NULL)
+			nthreads = atoi(threads_env);
+	}
+	if (nthreads <= 0) {
+		nthreads = ThrPool::ncores();
+		// handlers may block on a lock or on an rpc to another
+		// server, so keep enough threads around for the others
+		if (nthreads < min_dispatch_threads)
+			nthreads = min_dispatch_threads;
+	}
+	jsl_log(JSL_DBG_2, "rpcs::rpcs %d dispatch threads\n", nthreads);
+
+	int max_queued = nthreads * max_queued_per_thread;
+	int max_qdelay = default_max_qdelay;
+	char *queue_env = getenv("RPC_MAX_QUEUE");
+	if (queue_env != NULL)
+		max_queued = atoi(queue_env);
+	char *qdelay_env = getenv("RPC_MAX_QDELAY");
+	if (qdelay_env != NULL)
+		max_qdelay = atoi(qdelay_env);
+	set_admission(max_queued, max_qdelay);
+
 	reg(rpc_const::bind, this, &rpcs::rpcbind);
-	dispatchpool_ = new ThrPool(10,false);
+	reg(rpc_const::stats, this, &rpcs::rpcstat);
+	reg1(rpc_const::batch, new batch_handler(this));
+	dispatchpool_ = new ThrPool(nthreads, false);
 
-	listener_ = new tcpsconn(this, port_, lossytest_);
+	if (path_.empty())
+		listener_ = new tcpsconn(this, port_, lossytest_);
+	else
+		listener_ = new tcpsconn(this, path_.c_str(), lossytest_);
 }
 
 rpcs::~rpcs()
@@ -410,7 +1113,6 @@ rpcs::~rpcs()
 	//must delete listener before dispatchpool
 	delete listener_;
 	delete dispatchpool_;
-	free_reply_window();
 }
 
 bool
@@ -421,23 +1123,106 @@ rpcs::got_pdu(connection *c, char *b, int sz)
             return true;
         }
 
+	if (sz < RPC_HEADER_SZ) {
+		jsl_log(JSL_DBG_1, "rpcs::got_pdu: short request\n");
+		rpc_buf_free(b);
+		return true;
+	}
+	int proc = rpc_req_proc(b);
+
+	//urgent if the client flagged it or the procedure is.  an
+	//ordered connection's requests still run in order
+	bool urgent = connection::flags(b) & PDU_URGENT;
+	if (!urgent) {
+		handler *f = procs_.lookup(proc);
+		urgent = f && f->urgent;
+	}
+	if (!ordered_ && !admit(urgent, proc) && takes_busy(b)) {
+		reply_busy(c, b, urgent);
+		return true;
+	}
+
 	djob_t *j = new djob_t(c, b, sz);
+	j->arrived = now_ns();
+	j->urgent = urgent;
 	c->incref();
-	bool succ = dispatchpool_->addObjJob(this, &rpcs::dispatch, j);
+	queued_++;
+	bool succ = dispatchpool_->addObjJob(this, &rpcs::dispatch, j,
+			ordered_ ? (unsigned int)c->channo() + 1 : 0, urgent);
+	if (!succ)
+		queued_--;
 	if (!succ || !reachable_) {
 		c->decref();
 		delete j;
 	}
+	//an ordered server waits for room rather than reorder, and so
+	//does a client that cannot take a busy reply
+	if (!succ && !ordered_ && takes_busy(b)) {
+		reply_busy(c, b, urgent);
+		return true;
+	}
 	return succ; 
 }
 
+void
+rpcs::set_admission(int max_queued, int max_qdelay_ms)
+{
+	max_queued_ = max_queued;
+	max_qdelay_ = (int64_t)max_qdelay_ms * 1000000;
+	jsl_log(JSL_DBG_2, "rpcs::set_admission at most %d queued, %d ms\n",
+			max_queued, max_qdelay_ms);
+}
+
+//whether to queue a request for proc, or turn it away as busy
+bool
+rpcs::admit(bool urgent, int proc)
+{
+	if (urgent || proc == (int)rpc_const::bind ||
+			proc == (int)rpc_const::stats)
+		return true;
+	int q = queued_.load();
+	if (max_queued_ > 0 && q >= max_queued_)
+		return false;
+	if (max_qdelay_ > 0 && q >= dispatchpool_->size() &&
+			(int64_t)qdelay_.load() > max_qdelay_)
+		return false;
+	return true;
+}
+
+//whether the client that sent request b offered feat_busy; one that
+//did not bind on this server instance is held rather than turned away
+bool
+rpcs::takes_busy(const char *b)
+{
+	unsigned int nonce = rpc_req_clt_nonce(b);
+	ScopedLock bl(&busy_m_);
+	return nonce && busy_ok_.count(nonce);
+}
+
+//answer request b (which is freed) with busy_failure straight from the
+//reactor: the server keeps no trace of it, so the client sends it
+//again with the same xid
+void
+rpcs::reply_busy(connection *c, char *b, bool urgent)
+{
+	busy_++;
+	reply_header rh(rpc_req_xid(b), rpc_const::busy_failure);
+	rpc_buf_free(b);
+	jsl_log(JSL_DBG_2, "rpcs::got_pdu: busy, turning away xid %d\n",
+			rh.xid);
+	marshall rep;
+	rep.pack_reply_header(rh);
+	char *b1;
+	int sz1;
+	rep.take_buf(&b1, &sz1);
+	c->send_async_wo(b1, sz1, urgent ? PDU_URGENT : 0);
+}
+
 void
 rpcs::reg1(unsigned int proc, handler *h)
 {
-	ScopedLock pl(&procs_m_);
-	assert(procs_.count(proc) == 0);
-	procs_[proc] = h;
-	assert(procs_.count(proc) >= 1);
+	//in range and not registered twice
+	assert(procs_.add(proc, h));
 }
 
 void
@@ -448,23 +1233,16 @@ rpcs::updatestat(unsigned int proc)
 	curr_counts_--;
 	if(curr_counts_ == 0) {
 		std::map<int, int>::iterator i;
-		printf("RPC STATS: ");
+		jsl_log(JSL_DBG_1, "RPC STATS: ");
 		for (i = counts_.begin(); i != counts_.end(); i++) {
-			printf("%x %d ", i->first, i->second);
+			jsl_log(JSL_DBG_1, "%x %d ", i->first, i->second);
 		}
-		printf("\n");
+		jsl_log(JSL_DBG_1, "\n");
 
-		ScopedLock rwl(&reply_window_m_);
-		std::map<unsigned int,std::list<reply_t> >::iterator clt;
-
-		unsigned int totalrep = 0, maxrep = 0;
-		for (clt = reply_window_.begin(); clt != reply_window_.end(); clt++) {
-			totalrep += clt->second.size();
-			if (clt->second.size() > maxrep)
-				maxrep = clt->second.size();
-		}
-		jsl_log(JSL_DBG_1, "REPLY WINDOW: clients %ld total reply %d max per client %d\n", 
-				reply_window_.size(), totalrep, maxrep);
+		unsigned int clients, totalrep, maxrep;
+		reply_window_.stats(&clients, &totalrep, &maxrep);
+		jsl_log(JSL_DBG_1, "REPLY WINDOW: clients %u total reply %u max per client %u\n", 
+				clients, totalrep, maxrep);
 		curr_counts_ = counting_;
 	}
 }
@@ -473,8 +1251,20 @@ void
 rpcs::dispatch(djob_t *j)
 {
 	connection *c = j->conn;
-	unmarshall req(j->buf, j->sz);
+	unsigned int rflags = connection::flags(j->buf);
+	int budget = 0;
+	int sz = j->sz;
+	if ((rflags & PDU_BUDGET) && sz >= RPC_HEADER_SZ + (int)sizeof(int)) {
+		budget = rpc_req_budget(j->buf + sz);
+		sz -= sizeof(int);
+	}
+	unmarshall req(j->buf, sz);
+	uint64_t arrived = j->arrived;
+	unsigned int flags = j->urgent ? PDU_URGENT : 0;
 	delete j;
+	uint64_t started = now_ns();
+	queued_--;
+	qdelay_ = started - arrived;
 
 	req_header h;
 	req.unpack_req_header(&h);
@@ -486,55 +1276,62 @@ rpcs::dispatch(djob_t *j)
 		return;
 	}
 
+	//nobody is waiting for the reply any more.  like a request
+	//turned away busy it leaves no trace, so a retransmission with
+	//a new budget still runs
+	uint64_t deadline = 0;
+	if (budget > 0) {
+		deadline = arrived + (uint64_t)budget * 1000000;
+		if (started >= deadline) {
+			jsl_log(JSL_DBG_2, "rpcs::dispatch: rpc %u expired after %d ms\n",
+					h.xid, budget);
+			expired_++;
+			c->decref();
+			return;
+		}
+	}
+
 	jsl_log(JSL_DBG_2,
 			"rpcs::dispatch: rpc %u (proc %x, last_rep %u) from clt %u for srv instance %u \n",
 			h.xid, proc, h.xid_rep, h.clt_nonce, h.srv_nonce);
 
+	//the reply is in the request's encoding
 	marshall rep;
 	reply_header rh(h.xid,0);
+	char *b1;
+	int sz1;
+	if (rflags & PDU_V2) {
+		req.set_v2(true);
+		rep.set_v2(true);
+		flags |= PDU_V2;
+	}
 
 	//is client sending to an old instance of server?
 	if (h.srv_nonce != 0 && h.srv_nonce != nonce_) {
 		jsl_log(JSL_DBG_2,
 				"rpcs::dispatch: rpc for an old server instance %u (current %u) proc %x\n",
 				h.srv_nonce, nonce_, h.proc);
+		oldsrv_++;
 		rh.ret = rpc_const::oldsrv_failure;
 		rep.pack_reply_header(rh);
-		c->send(rep.cstr(),rep.size());
+		rep.take_buf(&b1,&sz1);
+		c->send_async(b1, sz1, flags);
+		c->decref();
 		return;
 	}
 
-	handler *f;
 	//is RPC proc a registered procedure?
-	{
-		ScopedLock pl(&procs_m_);
-		if(procs_.count(proc) < 1){
-			jsl_log(JSL_DBG_2, "rpcs::dispatch: bad proc %x procs.count %u\n",
-					proc, (unsigned)procs_.count(proc));
-			c->decref();
-			return;
-		}
-
-		f = procs_[proc];
+	handler *f = procs_.lookup(proc);
+	if (!f) {
+		badproc_++;
+		jsl_log(JSL_DBG_2, "rpcs::dispatch: bad proc %x\n", proc);
+		c->decref();
+		return;
 	}
 
 	rpcs::rpcstate_t stat;
-	char *b1;
-	int sz1;
 
 	if (h.clt_nonce) {
-		//have i seen this client before?
-		{
-			ScopedLock rwl(&reply_window_m_);
-			// if we don't know about this clt_nonce, create a cleanup object
-			if (reply_window_.find(h.clt_nonce) == reply_window_.end()) {
-				assert (reply_window_[h.clt_nonce].size() == 0); // create
-				jsl_log(JSL_DBG_2,
-						"rpcs::dispatch: new client %u xid %d chan %d, total clients %d\n", 
-						h.clt_nonce, h.xid, c->channo(), (int)reply_window_.size());
-			}
-		}
-
 		// save the latest good connection to the client
 		{
 			ScopedLock rwl(&conss_m_);
@@ -547,35 +1344,55 @@ rpcs::dispatch(djob_t *j)
 				conns_[h.clt_nonce] = c;
 			}
 		}
+		//a bind's offer is always in the old encoding
+		if (proc == (int)rpc_const::bind &&
+				req.size() >= RPC_HEADER_SZ + (int)sizeof(int) &&
+				(rpc_get_be<int>(req.cstr() + RPC_HEADER_SZ) &
+				 rpc_const::feat_busy)) {
+			ScopedLock bl(&busy_m_);
+			busy_ok_.insert(h.clt_nonce);
+		}
 
-		stat = checkduplicate_and_update(h.clt_nonce, h.xid, h.xid_rep, &b1, &sz1);
+		stat = reply_window_.check(h.clt_nonce, h.xid, h.xid_rep, &b1, &sz1);
 	} else {
 		//this client does not require at most once logic
-		stat = NEW;
+		stat = reply_window::NEW;
 	}
 
 	switch (stat) {
-		case NEW: //new request
+		case reply_window::NEW: //new request
 			if (counting_) {
 				updatestat(proc);
 			}
 
-			rh.ret = f->fn(req, rep);
+			f->stats.queue.add(started - arrived);
+			f->stats.bytes_in += req.size();
+
+			if ((rflags & PDU_LZ) && !req.lz_unpack()) {
+				rh.ret = rpc_const::unmarshal_args_failure;
+			} else {
+				tl_deadline = deadline;
+				rh.ret = f->fn(req, rep);
+				tl_deadline = 0;
+			}
 			assert(rh.ret >= 0 || 
 					rh.ret == rpc_const::unmarshal_args_failure);
+			{
+				uint64_t done = now_ns();
+				f->stats.exec.add(done - started);
+				started = done;
+			}
 
 			rep.pack_reply_header(rh);
+			if ((rflags & PDU_LZ_OK) && rep.lz_pack()) {
+				flags |= PDU_LZ;
+			}
 			rep.take_buf(&b1,&sz1);
 
 			jsl_log(JSL_DBG_2,
 					"rpcs::dispatch: sending and saving reply of size %d for rpc %u, proc %x ret %d, clt %u\n",
 					sz1, h.xid, proc, rh.ret, h.clt_nonce);
 
-			if (h.clt_nonce > 0) {
-				//only record replies for clients that require at-most-once logic
-				add_reply(h.clt_nonce, h.xid, b1, sz1);
-			}
-
 			// get the latest connection to the client
 			{
 				ScopedLock rwl(&conss_m_);
@@ -586,149 +1403,225 @@ rpcs::dispatch(djob_t *j)
 				}
 			}
 
-			c->send(b1, sz1);
 			if (h.clt_nonce == 0) {
-				//reply is not added to at-most-once window, free it
-				free(b1);
+				//reply is not added to at-most-once window, let the
+				//connection free it once it has been written
+				c->send_async(b1, sz1, flags);
+			} else {
+				//save the reply before sending it so that a
+				//retransmission finds it.  the window and the
+				//connection share the buffer, since a request
+				//acknowledging it may free the saved one first
+				rpc_buf_ref(b1);
+				if (!reply_window_.add(h.clt_nonce, h.xid, b1, sz1,
+							flags & (PDU_LZ | PDU_V2))) {
+					rpc_buf_free(b1);
+				}
+				c->send_async(b1, sz1, flags);
 			}
+			f->stats.bytes_out += sz1;
+			f->stats.send.add(now_ns() - started);
 			break;
-		case INPROGRESS: //server is working on this request
+		case reply_window::INPROGRESS: //server is working on this request
+			dup_inprogress_++;
 			break;
-		case DONE: //duplicate and we still have the response
-			c->send(b1, sz1);
+		case reply_window::DONE: //duplicate and we still have the response
+			//b1 is our own copy of the saved reply
+			dup_done_++;
+			flags |= connection::flags(b1) & (PDU_LZ | PDU_V2);
+			c->send_async(b1, sz1, flags);
 			break;
-		case FORGOTTEN: //very old request and we don't have the response anymore
+		case reply_window::FORGOTTEN: //very old request and we don't have the response anymore
+			forgotten_++;
 			jsl_log(JSL_DBG_2, "rpcs::dispatch: very old request %u from %u\n", 
 					h.xid, h.clt_nonce);
 			rh.ret = rpc_const::atmostonce_failure;
 			rep.pack_reply_header(rh);
-			c->send(rep.cstr(),rep.size());
+			rep.take_buf(&b1,&sz1);
+			c->send_async(b1, sz1, flags);
 			break;
 	}
 	c->decref();
 }
 
-void
-rpcs::add_reply(unsigned int clt_nonce, unsigned int xid,
-		char *b, int sz)
+//rpc handler
+int 
+rpcs::rpcbind(int a, int &r)
 {
-	ScopedLock rwl(&reply_window_m_);
-
-	std::list<reply_t>& reply_list = reply_window_[clt_nonce];
-	std::list<reply_t>::iterator it;
-	for (it  = reply_list.begin(); it != reply_list.end(); it++) {
-		if (it->xid == xid){
-			it->cb_present = true;
-
-			// it->buf = (char *)malloc(sz);
-			// memcpy(it->buf, b, sz);
-			it->buf = b;
-			it->sz = sz;
-			break;
-		}
-	}
-	// assert(reply_window_.find(clt_nonce) == reply_window_.end());
+	jsl_log(JSL_DBG_2, "rpcs::rpcbind called return nonce %u\n", nonce_);
+	r = nonce_;
+	return a & features_;
 }
 
-void
-rpcs::free_reply_window(void)
+int
+rpcs::rpcstat(int a, std::string &r)
 {
-	std::map<unsigned int,std::list<reply_t> >::iterator clt;
-	std::list<reply_t>::iterator it;
+	std::ostringstream o;
+	unsigned int clients, totalrep, maxrep;
+	unsigned int nconns;
+	reply_window_.stats(&clients, &totalrep, &maxrep);
+	{
+		ScopedLock rwl(&conss_m_);
+		nconns = conns_.size();
+	}
 
-	ScopedLock rwl(&reply_window_m_);
-	for (clt = reply_window_.begin(); clt != reply_window_.end(); clt++) {
-		for (it = clt->second.begin(); it != clt->second.end(); it++) {
-			free((*it).buf);
-		}
-		clt->second.clear();
+	if (path_.empty())
+		o << "rpcs port " << port_;
+	else
+		o << "rpcs " << path_;
+	o << ": " << dispatchpool_->size()
+		<< " dispatch threads, " << nconns << " client connections\n";
+	o << "reply window: " << clients << " clients, " << totalrep
+		<< " replies, at most " << maxrep << " for one client\n";
+	o << "at-most-once: " << dup_done_ << " replied again, "
+		<< dup_inprogress_ << " in progress, " << forgotten_
+		<< " forgotten; " << oldsrv_ << " for an old instance, "
+		<< badproc_ << " for unknown procedures\n";
+	o << "admission: " << busy_ << " turned away busy, " << queued_
+		<< " queued, last waited " << qdelay_ / 1000 << " us; "
+		<< expired_ << " expired before dispatch\n";
+
+	std::vector<std::pair<unsigned int, handler *> > procs;
+	procs_.list(&procs);
+	for (unsigned i = 0; i < procs.size(); i++) {
+		proc_stats &st = procs[i].second->stats;
+		if (st.exec.count() == 0)
+			continue;
+		o << "proc " << std::hex << procs[i].first << std::dec << ": "
+			<< st.exec.count() << " calls, " << st.bytes_in
+			<< " bytes in, " << st.bytes_out << " bytes out\n";
+		o << "  queue us: " << st.queue.summary(1000) << "\n";
+		o << "  exec  us: " << st.exec.summary(1000) << "\n";
+		o << "  send  us: " << st.send.summary(1000) << "\n";
 	}
-	reply_window_.clear();
+	r = o.str();
+	return 0;
 }
 
-rpcs::rpcstate_t 
-rpcs::checkduplicate_and_update(unsigned int clt_nonce, unsigned int xid,
-		unsigned int xid_rep, char **b, int *sz)
-{	
-	ScopedLock rwl(&reply_window_m_);
-
-	std::list<reply_t>::iterator it;
-	rpcs::rpcstate_t state = NEW;
-
-	std::list<reply_t>& reply_list = reply_window_[clt_nonce];
-
-	for (it = reply_list.begin(); it != reply_list.end();) {
-		if (it->xid == xid){
-			jsl_log(JSL_DBG_1, "reply_list.size(): %lu\n", reply_list.size());
-
-			if (it->xid <= xid_rep){
-				state = FORGOTTEN;
-				// break;
-			} else if (!it->cb_present) {
-				state = INPROGRESS;
-				// break;
-			} else {
-				*b = it->buf;
-				*sz = it->sz;
-				state = DONE;
-				// break;
-			}
-		}
-		// smaller than the xid_rep, is FORGOTTEN
-		if (it->xid <= xid_rep){
-			free(it->buf);
-			it = reply_list.erase(it);
-		} else { 
-			it++;
-		}
+//each call goes to its handler as if it had come on its own, except
+//that a batch cannot be nested nor include a bind.  the handlers'
+//exec times and bytes count in their own stats as well as the batch's.
+//the calls' args are unmarshalled where they lie in the request, and
+//their replies copied once, into rep
+int
+rpcs::batch(unmarshall &args, marshall &rep)
+{
+	std::vector<int> procs;
+	args >> procs;
+	int n = procs.size();
+	std::vector<const char *> reqs(n);
+	std::vector<unsigned int> reqsz(n);
+	for (int i = 0; i < n && args.ok(); i++) {
+		args >> reqsz[i];
+		reqs[i] = args.take(reqsz[i]);
 	}
-
-	if (state != NEW) {
-		return state;
+	if (!args.okdone())
+		return rpc_const::unmarshal_args_failure;
+
+	std::vector<int> rets(n);
+	std::vector<std::unique_ptr<marshall> > reps(n);
+	for (int i = 0; i < n; i++) {
+		reps[i].reset(new marshall());
+		handler *f = procs_.lookup(procs[i]);
+		if (!f || procs[i] == (int)rpc_const::bind ||
+				procs[i] == (int)rpc_const::batch) {
+			badproc_++;
+			rets[i] = rpc_const::proc_failure;
+			continue;
+		}
+		//like a request on its own, in the old encoding
+		unmarshall a(reqs[i], reqsz[i], false);
+		marshall &r = *reps[i];
+		uint64_t started = now_ns();
+		rets[i] = f->fn(a, r);
+		f->stats.exec.add(now_ns() - started);
+		r.flatten();
+		f->stats.bytes_in += reqsz[i];
+		f->stats.bytes_out += r.size() - RPC_HEADER_SZ;
 	}
-	else {
-		// not seen in the list, is NEW
-		struct rpcs::reply_t rt(xid);
-		reply_window_[clt_nonce].push_back(rt);
-		return NEW;
+	rep << rets;
+	for (int i = 0; i < n; i++) {
+		//as a string, which is what the client unmarshalls
+		int sz = reps[i]->size() - RPC_HEADER_SZ;
+		rep << (unsigned int) sz;
+		rep.rawbytes(reps[i]->cstr() + RPC_HEADER_SZ, sz);
 	}
+	return 0;
+}
 
-
-	// jsl_log(JSL_DBG_2, "rpcs::checkduplicate_and_update internal error: clt_nonce %u not found\n", clt_nonce);
+void
+marshall::grow(int n)
+{
+	assert (_buf != NULL);
+	_buf = rpc_buf_realloc(_buf, std::max(2*_capa, _ind+n));
+	_capa = rpc_buf_capacity(_buf);
 }
 
-//rpc handler
-int 
-rpcs::rpcbind(int a, int &r)
+void
+marshall::rawref(const char *p, int n)
 {
-	jsl_log(JSL_DBG_2, "rpcs::rpcbind called return nonce %u\n", nonce_);
-	r = nonce_;
-	return 0;
+	if (n <= 0)
+		return;
+	segment s;
+	s.off = _ind;
+	s.p = p;
+	s.n = n;
+	_segs.push_back(s);
+	_extsz += n;
 }
 
 void
-marshall::rawbyte(unsigned char x)
+marshall::copy_to(char *b)
 {
-	if (_ind >= _capa) {
-		_capa *= 2;
-		assert (_buf != NULL);
-		_buf = (char *)realloc(_buf, _capa);
-		assert(_buf);
+	int from = 0, to = 0;
+	for (unsigned i = 0; i < _segs.size(); i++) {
+		memcpy(b + to, _buf + from, _segs[i].off - from);
+		to += _segs[i].off - from;
+		from = _segs[i].off;
+		memcpy(b + to, _segs[i].p, _segs[i].n);
+		to += _segs[i].n;
 	}
-	_buf[_ind++] = x;
+	memcpy(b + to, _buf + from, _ind - from);
 }
 
 void
-marshall::rawbytes(const char *p, int n)
+marshall::flatten()
 {
-	if ((_ind+n) > _capa) {
-		_capa = _capa > n? 2*_capa:(_capa+n);
-		assert (_buf != NULL);
-		_buf = (char *)realloc(_buf, _capa);
-		assert(_buf);
+	if (_segs.empty())
+		return;
+	int sz = _ind + _extsz;
+	char *b = rpc_buf_alloc(sz);
+	copy_to(b);
+	rpc_buf_free(_buf);
+	_buf = b;
+	_capa = rpc_buf_capacity(b);
+	_ind = sz;
+	_segs.clear();
+	_extsz = 0;
+}
+
+void
+marshall::iov(std::vector<struct iovec> *v)
+{
+	v->clear();
+	int from = 0;
+	struct iovec e;
+	for (unsigned i = 0; i < _segs.size(); i++) {
+		if (_segs[i].off > from) {
+			e.iov_base = _buf + from;
+			e.iov_len = _segs[i].off - from;
+			v->push_back(e);
+		}
+		from = _segs[i].off;
+		e.iov_base = (void *)_segs[i].p;
+		e.iov_len = _segs[i].n;
+		v->push_back(e);
+	}
+	if (_ind > from) {
+		e.iov_base = _buf + from;
+		e.iov_len = _ind - from;
+		v->push_back(e);
 	}
-	memcpy(_buf+_ind, p, n);
-	_ind += n;
 }
 
 marshall &
@@ -746,18 +1639,36 @@ operator<<(marshall &m, char x)
 }
 
 
+void
+marshall::varint(unsigned long long x)
+{
+	char *p = grab(10);
+	int n = 0;
+	while (x >= 0x80) {
+		p[n++] = (char)(x | 0x80);
+		x >>= 7;
+	}
+	p[n++] = (char)x;
+	_ind -= 10 - n;
+}
+
 marshall &
 operator<<(marshall &m, unsigned short x)
 {
-	m.rawbyte((x >> 8) & 0xff);
-	m.rawbyte(x & 0xff);
+	if (m.v2())
+		m.varint(x);
+	else
+		rpc_put_be(m.grab(sizeof(x)), x);
 	return m;
 }
 
 marshall &
 operator<<(marshall &m, short x)
 {
-	m << (unsigned short) x;
+	if (m.v2())
+		m.varint(rpc_zigzag(x));
+	else
+		m << (unsigned short) x;
 	return m;
 }
 
@@ -765,63 +1676,150 @@ marshall &
 operator<<(marshall &m, unsigned int x)
 {
 	//network order is big-endian
-	m.rawbyte((x >> 24) & 0xff);
-	m.rawbyte((x >> 16) & 0xff);
-	m.rawbyte((x >> 8) & 0xff);
-	m.rawbyte(x & 0xff);
+	if (m.v2())
+		m.varint(x);
+	else
+		rpc_put_be(m.grab(sizeof(x)), x);
 	return m;
 }
 
 marshall &
 operator<<(marshall &m, int x)
 {
-	m << (unsigned int) x;
+	if (m.v2())
+		m.varint(rpc_zigzag(x));
+	else
+		m << (unsigned int) x;
 	return m;
 }
 
 marshall &
 operator<<(marshall &m, const std::string &s)
 {
-	m << (unsigned int) s.size();
-	m.rawbytes(s.data(), s.size());
+	if (m.v2()) {
+		m.varint(s.size());
+		m.rawbytes(s.data(), s.size());
+		return m;
+	}
+	char *p = m.grab(sizeof(unsigned int) + s.size());
+	rpc_put_be(p, (unsigned int) s.size());
+	memcpy(p + sizeof(unsigned int), s.data(), s.size());
 	return m;
 }
 
 marshall &
 operator<<(marshall &m, unsigned long long x)
 {
-	m << (unsigned int) (x >> 32);
-	m << (unsigned int) x;
+	if (m.v2())
+		m.varint(x);
+	else
+		rpc_put_be(m.grab(sizeof(x)), x);
 	return m;
 }
 
 void
 marshall::pack(int x)
 {
-	rawbyte((x >> 24) & 0xff);
-	rawbyte((x >> 16) & 0xff);
-	rawbyte((x >> 8) & 0xff);
-	rawbyte(x & 0xff);
+	rpc_put_be(grab(sizeof(x)), x);
+}
+
+bool
+marshall::lz_pack()
+{
+	int n = size() - RPC_HEADER_SZ;
+	if (n < RPC_LZ_MIN)
+		return false;
+
+	//a sample from the middle of the biggest piece first: a body that
+	//does not compress (random bytes, already compressed data) is then
+	//turned down without copying it or compressing all of it
+	const char *p = _buf + RPC_HEADER_SZ;
+	int pn = _segs.empty() ? n : _segs[0].off - RPC_HEADER_SZ;
+	for (unsigned i = 0; i < _segs.size(); i++) {
+		if (_segs[i].n > pn) {
+			p = _segs[i].p;
+			pn = _segs[i].n;
+		}
+	}
+	int sn = std::min(pn, RPC_LZ_SAMPLE);
+	char sample[RPC_LZ_SAMPLE];
+	if (lz_compress(p + (pn - sn) / 2, sn, sample, sn - sn / 8) == 0)
+		return false;
+
+	//the body in one piece; the rawref()ed bytes stay where they
+	//are until it is known to pay
+	char *src = _buf;
+	if (!_segs.empty()) {
+		src = rpc_buf_alloc(size());
+		copy_to(src);
+	}
+	//the unpacked size, then the compressed bytes
+	int cap = n - n / 8;
+	char *b = rpc_buf_alloc(RPC_HEADER_SZ + sizeof(unsigned int) + cap);
+	int z = lz_compress(src + RPC_HEADER_SZ, n,
+			b + RPC_HEADER_SZ + sizeof(unsigned int), cap);
+	if (src != _buf)
+		rpc_buf_free(src);
+	if (z == 0) {
+		rpc_buf_free(b);
+		return false;
+	}
+	memcpy(b, _buf, RPC_HEADER_SZ);
+	rpc_put_be(b + RPC_HEADER_SZ, (unsigned int) n);
+	rpc_buf_free(_buf);
+	_buf = b;
+	_capa = rpc_buf_capacity(b);
+	_ind = RPC_HEADER_SZ + sizeof(unsigned int) + z;
+	_segs.clear();
+	_extsz = 0;
+	return true;
 }
 
 void
 unmarshall::unpack(int *x)
 {
-	(*x) = (rawbyte() & 0xff) << 24;
-	(*x) |= (rawbyte() & 0xff) << 16;
-	(*x) |= (rawbyte() & 0xff) << 8;
-	(*x) |= rawbyte() & 0xff;
+	const char *p = take(sizeof(*x));
+	*x = p ? rpc_get_be<int>(p) : 0;
 }
 
 //take the contents from another unmarshall object
 void
 unmarshall::take_in(unmarshall &another)
 {
-	if (_buf)
-		free(_buf);
+	assert(!_borrowed);
+	rpc_buf_free(_buf);
 	another.take_buf(&_buf, &_sz);
 	_ind = RPC_HEADER_SZ;
 	_ok = _sz >= RPC_HEADER_SZ?true:false;
+	_v2 = another._v2;
+}
+
+bool
+unmarshall::lz_unpack()
+{
+	assert(!_borrowed);
+	int z = _sz - RPC_HEADER_SZ - (int)sizeof(unsigned int);
+	if (!_ok || z < 0) {
+		_ok = false;
+		return false;
+	}
+	unsigned int n = rpc_get_be<unsigned int>(_buf + RPC_HEADER_SZ);
+	if (n > (unsigned int)RPC_LZ_MAX) {
+		_ok = false;
+		return false;
+	}
+	char *b = rpc_buf_alloc(RPC_HEADER_SZ + n);
+	if (lz_decompress(_buf + RPC_HEADER_SZ + sizeof(unsigned int), z,
+				b + RPC_HEADER_SZ, n) != (int)n) {
+		rpc_buf_free(b);
+		_ok = false;
+		return false;
+	}
+	memcpy(b, _buf, RPC_HEADER_SZ);
+	rpc_buf_free(_buf);
+	_buf = b;
+	_sz = RPC_HEADER_SZ + n;
+	return true;
 }
 
 bool
@@ -845,6 +1843,22 @@ unmarshall::rawbyte()
 	return c;
 }
 
+unsigned long long
+unmarshall::varint()
+{
+	unsigned long long x = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		if (_ind >= _sz)
+			break;
+		unsigned char c = _buf[_ind++];
+		x |= (unsigned long long)(c & 0x7f) << shift;
+		if (!(c & 0x80))
+			return x;
+	}
+	_ok = false;
+	return 0;
+}
+
 unmarshall &
 operator>>(unmarshall &u, unsigned char &x)
 {
@@ -860,50 +1874,58 @@ operator>>(unmarshall &u, char &x)
 }
 
 
+//a word at a time; a short read yields 0 and leaves u !ok().  in the
+//compact encoding a value too wide for x is an error as well
+template<class T> static inline unmarshall &
+get_word(unmarshall &u, T &x)
+{
+	if (u.v2()) {
+		unsigned long long v = u.varint();
+		if (std::is_signed<T>::value) {
+			long long s = rpc_unzigzag(v);
+			x = (T)s;
+			if ((long long)x != s)
+				u.fail();
+		} else {
+			x = (T)v;
+			if ((unsigned long long)x != v)
+				u.fail();
+		}
+		return u;
+	}
+	const char *p = u.take(sizeof(x));
+	x = p ? rpc_get_be<T>(p) : 0;
+	return u;
+}
+
 unmarshall &
 operator>>(unmarshall &u, unsigned short &x)
 {
-	x = (u.rawbyte() & 0xff) << 8;
-	x |= u.rawbyte() & 0xff;
-	return u;
+	return get_word(u, x);
 }
 
 unmarshall &
 operator>>(unmarshall &u, short &x)
 {
-	x = (u.rawbyte() & 0xff) << 8;
-	x |= u.rawbyte() & 0xff;
-	return u;
+	return get_word(u, x);
 }
 
 unmarshall &
 operator>>(unmarshall &u, unsigned int &x)
 {
-	x = (u.rawbyte() & 0xff) << 24;
-	x |= (u.rawbyte() & 0xff) << 16;
-	x |= (u.rawbyte() & 0xff) << 8;
-	x |= u.rawbyte() & 0xff;
-	return u;
+	return get_word(u, x);
 }
 
 unmarshall &
 operator>>(unmarshall &u, int &x)
 {
-	x = (u.rawbyte() & 0xff) << 24;
-	x |= (u.rawbyte() & 0xff) << 16;
-	x |= (u.rawbyte() & 0xff) << 8;
-	x |= u.rawbyte() & 0xff;
-	return u;
+	return get_word(u, x);
 }
 
 unmarshall &
 operator>>(unmarshall &u, unsigned long long &x)
 {
-	unsigned int h, l;
-	u >> h;
-	u >> l;
-	x = l | ((unsigned long long) h << 32);
-	return u;
+	return get_word(u, x);
 }
 
 unmarshall &
@@ -973,6 +1995,23 @@ make_sockaddr(const char *hostandport, struct sockaddr_in *dst){
 
 }
 
+void
+make_sockaddr(const char *addr, struct sockaddr_storage *dst)
+{
+	memset(dst, 0, sizeof(*dst));
+	if (index(addr, '/') == NULL) {
+		make_sockaddr(addr, (struct sockaddr_in *)dst);
+		return;
+	}
+	struct sockaddr_un *sun = (struct sockaddr_un *)dst;
+	if (strlen(addr) >= sizeof(sun->sun_path)) {
+		fprintf(stderr, "socket path too long: %s\n", addr);
+		exit(1);
+	}
+	sun->sun_family = AF_UNIX;
+	strcpy(sun->sun_path, addr);
+}
+
 void
 make_sockaddr(const char *host, const char *port, struct sockaddr_in *dst){
 
@@ -5,12 +5,22 @@
 #include <netinet/in.h>
 #include <list>
 #include <map>
+#include <set>
+#include <memory>
+#include <functional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include "thr_pool.h"
 #include "marshall.h"
 #include "connection.h"
+#include "reply_window.h"
+#include "proc_table.h"
+#include "histogram.h"
+#include "slock.h"
 
 #ifdef DMALLOC
 #include "dmalloc.h"
@@ -19,6 +29,8 @@
 class rpc_const {
 	public:
 		static const unsigned int bind = 1;   // handler number reserved for bind
+		static const unsigned int stats = 2;  // handler number reserved for rpcs::rpcstat
+		static const unsigned int batch = 3;  // handler number reserved for rpcs::batch
 		static const int timeout_failure = -1;
 		static const int unmarshal_args_failure = -2;
 		static const int unmarshal_reply_failure = -3;
@@ -26,13 +38,128 @@ class rpc_const {
 		static const int oldsrv_failure = -5;
 		static const int bind_failure = -6;
 		static const int cancel_failure = -7;
+		// the server was overloaded and turned the call away
+		// without running it; rpcc backs off and tries again
+		// until the call's timeout runs out.  only clients that
+		// offered feat_busy get it
+		static const int busy_failure = -8;
+		// a call in a batch is for a procedure the server does
+		// not have
+		static const int proc_failure = -9;
+
+		// features a client asks for in its bind request and a
+		// server grants in bind's return value
+		static const int feat_crc32c = 0x1;  // checksum every pdu
+		static const int feat_urgent = 0x2;  // requests may be flagged urgent
+		static const int feat_lz = 0x4;  // bodies may be compressed
+		static const int feat_batch = 0x8;  // takes rpc_batch requests
+		static const int feat_v2 = 0x10;  // bodies may be compact, see marshall::set_v2()
+		static const int feat_budget = 0x20;  // requests may carry a budget
+		static const int feat_busy = 0x40;  // takes busy_failure replies
 };
 
+// the result of an asynchronous call (see rpcc::call_async()).
+// copies of a future share the same result.
+template<class R>
+class rpc_future {
+	private:
+		struct state {
+			state() : done(false), ret(0), r() {
+				assert(pthread_mutex_init(&m, 0) == 0);
+				assert(pthread_cond_init(&c, 0) == 0);
+			}
+			~state() {
+				assert(pthread_mutex_destroy(&m) == 0);
+				assert(pthread_cond_destroy(&c) == 0);
+			}
+			pthread_mutex_t m;
+			pthread_cond_t c;
+			bool done;
+			int ret;
+			R r;
+		};
+		std::shared_ptr<state> s_;
+
+	public:
+		rpc_future() : s_(new state()) {}
+
+		//has the call finished?
+		bool ready();
+		//wait for the call to finish; returns (and fills in r) what
+		//the corresponding rpcc::call() would have
+		int get(R &r);
+		//called once, when the call finishes
+		void set(int ret, R &r);
+};
+
+// calls to the same server to make in one round trip, with
+// rpcc::call_batch():
+//   rpc_batch b;
+//   b.add(extent_protocol::put, eid, buf);
+//   b.add(extent_protocol::remove, eid);
+//   if (cl->call_batch(b) == 0 && b.get(0, r) == 0 && b.get(1, r) == 0)
+//     ...
+// the server runs the calls one after another in the order they were
+// added, as a single request: at-most-once covers the batch as a whole.
+// a server that does not take batches (no feat_batch), or a batch of
+// one, gets the calls one by one instead, each its own request: a
+// failure part-way leaves the earlier calls done, and at-most-once
+// covers each call but not the group
+class rpc_batch {
+	private:
+		friend class rpcc;
+		std::vector<int> procs_;
+		std::vector<std::string> args_;
+		std::vector<int> rets_;
+		// call i's reply is the repsz_[i] bytes at reps_[i], inside
+		// one of bufs_
+		std::list<unmarshall> bufs_;
+		std::vector<const char *> reps_;
+		std::vector<unsigned int> repsz_;
+
+	public:
+		// add the call proc(a1, ..., an, r); get() returns its r
+		template<class... Args>
+			void add(unsigned int proc, const Args &... args);
+		int size() { return procs_.size(); }
+		// once call_batch() has succeeded: what call i returned,
+		// with its reply unmarshalled into r
+		template<class R> int get(int i, R &r);
+		void clear();
+};
+
+template<class... Args> void
+rpc_batch::add(unsigned int proc, const Args &... args)
+{
+	marshall m((0 + ... + marshall_hint(args)));
+	((m << args), ...);
+	procs_.push_back(proc);
+	args_.push_back(m.get_content());
+}
+
+template<class R> int
+rpc_batch::get(int i, R &r)
+{
+	assert(i >= 0 && i < (int)rets_.size());
+	if (rets_[i] < 0)
+		return rets_[i];
+	unmarshall u(reps_[i], repsz_[i], false);
+	u >> r;
+	if (u.okdone() != true)
+		return rpc_const::unmarshal_reply_failure;
+	return rets_[i];
+}
+
 // rpc client endpoint.
 // manages a xid space per destination socket
 // threaded: multiple threads can be sending RPCs,
 class rpcc : public chanmgr {
 
+	public:
+		//completion of an asynchronous call: the return value of the
+		//call (or an rpc_const failure) and the reply to unmarshall
+		typedef std::function<void (int ret, unmarshall &rep)> callback;
+
 	private:
 
 		//manages per rpc info
@@ -44,15 +171,46 @@ class rpcc : public chanmgr {
 			unmarshall *un;
 			int intret;
 			bool done;
+			bool lz; //un is still compressed, see unpack_reply()
 			pthread_mutex_t m;
 			pthread_cond_t c;
+			int ntransmits; //protected by m
+			struct timespec sent; //first transmission, CLOCK_MONOTONIC
+
+			//asynchronous calls only: the caller lives on the heap
+			//and owns its request, reply and connection reference;
+			//the async thread retransmits it and times it out
+			callback cb;
+			unmarshall rep;
+			char *req;
+			int reqsz;
+			int refs; //protected by rpcc::m_
+			int curr_to;
+			unsigned int flags; //PDU_* to send req with
+			int backoff; //ms to wait after the next busy reply
+			bool resend; //at nextdeadline, whatever the connection
+			struct timespec nextdeadline, finaldeadline;
+			struct timespec end; //finaldeadline, kept for the budget
+			connection *ch; //protected by m
 		};
 
-		void get_refconn(connection **ch);
+		void get_refconn(connection **ch, bool urgent = false);
 		void update_xid_rep(unsigned int xid);
+		void update_rtt_wo(int rtt);
+		int rto_ms_wo();
+		void note_transmit(caller *ca);
+		int unpack_reply(caller *ca);
+
+		void start_async_wo();
+		void async_loop();
+		void transmit_async(caller *ca);
+		void timeout_async(caller *ca);
+		void finish_async_wo(caller *ca);
+		bool backoff_async_wo(caller *ca);
+		void put_caller(caller *ca);
 
 
-		sockaddr_in dst_;
+		sockaddr_storage dst_;
 		unsigned int clt_nonce_;
 		unsigned int srv_nonce_;
 		bool bind_done_;
@@ -62,6 +220,9 @@ class rpcc : public chanmgr {
 		bool reachable_;
 
 		connection *chan_;
+		connection *uchan_; // the urgent calls' own, see get_refconn()
+		// granted at bind, rpc_const::feat_*; set under chan_m_
+		std::atomic<int> features_;
 
 		pthread_mutex_t m_; // protect insert/delete to calls[]
 		pthread_mutex_t chan_m_;
@@ -72,20 +233,56 @@ class rpcc : public chanmgr {
 		std::map<int, caller *> calls_;
 		std::list<unsigned int> xid_rep_window_;
 
+		//retransmission timer (Jacobson/Karels), in microseconds and
+		//protected by m_. every call starts waiting rto_ and doubles
+		//its timeout from there
+		bool have_rtt_;
+		int srtt_;
+		int rttvar_;
+		int rto_;
+
+		//async thread: started by the first asynchronous call. it
+		//runs the retransmission timers of asynchronous calls and
+		//their completion callbacks, in order of completion
+		pthread_t async_th_;
+		bool async_started_;
+		bool async_stop_;
+		pthread_cond_t async_c_;
+		std::list<caller *> completed_;
+
 	public:
 
 		rpcc(sockaddr_in d, bool retrans=true);
+		// d from make_sockaddr(): tcp, or a unix-domain socket
+		rpcc(const sockaddr_storage &d, bool retrans=true);
 		~rpcc();
 
+		//how long a call may take, and whether it is urgent: if the
+		//server agreed at bind, urgent requests travel on a
+		//connection of their own and go ahead of normal ones in its
+		//dispatch queue, and their replies ahead of normal ones in
+		//its send queue, so that they do not wait behind bulk
+		//transfers. pass rpcc::urgent(to) as call()'s timeout
 		struct TO {
 			int to;
+			bool urgent = false;
 		};
 		static const TO to_max;
-		static const TO to_min;
+		static const TO to_min; //retransmission timeout before any rtt sample
+		static const TO rto_floor;
+		static const TO rto_ceiling;
+		static const TO backoff_floor; //first wait after a busy reply
+		static const TO backoff_ceiling;
 		static TO to(int x) { TO t; t.to = x; return t;}
+		static TO urgent(TO t = to_max) { t.urgent = true; return t;}
 
 		unsigned int id() { return clt_nonce_; }
 
+		//smoothed round-trip time and current retransmission timeout
+		//to the server, in microseconds (for monitoring)
+		int srtt();
+		int rto();
+
 		int bind(TO to = to_max);
 
 		void set_reachable(bool r) { reachable_ = r; }
@@ -95,201 +292,234 @@ class rpcc : public chanmgr {
 		int call1(unsigned int proc, 
 				marshall &req, unmarshall &rep, TO to);
 
+		//start a call and return without waiting for the reply.
+		//cb is called exactly once, with what call1() would have
+		//returned.  callbacks run one at a time on the rpcc's async
+		//thread, so they must not wait for other asynchronous calls
+		//of the same rpcc.  takes over req's buffer.
+		void call1_async(unsigned int proc, marshall &req,
+				const callback &cb, TO to);
+
+		//make the calls in b in one round trip, or one at a time
+		//if the server does not take batches.  returns 0 or an
+		//rpc_const failure for the batch as a whole, after which
+		//none, some or all of the calls may have run
+		int call_batch(rpc_batch &b, TO to = to_max);
+
 		bool got_pdu(connection *c, char *b, int sz);
 
 
 		template<class R>
 			int call_m(unsigned int proc, marshall &req, R & r, TO to);
-
-		template<class R>
-			int call(unsigned int proc, R & r, TO to = to_max); 
-		template<class R, class A1>
-			int call(unsigned int proc, const A1 & a1, R & r, TO to = to_max); 
-		template<class R, class A1, class A2>
-			int call(unsigned int proc, const A1 & a1, const A2 & a2, R & r, 
-					TO to = to_max); 
-		template<class R, class A1, class A2, class A3>
-			int call(unsigned int proc, const A1 & a1, const A2 & a2, const A3 & a3, 
-					R & r, TO to = to_max); 
-		template<class R, class A1, class A2, class A3, class A4>
-			int call(unsigned int proc, const A1 & a1, const A2 & a2, const A3 & a3, 
-					const A4 & a4, R & r, TO to = to_max);
-		template<class R, class A1, class A2, class A3, class A4, class A5>
-			int call(unsigned int proc, const A1 & a1, const A2 & a2, const A3 & a3, 
-					const A4 & a4, const A5 & a5, R & r, TO to = to_max); 
-		template<class R, class A1, class A2, class A3, class A4, class A5,
-			class A6>
-				int call(unsigned int proc, const A1 & a1, const A2 & a2, const A3 & a3, 
-						const A4 & a4, const A5 & a5, const A6 & a6,
-						R & r, TO to = to_max); 
-		template<class R, class A1, class A2, class A3, class A4, class A5, 
-			class A6, class A7>
-				int call(unsigned int proc, const A1 & a1, const A2 & a2, const A3 & a3, 
-						const A4 & a4, const A5 & a5, const A6 &a6, const A7 &a7,
-						R & r, TO to = to_max); 
-
+		template<class T, size_t... I>
+			int call_t(unsigned int proc, T &t, TO to,
+					std::index_sequence<I...>);
+
+		//call(proc, a1, ..., an, r [, to]): marshall the arguments
+		//straight from the caller's objects, which may be temporaries,
+		//and unmarshall the reply into r. r must be a non-const lvalue;
+		//to, if given, is the last argument.
+		template<class... Args>
+			int call(unsigned int proc, Args &&... args);
+
+		//asynchronous versions of call(): the reply is handed to cb
+		//(see call1_async()) or is picked up from a future, e.g.
+		//  rpc_future<int> f;
+		//  cl->call_async(proc, f, rpcc::to(1000), a1, a2);
+		//  ...
+		//  int ret = f.get(r);
+		template<class R, class... Args>
+			void call_async(unsigned int proc,
+					const std::function<void (int, R &)> &cb, TO to,
+					const Args &... args);
+		template<class R, class... Args>
+			void call_async(unsigned int proc, rpc_future<R> &f, TO to,
+					const Args &... args);
 };
 
-template<class R> int 
-rpcc::call_m(unsigned int proc, marshall &req, R & r, TO to) 
+template<class R> bool
+rpc_future<R>::ready()
 {
-	unmarshall u;
-	int intret = call1(proc, req, u, to);
-	if (intret < 0) return intret;
-	u >> r;
-	if(u.okdone() != true)
-		return rpc_const::unmarshal_reply_failure;
-	return intret;
+	ScopedLock ml(&s_->m);
+	return s_->done;
 }
 
 template<class R> int
-rpcc::call(unsigned int proc, R & r, TO to) 
+rpc_future<R>::get(R &r)
 {
-	marshall m;
-	return call_m(proc, m, r, to);
+	ScopedLock ml(&s_->m);
+	while (!s_->done)
+		assert(pthread_cond_wait(&s_->c, &s_->m) == 0);
+	r = s_->r;
+	return s_->ret;
 }
 
-template<class R, class A1> int
-rpcc::call(unsigned int proc, const A1 & a1, R & r, TO to) 
+template<class R> void
+rpc_future<R>::set(int ret, R &r)
 {
-	marshall m;
-	m << a1;
-	return call_m(proc, m, r, to);
+	ScopedLock ml(&s_->m);
+	assert(!s_->done);
+	s_->ret = ret;
+	s_->r = r;
+	s_->done = true;
+	assert(pthread_cond_broadcast(&s_->c) == 0);
 }
 
-template<class R, class A1, class A2> int
-rpcc::call(unsigned int proc, const A1 & a1, const A2 & a2,
-		R & r, TO to) 
+template<class R, class... Args> void
+rpcc::call_async(unsigned int proc, const std::function<void (int, R &)> &cb,
+		TO to, const Args &... args)
 {
-	marshall m;
-	m << a1;
-	m << a2;
-	return call_m(proc, m, r, to);
-}
-
-template<class R, class A1, class A2, class A3> int
-rpcc::call(unsigned int proc, const A1 & a1, const A2 & a2,
-		const A3 & a3, R & r, TO to) 
-{
-	marshall m;
-	m << a1;
-	m << a2;
-	m << a3;
-	return call_m(proc, m, r, to);
+	marshall m((0 + ... + marshall_hint(args)));
+	m.set_v2(features_ & rpc_const::feat_v2);
+	((m << args), ...);
+	call1_async(proc, m, [cb](int ret, unmarshall &u) {
+		R r = R();
+		if (ret >= 0) {
+			u >> r;
+			if (u.okdone() != true)
+				ret = rpc_const::unmarshal_reply_failure;
+		}
+		cb(ret, r);
+	}, to);
 }
 
-template<class R, class A1, class A2, class A3, class A4> int
-rpcc::call(unsigned int proc, const A1 & a1, const A2 & a2,
-		const A3 & a3, const A4 & a4, R & r, TO to) 
+template<class R, class... Args> void
+rpcc::call_async(unsigned int proc, rpc_future<R> &f, TO to,
+		const Args &... args)
 {
-	marshall m;
-	m << a1;
-	m << a2;
-	m << a3;
-	m << a4;
-	return call_m(proc, m, r, to);
+	rpc_future<R> ff = f;
+	call_async<R>(proc, [ff](int ret, R &r) mutable { ff.set(ret, r); },
+			to, args...);
 }
 
-template<class R, class A1, class A2, class A3, class A4, class A5> int
-rpcc::call(unsigned int proc, const A1 & a1, const A2 & a2,
-		const A3 & a3, const A4 & a4, const A5 & a5, R & r, TO to) 
+template<class R> int 
+rpcc::call_m(unsigned int proc, marshall &req, R & r, TO to) 
 {
-	marshall m;
-	m << a1;
-	m << a2;
-	m << a3;
-	m << a4;
-	m << a5;
-	return call_m(proc, m, r, to);
+	unmarshall u;
+	int intret = call1(proc, req, u, to);
+	if (intret < 0) return intret;
+	u >> r;
+	if(u.okdone() != true)
+		return rpc_const::unmarshal_reply_failure;
+	return intret;
 }
 
-template<class R, class A1, class A2, class A3, class A4, class A5,
-	class A6> int
-rpcc::call(unsigned int proc, const A1 & a1, const A2 & a2,
-		const A3 & a3, const A4 & a4, const A5 & a5, 
-		const A6 & a6, R & r, TO to) 
+template<class... Args> int
+rpcc::call(unsigned int proc, Args &&... args)
 {
-	marshall m;
-	m << a1;
-	m << a2;
-	m << a3;
-	m << a4;
-	m << a5;
-	m << a6;
-	return call_m(proc, m, r, to);
+	constexpr size_t n = sizeof...(Args);
+	typedef std::tuple<Args...> types;
+	typedef typename std::decay<
+		typename std::tuple_element<n - 1, types>::type>::type last;
+	constexpr bool has_to = std::is_same<last, TO>::value;
+	constexpr size_t nargs = n - (has_to ? 2 : 1);
+	typedef typename std::tuple_element<nargs, types>::type reply;
+	static_assert(std::is_lvalue_reference<reply>::value &&
+			!std::is_const<typename std::remove_reference<reply>::type>::value,
+			"the reply must be a non-const lvalue");
+
+	auto t = std::tie(args...);
+	TO to = to_max;
+	if constexpr (has_to)
+		to = std::get<n - 1>(t);
+	return call_t(proc, t, to, std::make_index_sequence<nargs>());
 }
 
-template<class R, class A1, class A2, class A3, class A4, class A5,
-	class A6, class A7> int
-rpcc::call(unsigned int proc, const A1 & a1, const A2 & a2,
-		const A3 & a3, const A4 & a4, const A5 & a5, 
-		const A6 & a6, const A7 & a7,
-		R & r, TO to) 
+template<class T, size_t... I> int
+rpcc::call_t(unsigned int proc, T &t, TO to, std::index_sequence<I...>)
 {
-	marshall m;
-	m << a1;
-	m << a2;
-	m << a3;
-	m << a4;
-	m << a5;
-	m << a6;
-	m << a7;
-	return call_m(proc, m, r, to);
+	marshall m((0 + ... + marshall_hint(std::get<I>(t))));
+	m.set_v2(features_ & rpc_const::feat_v2);
+	(marshall_ref(m, std::get<I>(t)), ...);
+	return call_m(proc, m, std::get<sizeof...(I)>(t), to);
 }
 
 bool operator<(const sockaddr_in &a, const sockaddr_in &b);
 
+// what rpcs::dispatch measures for each procedure, in ns and bytes
+struct proc_stats {
+	proc_stats() : bytes_in(0), bytes_out(0) { }
+	histogram queue; // from got_pdu() until a dispatch thread takes it
+	histogram exec;  // in the handler
+	histogram send;  // saving the reply and handing it to the connection
+	std::atomic<uint64_t> bytes_in;
+	std::atomic<uint64_t> bytes_out;
+};
+
 class handler {
 	public:
-		handler() { }
+		handler() : urgent(false) { }
 		virtual ~handler() { }
 		virtual int fn(unmarshall &, marshall &) = 0;
+		proc_stats stats;
+		bool urgent; // dispatched ahead of other procedures' requests
+};
+
+// calls (sob->*meth)(a1, ..., an, r) with a1..an unmarshalled from the
+// request: moved into by-value and && parameters, bound to const &
+// ones. r is the last parameter, a non-const reference, and is
+// marshalled into the reply.
+template<class S, class... P>
+class method_handler : public handler {
+	private:
+		typedef std::tuple<P...> params;
+		static constexpr size_t nargs = sizeof...(P) - 1;
+		typedef typename std::tuple_element<nargs, params>::type reply;
+		static_assert(std::is_lvalue_reference<reply>::value &&
+				!std::is_const<typename std::remove_reference<reply>::type>::value,
+				"a handler's last parameter must be its non-const reply");
+		typedef typename std::remove_reference<reply>::type R;
+
+		S *sob_;
+		int (S::*meth_)(P...);
+
+		template<size_t... I>
+		int call(unmarshall &args, marshall &ret, std::index_sequence<I...>) {
+			std::tuple<typename std::decay<
+				typename std::tuple_element<I, params>::type>::type...> a;
+			(void)(args >> ... >> std::get<I>(a));
+			if(!args.okdone())
+				return rpc_const::unmarshal_args_failure;
+			R r = R();
+			int b = (sob_->*meth_)(std::forward<
+					typename std::tuple_element<I, params>::type>(
+						std::get<I>(a))..., r);
+			ret << r;
+			return b;
+		}
+
+	public:
+		method_handler(S *sob, int (S::*meth)(P...))
+			: sob_(sob), meth_(meth) { }
+		int fn(unmarshall &args, marshall &ret) {
+			return call(args, ret, std::make_index_sequence<nargs>());
+		}
 };
 
 
 // rpc server endpoint.
 class rpcs : public chanmgr {
 
-	typedef enum {
-		NEW,  // new RPC, not a duplicate
-		INPROGRESS, // duplicate of an RPC we're still processing
-		DONE, // duplicate of an RPC we already replied to (have reply)
-		FORGOTTEN,  // duplicate of an old RPC whose reply we've forgotten
-	} rpcstate_t;
+	typedef reply_window::rpcstate_t rpcstate_t;
 
 	private:
 
-	struct reply_t {
-		reply_t (unsigned int _xid) {
-			xid = _xid;
-			cb_present = false;
-			buf = NULL;
-			sz = 0;
-		}
-		unsigned int xid;
-		bool cb_present;
-		char *buf;
-		int sz;
-	};
-
 	int port_;
+	std::string path_; // of the unix-domain socket, instead of port_
 	unsigned int nonce_;
+	int features_; // rpc_const::feat_* granted to clients
 
 	// provide at most once semantics by maintaining a window of replies
 	// per client that that client hasn't acknowledged receiving yet.
-	std::map<unsigned int, std::list<reply_t> > reply_window_;
-
-	void free_reply_window(void);
-	void add_reply(unsigned int clt_nonce, unsigned int xid, char *b, int sz);
-
-	rpcstate_t checkduplicate_and_update(unsigned int clt_nonce, 
-			unsigned int xid, unsigned int rep_xid,
-			char **b, int *sz);
+	reply_window reply_window_;
 
 	void updatestat(unsigned int proc);
 
 	// latest connection to the client
 	std::map<unsigned int, connection *> conns_;
+	// clients that offered feat_busy when they bound.  the reactor
+	// looks here, so busy_m_ is never held while taking another lock
+	std::set<unsigned int> busy_ok_;
 
 	// counting
 	const int counting_;
@@ -299,13 +529,36 @@ class rpcs : public chanmgr {
 	int lossytest_; 
 	bool reachable_;
 
-	// map proc # to function
-	std::map<int, handler *> procs_;
+	// map proc # to function; looked up without a lock
+	proc_table procs_;
 
-	pthread_mutex_t procs_m_; // protect insert/delete to procs[]
 	pthread_mutex_t count_m_;  //protect modification of counts
-	pthread_mutex_t reply_window_m_; // protect reply window et al
 	pthread_mutex_t conss_m_; // protect conns_
+	pthread_mutex_t busy_m_; // protect busy_ok_
+
+	// requests turned away or answered from the at-most-once window
+	std::atomic<uint64_t> dup_done_; // replied again from the window
+	std::atomic<uint64_t> dup_inprogress_; // still being handled, dropped
+	std::atomic<uint64_t> forgotten_; // reply long gone, atmostonce_failure
+	std::atomic<uint64_t> oldsrv_; // for an earlier instance of the server
+	std::atomic<uint64_t> badproc_; // for an unregistered procedure
+
+	// admission control: requests are turned away with busy_failure
+	// rather than queued once max_queued_ are waiting for a dispatch
+	// thread, or once there is a standing queue (at least one job
+	// per thread) and the last request dispatched had waited longer
+	// than max_qdelay_.  <= 0 turns a limit off.  a client that did
+	// not offer feat_busy would take busy_failure for a real failure,
+	// so its requests queue regardless, as they always have
+	std::atomic<int> queued_; // in dispatchpool_, not yet started
+	std::atomic<uint64_t> qdelay_; // ns the last dispatched one waited
+	int max_queued_;
+	int64_t max_qdelay_; // ns
+	std::atomic<uint64_t> busy_; // turned away
+	std::atomic<uint64_t> expired_; // their caller gave up before dispatch
+	bool admit(bool urgent, int proc);
+	bool takes_busy(const char *b);
+	void reply_busy(connection *c, char *b, bool urgent);
 
 
 	protected:
@@ -315,288 +568,87 @@ class rpcs : public chanmgr {
 		char *buf;
 		int sz;
 		connection *conn;
+		uint64_t arrived; // ns, for proc_stats::queue
+		bool urgent;
 	};
 	void dispatch(djob_t *);
 
 	// internal handler registration
 	void reg1(unsigned int proc, handler *);
 
+	rpcs(unsigned int port, const std::string &path, int counts, int nthreads);
+
 	ThrPool* dispatchpool_;
 	tcpsconn* listener_;
+	bool ordered_;
 
 	public:
-	rpcs(unsigned int port, int counts=0);
+	// nthreads dispatch threads; by default RPC_THREADS, or one per
+	// core but at least min_dispatch_threads
+	rpcs(unsigned int port, int counts=0, int nthreads=0);
+	// listen on addr, in the same forms as make_sockaddr() takes:
+	// "[host:]port", or a path for a unix-domain socket, which
+	// clients on the same host reach without going through tcp
+	rpcs(const std::string &addr, int counts=0, int nthreads=0);
 	~rpcs();
 
-	//RPC handler for clients binding
-	int rpcbind(int a, int &r);
-
-	void set_reachable(bool r) { reachable_ = r; }
-
-	bool got_pdu(connection *c, char *b, int sz);
-
-	// register a handler
-	template<class S, class A1, class R>
-		void reg(unsigned int proc, S*, int (S::*meth)(const A1 a1, R & r));
-	template<class S, class A1, class A2, class R>
-		void reg(unsigned int proc, S*, int (S::*meth)(const A1 a1, const A2, 
-					R & r));
-	template<class S, class A1, class A2, class A3, class R>
-		void reg(unsigned int proc, S*, int (S::*meth)(const A1, const A2, 
-					const A3, R & r));
-	template<class S, class A1, class A2, class A3, class A4, class R>
-		void reg(unsigned int proc, S*, int (S::*meth)(const A1, const A2, 
-					const A3, const A4, R & r));
-	template<class S, class A1, class A2, class A3, class A4, class A5, class R>
-		void reg(unsigned int proc, S*, int (S::*meth)(const A1, const A2, 
-					const A3, const A4, const A5, 
-					R & r));
-	template<class S, class A1, class A2, class A3, class A4, class A5, class A6,
-		class R>
-			void reg(unsigned int proc, S*, int (S::*meth)(const A1, const A2, 
-						const A3, const A4, const A5, 
-						const A6, R & r));
-	template<class S, class A1, class A2, class A3, class A4, class A5, class A6,
-		class A7, class R>
-			void reg(unsigned int proc, S*, int (S::*meth)(const A1, const A2, 
-						const A3, const A4, const A5, 
-						const A6, const A7,
-						R & r));
-};
+	static const int min_dispatch_threads = 10;
 
-template<class S, class A1, class R> void
-rpcs::reg(unsigned int proc, S*sob, int (S::*meth)(const A1 a1, R & r))
-{
-	class h1 : public handler {
-		private:
-			S * sob;
-			int (S::*meth)(const A1 a1, R & r);
-		public:
-			h1(S *xsob, int (S::*xmeth)(const A1 a1, R & r))
-				: sob(xsob), meth(xmeth) { }
-			int fn(unmarshall &args, marshall &ret) {
-				A1 a1;
-				R r;
-				args >> a1;
-				if(!args.okdone())
-					return rpc_const::unmarshal_args_failure;
-				int b = (sob->*meth)(a1, r);
-				ret << r;
-				return b;
-			}
-	};
-	reg1(proc, new h1(sob, meth));
-}
-
-template<class S, class A1, class A2, class R> void
-rpcs::reg(unsigned int proc, S*sob, int (S::*meth)(const A1 a1, const A2 a2, 
-			R & r))
-{
-	class h1 : public handler {
-		private:
-			S * sob;
-			int (S::*meth)(const A1 a1, const A2 a2, R & r);
-		public:
-			h1(S *xsob, int (S::*xmeth)(const A1 a1, const A2 a2, R & r))
-				: sob(xsob), meth(xmeth) { }
-			int fn(unmarshall &args, marshall &ret) {
-				A1 a1;
-				A2 a2;
-				R r;
-				args >> a1;
-				args >> a2;
-				if(!args.okdone())
-					return rpc_const::unmarshal_args_failure;
-				int b = (sob->*meth)(a1, a2, r);
-				ret << r;
-				return b;
-			}
-	};
-	reg1(proc, new h1(sob, meth));
-}
+	//RPC handler for clients binding: r is the server nonce, and
+	//the return value the features asked for in a that this server
+	//also supports
+	int rpcbind(int a, int &r);
 
-template<class S, class A1, class A2, class A3, class R> void
-rpcs::reg(unsigned int proc, S*sob, int (S::*meth)(const A1 a1, const A2 a2, 
-			const A3 a3, R & r))
-{
-	class h1 : public handler {
-		private:
-			S * sob;
-			int (S::*meth)(const A1 a1, const A2 a2, const A3 a3, R & r);
-		public:
-			h1(S *xsob, int (S::*xmeth)(const A1 a1, const A2 a2, const A3 a3, R & r))
-				: sob(xsob), meth(xmeth) { }
-			int fn(unmarshall &args, marshall &ret) {
-				A1 a1;
-				A2 a2;
-				A3 a3;
-				R r;
-				args >> a1;
-				args >> a2;
-				args >> a3;
-				if(!args.okdone())
-					return rpc_const::unmarshal_args_failure;
-				int b = (sob->*meth)(a1, a2, a3, r);
-				ret << r;
-				return b;
-			}
-	};
-	reg1(proc, new h1(sob, meth));
-}
+	//RPC handler for rpcstat: a report of the proc_stats of every
+	//procedure, the at-most-once counters and connection and reply
+	//window sizes
+	int rpcstat(int a, std::string &r);
 
-template<class S, class A1, class A2, class A3, class A4, class R> void
-rpcs::reg(unsigned int proc, S*sob, int (S::*meth)(const A1 a1, const A2 a2, 
-			const A3 a3, const A4 a4, 
-			R & r))
-{
-	class h1 : public handler {
-		private:
-			S * sob;
-			int (S::*meth)(const A1 a1, const A2 a2, const A3 a3, const A4 a4, R & r);
-		public:
-			h1(S *xsob, int (S::*xmeth)(const A1 a1, const A2 a2, const A3 a3, 
-						const A4 a4, R & r))
-				: sob(xsob), meth(xmeth)  { }
-			int fn(unmarshall &args, marshall &ret) {
-				A1 a1;
-				A2 a2;
-				A3 a3;
-				A4 a4;
-				R r;
-				args >> a1;
-				args >> a2;
-				args >> a3;
-				args >> a4;
-				if(!args.okdone())
-					return rpc_const::unmarshal_args_failure;
-				int b = (sob->*meth)(a1, a2, a3, a4, r);
-				ret << r;
-				return b;
-			}
-	};
-	reg1(proc, new h1(sob, meth));
-}
+	//RPC handler for rpc_const::batch: runs the calls of an
+	//rpc_batch through their handlers and returns what each did
+	int batch(unmarshall &args, marshall &rep);
 
-template<class S, class A1, class A2, class A3, class A4, class A5, class R> void
-rpcs::reg(unsigned int proc, S*sob, int (S::*meth)(const A1 a1, const A2 a2, 
-			const A3 a3, const A4 a4, 
-			const A5 a5, R & r))
-{
-	class h1 : public handler {
-		private:
-			S * sob;
-			int (S::*meth)(const A1 a1, const A2 a2, const A3 a3, const A4 a4, 
-					const A5 a5, R & r);
-		public:
-			h1(S *xsob, int (S::*xmeth)(const A1 a1, const A2 a2, const A3 a3, 
-						const A4 a4, const A5 a5, R & r))
-				: sob(xsob), meth(xmeth) { }
-			int fn(unmarshall &args, marshall &ret) {
-				A1 a1;
-				A2 a2;
-				A3 a3;
-				A4 a4;
-				A5 a5;
-				R r;
-				args >> a1;
-				args >> a2;
-				args >> a3;
-				args >> a4;
-				args >> a5;
-				if(!args.okdone())
-					return rpc_const::unmarshal_args_failure;
-				int b = (sob->*meth)(a1, a2, a3, a4, a5, r);
-				ret << r;
-				return b;
-			}
-	};
-	reg1(proc, new h1(sob, meth));
-}
+	void set_reachable(bool r) { reachable_ = r; }
 
-template<class S, class A1, class A2, class A3, class A4, class A5, class A6, class R> void
-rpcs::reg(unsigned int proc, S*sob, int (S::*meth)(const A1 a1, const A2 a2, 
-			const A3 a3, const A4 a4, 
-			const A5 a5, const A6 a6, 
-			R & r))
-{
-	class h1 : public handler {
-		private:
-			S * sob;
-			int (S::*meth)(const A1 a1, const A2 a2, const A3 a3, const A4 a4, 
-					const A5 a5, const A6 a6, R & r);
-		public:
-			h1(S *xsob, int (S::*xmeth)(const A1 a1, const A2 a2, const A3 a3, 
-						const A4 a4, const A5 a5, const A6 a6, R & r))
-				: sob(xsob), meth(xmeth) { }
-			int fn(unmarshall &args, marshall &ret) {
-				A1 a1;
-				A2 a2;
-				A3 a3;
-				A4 a4;
-				A5 a5;
-				A6 a6;
-				R r;
-				args >> a1;
-				args >> a2;
-				args >> a3;
-				args >> a4;
-				args >> a5;
-				args >> a6;
-				if(!args.okdone())
-					return rpc_const::unmarshal_args_failure;
-				int b = (sob->*meth)(a1, a2, a3, a4, a5, a6, r);
-				ret << r;
-				return b;
-			}
-	};
-	reg1(proc, new h1(sob, meth));
-}
+	// handle the requests of each connection one at a time, in the
+	// order they arrive. a handler that blocks then holds up every
+	// later request on its connection. call before any client binds.
+	void set_ordered(bool o) { ordered_ = o; }
+
+	// admission limits, by default RPC_MAX_QUEUE (requests) and
+	// RPC_MAX_QDELAY (ms) or max_queued_per_thread per dispatch
+	// thread and default_max_qdelay.  urgent requests, bind and
+	// stats are always let in, and so is everything on an ordered
+	// server, where turning one request away would reorder them
+	void set_admission(int max_queued, int max_qdelay_ms);
+
+	// for a handler: ms left before the caller of the request this
+	// thread is handling gives up waiting for the reply, or -1 if it
+	// never does.  a handler that calls another server can pass this
+	// on as the timeout of its own call.  requests whose budget has
+	// run out by the time a thread is free for them are dropped.
+	static int budget();
+	static const int max_queued_per_thread = 32;
+	static const int default_max_qdelay = 100;
 
-template<class S, class A1, class A2, class A3, class A4, class A5, 
-	class A6, class A7, class R> void
-rpcs::reg(unsigned int proc, S*sob, int (S::*meth)(const A1 a1, const A2 a2, 
-			const A3 a3, const A4 a4, 
-			const A5 a5, const A6 a6,
-			const A7 a7, R & r))
-{
-	class h1 : public handler {
-		private:
-			S * sob;
-			int (S::*meth)(const A1 a1, const A2 a2, const A3 a3, const A4 a4, 
-					const A5 a5, const A6 a6, const A7 a7, R & r);
-		public:
-			h1(S *xsob, int (S::*xmeth)(const A1 a1, const A2 a2, const A3 a3, 
-						const A4 a4, const A5 a5, const A6 a6,
-						const A7 a7, R & r))
-				: sob(xsob), meth(xmeth) { }
-			int fn(unmarshall &args, marshall &ret) {
-				A1 a1;
-				A2 a2;
-				A3 a3;
-				A4 a4;
-				A5 a5;
-				A6 a6;
-				A7 a7;
-				R r;
-				args >> a1;
-				args >> a2;
-				args >> a3;
-				args >> a4;
-				args >> a5;
-				args >> a6;
-				args >> a7;
-				if(!args.okdone())
-					return rpc_const::unmarshal_args_failure;
-				int b = (sob->*meth)(a1, a2, a3, a4, a5, a6, a7, r);
-				ret << r;
-				return b;
-			}
-	};
-	reg1(proc, new h1(sob, meth));
-}
+	bool got_pdu(connection *c, char *b, int sz);
 
+	// register a handler: int S::meth(A1, ..., An, R &r), where each
+	// argument is taken by value, const & or &&. requests for an
+	// urgent procedure are dispatched, and their replies sent, ahead
+	// of normal ones, as are requests a client marks urgent
+	template<class S, class... P>
+		void reg(unsigned int proc, S *sob, int (S::*meth)(P...),
+				bool urgent = false) {
+			handler *h = new method_handler<S, P...>(sob, meth);
+			h->urgent = urgent;
+			reg1(proc, h);
+		}
+};
 
 void make_sockaddr(const char *hostandport, struct sockaddr_in *dst);
+// also takes the path of a unix-domain socket: anything with a '/'
+void make_sockaddr(const char *addr, struct sockaddr_storage *dst);
 void make_sockaddr(const char *host, const char *port,
 		struct sockaddr_in *dst);
 
@@ -0,0 +1,485 @@
+// rpc throughput and latency benchmark.
+//
+//   rpcbench [options]
+//
+// runs every combination of the comma-separated lists given to
+//   -m closed,open   closed loop: each thread makes one call after the
+//                    other.  open loop: calls start at -r calls/s
+//                    whatever the server manages, and latency counts
+//                    from when a call was due to start
+//   -w put,get,echo  the payload goes to the server, comes back, or both
+//   -s 16,64k,max    payload bytes, with k and m suffixes; max is the
+//                    most a pdu holds
+//   -t 1,8           client threads
+//   -c 1,4           rpcc instances, which the threads take turns at
+//   -p 10            server dispatch threads
+//   -a 1,0           at-most-once on (a random clt_nonce) or off (0)
+//   -r 1000          open loop: calls/s over all the threads
+// and prints a line for each run, in
+//   -f csv|json      comma-separated values under a header line, or a
+//                    JSON object per line
+// a run lasts -d secs (2) after -W secs (0.5) of warming up, against a
+// server in this process on a fresh port or against
+//   -x [host:]port   "rpcbench -l [host:]port -p n" running elsewhere
+//                    (the pool column is then 0)
+// the payload is random, so compression does not flatter it.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "rpc.h"
+#include "histogram.h"
+#include "jsl_log.h"
+
+enum {
+	bench_put = 0x9001,
+	bench_get,
+	bench_echo
+};
+
+class bench_srv {
+	public:
+		bench_srv(const std::string &d) : data(d) { }
+		int put(const std::string &buf, int &r) {
+			r = buf.size();
+			return 0;
+		}
+		int get(int n, std::string &r) {
+			r.assign(data, 0, n);
+			return 0;
+		}
+		int echo(std::string buf, std::string &r) {
+			r = std::move(buf);
+			return 0;
+		}
+	private:
+		const std::string &data;
+};
+
+static rpcs *
+start_srv(rpcs *s, bench_srv *srv)
+{
+	s->reg(bench_put, srv, &bench_srv::put);
+	s->reg(bench_get, srv, &bench_srv::get);
+	s->reg(bench_echo, srv, &bench_srv::echo);
+	return s;
+}
+
+static double
+now_sec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+sleep_until(double t)
+{
+	double d = t - now_sec();
+	if (d > 0)
+		usleep(d * 1e6);
+}
+
+struct run {
+	// the configuration
+	std::string mode;
+	std::string work;
+	int size;
+	int threads;
+	int nclients;
+	int pool;
+	bool amo;
+	int rate;
+
+	// what the threads share
+	std::vector<rpcc *> clients;
+	const std::string *payload;
+	double start, end; // of the measurement, now_sec()
+	std::atomic<bool> stop;
+	std::atomic<int> inflight; // open loop
+	int max_inflight;
+	// once bench() stops waiting, the calls still out are counted as
+	// errors and their replies, should they come, are not counted
+	pthread_mutex_t m;
+	bool abandoned;
+	histogram h; // ns
+	std::atomic<uint64_t> calls;
+	std::atomic<uint64_t> errors;
+};
+
+static const rpcc::TO call_to = { 10000 };
+// the open loop gives up on calls beyond this many payload bytes
+// outstanding rather than queue without bound
+static const int max_inflight_bytes = 256 << 20;
+
+// one call of r's workload; whether it went through
+static bool
+do_call(run *r, rpcc *c)
+{
+	int n;
+	std::string rep;
+	if (r->work == "put")
+		return c->call(bench_put, *r->payload, n, call_to) == 0 &&
+			n == r->size;
+	if (r->work == "get")
+		return c->call(bench_get, r->size, rep, call_to) == 0 &&
+			(int)rep.size() == r->size;
+	return c->call(bench_echo, *r->payload, rep, call_to) == 0 &&
+		rep.size() == r->payload->size();
+}
+
+// count a call that was due at t0 and finished now, if it was due
+// during the measurement; one that finishes late still counts, as
+// lateness is what the open loop is there to show
+static void
+record(run *r, double t0, bool ok)
+{
+	double t1 = now_sec();
+	if (t0 < r->start || t0 >= r->end)
+		return;
+	if (ok) {
+		r->h.add((t1 - t0) * 1e9);
+		r->calls++;
+	} else {
+		r->errors++;
+	}
+}
+
+// an open loop call's reply
+static void
+settle(run *r, double t0, bool ok)
+{
+	ScopedLock ml(&r->m);
+	if (!r->abandoned)
+		record(r, t0, ok);
+	r->inflight--;
+}
+
+struct worker_arg {
+	run *r;
+	int i;
+};
+
+static void *
+closed_worker(void *a)
+{
+	worker_arg *w = (worker_arg *)a;
+	run *r = w->r;
+	rpcc *c = r->clients[w->i % r->nclients];
+	while (!r->stop) {
+		double t0 = now_sec();
+		bool ok = do_call(r, c);
+		record(r, t0, ok);
+	}
+	return NULL;
+}
+
+// calls go out asynchronously, on schedule, so that a slow reply does
+// not hold up the calls behind it
+static void *
+open_worker(void *a)
+{
+	worker_arg *w = (worker_arg *)a;
+	run *r = w->r;
+	rpcc *c = r->clients[w->i % r->nclients];
+	double each = (double)r->threads / r->rate;
+	double t0 = now_sec() + each * w->i / r->threads;
+	// every call due before the end goes out, however late
+	for (; t0 < r->end; t0 += each) {
+		sleep_until(t0);
+		if (r->inflight >= r->max_inflight || now_sec() - t0 > 1) {
+			// the server, or sending, is this far behind; the
+			// call fails
+			record(r, t0, false);
+			continue;
+		}
+		r->inflight++;
+		std::function<void (int, int &)> ip = [r, t0](int ret, int &n) {
+			settle(r, t0, ret == 0 && n == r->size);
+		};
+		std::function<void (int, std::string &)> sp =
+			[r, t0](int ret, std::string &rep) {
+			settle(r, t0, ret == 0 && (int)rep.size() == r->size);
+		};
+		if (r->work == "put")
+			c->call_async<int>(bench_put, ip, call_to, *r->payload);
+		else if (r->work == "get")
+			c->call_async<std::string>(bench_get, sp, call_to, r->size);
+		else
+			c->call_async<std::string>(bench_echo, sp, call_to,
+					*r->payload);
+	}
+	return NULL;
+}
+
+static void
+print_run(run *r, double secs, const char *format, bool first)
+{
+	double mb = (double)r->calls * r->size *
+		(r->work == "echo" ? 2 : 1) / secs / 1e6;
+	double p50 = r->h.percentile(0.5) / 1e3;
+	double p99 = r->h.percentile(0.99) / 1e3;
+	double p999 = r->h.percentile(0.999) / 1e3;
+	double mx = r->h.max() / 1e3;
+	if (strcmp(format, "json") == 0) {
+		printf("{\"mode\": \"%s\", \"work\": \"%s\", \"bytes\": %d, "
+				"\"threads\": %d, \"clients\": %d, \"pool\": %d, "
+				"\"amo\": %d, \"rate\": %d, \"secs\": %.2f, "
+				"\"calls\": %llu, \"errors\": %llu, "
+				"\"calls_per_s\": %.0f, \"mb_per_s\": %.1f, "
+				"\"p50_us\": %.0f, \"p99_us\": %.0f, "
+				"\"p999_us\": %.0f, \"max_us\": %.0f}\n",
+				r->mode.c_str(), r->work.c_str(), r->size, r->threads,
+				r->nclients, r->pool, r->amo, r->rate, secs,
+				(unsigned long long)r->calls.load(),
+				(unsigned long long)r->errors.load(),
+				r->calls / secs, mb, p50, p99, p999, mx);
+		return;
+	}
+	if (first)
+		printf("mode,work,bytes,threads,clients,pool,amo,rate,secs,"
+				"calls,errors,calls_per_s,mb_per_s,p50_us,p99_us,"
+				"p999_us,max_us\n");
+	printf("%s,%s,%d,%d,%d,%d,%d,%d,%.2f,%llu,%llu,%.0f,%.1f,%.0f,%.0f,"
+			"%.0f,%.0f\n", r->mode.c_str(), r->work.c_str(), r->size,
+			r->threads, r->nclients, r->pool, r->amo, r->rate, secs,
+			(unsigned long long)r->calls.load(),
+			(unsigned long long)r->errors.load(),
+			r->calls / secs, mb, p50, p99, p999, mx);
+}
+
+// run r against the server at dst; false if the clients cannot bind
+static bool
+bench(run *r, const sockaddr_storage &dst, double warmup, double secs)
+{
+	for (int i = 0; i < r->nclients; i++) {
+		rpcc *c = new rpcc(dst, r->amo);
+		r->clients.push_back(c);
+		if (c->bind(rpcc::to(5000)) != 0)
+			return false;
+	}
+
+	r->start = now_sec() + warmup;
+	r->end = r->start + secs;
+	r->stop = false;
+	r->inflight = 0;
+	assert(pthread_mutex_init(&r->m, NULL) == 0);
+	r->abandoned = false;
+	r->max_inflight = std::min(max_inflight_bytes / std::max(r->size, 1),
+			10000);
+	r->max_inflight = std::max(r->max_inflight, 1);
+	r->calls = 0;
+	r->errors = 0;
+	bool open = r->mode == "open";
+	std::vector<pthread_t> th(r->threads);
+	std::vector<worker_arg> args(r->threads);
+	for (int i = 0; i < r->threads; i++) {
+		args[i].r = r;
+		args[i].i = i;
+		assert(pthread_create(&th[i], NULL,
+					open ? open_worker : closed_worker, &args[i]) == 0);
+	}
+	sleep_until(r->end);
+	r->stop = true;
+	for (int i = 0; i < r->threads; i++)
+		assert(pthread_join(th[i], NULL) == 0);
+	// the clients must not go away under their calls
+	double give_up = now_sec() + call_to.to / 1000.0 + 1;
+	while (r->inflight > 0 && now_sec() < give_up)
+		usleep(10000);
+	// a call that never came back failed, as far as the run goes
+	ScopedLock ml(&r->m);
+	r->abandoned = true;
+	r->errors += r->inflight;
+	return true;
+}
+
+static std::vector<std::string>
+split(const char *s)
+{
+	std::vector<std::string> v;
+	std::string cur;
+	for (; ; s++) {
+		if (*s == ',' || *s == '\0') {
+			if (!cur.empty())
+				v.push_back(cur);
+			cur.clear();
+			if (*s == '\0')
+				break;
+		} else {
+			cur += *s;
+		}
+	}
+	return v;
+}
+
+// the most payload a request or reply pdu holds: the rpc header and
+// the string's length come out of MAX_PDU, but the crc32c and budget
+// trailers a connection negotiates do not (see pdu_trailers())
+static const int max_payload = MAX_PDU - RPC_HEADER_SZ - sizeof(unsigned int);
+
+static std::vector<int>
+split_sizes(const char *s)
+{
+	std::vector<std::string> v = split(s);
+	std::vector<int> n;
+	for (unsigned i = 0; i < v.size(); i++) {
+		if (v[i] == "max") {
+			n.push_back(max_payload);
+			continue;
+		}
+		char *e;
+		long x = strtol(v[i].c_str(), &e, 10);
+		if (*e == 'k' || *e == 'K')
+			x <<= 10;
+		else if (*e == 'm' || *e == 'M')
+			x <<= 20;
+		if (x < 0 || x > max_payload) {
+			fprintf(stderr, "rpcbench: payload %s is more than %d bytes\n",
+					v[i].c_str(), max_payload);
+			exit(1);
+		}
+		n.push_back(x);
+	}
+	return n;
+}
+
+static std::vector<int>
+split_ints(const char *s)
+{
+	std::vector<std::string> v = split(s);
+	std::vector<int> n;
+	for (unsigned i = 0; i < v.size(); i++)
+		n.push_back(atoi(v[i].c_str()));
+	return n;
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-m closed,open] [-w put,get,echo] "
+			"[-s sizes] [-t threads] [-c clients] [-p pool] [-a 1,0] "
+			"[-r rate] [-d secs] [-W secs] [-f csv|json] "
+			"[-x [host:]port | -l [host:]port]\n", prog);
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	std::vector<std::string> modes = split("closed");
+	std::vector<std::string> works = split("put");
+	std::vector<int> sizes = split_sizes("16,4k,64k,1m");
+	std::vector<int> threads = split_ints("1,8");
+	std::vector<int> clients = split_ints("1");
+	std::vector<int> pools = split_ints("10");
+	std::vector<int> amos = split_ints("1");
+	std::vector<int> rates = split_ints("1000");
+	double secs = 2, warmup = 0.5;
+	const char *format = "csv";
+	const char *remote = NULL, *listen = NULL;
+
+	int ch;
+	while ((ch = getopt(argc, argv, "m:w:s:t:c:p:a:r:d:W:f:x:l:")) != -1) {
+		switch (ch) {
+			case 'm': modes = split(optarg); break;
+			case 'w': works = split(optarg); break;
+			case 's': sizes = split_sizes(optarg); break;
+			case 't': threads = split_ints(optarg); break;
+			case 'c': clients = split_ints(optarg); break;
+			case 'p': pools = split_ints(optarg); break;
+			case 'a': amos = split_ints(optarg); break;
+			case 'r': rates = split_ints(optarg); break;
+			case 'd': secs = atof(optarg); break;
+			case 'W': warmup = atof(optarg); break;
+			case 'f': format = optarg; break;
+			case 'x': remote = optarg; break;
+			case 'l': listen = optarg; break;
+			default: usage(argv[0]);
+		}
+	}
+	if (optind != argc || secs <= 0 ||
+			(strcmp(format, "csv") && strcmp(format, "json")))
+		usage(argv[0]);
+	for (unsigned i = 0; i < modes.size(); i++)
+		if (modes[i] != "closed" && modes[i] != "open")
+			usage(argv[0]);
+	for (unsigned i = 0; i < works.size(); i++)
+		if (works[i] != "put" && works[i] != "get" && works[i] != "echo")
+			usage(argv[0]);
+	jsl_set_debug(0);
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	std::string data(max_payload, 0);
+	for (unsigned i = 0; i < data.size(); i++)
+		data[i] = random();
+	bench_srv srv(data);
+
+	if (listen) {
+		start_srv(new rpcs(listen, 0, pools[0]), &srv);
+		while (1)
+			sleep(1);
+	}
+
+	int port = 40000 + (getpid() % 10000);
+	bool first = true;
+	for (unsigned mi = 0; mi < modes.size(); mi++)
+	for (unsigned wi = 0; wi < works.size(); wi++)
+	for (unsigned si = 0; si < sizes.size(); si++)
+	for (unsigned ti = 0; ti < threads.size(); ti++)
+	for (unsigned ci = 0; ci < clients.size(); ci++)
+	for (unsigned pi = 0; pi < (remote ? 1 : pools.size()); pi++)
+	for (unsigned ai = 0; ai < amos.size(); ai++)
+	for (unsigned ri = 0; ri < (modes[mi] == "open" ? rates.size() : 1); ri++) {
+		run *r = new run;
+		r->mode = modes[mi];
+		r->work = works[wi];
+		r->size = sizes[si];
+		r->threads = std::max(threads[ti], 1);
+		r->nclients = std::max(clients[ci], 1);
+		r->pool = remote ? 0 : pools[pi];
+		r->amo = amos[ai] != 0;
+		r->rate = modes[mi] == "open" ? std::max(rates[ri], 1) : 0;
+		std::string payload(data, 0, r->size);
+		r->payload = &payload;
+
+		rpcs *s = NULL;
+		sockaddr_storage dst;
+		if (remote) {
+			make_sockaddr(remote, &dst);
+		} else {
+			// an earlier run's port may still be in use
+			while (!s) {
+				try {
+					s = new rpcs(++port, 0, r->pool);
+				} catch (PortBusyException &e) {
+				}
+			}
+			start_srv(s, &srv);
+			char addr[32];
+			snprintf(addr, sizeof(addr), "127.0.0.1:%d", port);
+			make_sockaddr(addr, &dst);
+		}
+		if (bench(r, dst, warmup, secs)) {
+			print_run(r, secs, format, first);
+			first = false;
+		} else {
+			fprintf(stderr, "rpcbench: bind failed\n");
+		}
+		for (unsigned i = 0; i < r->clients.size(); i++)
+			delete r->clients[i];
+		delete s;
+		// calls that never came back still hold r
+		if (r->inflight == 0)
+			delete r;
+	}
+	return 0;
+}
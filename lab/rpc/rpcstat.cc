@@ -0,0 +1,42 @@
+// dump the statistics an rpc server keeps (see rpcs::rpcstat()).
+//
+//   rpcstat [host:]port ...
+//
+// works against any rpcs: extent_server, lock_server and each of the
+// rsm replicas.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+#include "rpc.h"
+#include "jsl_log.h"
+
+int
+main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s [host:]port ...\n", argv[0]);
+		exit(1);
+	}
+	jsl_set_debug(0);
+
+	int failed = 0;
+	for (int i = 1; i < argc; i++) {
+		struct sockaddr_in dst;
+		make_sockaddr(argv[i], &dst);
+
+		rpcc cl(dst);
+		std::string r;
+		int ret = cl.bind(rpcc::to(1000));
+		if (ret == 0)
+			ret = cl.call(rpc_const::stats, 0, r, rpcc::to(1000));
+		if (ret != 0) {
+			fprintf(stderr, "%s: rpc failed (%d)\n", argv[i], ret);
+			failed++;
+			continue;
+		}
+		printf("%s%s", i > 1 ? "\n" : "", r.c_str());
+	}
+	return failed ? 1 : 0;
+}
@@ -8,12 +8,19 @@
 #include <getopt.h>
 
 #include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <ios>
 #include <iostream>
 #include <fstream>
 #include <string>
 
 #include "rpc.h"
+#include "crc32c.h"
+#include "lz.h"
 
 #include "jsl_log.h"
 #include "gettime.h"
@@ -36,10 +43,14 @@ pthread_attr_t attr;
 // from multiple classes.
 class srv {
 	public:
-		int handle_22(const std::string a, const std::string b, std::string & r);
+		int handle_22(const std::string &a, std::string &&b, std::string & r);
 		int handle_fast(const int a, int &r);
 		int handle_slow(const int a, int &r);
 		int handle_bigrep(const int a, std::string &r);
+		int handle_seq(const int a, int &r);
+		int handle_held(const int a, int &r);
+		int handle_budget(const int a, int &r);
+		int handle_order(const int a, int &r);
 };
 
 
@@ -95,9 +106,9 @@ void process_mem_usage(double& resident_set)
 // at these argument types, so this function definition
 // does what a .x file does in SunRPC.
 int
-srv::handle_22(const std::string a, std::string b, std::string &r)
+srv::handle_22(const std::string &a, std::string &&b, std::string &r)
 {
-	r = a + b;
+	r = a + std::move(b);
 	return 0;
 }
 
@@ -123,17 +134,154 @@ srv::handle_bigrep(const int len, std::string &r)
 	return 0;
 }
 
+// checks that requests arrive in sequence, for ordered_test()
+static pthread_mutex_t seq_m = PTHREAD_MUTEX_INITIALIZER;
+static int seq_last = -1;
+static int seq_bad = 0;
+
+int
+srv::handle_seq(const int a, int &r)
+{
+	{
+		ScopedLock ml(&seq_m);
+		if (a != seq_last + 1)
+			seq_bad++;
+		seq_last = a;
+	}
+	usleep(random() % 500);
+	r = a;
+	return 0;
+}
+
+// handle_held waits until the test lets it go
+static std::atomic<bool> held(false);
+static std::atomic<int> nheld(0); // calls it has run
+
+int
+srv::handle_held(const int a, int &r)
+{
+	nheld++;
+	while (held)
+		usleep(1000);
+	r = a;
+	return 0;
+}
+
+static std::atomic<int> budgets(0);
+
+int
+srv::handle_budget(const int a, int &r)
+{
+	budgets++;
+	r = rpcs::budget();
+	return 0;
+}
+
+// the order requests run in, for urgent_test()
+static pthread_mutex_t order_m = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<int> order;
+
+int
+srv::handle_order(const int a, int &r)
+{
+	ScopedLock ml(&order_m);
+	order.push_back(a);
+	r = a;
+	return 0;
+}
+
 srv service;
 
+// every procedure srv has, under the numbers the tests call
+static void
+reg_all(rpcs *s)
+{
+	s->reg(22, &service, &srv::handle_22);
+	s->reg(23, &service, &srv::handle_fast);
+	s->reg(24, &service, &srv::handle_slow);
+	s->reg(25, &service, &srv::handle_bigrep);
+	s->reg(26, &service, &srv::handle_seq);
+	s->reg(27, &service, &srv::handle_held);
+	s->reg(28, &service, &srv::handle_order);
+	s->reg(29, &service, &srv::handle_budget);
+	s->reg(30, &service, &srv::handle_fast, true); // urgent
+}
+
 void startserver()
 {
 	server = new rpcs(port);
-	server->reg(22, &service, &srv::handle_22);
-	server->reg(23, &service, &srv::handle_fast);
-	server->reg(24, &service, &srv::handle_slow);
-	server->reg(25, &service, &srv::handle_bigrep);
+	reg_all(server);
 }
 
+// a server of a test's own, on port + off or on a unix-domain socket
+// at path (see test_path()), with nthreads dispatch threads
+static rpcs *
+test_server(int off, int nthreads = 0)
+{
+	rpcs *s = new rpcs(port + off, 0, nthreads);
+	reg_all(s);
+	return s;
+}
+
+static rpcs *
+test_server(const std::string &path, int nthreads = 0)
+{
+	rpcs *s = new rpcs(path, 0, nthreads);
+	reg_all(s);
+	return s;
+}
+
+// a socket path of this process's own for the test called name
+static std::string
+test_path(const char *name)
+{
+	return "/tmp/rpctest-" + std::to_string(getpid()) + "-" + name + ".sock";
+}
+
+// a client bound to the test_server() at port + off or at path
+static rpcc *
+test_client(int off)
+{
+	sockaddr_in d = dst;
+	d.sin_port = htons(port + off);
+	rpcc *c = new rpcc(d);
+	assert(c->bind() == 0);
+	return c;
+}
+
+static rpcc *
+test_client(const std::string &path)
+{
+	sockaddr_storage d;
+	make_sockaddr(path.c_str(), &d);
+	rpcc *c = new rpcc(d);
+	assert(c->bind() == 0);
+	return c;
+}
+
+// an environment variable set for as long as this is in scope, for
+// servers and clients that read it when they start or bind
+class scoped_env {
+	public:
+		scoped_env(const char *name, const char *value) : name_(name) {
+			const char *old = getenv(name);
+			had_ = old != NULL;
+			if (had_)
+				old_ = old;
+			assert(setenv(name, value, 1) == 0);
+		}
+		~scoped_env() {
+			if (had_)
+				assert(setenv(name_, old_.c_str(), 1) == 0);
+			else
+				assert(unsetenv(name_) == 0);
+		}
+	private:
+		const char *name_;
+		bool had_;
+		std::string old_;
+};
+
 void
 testmarshall()
 {
@@ -165,6 +313,399 @@ testmarshall()
 	un >> s1;
 	assert(un.okdone());
 	assert(i1==i && l1==l && s1==s);
+
+	//a budget goes after the arguments, outside what is unpacked
+	marshall m1;
+	m1.pack_req_header(rh);
+	m1 << i;
+	rpc_req_set_budget(m1.grab(sizeof(int)) + sizeof(int), 7);
+	m1.take_buf(&b,&sz);
+	assert(sz == (int)(RPC_HEADER_SZ+2*sizeof(int)));
+	assert(rpc_req_budget(b + sz) == 7);
+	unmarshall un1(b, sz - sizeof(int));
+	un1.unpack_req_header(&rh1);
+	un1 >> i1;
+	assert(un1.okdone() && i1 == i);
+
+	//a long string can be referenced rather than copied
+	std::string big(MARSHALL_REF_MIN, 'b');
+	marshall m2;
+	m2.pack_req_header(rh);
+	m2 << i;
+	marshall_ref(m2, big);
+	m2 << s;
+	assert(m2.size() == (int)(RPC_HEADER_SZ+sizeof(i)+2*sizeof(int)+
+				big.size()+s.size()));
+	std::vector<struct iovec> v;
+	m2.iov(&v);
+	assert(v.size() == 3 && v[1].iov_base == big.data());
+
+	m2.take_buf(&b,&sz);
+	assert(sz == (int)(RPC_HEADER_SZ+sizeof(i)+2*sizeof(int)+
+				big.size()+s.size()));
+	unmarshall un2(b,sz);
+	un2.unpack_req_header(&rh1);
+	std::string big1;
+	un2 >> i1;
+	un2 >> big1;
+	un2 >> s1;
+	assert(un2.okdone());
+	assert(i1==i && big1==big && s1==s);
+	//arrays of integers go in one piece, but look the same on the
+	//wire as one integer after another
+	std::vector<unsigned long long> vl;
+	std::vector<short> vs;
+	marshall m3, m4;
+	for (int k = 0; k < 100; k++) {
+		vl.push_back(0x0102030405060708ULL * k);
+		vs.push_back(-k);
+	}
+	m3 << vl;
+	m3 << vs;
+	m4 << (unsigned int) vl.size();
+	for (unsigned k = 0; k < vl.size(); k++)
+		m4 << vl[k];
+	m4 << (unsigned int) vs.size();
+	for (unsigned k = 0; k < vs.size(); k++)
+		m4 << (unsigned short) vs[k];
+	assert(m3.size() == m4.size());
+	assert(memcmp(m3.cstr() + RPC_HEADER_SZ, m4.cstr() + RPC_HEADER_SZ,
+				m3.size() - RPC_HEADER_SZ) == 0);
+
+	m3.take_buf(&b,&sz);
+	unmarshall un3(b,sz);
+	un3.unpack_req_header(&rh1);
+	std::vector<unsigned long long> vl1;
+	std::vector<short> vs1;
+	un3 >> vl1;
+	un3 >> vs1;
+	assert(un3.okdone() && vl1 == vl && vs1 == vs);
+
+	//a length that runs past the end fails without allocating it
+	marshall m5;
+	m5 << (unsigned int) 0x7fffffff;
+	m5.take_buf(&b,&sz);
+	unmarshall un5(b,sz);
+	un5.unpack_req_header(&rh1);
+	un5 >> vl1;
+	assert(!un5.ok() && vl1.size() == vl.size());
+}
+
+//the compact encoding: each value comes back as it went in, small
+//ones take a byte or two, and a value too wide for its type fails
+void
+testv2()
+{
+	marshall m;
+	m.set_v2(true);
+	int ints[] = { 0, 1, -1, 63, -64, 64, 1 << 30, -2147483647 - 1 };
+	for (unsigned k = 0; k < sizeof(ints) / sizeof(ints[0]); k++)
+		m << ints[k];
+	unsigned long long ls[] = { 0, 127, 128, 1ULL << 35, ~0ULL };
+	for (unsigned k = 0; k < sizeof(ls) / sizeof(ls[0]); k++)
+		m << ls[k];
+	std::string s("hallo....");
+	std::string big(MARSHALL_REF_MIN, 'b');
+	std::vector<unsigned long long> vl;
+	std::vector<short> vs;
+	std::vector<char> vc(300, 'c');
+	std::map<std::string, int> mp;
+	for (int k = 0; k < 100; k++) {
+		vl.push_back(0x0102030405060708ULL * k);
+		vs.push_back(-k);
+		mp[std::string(k, 'k')] = -k;
+	}
+	m << s;
+	marshall_ref(m, big);
+	m << vl << vs << vc << mp << (short) -300 << (unsigned short) 65535;
+
+	char *b;
+	int sz;
+	m.take_buf(&b,&sz);
+	req_header rh;
+	unmarshall un(b,sz);
+	un.set_v2(true);
+	un.unpack_req_header(&rh);
+	for (unsigned k = 0; k < sizeof(ints) / sizeof(ints[0]); k++) {
+		int i1;
+		un >> i1;
+		assert(i1 == ints[k]);
+	}
+	for (unsigned k = 0; k < sizeof(ls) / sizeof(ls[0]); k++) {
+		unsigned long long l1;
+		un >> l1;
+		assert(l1 == ls[k]);
+	}
+	std::string s1, big1;
+	std::vector<unsigned long long> vl1;
+	std::vector<short> vs1;
+	std::vector<char> vc1;
+	std::map<std::string, int> mp1;
+	short h1;
+	unsigned short uh1;
+	un >> s1 >> big1 >> vl1 >> vs1 >> vc1 >> mp1 >> h1 >> uh1;
+	assert(un.okdone());
+	assert(s1 == s && big1 == big && vl1 == vl && vs1 == vs && vc1 == vc);
+	assert(mp1 == mp && h1 == -300 && uh1 == 65535);
+
+	//what a lock request's arguments take either way
+	marshall m1, m2;
+	m2.set_v2(true);
+	m1 << std::string("12.34.56.78:12345") << 5ULL << 17ULL;
+	m2 << std::string("12.34.56.78:12345") << 5ULL << 17ULL;
+	assert(m1.size() - RPC_HEADER_SZ == 4 + 17 + 8 + 8);
+	assert(m2.size() - RPC_HEADER_SZ == 1 + 17 + 1 + 1);
+
+	//too wide for an int, or no end to the varint
+	marshall m3;
+	m3.set_v2(true);
+	m3 << (1ULL << 40);
+	m3.take_buf(&b,&sz);
+	unmarshall un3(b,sz);
+	un3.set_v2(true);
+	un3.unpack_req_header(&rh);
+	int i3;
+	un3 >> i3;
+	assert(!un3.ok());
+	std::string eleven(11, (char) 0xff);
+	unmarshall un4(eleven);
+	un4.set_v2(true);
+	unsigned long long l4;
+	un4 >> l4;
+	assert(!un4.ok());
+
+	//a vector longer than what is left fails without allocating it
+	marshall m5;
+	m5.set_v2(true);
+	m5 << (unsigned int) 0x7fffffff;
+	m5.take_buf(&b,&sz);
+	unmarshall un5(b,sz);
+	un5.set_v2(true);
+	un5.unpack_req_header(&rh);
+	un5 >> vl1;
+	assert(!un5.ok() && vl1.size() == vl.size());
+}
+
+void
+testbufpool()
+{
+	char *b = rpc_buf_alloc(100);
+	assert(rpc_buf_capacity(b) >= 100);
+	memset(b, 'x', 100);
+	rpc_buf_free(b);
+
+	//a freed buffer is handed out again for a pdu of the same class
+	char *b1 = rpc_buf_alloc(90);
+	assert(b1 == b);
+
+	//growing keeps the contents, across pooled and malloc'd sizes
+	memset(b1, 'y', 90);
+	b1 = rpc_buf_realloc(b1, 5000);
+	b1 = rpc_buf_realloc(b1, 1<<20);
+	assert(rpc_buf_capacity(b1) >= (1<<20));
+	for (int i = 0; i < 90; i++)
+		assert(b1[i] == 'y');
+	rpc_buf_free(b1);
+	rpc_buf_free(NULL);
+
+	//a marshall sized up front never has to grow
+	std::string big(MARSHALL_REF_MIN - 1, 'z');
+	marshall m(marshall_hint(big));
+	char *p = m.cstr();
+	m << big;
+	assert(m.cstr() == p);
+
+	//buffers bigger than the thread caches are pooled too
+	b = rpc_buf_alloc(6<<20);
+	rpc_buf_free(b);
+	b1 = rpc_buf_alloc(5<<20);
+	assert(b1 == b);
+	rpc_buf_free(b1);
+
+	//a shared buffer is recycled only when its last holder frees it
+	b = rpc_buf_alloc(100);
+	rpc_buf_ref(b);
+	rpc_buf_free(b);
+	b1 = rpc_buf_alloc(100);
+	assert(b1 != b);
+	rpc_buf_free(b1);
+	rpc_buf_free(b);
+	b1 = rpc_buf_alloc(100);
+	assert(b1 == b);
+	rpc_buf_free(b1);
+}
+
+void
+testhistogram()
+{
+	histogram h;
+	for (uint64_t v = 1; v <= 10000; v++)
+		h.add(v);
+	assert(h.count() == 10000 && h.max() == 10000);
+	assert(h.mean() == 5000.5);
+	//every percentile is right to within a sub-bucket
+	uint64_t p50 = h.percentile(0.5), p99 = h.percentile(0.99);
+	assert(p50 >= 5000 && p50 <= 5000 + 5000 / HIST_SUB);
+	assert(p99 >= 9900 && p99 <= 10000);
+	assert(h.percentile(1) == 10000);
+	h.add(1ULL << 40);
+	assert(h.max() == 1ULL << 40);
+}
+
+void
+testcrc32c()
+{
+	//the check value of the catalogue of crc algorithms, and the
+	//iSCSI test vectors of 32 zero and 32 0xff bytes
+	assert(crc32c(0, "123456789", 9) == 0xe3069283);
+	char b[32];
+	memset(b, 0, sizeof(b));
+	assert(crc32c(0, b, sizeof(b)) == 0x8a9136aa);
+	memset(b, 0xff, sizeof(b));
+	assert(crc32c(0, b, sizeof(b)) == 0x62a8ab43);
+
+	//long enough for every block size of the hardware path, at
+	//every alignment, and in two pieces
+	std::string s(3 * 3 * 8192 + 777, 0);
+	for (unsigned i = 0; i < s.size(); i++)
+		s[i] = random();
+	for (int off = 0; off < 8; off++) {
+		size_t n = s.size() - off;
+		uint32_t c = crc32c_sw(0, s.data() + off, n);
+		assert(crc32c(0, s.data() + off, n) == c);
+		assert(crc32c(crc32c(0, s.data() + off, 1000), s.data() + off + 1000,
+					n - 1000) == c);
+	}
+}
+
+void
+testlz()
+{
+	//text, runs, noise and a mix, at sizes around the codec's limits
+	int sizes[] = { 0, 1, 12, 13, 100, 4096, 70000, 300000 };
+	for (unsigned i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+		for (int kind = 0; kind < 4; kind++) {
+			int n = sizes[i];
+			std::string s(n, 0);
+			for (int k = 0; k < n; k++) {
+				if (kind == 0)
+					s[k] = 'a' + random() % 4;
+				else if (kind == 1)
+					s[k] = k / 1000;
+				else if (kind == 2 || k < 9 || random() % 8 == 0)
+					s[k] = random();
+				else
+					s[k] = s[k - 9];
+			}
+			std::string z(lz_bound(n), 0), u(n, 0);
+			int zn = lz_compress(s.data(), n, &z[0], z.size());
+			assert(zn > 0);
+			assert(lz_decompress(z.data(), zn, &u[0], n) == n && u == s);
+			//too little room either way
+			if (n > 0) {
+				assert(lz_decompress(z.data(), zn, &u[0], n - 1) < 0);
+				assert(lz_compress(s.data(), n, &z[0], zn - 1) == 0);
+			}
+		}
+	}
+
+	//a body that compresses, through marshall and back
+	marshall m;
+	std::string s(100000, 'y');
+	m << s;
+	m.pack_req_header(req_header(1, 22));
+	assert(m.lz_pack() && m.size() < 1000);
+	char *b;
+	int sz;
+	m.take_buf(&b, &sz);
+	unmarshall u(b, sz);
+	req_header h;
+	u.unpack_req_header(&h);
+	assert(u.lz_unpack() && h.xid == 1 && h.proc == 22);
+	std::string t;
+	u >> t;
+	assert(u.okdone() && t == s);
+
+	//referenced bodies: one that does not compress keeps its pieces,
+	//one that does comes back whole
+	std::string noise(100000, 0);
+	for (unsigned i = 0; i < noise.size(); i++)
+		noise[i] = random();
+	marshall m2;
+	marshall_ref(m2, noise);
+	int sz2 = m2.size();
+	std::vector<struct iovec> v;
+	assert(!m2.lz_pack() && m2.size() == sz2);
+	m2.iov(&v);
+	assert(v.size() > 1);
+	marshall m3;
+	marshall_ref(m3, s);
+	m3.pack_req_header(req_header(2, 22));
+	assert(m3.lz_pack() && m3.size() < 1000);
+	m3.take_buf(&b, &sz);
+	unmarshall u3(b, sz);
+	u3.unpack_req_header(&h);
+	assert(u3.lz_unpack() && h.xid == 2);
+	u3 >> t;
+	assert(u3.okdone() && t == s);
+}
+
+// a record's arguments, formatted again, read as printf has them
+template<class... Args> static void
+check_binlog(const char *fmt, const Args &... args)
+{
+	char rec[BINLOG_MAX_RECORD];
+	binlog_buf b = { rec, rec + sizeof(rec) };
+	(binlog_put(b, args), ...);
+	char want[512];
+	snprintf(want, sizeof(want), fmt, args...);
+	assert(binlog_format(fmt, rec, b.p - rec) == want);
+}
+
+void
+testbinlog()
+{
+	check_binlog("plain\n");
+	check_binlog("%d %u %x %lld %016llx %ld\n", -5, 7u, 255, -1LL,
+			0x1234ULL, 100000L);
+	check_binlog("%s|%10s|%-4s|%.2s|%s\n", "abc", "r", "l", "trunc",
+			(const char *)"");
+	check_binlog("%c%c %5.1f %g %e\n", 'o', 'k', 3.14159, 0.5f, 1e10);
+	check_binlog("%zu %hd %p %%\n", (size_t)42, (short)-3, (void *)0x1000);
+	check_binlog("%*d|%-*.*f|\n", 5, 42, 8, 2, 2.5);
+
+	//long strings are cut short, and missing arguments show
+	char rec[BINLOG_MAX_RECORD];
+	binlog_buf b = { rec, rec + sizeof(rec) };
+	std::string big(3 * BINLOG_MAX_STRING, 'a');
+	binlog_put(b, big.c_str());
+	binlog_put(b, 7);
+	assert(binlog_format("%s %d %d", rec, b.p - rec) ==
+			big.substr(0, BINLOG_MAX_STRING) + " 7 <?>");
+
+	//what was logged just before an abort() still comes out
+	int p[2];
+	assert(pipe(p) == 0);
+	pid_t pid = fork();
+	assert(pid >= 0);
+	if (pid == 0) {
+		dup2(p[1], 1);
+		close(p[0]);
+		jsl_set_debug(1);
+		jsl_log(JSL_DBG_1, "last words %d\n", 42);
+		abort();
+	}
+	close(p[1]);
+	std::string out;
+	char buf[256];
+	int n;
+	while ((n = read(p[0], buf, sizeof(buf))) > 0)
+		out.append(buf, n);
+	close(p[0]);
+	int st;
+	assert(waitpid(pid, &st, 0) == pid);
+	assert(WIFSIGNALED(st) && WTERMSIG(st) == SIGABRT);
+	assert(out.find("last words 42\n") != std::string::npos);
 }
 
 void *
@@ -306,6 +847,17 @@ simple_tests(rpcc *c)
 	assert(intret < 0);
 	printf("   -- too many arguments .. failed ok\n");
 
+	// a procedure nobody registered gets no reply
+	intret = c->call(0x6001, 1001, rep, rpcc::to(500));
+	assert(intret < 0);
+	printf("   -- unregistered procedure .. failed ok\n");
+
+	// every rpcs reports the calls it has handled
+	std::string st;
+	intret = c->call(rpc_const::stats, 0, st);
+	assert(intret == 0 && st.find("proc 16: ") != std::string::npos);
+	printf("   -- server statistics .. ok\n");
+
 	// wrong return value size
 	int wrongrep;
 	intret = c->call(23, "hello", " goodbye", wrongrep);
@@ -333,6 +885,35 @@ simple_tests(rpcc *c)
 	assert(rep.size() == 1000001);
 	printf("   -- huge 1M rpc request .. ok\n");
 
+	// one that does not compress
+	std::string noise(100000, 0);
+	for (unsigned i = 0; i < noise.size(); i++)
+		noise[i] = random();
+	intret = c->call(22, noise, "z", rep);
+	assert(intret == 0 && rep == noise + "z");
+	printf("   -- incompressible rpc request .. ok\n");
+
+	// the largest request there is, with its crc32c and budget on top
+	noise.resize(MAX_PDU - RPC_HEADER_SZ - 2 * sizeof(int));
+	for (unsigned i = 0; i < noise.size(); i++)
+		noise[i] = random();
+	intret = c->call(22, noise, "", rep, rpcc::to(200000));
+	assert(intret == 0 && rep == noise);
+	printf("   -- largest rpc request .. ok\n");
+
+	// a reply bigger than a pdu may be, but that compresses to far less
+	char *lz_env = getenv("RPC_COMPRESS");
+	if (lz_env == NULL || atoi(lz_env) != 0) {
+		intret = c->call(25, 20 << 20, rep, rpcc::to(200000));
+		assert(intret == 0 && rep.size() == 20 << 20);
+		printf("   -- compressed 20M reply .. ok\n");
+
+		rpc_future<std::string> f;
+		c->call_async(25, f, rpcc::to(200000), 1 << 20);
+		assert(f.get(rep) == 0 && rep.size() == 1 << 20);
+		printf("   -- compressed async reply .. ok\n");
+	}
+
 	// specify a timeout value to an RPC that should timeout (udp)
 	struct sockaddr_in non_existent;
 	memset(&non_existent, 0, sizeof(non_existent));
@@ -370,6 +951,612 @@ concurrent_test(int nt)
 	printf(" OK\n");
 }
 
+void
+rto_test()
+{
+	// the retransmission timer adapts to the fast local server
+	printf("start rto_test ...");
+	rpcc *c = new rpcc(dst);
+	assert(c->rto() == rpcc::to_min.to * 1000);
+	assert(c->bind() == 0);
+	for (int i = 0; i < 100; i++) {
+		int rep;
+		assert(c->call(23, i, rep) == 0);
+	}
+	assert(c->srtt() < c->rto());
+	assert(c->rto() >= rpcc::rto_floor.to * 1000);
+	assert(c->rto() < rpcc::to_min.to * 1000);
+	delete c;
+	printf(" OK\n");
+}
+
+void
+batch_test(rpcc *c)
+{
+	printf("start batch_test ...");
+	rpc_batch b;
+	assert(c->call_batch(b) == 0);
+
+	std::string big(1000000, 'x');
+	b.add(23, 1);
+	b.add(22, std::string("a"), std::string("b"));
+	b.add(22, big, std::string("z"));
+	assert(b.size() == 3);
+	assert(c->call_batch(b) == 0);
+	int r;
+	std::string rep;
+	assert(b.get(0, r) == 0 && r == 2);
+	assert(b.get(1, rep) == 0 && rep == "ab");
+	assert(b.get(2, rep) == 0 && rep == big + "z");
+	// the wrong reply type
+	assert(b.get(1, r) == rpc_const::unmarshal_reply_failure);
+
+	// without batches each call goes on its own, and the server
+	// does not answer one for a procedure it does not have
+	char *batch_env = getenv("RPC_BATCH");
+	if (batch_env == NULL || atoi(batch_env) != 0) {
+		b.clear();
+		b.add(23, 5);
+		b.add(0x7777, 5);
+		b.add(rpc_const::batch, 5);
+		assert(c->call_batch(b) == 0);
+		assert(b.get(0, r) == 0 && r == 6);
+		assert(b.get(1, r) == rpc_const::proc_failure);
+		assert(b.get(2, r) == rpc_const::proc_failure);
+	}
+	printf(" OK\n");
+}
+
+void
+batch_fallback_test()
+{
+	// a server that does not take batches (RPC_BATCH=0) gets the
+	// calls one at a time, and call_batch() hides the difference.
+	// one that does sees a single batch call
+	printf("start batch_fallback_test ...");
+	for (int batches = 0; batches < 2; batches++) {
+		rpcs *s;
+		rpcc *c;
+		{
+			scoped_env e("RPC_BATCH", batches ? "1" : "0");
+			s = test_server(5 + batches);
+			c = test_client(5 + batches);
+		}
+		rpc_batch b;
+		b.add(23, 1);
+		b.add(22, std::string("a"), std::string("b"));
+		assert(c->call_batch(b) == 0);
+		int r;
+		std::string rep;
+		assert(b.get(0, r) == 0 && r == 2);
+		assert(b.get(1, rep) == 0 && rep == "ab");
+
+		std::string st;
+		assert(c->call(rpc_const::stats, 0, st) == 0);
+		assert((st.find("proc 3: 1 calls") != std::string::npos) ==
+				(batches == 1));
+		assert(st.find("proc 17: 1 calls") != std::string::npos);
+		delete c;
+		delete s;
+	}
+	printf(" OK\n");
+}
+
+void
+async_test(rpcc *c, int n)
+{
+	// drive many calls from a single thread
+	printf("start async_test (%d calls) ...", n);
+
+	std::vector<rpc_future<int> > fs(n);
+	for (int i = 0; i < n; i++) {
+		c->call_async(i % 2 ? 23 : 24, fs[i], rpcc::to(3000), i);
+	}
+	for (int i = 0; i < n; i++) {
+		int rep;
+		int ret = fs[i].get(rep);
+		assert(ret == 0 && rep == i + (i % 2 ? 1 : 2));
+	}
+
+	// completion callbacks
+	pthread_mutex_t m;
+	pthread_cond_t cv;
+	assert(pthread_mutex_init(&m, 0) == 0);
+	assert(pthread_cond_init(&cv, 0) == 0);
+	int ndone = 0;
+	for (int i = 0; i < n; i++) {
+		c->call_async<std::string>(22, [&, i](int ret, std::string &r) {
+			assert(ret == 0 && r == "x" + std::to_string(i));
+			ScopedLock ml(&m);
+			if (++ndone == n)
+				assert(pthread_cond_signal(&cv) == 0);
+		}, rpcc::to(3000), std::string("x"), std::to_string(i));
+	}
+	{
+		ScopedLock ml(&m);
+		while (ndone < n)
+			assert(pthread_cond_wait(&cv, &m) == 0);
+	}
+	assert(pthread_mutex_destroy(&m) == 0);
+	assert(pthread_cond_destroy(&cv) == 0);
+
+	// a call that cannot be started still completes
+	rpcc *c1 = new rpcc(dst);
+	rpc_future<int> f;
+	c1->call_async(23, f, rpcc::to(1000), 1);
+	int rep;
+	assert(f.get(rep) == rpc_const::bind_failure);
+	delete c1;
+	printf(" OK\n");
+}
+
+void
+ordered_test(int n)
+{
+	// an ordered server runs one connection's requests in sequence,
+	// however many dispatch threads it has
+	printf("start ordered_test (%d calls) ...", n);
+	rpcs *s = test_server(1, 4);
+	s->set_ordered(true);
+	rpcc *c = test_client(1);
+	std::vector<rpc_future<int> > fs(n);
+	for (int i = 0; i < n; i++) {
+		c->call_async(26, fs[i], rpcc::to(3000), i);
+	}
+	for (int i = 0; i < n; i++) {
+		int rep;
+		assert(fs[i].get(rep) == 0 && rep == i);
+	}
+	assert(seq_last == n - 1 && seq_bad == 0);
+	delete c;
+	delete s;
+	printf(" OK\n");
+}
+
+void
+urgent_test(int n)
+{
+	// urgent requests overtake the normal ones queued at a server
+	// with a single dispatch thread
+	printf("start urgent_test (%d calls) ...", n);
+	rpcs *s = test_server(2, 1);
+	s->set_admission(0, 0); // queue everything, however long
+	rpcc *c = test_client(2);
+	std::atomic<int> ndone(0);
+	for (int i = 0; i < n; i++) {
+		c->call_async<int>(24, [&, i](int ret, int &r) {
+			assert(ret == 0 && r == i + 2);
+			ndone++;
+		}, rpcc::to(60000), i);
+	}
+	// an urgent procedure, then a normal one called urgently
+	int r;
+	assert(c->call(30, 1, r) == 0 && r == 2);
+	std::string rep;
+	assert(c->call(22, "a", "b", rep, rpcc::urgent()) == 0 && rep == "ab");
+	assert(ndone.load() < n / 2);
+	while (ndone.load() < n)
+		usleep(10000);
+
+	// while the thread is taken, normal calls queue up, and an
+	// urgent one sent after them is the first to run once it is free
+	held = true;
+	c->call_async<int>(27, [&](int ret, int &r) {
+		assert(ret == 0);
+		ndone++;
+	}, rpcc::to(60000), 0);
+	usleep(100000); // the thread is taken
+	for (int i = 0; i < 10; i++) {
+		c->call_async<int>(28, [&](int ret, int &r) {
+			assert(ret == 0);
+			ndone++;
+		}, rpcc::to(60000), i);
+	}
+	usleep(100000); // they are queued
+	c->call_async<int>(28, [&](int ret, int &r) {
+		assert(ret == 0 && r == 100);
+		ndone++;
+	}, rpcc::urgent(), 100);
+	usleep(100000);
+	held = false;
+	while (ndone.load() < n + 12)
+		usleep(10000);
+	{
+		ScopedLock ml(&order_m);
+		assert(order.size() == 11 && order[0] == 100);
+		for (int i = 0; i < 10; i++)
+			assert(order[i + 1] == i);
+	}
+	delete c;
+	delete s;
+	printf(" OK\n");
+}
+
+void
+busy_test()
+{
+	// a server with one dispatch thread that lets one request wait
+	// for it turns the others away, and they come back until they
+	// get in or their time runs out
+	printf("start busy_test ...");
+	rpcs *s = test_server(3, 1);
+	s->set_admission(1, 0);
+	rpcc *c = test_client(3);
+	// and one that cannot take busy replies (bound while the server
+	// has a thread free for the bind)
+	rpcc *old;
+	{
+		scoped_env e("RPC_BUSY", "0");
+		old = test_client(3);
+	}
+	held = true;
+	nheld = 0;
+	std::atomic<int> ndone(0);
+	for (int i = 0; i < 2; i++) {
+		c->call_async<int>(27, [&, i](int ret, int &r) {
+			assert(ret == 0 && r == i);
+			ndone++;
+		}, rpcc::to(60000), i);
+		usleep(100000); // the first has to be running
+	}
+	// the thread is taken and the queue full
+	int r;
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	assert(c->call(27, 2, r, rpcc::to(300)) == rpc_const::busy_failure);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	assert(end.tv_sec - start.tv_sec < 2);
+	// the client that cannot take a busy reply waits in the queue
+	// instead, until its time runs out and the request expires there
+	assert(old->call(27, 2, r, rpcc::to(300)) == rpc_const::timeout_failure);
+	delete old;
+	// one that backs off long enough to get in once the others finish
+	c->call_async<int>(27, [&](int ret, int &r) {
+		assert(ret == 0 && r == 3);
+		ndone++;
+	}, rpcc::to(60000), 3);
+	usleep(100000);
+	held = false;
+	while (ndone.load() < 3)
+		usleep(10000);
+	// the one turned away for good never ran, however often it came
+	assert(nheld == 3);
+	std::string st;
+	assert(c->call(rpc_const::stats, 0, st) == 0);
+	assert(st.find("admission: 0 turned") == std::string::npos);
+	delete c;
+	delete s;
+	printf(" OK\n");
+}
+
+void
+expire_test()
+{
+	// a request whose caller has given up by the time a dispatch
+	// thread is free for it is dropped; handlers see what is left
+	printf("start expire_test ...");
+	rpcs *s = test_server(4, 1);
+	rpcc *c = test_client(4);
+	int r;
+	assert(c->call(29, 0, r, rpcc::to(5000)) == 0);
+	assert(r > 4000 && r <= 5000);
+	assert(budgets == 1);
+
+	held = true;
+	std::atomic<bool> done(false);
+	c->call_async<int>(27, [&](int ret, int &r) {
+		assert(ret == 0);
+		done = true;
+	}, rpcc::to(60000), 0);
+	usleep(100000); // the thread is taken
+	assert(c->call(29, 0, r, rpcc::to(200)) == rpc_const::timeout_failure);
+	held = false;
+	while (!done)
+		usleep(10000);
+	std::string st;
+	assert(c->call(rpc_const::stats, 0, st) == 0);
+	assert(st.find("; 1 expired") != std::string::npos);
+	assert(budgets == 1);
+	delete c;
+	delete s;
+	printf(" OK\n");
+}
+
+void
+unix_test()
+{
+	// the same server reached over a unix-domain socket
+	std::string path = test_path("unix");
+	printf("start unix_test (%s) ...", path.c_str());
+	rpcs *s = test_server(path);
+	rpcc *c = test_client(path);
+	std::string rep;
+	assert(c->call(22, "hello", " goodbye", rep) == 0);
+	assert(rep == "hello goodbye");
+	std::string big(1000000, 'x');
+	assert(c->call(22, big, "z", rep) == 0);
+	assert(rep.size() == big.size() + 1);
+
+	//a second server does not take over the path from a live one
+	bool busy = false;
+	try {
+		new rpcs(path);
+	} catch (PortBusyException &e) {
+		busy = true;
+	}
+	assert(busy);
+	assert(c->call(22, "still", " here", rep) == 0);
+	delete c;
+	delete s;
+	assert(access(path.c_str(), F_OK) != 0);
+
+	//nor from a file that is not a socket
+	int fd = open(path.c_str(), O_CREAT | O_WRONLY, 0600);
+	assert(fd >= 0);
+	close(fd);
+	busy = false;
+	try {
+		new rpcs(path);
+	} catch (PortBusyException &e) {
+		busy = true;
+	}
+	assert(busy && access(path.c_str(), F_OK) == 0);
+	unlink(path.c_str());
+
+	//but a socket left behind by a server that died is fair game
+	sockaddr_storage d;
+	make_sockaddr(path.c_str(), &d);
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	assert(fd >= 0);
+	assert(bind(fd, (sockaddr *)&d, sizeof(sockaddr_un)) == 0);
+	close(fd);
+	s = new rpcs(path);
+	delete s;
+	assert(access(path.c_str(), F_OK) != 0);
+	printf(" OK\n");
+}
+
+//a peer without the compact encoding (RPC_V2=0), either end: bind
+//settles on the old one and calls, batches included, still work
+void
+old_peer_test()
+{
+	printf("start old_peer_test ...");
+	for (int old_srv = 0; old_srv < 2; old_srv++) {
+		std::string path = test_path(old_srv ? "old-srv" : "old-clt");
+		rpcs *s;
+		rpcc *c;
+		{
+			scoped_env e("RPC_V2", old_srv ? "0" : "1");
+			s = test_server(path);
+		}
+		{
+			scoped_env e("RPC_V2", old_srv ? "1" : "0");
+			c = test_client(path);
+		}
+		std::string rep;
+		assert(c->call(22, "hello", " goodbye", rep) == 0);
+		assert(rep == "hello goodbye");
+		int r;
+		assert(c->call(23, -5, r) == 0 && r == -4);
+		rpc_batch b;
+		b.add(23, 1);
+		b.add(22, std::string("a"), std::string("b"));
+		assert(c->call_batch(b) == 0);
+		assert(b.get(0, r) == 0 && r == 2);
+		assert(b.get(1, rep) == 0 && rep == "ab");
+		delete c;
+		delete s;
+	}
+	printf(" OK\n");
+}
+
+// an rpcs at path reached over a bare socket, so a test can put
+// exactly the bytes it wants on the wire
+static int
+raw_connect(const std::string &path)
+{
+	sockaddr_storage d;
+	make_sockaddr(path.c_str(), &d);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	assert(fd >= 0);
+	assert(connect(fd, (struct sockaddr *)&d, sizeof(struct sockaddr_un)) == 0);
+	return fd;
+}
+
+// send m, a request with its header packed, with flags in its length
+// word; with PDU_CRC, a crc32c trailer that is wrong if bad is set.
+// the flags in flip are flipped after the crc is worked out
+static void
+raw_send(int fd, marshall &m, unsigned int flags, bool bad=false,
+		unsigned int flip=0)
+{
+	char *b;
+	int sz;
+	m.take_buf(&b, &sz);
+	char crc[4];
+	int n = sz + ((flags & PDU_CRC) ? sizeof(crc) : 0);
+	uint32_t w = htonl(n | flags);
+	memcpy(b, &w, sizeof(w));
+	rpc_put_be<uint32_t>(crc, crc32c(0, b, sz) ^ (bad ? 1 : 0));
+	w = htonl((n | flags) ^ flip);
+	memcpy(b, &w, sizeof(w));
+	assert(write(fd, b, sz) == sz);
+	if (flags & PDU_CRC)
+		assert(write(fd, crc, sizeof(crc)) == sizeof(crc));
+	rpc_buf_free(b);
+}
+
+static bool
+read_all(int fd, char *p, int n)
+{
+	while (n > 0) {
+		int r = read(fd, p, n);
+		if (r <= 0)
+			return false;
+		p += r;
+		n -= r;
+	}
+	return true;
+}
+
+// the next reply on fd into u, its crc32c checked and taken off, or
+// false once the server has closed the connection
+static bool
+raw_recv(int fd, unmarshall *u, unsigned int *flags)
+{
+	uint32_t w;
+	if (!read_all(fd, (char *)&w, sizeof(w)))
+		return false;
+	int sz = ntohl(w) & PDU_LEN_MASK;
+	*flags = ntohl(w) & ~PDU_LEN_MASK;
+	assert(sz > RPC_HEADER_SZ && sz < 1000);
+	char *b = rpc_buf_alloc(sz);
+	memcpy(b, &w, sizeof(w));
+	assert(read_all(fd, b + sizeof(w), sz - sizeof(w)));
+	if (*flags & PDU_CRC) {
+		sz -= sizeof(uint32_t);
+		assert(rpc_get_be<uint32_t>(b + sz) == crc32c(0, b, sz));
+	}
+	unmarshall r(b, sz);
+	u->take_in(r);
+	return true;
+}
+
+//a peer from before bind features, speaking raw: its length words
+//carry no flags and its headers are five words, and so are the
+//server's replies to it
+void
+wire_test()
+{
+	printf("start wire_test ...");
+	assert(RPC_HEADER_SZ == (int)(sizeof(rpc_sz_t) + 5 * sizeof(int)));
+	std::string path = test_path("wire");
+	rpcs *s = test_server(path);
+	int fd = raw_connect(path);
+
+	marshall m;
+	m.pack_req_header(req_header(7, 22, 0, 0, 0));
+	m << std::string("old") << std::string(" peer");
+	raw_send(fd, m, 0);
+
+	unmarshall u;
+	unsigned int flags;
+	assert(raw_recv(fd, &u, &flags));
+	assert(flags == 0);
+	reply_header rh;
+	u.unpack_reply_header(&rh);
+	std::string rep;
+	u >> rep;
+	assert(u.okdone());
+	assert(rh.xid == 7 && rh.ret == 0 && rep == "old peer");
+	close(fd);
+	delete s;
+	printf(" OK\n");
+}
+
+//a pdu whose crc32c is right is answered with one, while one whose
+//crc32c is wrong, or whose flags changed on the way, is dropped along
+//with its connection
+void
+crc_test()
+{
+	printf("start crc_test ...");
+	std::string path = test_path("crc");
+	rpcs *s = test_server(path);
+	int fd = raw_connect(path);
+
+	marshall m;
+	m.pack_req_header(req_header(1, 22, 0, 0, 0));
+	m << std::string("a") << std::string("b");
+	raw_send(fd, m, PDU_CRC);
+	unmarshall u;
+	unsigned int flags;
+	assert(raw_recv(fd, &u, &flags));
+	assert(flags == PDU_CRC);
+	reply_header rh;
+	u.unpack_reply_header(&rh);
+	std::string rep;
+	u >> rep;
+	assert(u.okdone() && rh.xid == 1 && rep == "ab");
+
+	marshall m1;
+	m1.pack_req_header(req_header(2, 22, 0, 0, 0));
+	m1 << std::string("c") << std::string("d");
+	raw_send(fd, m1, PDU_CRC, true);
+	assert(!raw_recv(fd, &u, &flags));
+	close(fd);
+
+	fd = raw_connect(path);
+	marshall m2;
+	m2.pack_req_header(req_header(3, 22, 0, 0, 0));
+	m2 << std::string("e") << std::string("f");
+	raw_send(fd, m2, PDU_CRC, false, PDU_V2);
+	assert(!raw_recv(fd, &u, &flags));
+	close(fd);
+	delete s;
+	printf(" OK\n");
+}
+
+//a request flagged PDU_BUDGET ends in its budget; one that is not,
+//as from a peer that did not bind for budgets, has no deadline
+void
+budget_wire_test()
+{
+	printf("start budget_wire_test ...");
+	std::string path = test_path("budget");
+	rpcs *s = test_server(path);
+	int fd = raw_connect(path);
+
+	for (int b = 0; b < 2; b++) {
+		marshall m;
+		m.pack_req_header(req_header(b, 29, 0, 0, 0));
+		m << 0;
+		if (b)
+			rpc_req_set_budget(m.grab(sizeof(int)) + sizeof(int), 5000);
+		raw_send(fd, m, b ? PDU_BUDGET : 0);
+		unmarshall u;
+		unsigned int flags;
+		assert(raw_recv(fd, &u, &flags));
+		reply_header rh;
+		u.unpack_reply_header(&rh);
+		int r;
+		u >> r;
+		assert(u.okdone() && rh.xid == b && rh.ret == 0);
+		if (b)
+			assert(r > 4000 && r <= 5000);
+		else
+			assert(r == -1);
+	}
+	close(fd);
+	delete s;
+	printf(" OK\n");
+}
+
+void
+many_connections_test(int n)
+{
+	// open more connections than the old fixed-size PollMgr
+	// fd table could hold, and use all of them.
+	printf("start many_connections_test (%d clients) ...", n);
+
+	std::vector<rpcc *> cls;
+	for (int i = 0; i < n; i++) {
+		rpcc *c = new rpcc(dst);
+		assert(c->bind() == 0);
+		cls.push_back(c);
+	}
+	for (int i = 0; i < n; i++) {
+		int rep;
+		int ret = cls[i]->call(23, i, rep);
+		assert(ret == 0 && rep == i+1);
+	}
+	for (int i = 0; i < n; i++) {
+		delete cls[i];
+	}
+	printf(" OK\n");
+}
+
 void 
 garbage_collection_test(int nt)
 {
@@ -507,6 +1694,9 @@ main(int argc, char *argv[])
 
 	srandom(getpid());
 	port = 20000 + (getpid() % 10000);
+	//everything here is on this host, where compression is otherwise
+	//off; RPC_COMPRESS=0 still turns it off
+	assert(setenv("RPC_COMPRESS", "1", 0) == 0);
 
 	char ch = 0;
 	while ((ch = getopt(argc, argv, "csd:p:l"))!=-1) {
@@ -541,6 +1731,12 @@ main(int argc, char *argv[])
 	}
 
 	testmarshall();
+	testbufpool();
+	testhistogram();
+	testcrc32c();
+	testlz();
+	testv2();
+	testbinlog();
 
 	pthread_attr_init(&attr);
 	// set stack size to 32K, so we don't run out of memory
@@ -570,6 +1766,22 @@ main(int argc, char *argv[])
 
 		simple_tests(clients[0]);
 		concurrent_test(10);
+		async_test(clients[0], 500);
+		batch_test(clients[0]);
+		rto_test();
+		if (isserver) {
+			batch_fallback_test();
+			ordered_test(200);
+			urgent_test(100);
+			busy_test();
+			expire_test();
+			unix_test();
+			old_peer_test();
+			wire_test();
+			crc_test();
+			budget_wire_test();
+			many_connections_test(200);
+		}
 		lossy_test();
 		if (isserver) {
 			failure_test();
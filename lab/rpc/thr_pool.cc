@@ -2,67 +2,180 @@
 #include "thr_pool.h"
 #include <stdlib.h>
 #include <errno.h>
+#include <unistd.h>
 
-static void *
-do_worker(void *arg)
+void *
+ThrPool::do_worker(void *arg)
 {
-	ThrPool *tp = (ThrPool *)arg;
+	worker *w = (worker *)arg;
+	ThrPool *tp = w->tp;
 	while (1) {
 		ThrPool::job_t j;
-		if (!tp->takeJob(&j))
+		if (!tp->takeJob(w, &j))
 			break; //die
 
-		(void)(j.f)(j.a);
+		(j.f)(&j);
 	}
 	pthread_exit(NULL);
 }
 
+int
+ThrPool::ncores()
+{
+	int n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? n : 1;
+}
+
 //if blocking, then addJob() blocks when queue is full
 //otherwise, addJob() simply returns false when queue is full
 ThrPool::ThrPool(int sz, bool blocking)
-: nthreads_(sz),blockadd_(blocking),jobq_(100*sz) 
+: nthreads_(sz > 0 ? sz : ncores()), blockadd_(blocking), next_(0),
+	stealable_(0), urgent_(WORKER_QUEUE_SZ), nurgent_(0), idle_(0),
+	stop_(false)
 {
 	pthread_attr_init(&attr_);
 	pthread_attr_setstacksize(&attr_, 128<<10);
 
-	for (int i = 0; i < sz; i++) {
-		pthread_t t;
-		assert(pthread_create(&t, &attr_, do_worker, (void *)this) ==0);
-		th_.push_back(t);
+	for (int i = 0; i < nthreads_; i++) {
+		worker *w = new worker;
+		w->tp = this;
+		w->id = i;
+		workers_.push_back(w);
+	}
+	for (int i = 0; i < nthreads_; i++) {
+		assert(pthread_create(&workers_[i]->th, &attr_, do_worker,
+					(void *)workers_[i]) == 0);
 	}
 }
 
-//IMPORTANT: this function can be called only when no external thread 
-//will ever use this thread pool again or is currently blocking on it
+//IMPORTANT: this function can be called only when no external thread
+//will ever use this thread pool again or is currently blocking on it.
+//jobs that are already queued still run.
 ThrPool::~ThrPool()
 {
+	stop_ = true;
 	for (int i = 0; i < nthreads_; i++) {
-		job_t j;
-		j.f = (void *(*)(void *))NULL; //poison pill to tell worker threads to exit
-		jobq_.enq(j);
+		workers_[i]->park.wake();
 	}
 
 	for (int i = 0; i < nthreads_; i++) {
-		assert(pthread_join(th_[i], NULL)==0);
+		assert(pthread_join(workers_[i]->th, NULL)==0);
+		delete workers_[i];
 	}
 
 	assert(pthread_attr_destroy(&attr_)==0);
 }
 
-bool 
-ThrPool::addJob(void *(*f)(void *), void *a)
+bool
+ThrPool::addJob(const job_t &j, unsigned int key, bool urgent)
 {
-	job_t j;
-	j.f = f;
-	j.a = a;
+	worker *w;
+	if (urgent && !key) {
+		if (!urgent_.enq(j, blockadd_))
+			return false;
+		nurgent_++;
+		if (idle_.load() > 0)
+			wake_idle();
+		return true;
+	}
+	if (key) {
+		w = workers_[key % nthreads_];
+		if (!w->keyed.enq(j, blockadd_))
+			return false;
+		w->nkeyed++;
+		wake(w);
+		return true;
+	}
 
-	return jobq_.enq(j,blockadd_);
+	//the next worker round-robin, or the first one after it with
+	//room in its queue
+	unsigned int first = next_.fetch_add(1);
+	w = NULL;
+	for (int i = 0; i < nthreads_; i++) {
+		worker *v = workers_[(first + i) % nthreads_];
+		if (v->q.try_enq(j)) {
+			w = v;
+			break;
+		}
+	}
+	if (!w) {
+		if (!blockadd_)
+			return false;
+		w = workers_[first % nthreads_];
+		w->q.enq(j);
+	}
+	stealable_++;
+
+	//if w is busy, let an idle worker steal the job
+	if (!wake(w) && idle_.load() > 0)
+		wake_idle();
+	return true;
 }
 
-bool 
-ThrPool::takeJob(job_t *j)
+//wake w up if it is asleep (or about to be)
+bool
+ThrPool::wake(worker *w)
 {
-	jobq_.deq(j);
-	return (j->f!=NULL);
+	if (!w->sleeping.exchange(false))
+		return false;
+	w->park.wake();
+	return true;
+}
+
+void
+ThrPool::wake_idle()
+{
+	for (int i = 0; i < nthreads_; i++) {
+		if (wake(workers_[i]))
+			return;
+	}
 }
 
+//take a job for worker w: an urgent job first, then its keyed jobs,
+//then its own queue, then steal the oldest job of another worker.
+//sleep if there is none.
+bool
+ThrPool::takeJob(worker *w, job_t *j)
+{
+	for (int n = 0; ; n++) {
+		if (nurgent_.load() > 0 && urgent_.try_deq(j)) {
+			nurgent_--;
+			return true;
+		}
+		if (w->keyed.try_deq(j)) {
+			w->nkeyed--;
+			return true;
+		}
+		for (int i = 0; stealable_.load() > 0 && i < nthreads_; i++) {
+			worker *v = workers_[(w->id + i) % nthreads_];
+			if (v->q.try_deq(j)) {
+				stealable_--;
+				return true;
+			}
+		}
+		if (n < MPMC_SPINS + MPMC_YIELDS) {
+			backoff(n);
+			continue;
+		}
+
+		//addJob() counts a job in nkeyed, stealable_ or nurgent_
+		//(after queueing it, so the counts can dip below zero for
+		//a moment) before it checks sleeping, and we set sleeping
+		//before we check them, so either it wakes us or we see
+		//its job here
+		unsigned int t = w->park.prepare();
+		w->sleeping = true;
+		idle_++;
+		if (w->nkeyed.load() > 0 || stealable_.load() > 0 ||
+				nurgent_.load() > 0) {
+			//work came in after all
+		} else if (stop_) {
+			idle_--;
+			return false;
+		} else {
+			w->park.wait(t);
+		}
+		idle_--;
+		w->sleeping = false;
+	}
+}
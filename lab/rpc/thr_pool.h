@@ -2,40 +2,85 @@
 #define __THR_POOL__
 
 #include <pthread.h>
+#include <atomic>
+#include <new>
 #include <vector>
 
-#include "fifo.h"
+#include "mpmc_queue.h"
 
+// bytes of argument a job can carry inline
+#define JOB_ARG_SZ 32
+// jobs each worker's queue holds
+#define WORKER_QUEUE_SZ 128
+
+// each worker has its own lock-free job queue. a job is added to one
+// worker's queue (round-robin) and idle workers steal from the others,
+// so there is no lock shared by every producer and consumer.
 class ThrPool {
 
 
 	public:
 		struct job_t {
-			void *(*f)(void *); //function point
-			void *a; //function arguments
+			void (*f)(job_t *); //function point
+			union {
+				void *align_;
+				char arg[JOB_ARG_SZ]; //function arguments, stored inline
+			};
 		};
 
+		// sz worker threads, or one per core if sz <= 0.
+		// if blocking, addObjJob() blocks when the pool is full,
+		// otherwise it returns false
 		ThrPool(int sz, bool blocking=true);
 		~ThrPool();
-		template<class C, class A> bool addObjJob(C *o, void (C::*m)(A), A a);
+
+		// run (o->*m)(a) on some worker. jobs with the same non-zero
+		// key run one at a time in the order they were added (they
+		// all go to the same worker and are never stolen). urgent
+		// jobs without a key go to a queue that every worker takes
+		// from before anything else.
+		template<class C, class A> bool addObjJob(C *o, void (C::*m)(A), A a,
+				unsigned int key = 0, bool urgent = false);
 		void waitDone();
 
-		bool takeJob(job_t *j);
+		int size() { return nthreads_; }
+		static int ncores();
 
 	private:
+		struct worker {
+			worker() : q(WORKER_QUEUE_SZ), keyed(WORKER_QUEUE_SZ),
+				nkeyed(0), sleeping(false) {}
+			ThrPool *tp;
+			int id;
+			pthread_t th;
+			mpmc_queue<job_t> q; // may be stolen by other workers
+			mpmc_queue<job_t> keyed; // run only by this worker, in order
+			std::atomic<int> nkeyed; // jobs in keyed
+			std::atomic<bool> sleeping;
+			parker park;
+		};
+
 		pthread_attr_t attr_;
 		int nthreads_;
 		bool blockadd_;
 
-
-		fifo<job_t> jobq_;
-		std::vector<pthread_t> th_;
-
-		bool addJob(void *(*f)(void *), void *a);
+		std::vector<worker *> workers_;
+		std::atomic<unsigned int> next_; //round-robin target for addJob()
+		std::atomic<int> stealable_; //jobs in all q's
+		mpmc_queue<job_t> urgent_;
+		std::atomic<int> nurgent_; //jobs in urgent_
+		std::atomic<int> idle_; //workers that are (about to go) asleep
+		std::atomic<bool> stop_;
+
+		static void *do_worker(void *);
+		bool takeJob(worker *w, job_t *j);
+		bool addJob(const job_t &j, unsigned int key, bool urgent);
+		bool wake(worker *w);
+		void wake_idle();
 };
 
-	template <class C, class A> bool 
-ThrPool::addObjJob(C *o, void (C::*m)(A), A a)
+	template <class C, class A> bool
+ThrPool::addObjJob(C *o, void (C::*m)(A), A a, unsigned int key, bool urgent)
 {
 
 	class objfunc_wrapper {
@@ -43,22 +88,25 @@ ThrPool::addObjJob(C *o, void (C::*m)(A), A a)
 			C *o;
 			void (C::*m)(A a);
 			A a;
-			static void *func(void *vvv) {
-				objfunc_wrapper *x = (objfunc_wrapper*)vvv;
+			static void func(job_t *j) {
+				objfunc_wrapper *x = (objfunc_wrapper *)j->arg;
 				C *o = x->o;
 				void (C::*m)(A ) = x->m;
 				A a = x->a;
+				x->~objfunc_wrapper();
 				(o->*m)(a);
-				delete x;
-				return 0;
 			}
 	};
+	static_assert(sizeof(objfunc_wrapper) <= JOB_ARG_SZ,
+			"job argument does not fit in job_t");
 
-	objfunc_wrapper *x = new objfunc_wrapper;
+	job_t j;
+	j.f = &objfunc_wrapper::func;
+	objfunc_wrapper *x = new (j.arg) objfunc_wrapper;
 	x->o = o;
 	x->m = m;
 	x->a = a;
-	return addJob(&objfunc_wrapper::func, (void *)x);
+	return addJob(j, key, urgent);
 }
 
 
@@ -79,11 +79,13 @@
 // upcalls, but can keep its locks when calling down.
 
 #include <fstream>
+#include <list>
 #include <iostream>
 
 #include "handle.h"
 #include "rsm.h"
 #include "rsm_client.h"
+#include "jsl_log.h"
 
 static void *
 recoverythread(void *x)
@@ -124,12 +126,12 @@ rsm::rsm(std::string _first, std::string _me)
   }
 
   rsmrpc = cfg->get_rpcs();
-  rsmrpc->reg(rsm_client_protocol::invoke, this, &rsm::client_invoke);
-  rsmrpc->reg(rsm_client_protocol::members, this, &rsm::client_members);
-  rsmrpc->reg(rsm_protocol::invoke, this, &rsm::invoke);
+  rsmrpc->reg(rsm_client_protocol::invoke, this, &rsm::client_invoke, true);
+  rsmrpc->reg(rsm_client_protocol::members, this, &rsm::client_members, true);
+  rsmrpc->reg(rsm_protocol::invoke, this, &rsm::invoke, true);
   rsmrpc->reg(rsm_protocol::transferreq, this, &rsm::transferreq);
-  rsmrpc->reg(rsm_protocol::transferdonereq, this, &rsm::transferdonereq);
-  rsmrpc->reg(rsm_protocol::joinreq, this, &rsm::joinreq);
+  rsmrpc->reg(rsm_protocol::transferdonereq, this, &rsm::transferdonereq, true);
+  rsmrpc->reg(rsm_protocol::joinreq, this, &rsm::joinreq, true);
 
   // tester must be on different port, otherwise it may partition itself
   testsvr = new rpcs(atoi(_me.c_str()) + 1);
@@ -147,7 +149,7 @@ void
 rsm::reg1(int proc, handler *h)
 {
   assert(pthread_mutex_lock(&rsm_mutex)==0);
-  procs[proc] = h;
+  assert(procs.add(proc, h));
   assert(pthread_mutex_unlock(&rsm_mutex)==0);
 }
 
@@ -159,12 +161,12 @@ rsm::recovery()
 
   assert(pthread_mutex_lock(&rsm_mutex)==0);
 
-  printf("recovery: starts recovery\n");
+  jsl_log(JSL_DBG_1, "recovery: starts recovery\n");
 
   while (1) {
     while (!cfg->ismember(cfg->myaddr())) {
       if (join(primary)) {
-	       printf("recovery: joined\n");
+	       jsl_log(JSL_DBG_1, "recovery: joined\n");
          commit_change_without_mutex( cfg -> vid_with_mutex() );
       } else {
 	     assert(pthread_mutex_unlock(&rsm_mutex)==0);
@@ -179,13 +181,13 @@ rsm::recovery()
 
 
     if (primary == cfg->myaddr()) {
-      printf("recovery: I am primary, sync with backups\n");
+      jsl_log(JSL_DBG_1, "recovery: I am primary, sync with backups\n");
       r = sync_with_backups();
     } else {
-      printf("recovery: I am a replica, sync with primary\n");
+      jsl_log(JSL_DBG_1, "recovery: I am a replica, sync with primary\n");
       r = sync_with_primary();
     }
-    printf("recovery: sync done\n");
+    jsl_log(JSL_DBG_1, "recovery: sync done\n");
 
     if(vid_insync_rsm != vid_cur_rsm){
       continue;
@@ -198,7 +200,7 @@ rsm::recovery()
       myvs.seqno = 1;
       inviewchange = false;
     } 
-    printf("recovery: go to sleep %d %d\n", insync, inviewchange);
+    jsl_log(JSL_DBG_1, "recovery: go to sleep %d %d\n", insync, inviewchange);
     pthread_cond_wait(&recovery_cond, &rsm_mutex);
   }
   assert(pthread_mutex_unlock(&rsm_mutex)==0);
@@ -208,8 +210,6 @@ bool
 rsm::sync_with_backups()
 {
   // For lab 8
-  insync = true;
-
   assert(pthread_mutex_unlock(&rsm_mutex)==0);
 
   assert(pthread_mutex_lock(&invoke_mutex)==0);
@@ -227,6 +227,9 @@ rsm::sync_with_backups()
       backups.push_back(tmp[i]);
     }
   }
+  //only now: a transferdonereq taken while an invoke was still
+  //draining would have found no backups to tick off
+  insync = true;
 
 
   while(!backups.empty() && vid_insync_rsm == vid_cur_rsm){
@@ -263,7 +266,7 @@ rsm::sync_with_primary()
         //primary may not have synced with me, in this case we have two subcases
         //primary's view is older than me, then no problem, it will not wait for me forever, it will eventually move to the new view
         //primary's view is newer than me, then no problem, I will sync with him after I have moved to the new view
-        printf("rsm::sync_with_primary: vid_insync_rsm != vid_cur_rsm, break now \n");
+        jsl_log(JSL_DBG_1, "rsm::sync_with_primary: vid_insync_rsm != vid_cur_rsm, break now \n");
         pthread_mutex_unlock(&rsm_mutex);
         break; 
       }
@@ -281,7 +284,7 @@ rsm::sync_with_primary()
     if(succ){
       break; //sync sucessed
     }else{
-      printf("rsm::sync_with_primary: failed, sleep 2 and try again \n");
+      jsl_log(JSL_DBG_1, "rsm::sync_with_primary: failed, sleep 2 and try again \n");
       sleep(1); //sync failed, sleep and try again  
     }
 
@@ -305,7 +308,7 @@ rsm::statetransfer(std::string m)
   rsm_protocol::transferres r;
   handle h(m);
   int ret;
-  printf("rsm::statetransfer: contact %s w. my last_myvs(%d,%d)\n", 
+  jsl_log(JSL_DBG_1, "rsm::statetransfer: contact %s w. my last_myvs(%d,%d)\n", 
 	 m.c_str(), last_myvs.vid, last_myvs.seqno);
   if (h.get_rpcc()) {
     assert(pthread_mutex_unlock(&rsm_mutex)==0);
@@ -314,7 +317,7 @@ rsm::statetransfer(std::string m)
     assert(pthread_mutex_lock(&rsm_mutex)==0);
   }
   if (h.get_rpcc() == 0 || ret != rsm_protocol::OK) {
-    printf("rsm::statetransfer: couldn't reach %s %lx %d\n", m.c_str(), 
+    jsl_log(JSL_DBG_1, "rsm::statetransfer: couldn't reach %s %lx %d\n", m.c_str(), 
 	   (long unsigned) h.get_rpcc(), ret);
     return false;
   }
@@ -322,7 +325,7 @@ rsm::statetransfer(std::string m)
     stf->unmarshal_state(r.state);
   }
   last_myvs = r.last;
-  printf("rsm::statetransfer transfer from %s success, vs(%d,%d)\n", 
+  jsl_log(JSL_DBG_1, "rsm::statetransfer transfer from %s success, vs(%d,%d)\n", 
 	 m.c_str(), last_myvs.vid, last_myvs.seqno);
   return true;
 }
@@ -337,24 +340,24 @@ rsm::statetransferdone(std::string m) {
   int r;
   int ret = 0;
   if (cl){
-    printf("rsm::statetransferdone: Now notify the primary that statetransfer is done\n");
+    jsl_log(JSL_DBG_1, "rsm::statetransferdone: Now notify the primary that statetransfer is done\n");
 
     //pthread_mutex_unlock(&rsm_mutex); //don't hold the mutex while calling RPC
     ret = cl->call(rsm_protocol::transferdonereq, myname, vid_insync_rsm, r, rpcc::to(1000));
     //pthread_mutex_lock(&rsm_mutex);
 
     if(ret == rsm_protocol::OK){
-      printf("rsm::statetransferdone: primary is noftified and returns OK\n");
+      jsl_log(JSL_DBG_1, "rsm::statetransferdone: primary is noftified and returns OK\n");
 
       return true;
 
     }else{
       //assert(ret == rsm_protocol::BUSY);
-      printf("rsm::statetransferdone: primary is noftified, but it is BUSY (or ERR)\n");
+      jsl_log(JSL_DBG_1, "rsm::statetransferdone: primary is noftified, but it is BUSY (or ERR)\n");
       return false;
     }
   }else{
-    printf("[error] rsm::statetransferdone, rpc error\n");
+    jsl_log(JSL_DBG_1, "[error] rsm::statetransferdone, rpc error\n");
     return false;
   }
   
@@ -370,7 +373,7 @@ rsm::join(std::string m) {
   rsm_protocol::joinres r;
 
   if (h.get_rpcc() != 0) {
-    printf("rsm::join: %s mylast (%d,%d)\n", m.c_str(), last_myvs.vid, 
+    jsl_log(JSL_DBG_1, "rsm::join: %s mylast (%d,%d)\n", m.c_str(), last_myvs.vid, 
 	   last_myvs.seqno);
     assert(pthread_mutex_unlock(&rsm_mutex)==0);
     ret = h.get_rpcc()->call(rsm_protocol::joinreq, cfg->myaddr(), last_myvs, 
@@ -378,11 +381,11 @@ rsm::join(std::string m) {
     assert(pthread_mutex_lock(&rsm_mutex)==0);
   }
   if (h.get_rpcc() == 0 || ret != rsm_protocol::OK) {
-    printf("rsm::join: couldn't reach %s %p %d\n", m.c_str(), 
+    jsl_log(JSL_DBG_1, "rsm::join: couldn't reach %s %p %d\n", m.c_str(), 
 	   h.get_rpcc(), ret);
     return false;
   }
-  printf("rsm::join: succeeded %s\n", r.log.c_str());
+  jsl_log(JSL_DBG_1, "rsm::join: succeeded %s\n", r.log.c_str());
   cfg->restore(r.log);
   return true;
 }
@@ -400,7 +403,7 @@ rsm::commit_change(unsigned vid)
   pthread_mutex_lock(&rsm_mutex);
   // Lab 7:
   // - If I am not part of the new view, start recovery
-  printf("[debug] rsm::commit_change, commited vid is vid = %d\n", vid);
+  jsl_log(JSL_DBG_1, "[debug] rsm::commit_change, commited vid is vid = %d\n", vid);
   commit_change_without_mutex(vid);
 
   pthread_mutex_unlock(&rsm_mutex);
@@ -434,14 +437,14 @@ rsm::commit_change_without_mutex(unsigned vid)
 std::string
 rsm::execute(int procno, std::string req)
 {
-  printf("execute\n");
-  handler *h = procs[procno];
+  jsl_log(JSL_DBG_4, "execute\n");
+  handler *h = procs.lookup(procno);
   assert(h);
   unmarshall args(req);
   marshall rep;
   std::string reps;
   rsm_protocol::status ret = h->fn(args, rep);
-  marshall rep1;
+  marshall rep1(marshall_hint(ret) + marshall_hint(rep.str()));
   rep1 << ret;
   rep1 << rep.str();
   return rep1.str();
@@ -486,6 +489,10 @@ rsm::client_invoke(int procno, std::string req, std::string &r)
   //Second, foward client's requests to all replicas expect the primary (and primary is me)
   std::vector<std::string> cur_mems = cfg->get_curview();
 
+  //the invokes go out to all backups at once, except with breakpoint 1
+  //armed: then they go one at a time so the primary dies part-way
+  std::list<handle> hs;
+  std::vector<rpc_future<int> > rs;
   for(unsigned i = 0; i < cur_mems.size(); i++){
     std::string m = cur_mems[i];
     if(m == primary){
@@ -494,26 +501,41 @@ rsm::client_invoke(int procno, std::string req, std::string &r)
       continue;
     }
 
-    handle h(cur_mems[i]);
-    rpcc* cl = h.get_rpcc();
+    hs.emplace_back(cur_mems[i]);
+    rpcc* cl = hs.back().get_rpcc();
 
-    if(cl != NULL){
+    if(cl != NULL && break1){
       assert(pthread_mutex_unlock(&rsm_mutex)==0);//Do not hold rsm_mutex while RPC call
-      ret = cl->call(rsm_protocol::invoke, procno, cur_vs, req, dummy, rpcc::to(1000));
+      ret = cl->call(rsm_protocol::invoke, procno, cur_vs, req, dummy, rpcc::urgent(rpcc::to(1000)));
       assert(pthread_mutex_lock(&rsm_mutex)==0);
       if(ret != rsm_protocol::OK){
-        all_successful = false;
         assert(pthread_mutex_unlock(&rsm_mutex)==0);
         assert(pthread_mutex_unlock(&invoke_mutex)==0);
         return rsm_client_protocol::BUSY;
       }
       breakpoint1();
+    }else if(cl != NULL){
+      rs.push_back(rpc_future<int>());
+      cl->call_async(rsm_protocol::invoke, rs.back(), rpcc::urgent(rpcc::to(1000)), procno, cur_vs, req);
     }else{
-      printf("[debug] rsm::client_invoke h.get_rpcc() == NULL\n");
+      jsl_log(JSL_DBG_1, "[debug] rsm::client_invoke h.get_rpcc() == NULL\n");
     }
 
   }
 
+  assert(pthread_mutex_unlock(&rsm_mutex)==0);//Do not hold rsm_mutex while RPC call
+  for(unsigned i = 0; i < rs.size(); i++){
+    ret = rs[i].get(dummy);
+    if(ret != rsm_protocol::OK){
+      all_successful = false;
+    }
+  }
+  assert(pthread_mutex_lock(&rsm_mutex)==0);
+  if(!all_successful){
+    assert(pthread_mutex_unlock(&rsm_mutex)==0);
+    assert(pthread_mutex_unlock(&invoke_mutex)==0);
+    return rsm_client_protocol::BUSY;
+  }
   //Third, if all replicas successes, I can process the requet now
   if(all_successful){
     r = execute(procno, req); // r must be assigned by the return value of execute()
@@ -548,7 +570,7 @@ rsm::invoke(int proc, viewstamp vs, std::string req, int &dummy)
   }
 
   if(vs != myvs){ //not my expected view
-    printf("My expected vs is vid = %d seqno = %d, but the incoming vs is vid = %d seqno =%d \n", myvs.vid, myvs.seqno, vs.vid, vs.seqno);
+    jsl_log(JSL_DBG_1, "My expected vs is vid = %d seqno = %d, but the incoming vs is vid = %d seqno =%d \n", myvs.vid, myvs.seqno, vs.vid, vs.seqno);
     return rsm_protocol::ERR;
   }
 
@@ -573,7 +595,7 @@ rsm::transferreq(std::string src, viewstamp last, rsm_protocol::transferres &r)
 {
   assert(pthread_mutex_lock(&rsm_mutex)==0);
   int ret = rsm_protocol::OK;
-  printf("transferreq from %s (%d,%d) vs (%d,%d)\n", src.c_str(), 
+  jsl_log(JSL_DBG_1, "transferreq from %s (%d,%d) vs (%d,%d)\n", src.c_str(), 
 	 last.vid, last.seqno, last_myvs.vid, last_myvs.seqno);
   if (stf && last != last_myvs) 
     r.state = stf->marshal_state();
@@ -591,7 +613,7 @@ rsm::transferdonereq(std::string m, unsigned vid, int &r)
   int ret = rsm_client_protocol::OK;
   assert (pthread_mutex_lock(&rsm_mutex) == 0);
 
-  printf("rsm::transferdonereq: get transferdone reqeust, incoming vid = %d my vid_insync_rsm = %d\n", vid, vid_insync_rsm);
+  jsl_log(JSL_DBG_1, "rsm::transferdonereq: get transferdone reqeust, incoming vid = %d my vid_insync_rsm = %d\n", vid, vid_insync_rsm);
 
   //if !insync, means primary is not ready for sync, backups could/should try again later
   //if vid != vid_insync_rsm, the backup's vid_insync differs with mine
@@ -630,13 +652,13 @@ rsm::joinreq(std::string m, viewstamp last, rsm_protocol::joinres &r)
   int ret = rsm_client_protocol::OK;
 
   assert (pthread_mutex_lock(&rsm_mutex) == 0);
-  printf("joinreq: src %s last (%d,%d) mylast (%d,%d)\n", m.c_str(), 
+  jsl_log(JSL_DBG_1, "joinreq: src %s last (%d,%d) mylast (%d,%d)\n", m.c_str(), 
 	 last.vid, last.seqno, last_myvs.vid, last_myvs.seqno);
   if (cfg->ismember(m)) {
-    printf("joinreq: is still a member\n");
+    jsl_log(JSL_DBG_1, "joinreq: is still a member\n");
     r.log = cfg->dump();
   } else if (cfg->myaddr() != primary) {
-    printf("joinreq: busy\n");
+    jsl_log(JSL_DBG_1, "joinreq: busy\n");
     ret = rsm_client_protocol::BUSY;
   } else {
     bool ok;
@@ -645,7 +667,7 @@ rsm::joinreq(std::string m, viewstamp last, rsm_protocol::joinres &r)
     ok = cfg->add(m);
     assert(pthread_mutex_lock(&rsm_mutex) == 0);
 
-    printf("[debug] rsm::joinreq node(%s) cfg->add = %d\n", m.c_str(), ok);
+    jsl_log(JSL_DBG_1, "[debug] rsm::joinreq node(%s) cfg->add = %d\n", m.c_str(), ok);
     if (ok)
     {
       r.log = cfg->dump();
@@ -656,7 +678,7 @@ rsm::joinreq(std::string m, viewstamp last, rsm_protocol::joinres &r)
     }
 
   }
-  printf("[debug] rsm::joinreq done\n");
+  jsl_log(JSL_DBG_1, "[debug] rsm::joinreq done\n");
   assert (pthread_mutex_unlock(&rsm_mutex) == 0);
   return ret;
 }
@@ -674,7 +696,7 @@ rsm::client_members(int i, std::vector<std::string> &r)
   m = cfg->get_curview();
   m.push_back(primary);
   r = m;
-  printf("rsm::client_members return %s m %s\n", cfg->print_curview().c_str(),
+  jsl_log(JSL_DBG_1, "rsm::client_members return %s m %s\n", cfg->print_curview().c_str(),
 	 primary.c_str());
   assert(pthread_mutex_unlock(&rsm_mutex)==0);
   return rsm_protocol::OK;
@@ -691,7 +713,7 @@ rsm::set_primary()
   assert (c.size() > 0);
 
   if (isamember(primary,c)) {
-    printf("set_primary: primary stays %s\n", primary.c_str());
+    jsl_log(JSL_DBG_1, "set_primary: primary stays %s\n", primary.c_str());
     return;
   }
 
@@ -699,7 +721,7 @@ rsm::set_primary()
   for (unsigned i = 0; i < p.size(); i++) {
     if (isamember(p[i], c)) {
       primary = p[i];
-      printf("set_primary: primary is %s\n", primary.c_str());
+      jsl_log(JSL_DBG_1, "set_primary: primary is %s\n", primary.c_str());
       return;
     }
   }
@@ -736,7 +758,7 @@ rsm::net_repair_wo(bool heal)
   for (unsigned i  = 0; i < m.size(); i++) {
     if (m[i] != cfg->myaddr()) {
         handle h(m[i]);
-	printf("rsm::net_repair_wo: %s %d\n", m[i].c_str(), heal);
+	jsl_log(JSL_DBG_1, "rsm::net_repair_wo: %s %d\n", m[i].c_str(), heal);
 	if (h.get_rpcc()) h.get_rpcc()->set_reachable(heal);
     }
   }
@@ -747,7 +769,7 @@ rsm_test_protocol::status
 rsm::test_net_repairreq(int heal, int &r)
 {
   assert(pthread_mutex_lock(&rsm_mutex)==0);
-  printf("rsm::test_net_repairreq: %d (dopartition %d, partitioned %d)\n", 
+  jsl_log(JSL_DBG_1, "rsm::test_net_repairreq: %d (dopartition %d, partitioned %d)\n", 
 	 heal, dopartition, partitioned);
   if (heal) {
     net_repair_wo(heal);
@@ -767,7 +789,7 @@ void
 rsm::breakpoint1()
 {
   if (break1) {
-    printf("Dying at breakpoint 1 in rsm!\n");
+    jsl_log(JSL_DBG_1, "Dying at breakpoint 1 in rsm!\n");
     exit(1);
   }
 }
@@ -776,7 +798,7 @@ void
 rsm::breakpoint2()
 {
   if (break2) {
-    printf("Dying at breakpoint 2 in rsm!\n");
+    jsl_log(JSL_DBG_1, "Dying at breakpoint 2 in rsm!\n");
     exit(1);
   }
 }
@@ -796,7 +818,7 @@ rsm::breakpointreq(int b, int &r)
 {
   r = rsm_test_protocol::OK;
   assert(pthread_mutex_lock(&rsm_mutex)==0);
-  printf("rsm::breakpointreq: %d\n", b);
+  jsl_log(JSL_DBG_1, "rsm::breakpointreq: %d\n", b);
   if (b == 1) break1 = true;
   else if (b == 2) break2 = true;
   else if (b == 3 || b == 4) cfg->breakpoint(b);
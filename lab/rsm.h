@@ -16,7 +16,7 @@ class rsm : public config_view_change {
  private:
   void reg1(int proc, handler *);
  protected:
-  std::map<int, handler *> procs;
+  proc_table procs;
   config *cfg;
   class rsm_state_transfer *stf;
   rpcs *rsmrpc;
@@ -88,158 +88,23 @@ class rsm : public config_view_change {
   void recovery();
   void commit_change(unsigned vid);
 
-  template<class S, class A1, class R>
-    void reg(int proc, S*, int (S::*meth)(const A1 a1, R &));
-  template<class S, class A1, class A2, class R>
-    void reg(int proc, S*, int (S::*meth)(const A1 a1, const A2 a2, R &));
-  template<class S, class A1, class A2, class A3, class R>
-    void reg(int proc, S*, int (S::*meth)(const A1 a1, const A2 a2, 
-            const A3 a3, R &));
-  template<class S, class A1, class A2, class A3, class A4, class R>
-    void reg(int proc, S*, int (S::*meth)(const A1 a1, const A2 a2, 
-            const A3 a3, const A4 a4, R &));
-  template<class S, class A1, class A2, class A3, class A4, class A5, class R>
-    void reg(int proc, S*, int (S::*meth)(const A1 a1, const A2 a2, 
-            const A3 a3, const A4 a4, 
-            const A5 a5, R &));
+  // register a handler, as rpcs::reg
+  template<class S, class... P>
+    void reg(int proc, S *sob, int (S::*meth)(P...));
 };
 
-template<class S, class A1, class R> void
-  rsm::reg(int proc, S*sob, int (S::*meth)(const A1 a1, R & r))
+template<class S, class... P> void
+  rsm::reg(int proc, S *sob, int (S::*meth)(P...))
 {
-  class h1 : public handler {
-  private:
-    S * sob;
-    int (S::*meth)(const A1 a1, R & r);
+  // every replica executes the same requests, so one that does not
+  // unmarshall is a bug rather than a bad client
+  class h1 : public method_handler<S, P...> {
   public:
-  h1(S *xsob, int (S::*xmeth)(const A1 a1, R & r))
-      : sob(xsob), meth(xmeth) { }
+    h1(S *xsob, int (S::*xmeth)(P...))
+      : method_handler<S, P...>(xsob, xmeth) { }
     int fn(unmarshall &args, marshall &ret) {
-      A1 a1;
-      R r;
-      args >> a1;
-      assert(args.okdone());
-      int b = (sob->*meth)(a1,r);
-      ret << r;
-      return b;
-    }
-  };
-  reg1(proc, new h1(sob, meth));
-}
-
-template<class S, class A1, class A2, class R> void
-  rsm::reg(int proc, S*sob, int (S::*meth)(const A1 a1, const A2 a2, R & r))
-{
- class h1 : public handler {
-  private:
-    S * sob;
-    int (S::*meth)(const A1 a1, const A2 a2, R & r);
-  public:
-  h1(S *xsob, int (S::*xmeth)(const A1 a1, const A2 a2, R & r))
-    : sob(xsob), meth(xmeth) { }
-    int fn(unmarshall &args, marshall &ret) {
-      A1 a1;
-      A2 a2;
-      R r;
-      args >> a1;
-      args >> a2;
-      assert(args.okdone());
-      int b = (sob->*meth)(a1,a2,r);
-      ret << r;
-      return b;
-    }
-  };
-  reg1(proc, new h1(sob, meth));
-}
-
-template<class S, class A1, class A2, class A3, class R> void
-  rsm::reg(int proc, S*sob, int (S::*meth)(const A1 a1, const A2 a2, 
-             const A3 a3, R & r))
-{
- class h1 : public handler {
-  private:
-    S * sob;
-    int (S::*meth)(const A1 a1, const A2 a2, const A3 a3, R & r);
-  public:
-  h1(S *xsob, int (S::*xmeth)(const A1 a1, const A2 a2, const A3 a3, R & r))
-    : sob(xsob), meth(xmeth) { }
-    int fn(unmarshall &args, marshall &ret) {
-      A1 a1;
-      A2 a2;
-      A3 a3;
-      R r;
-      args >> a1;
-      args >> a2;
-      args >> a3;
-      assert(args.okdone());
-      int b = (sob->*meth)(a1,a2,a3,r);
-      ret << r;
-      return b;
-    }
-  };
-  reg1(proc, new h1(sob, meth));
-}
-
-template<class S, class A1, class A2, class A3, class A4, class R> void
-  rsm::reg(int proc, S*sob, int (S::*meth)(const A1 a1, const A2 a2, 
-             const A3 a3, const A4 a4, R & r))
-{
- class h1 : public handler {
-  private:
-    S * sob;
-    int (S::*meth)(const A1 a1, const A2 a2, const A3 a3, const A4 a4, R & r);
-  public:
-  h1(S *xsob, int (S::*xmeth)(const A1 a1, const A2 a2, const A3 a3, 
-            const A4 a4, R & r))
-    : sob(xsob), meth(xmeth) { }
-    int fn(unmarshall &args, marshall &ret) {
-      A1 a1;
-      A2 a2;
-      A3 a3;
-      A4 a4;
-      R r;
-      args >> a1;
-      args >> a2;
-      args >> a3;
-      args >> a4;
-      assert(args.okdone());
-      int b = (sob->*meth)(a1,a2,a3,a4,r);
-      ret << r;
-      return b;
-    }
-  };
-  reg1(proc, new h1(sob, meth));
-}
-
-
-template<class S, class A1, class A2, class A3, class A4, class A5, class R> void
-  rsm::reg(int proc, S*sob, int (S::*meth)(const A1 a1, const A2 a2, 
-             const A3 a3, const A4 a4, 
-             const A5 a5, R & r))
-{
- class h1 : public handler {
-  private:
-    S * sob;
-    int (S::*meth)(const A1 a1, const A2 a2, const A3 a3, const A4 a4, 
-       const A5 a5, R & r);
-  public:
-  h1(S *xsob, int (S::*xmeth)(const A1 a1, const A2 a2, const A3 a3, 
-            const A4 a4, const A5 a5, R & r))
-    : sob(xsob), meth(xmeth) { }
-    int fn(unmarshall &args, marshall &ret) {
-      A1 a1;
-      A2 a2;
-      A3 a3;
-      A4 a4;
-      A5 a5;
-      R r;
-      args >> a1;
-      args >> a2;
-      args >> a3;
-      args >> a4;
-      assert(args.okdone());
-      int b = (sob->*meth)(a1,a2,a3,a4,a5,r);
-      ret << r;
+      int b = method_handler<S, P...>::fn(args, ret);
+      assert(b != rpc_const::unmarshal_args_failure);
       return b;
     }
   };
@@ -4,6 +4,8 @@
 #include "rpc.h"
 #include "rsm_protocol.h"
 #include <string>
+#include <tuple>
+#include <utility>
 #include <vector>
 
 
@@ -33,116 +35,34 @@ class rsm_client {
   rsm_client(std::string dst);
   rsm_protocol::status invoke(int proc, std::string req, std::string &rep);
 
-  template<class R, class A1>
-    int call(unsigned int proc, const A1 & a1, R &r);
-
-  template<class R, class A1, class A2>
-    int call(unsigned int proc, const A1 & a1, const A2 & a2, R &r);
-
-  template<class R, class A1, class A2, class A3>
-    int call(unsigned int proc, const A1 & a1, const A2 & a2, const A3 & a3, 
-	     R &r);
-
-  template<class R, class A1, class A2, class A3, class A4>
-    int call(unsigned int proc, const A1 & a1, const A2 & a2, const A3 & a3, 
-	     const A4 & a4, R &r);
-
-  template<class R, class A1, class A2, class A3, class A4, class A5>
-    int call(unsigned int proc, const A1 & a1, const A2 & a2, const A3 & a3, 
-	     const A4 & a4, const A5 & a5, R &r);
+  // call(proc, a1, ..., an, r), as rpcc::call but without a timeout
+  template<class... Args>
+    int call(unsigned int proc, Args &&... args);
+ private:
+  template<class T, size_t... I>
+    int call_t(unsigned int proc, T &t, std::index_sequence<I...>);
 };
 
-template<class R, class A1> int
-  rsm_client::call(unsigned int proc, const A1 & a1, R & r)
+template<class... Args> int
+  rsm_client::call(unsigned int proc, Args &&... args)
 {
-  marshall m;
-  std::string rep;
-  std::string res;
-  m << a1;
-  int intret = invoke(proc, m.str(), rep);
-  unmarshall u(rep);
-  u >> intret;
-  u >> res;
-  unmarshall u1(res);
-  u1 >> r;
-  return intret;
-}
-
-template<class R, class A1, class A2> int
-  rsm_client::call(unsigned int proc, const A1 & a1, const A2 & a2, R & r)
-{
-  marshall m;
-  std::string rep;
-  std::string res;
-  m << a1;
-  m << a2;
-  int intret = invoke(proc, m.str(), rep);
-  unmarshall u(rep);
-  u >> intret;
-  u >> res;
-  unmarshall u1(res);
-  u1 >> r;
-  return intret;
-}
-
-template<class R, class A1, class A2, class A3> int
-  rsm_client::call(unsigned int proc, const A1 & a1, 
-		const A2 & a2, const A3 & a3, R & r)
-{
-  marshall m;
-  std::string rep;
-  std::string res;
-  m << a1;
-  m << a2;
-  m << a3;
-  int intret = invoke(proc, m.str(), rep);
-  unmarshall u(rep);
-  u >> intret;
-  u >> res;
-  unmarshall u1(res);
-  u1 >> r;
-  return intret;
-}
-
-template<class R, class A1, class A2, class A3, class A4> int
-  rsm_client::call(unsigned int proc, const A1 & a1, 
-		   const A2 & a2, const A3 & a3, const A4 & a4, R & r)
-{
-  marshall m;
-  std::string rep;
-  std::string res;
-  m << a1;
-  m << a2;
-  m << a3;
-  m << a4;
-  int intret = invoke(proc, m.str(), rep);
-  unmarshall u(rep);
-  u >> intret;
-  u >> res;
-  unmarshall u1(res);
-  u1 >> r;
-  return intret;
+  auto t = std::tie(args...);
+  return call_t(proc, t, std::make_index_sequence<sizeof...(Args) - 1>());
 }
 
-template<class R, class A1, class A2, class A3, class A4, class A5> int
-  rsm_client::call(unsigned int proc, const A1 & a1, 
-		   const A2 & a2, const A3 & a3, const A4 & a4, const A5 & a5,
-		   R & r)
+template<class T, size_t... I> int
+  rsm_client::call_t(unsigned int proc, T &t, std::index_sequence<I...>)
 {
-  marshall m;
+  marshall m((0 + ... + marshall_hint(std::get<I>(t))));
   std::string rep;
   std::string res;
-  m << a1;
-  m << a2;
-  m << a3;
-  m << a4;
-  m << a5;
+  ((m << std::get<I>(t)), ...);
   int intret = invoke(proc, m.str(), rep);
   unmarshall u(rep);
   u >> intret;
   u >> res;
   unmarshall u1(res);
-  u1 >> r;
+  u1 >> std::get<sizeof...(I)>(t);
   return intret;
 }
 
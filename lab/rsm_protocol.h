@@ -57,7 +57,7 @@ inline bool operator!=(viewstamp a, viewstamp b) {
   return a.vid != b.vid || a.seqno != b.seqno;
 }
 
-inline marshall& operator<<(marshall &m, viewstamp v)
+inline marshall& operator<<(marshall &m, const viewstamp &v)
 {
   m << v.vid;
   m << v.seqno;
@@ -71,7 +71,7 @@ inline unmarshall& operator>>(unmarshall &u, viewstamp &v) {
 }
 
 inline marshall &
-operator<<(marshall &m, rsm_protocol::transferres r)
+operator<<(marshall &m, const rsm_protocol::transferres &r)
 {
   m << r.state;
   m << r.last;
@@ -87,7 +87,7 @@ operator>>(unmarshall &u, rsm_protocol::transferres &r)
 }
 
 inline marshall &
-operator<<(marshall &m, rsm_protocol::joinres r)
+operator<<(marshall &m, const rsm_protocol::joinres &r)
 {
   m << r.log;
   return m;
@@ -10,7 +10,7 @@
 
 rsmtest_client::rsmtest_client(std::string dst)
 {
-  sockaddr_in dstsock;
+  sockaddr_storage dstsock;
   make_sockaddr(dst.c_str(), &dstsock);
   cl = new rpcc(dstsock);
   if (cl->bind() < 0) {
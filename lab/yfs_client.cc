@@ -11,6 +11,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <random>
+#include "jsl_log.h"
 
 std::random_device rd;
 std::mt19937 rndgen(rd());
@@ -73,7 +74,7 @@ yfs_client::getfile(inum inum, fileinfo &fin)
   int r = OK;
 
 
-  printf("getfile %016llx\n", inum);
+  jsl_log(JSL_DBG_4, "getfile %016llx\n", inum);
   extent_protocol::attr a;
   if (ec->getattr(inum, a) != extent_protocol::OK) {
     r = IOERR;
@@ -84,7 +85,7 @@ yfs_client::getfile(inum inum, fileinfo &fin)
   fin.mtime = a.mtime;
   fin.ctime = a.ctime;
   fin.size = a.size;
-  printf("getfile %016llx -> sz %llu\n", inum, fin.size);
+  jsl_log(JSL_DBG_4, "getfile %016llx -> sz %llu\n", inum, fin.size);
 
  release:
 
@@ -95,7 +96,7 @@ int
 yfs_client::setfile(inum inum, const fileinfo &fin)
 {
 
-  printf("setfile %016llx\n", inum);
+  jsl_log(JSL_DBG_4, "setfile %016llx\n", inum);
   assert(isfile(inum));
   extent_protocol::attr a;
   // TODO: may occur cast problem
@@ -116,7 +117,7 @@ yfs_client::getdir(inum inum, dirinfo &din)
 {
   int r = OK;
 
-  printf("getdir %016llx\n", inum);
+  jsl_log(JSL_DBG_4, "getdir %016llx\n", inum);
   extent_protocol::attr a;
   if (ec->getattr(inum, a) != extent_protocol::OK) {
     r = IOERR;
@@ -136,7 +137,7 @@ int
 yfs_client::getcontent(inum ino, std::string &buf){
   int r = OK;
 
-  printf("getcontent %016llx\n", ino);
+  jsl_log(JSL_DBG_4, "getcontent %016llx\n", ino);
 
   if (ec->get(ino, buf) != extent_protocol::OK) {
     r = IOERR;
@@ -152,16 +153,16 @@ yfs_client::getdirmap(inum dir_ino, dirmap &m){
   int r = OK;
   std::string buf;
   
-  printf("getdirmap %016llx\n", dir_ino);
+  jsl_log(JSL_DBG_4, "getdirmap %016llx\n", dir_ino);
 
   if (getcontent(dir_ino, buf) != extent_protocol::OK) {
-    printf("getdirmap: content not found!!!: %016llx\n", dir_ino);
+    jsl_log(JSL_DBG_1, "getdirmap: content not found!!!: %016llx\n", dir_ino);
     r = NOENT;
     goto release;
   }  
 
   if (deserialize(buf, m) != OK){
-    printf("getdirmap: deserialize failed: %016llx\n", dir_ino);
+    jsl_log(JSL_DBG_1, "getdirmap: deserialize failed: %016llx\n", dir_ino);
     r = IOERR;
     goto release;
   }
@@ -177,13 +178,13 @@ yfs_client::lookup(inum dir_ino, std::string file_name, inum & file_ino)
 
   dirmap dir_map;
   if (getdirmap(dir_ino, dir_map) != OK){
-    printf("\t lookup: map not found!!!: parent(%08llx), name(%s)\n", dir_ino, file_name.c_str());
+    jsl_log(JSL_DBG_1, "\t lookup: map not found!!!: parent(%08llx), name(%s)\n", dir_ino, file_name.c_str());
     r = IOERR;
     goto release;
   }
 
   if (dir_map.find(file_name) == dir_map.end()){
-    printf("\t lookup: file not found!!!: parent(%08llx), name(%s)\n", dir_ino, file_name.c_str());
+    jsl_log(JSL_DBG_1, "\t lookup: file not found!!!: parent(%08llx), name(%s)\n", dir_ino, file_name.c_str());
     r = NOENT;
     goto release;
   }
@@ -196,7 +197,7 @@ yfs_client::lookup(inum dir_ino, std::string file_name, inum & file_ino)
 int
 yfs_client::putcontent(inum ino, const std::string &buf){
   int r = OK;
-  printf("putcontent %016llx\n", ino);
+  jsl_log(JSL_DBG_4, "putcontent %016llx\n", ino);
 
   if (ec->put(ino, buf) != extent_protocol::OK) {
     r = FBIG;
@@ -212,23 +213,23 @@ yfs_client::putdirmap(inum dir_ino, const dirmap &m){
   int r = OK;
   std::string buf;
   
-  printf("putdirmap %016llx\n", dir_ino);
+  jsl_log(JSL_DBG_4, "putdirmap %016llx\n", dir_ino);
 
   dirinfo dir_info;
   if (getdir(dir_ino, dir_info) != OK) {
-    printf("putdirmap: dir not found: %016llx\n", dir_ino);
+    jsl_log(JSL_DBG_1, "putdirmap: dir not found: %016llx\n", dir_ino);
     r = NOENT;
     goto release;
   }  
 
   if (serialize(m, buf) != OK){
-    printf("putdirmap: serialize failed: %016llx\n", dir_ino);
+    jsl_log(JSL_DBG_1, "putdirmap: serialize failed: %016llx\n", dir_ino);
     r = IOERR;
     goto release;
   }
 
   if (putcontent(dir_ino, buf) != OK){
-    printf("putdirmap: putcontent failed: %016llx\n", dir_ino);
+    jsl_log(JSL_DBG_1, "putdirmap: putcontent failed: %016llx\n", dir_ino);
     r = IOERR;
     goto release;
   }
@@ -251,10 +252,10 @@ yfs_client::create(inum parent, const char *name, inum & file_ino, int isfile){
 
   yfs_lock(file_ino);
 
-  printf("create  name = %s with id = %08llx in parent = %016llx,\n", file_name.c_str(), file_ino, parent);
+  jsl_log(JSL_DBG_4, "create  name = %s with id = %08llx in parent = %016llx,\n", file_name.c_str(), file_ino, parent);
 
   if (getdirmap(parent, m) != OK){
-    printf("\t create: map not found!!!: parent(%016llx), name(%s)\n", parent, file_name.c_str());
+    jsl_log(JSL_DBG_1, "\t create: map not found!!!: parent(%016llx), name(%s)\n", parent, file_name.c_str());
     r = NOENT;
     goto release;
   }
@@ -269,35 +270,35 @@ yfs_client::create(inum parent, const char *name, inum & file_ino, int isfile){
   m[file_name] = file_ino;
 
   if (putdirmap(parent, m) != OK){
-    printf("\t create: putdirmap failed!!!: parent(%08llx), name(%s)\n", parent, file_name.c_str());
+    jsl_log(JSL_DBG_1, "\t create: putdirmap failed!!!: parent(%08llx), name(%s)\n", parent, file_name.c_str());
     r = IOERR;
     goto release;
   }
 
   if (isfile == 0){
     if (serialize(mp, buf) != OK){
-      printf("create: serialize failed: %016llx\n", parent);
+      jsl_log(JSL_DBG_1, "create: serialize failed: %016llx\n", parent);
       r = IOERR;
       goto release;
     }
   }
 
   if (putcontent(file_ino, buf) != OK){
-    printf("\t create: init file content failed!!!: parent(%08llx), name(%s)\n", parent, file_name.c_str());
+    jsl_log(JSL_DBG_1, "\t create: init file content failed!!!: parent(%08llx), name(%s)\n", parent, file_name.c_str());
     r = IOERR;
     goto release;
   }
 
   extent_protocol::attr a;
   if (ec->getattr(file_ino, a) != extent_protocol::OK) {
-    printf("create: file not found: %016llx\n", file_ino);
+    jsl_log(JSL_DBG_1, "create: file not found: %016llx\n", file_ino);
     r = IOERR;
     goto release;
   }
 
   extent_protocol::attr a_par_old;
   if (ec->getattr(parent, a_par_old) != extent_protocol::OK) {
-    printf("create: dir not found: %016llx\n", parent);
+    jsl_log(JSL_DBG_1, "create: dir not found: %016llx\n", parent);
     r = NOENT;
     goto release;
   }
@@ -309,7 +310,7 @@ yfs_client::create(inum parent, const char *name, inum & file_ino, int isfile){
   a_par.mtime = a.mtime;
 
   if (ec->setattr(parent, a_par) != extent_protocol::OK) {
-    printf("\t create: failed!!!: parent(%08llx)", parent);
+    jsl_log(JSL_DBG_1, "\t create: failed!!!: parent(%08llx)", parent);
     r = IOERR;
     goto release;
   }
@@ -335,27 +336,27 @@ yfs_client::remove(inum dir_ino, const char *name){
   std::string file_name(name);
 
   if (getdirmap(dir_ino, m) != OK){
-    printf("\t remove: map not found!!!: parent(%08llx), name(%s)\n", dir_ino, file_name.c_str());
+    jsl_log(JSL_DBG_1, "\t remove: map not found!!!: parent(%08llx), name(%s)\n", dir_ino, file_name.c_str());
     r = NOENT;
     goto release;
   }
 
   if (m.find(file_name) == m.end()){
-    printf("\t remove: name not found!!!: parent(%08llx), name(%s)\n", dir_ino, file_name.c_str());
+    jsl_log(JSL_DBG_1, "\t remove: name not found!!!: parent(%08llx), name(%s)\n", dir_ino, file_name.c_str());
     r = NOENT;
     goto release;    
   }
 
   ino = m[file_name];
   if (remove_recur(ino) != OK){
-    printf("\t remove: remove failed!!!: parent(%08llx), name(%s)\n", dir_ino, file_name.c_str());
+    jsl_log(JSL_DBG_1, "\t remove: remove failed!!!: parent(%08llx), name(%s)\n", dir_ino, file_name.c_str());
     r = IOERR;
     goto release;
   }
 
   m.erase(file_name);
   if (putdirmap(dir_ino, m) != OK){
-    printf("\t create: putdirmap failed!!!: parent(%08llx), name(%s)\n", dir_ino, file_name.c_str());
+    jsl_log(JSL_DBG_1, "\t create: putdirmap failed!!!: parent(%08llx), name(%s)\n", dir_ino, file_name.c_str());
     r = IOERR;
     goto release;
   }  
@@ -373,14 +374,14 @@ yfs_client::remove_recur(inum ino){
   if(isdir(ino)){
     dirmap m;
     if (getdirmap(ino, m) != OK){
-      printf("\t remove: map not found!!!: parent(%08llx)\n", ino);
+      jsl_log(JSL_DBG_1, "\t remove: map not found!!!: parent(%08llx)\n", ino);
       r = NOENT;
       goto release;
     }
     
     foreach(m, it){
       if (remove_recur(it->second) != OK){
-        printf("\t remove: remove failed!!!: parent(%08llx)\n", ino);
+        jsl_log(JSL_DBG_1, "\t remove: remove failed!!!: parent(%08llx)\n", ino);
         r = IOERR;
         goto release;
       }
@@ -390,7 +391,7 @@ yfs_client::remove_recur(inum ino){
   }
 
   if (ec->remove(ino) != OK){
-    printf("\t remove: remove failed!!!: parent(%08llx)\n", ino);
+    jsl_log(JSL_DBG_1, "\t remove: remove failed!!!: parent(%08llx)\n", ino);
     r = IOERR;
     goto release;
   } 
@@ -457,7 +458,7 @@ yfs_client::deserialize(const std::string &buf, dirmap &dir_map)
 {
     int r = OK;
     
-    printf("deserialize %s\n", buf.c_str());
+    jsl_log(JSL_DBG_4, "deserialize %zu bytes\n", buf.size());
 
     char delim = ',';
     std::vector<std::string> elems;